@@ -0,0 +1,326 @@
+//
+//  kdiff.c
+//  killctl
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "kdiff.h"
+#include "kimage.h"
+#include "../test/tables.h"
+
+// Linear merge of two sorted symbol tables
+static void diff_symbols(const struct kimage* old_image, const struct kimage* new_image, int verbose)
+{
+    size_t added = 0;
+    size_t removed = 0;
+    size_t moved = 0;
+    
+    size_t i = 0;
+    size_t j = 0;
+    while (i < old_image->nsyms || j < new_image->nsyms) {
+        int res;
+        if (i == old_image->nsyms) {
+            res = 1;
+        } else if (j == new_image->nsyms) {
+            res = -1;
+        } else {
+            res = strcmp(old_image->symbols[i].name, new_image->symbols[j].name);
+        }
+        
+        if (res < 0) {
+            if (verbose) {
+                printf("- %s\n", old_image->symbols[i].name);
+            }
+            removed++;
+            i++;
+        } else if (res > 0) {
+            if (verbose) {
+                printf("+ %s\n", new_image->symbols[j].name);
+            }
+            added++;
+            j++;
+        } else {
+            if (old_image->symbols[i].value != new_image->symbols[j].value) {
+                moved++;
+            }
+            i++;
+            j++;
+        }
+    }
+    
+    printf("symbols: %zu -> %zu, %zu added, %zu removed, %zu moved\n",
+           old_image->nsyms, new_image->nsyms, added, removed, moved);
+}
+
+static int check_required(const struct kimage* old_image, const struct kimage* new_image)
+{
+    int missing = 0;
+    
+    printf("\n%-28s %6s %6s\n", "kext symbol", "old", "new");
+    for (size_t i = 0; i < g_kext_symbol_count; ++i) {
+        const char* name = g_kext_symbols[i].name;
+        int required = g_kext_symbols[i].required;
+        int in_old = (kimage_symbol(old_image, name) != NULL);
+        int in_new = (kimage_symbol(new_image, name) != NULL);
+        
+        printf("%-28s %6s %6s%s\n", name, (in_old ? "yes" : "no"), (in_new ? "yes" : "no"), (required ? "" : "  (optional)"));
+        if (required && !in_new) {
+            missing++;
+        }
+    }
+    
+    // Layout choice depends on it
+    if (!kimage_symbol(new_image, "_version_major")) {
+        printf("_version_major is missing\n");
+        missing++;
+    }
+    
+    return missing;
+}
+
+struct table_match {
+    int         found;
+    uint64_t    vmaddr;
+    int         call_in_text;   /* first entry's handler points into __TEXT */
+};
+
+static void match_table(const struct kimage* image, const struct table_layout* layout, struct table_match* match)
+{
+    memset(match, 0, sizeof(*match));
+    
+    const struct mach_header_64* mh = (const struct mach_header_64*)image->data;
+    const struct segment_command_64* data = find_segment_64(mh, SEG_DATA);
+    const struct segment_command_64* text = find_segment_64(mh, SEG_TEXT);
+    if (!data || data->fileoff > image->size || data->filesize > image->size - data->fileoff) {
+        return;
+    }
+    
+    size_t offset;
+    if (!tables_find(layout, image->data + data->fileoff, (size_t)data->filesize, &offset)) {
+        return;
+    }
+    
+    match->found = 1;
+    match->vmaddr = data->vmaddr + offset;
+    
+    // Entry 1 is populated in both tables (exit and kern_invalid)
+    uint64_t call;
+    memcpy(&call, image->data + data->fileoff + offset + layout->stride + layout->call_offset, sizeof(call));
+    match->call_in_text = (text && call >= text->vmaddr && call - text->vmaddr < text->vmsize);
+}
+
+// Layout measured at the start of a table, found by its symbol or by any known layout
+struct table_measure {
+    int                 found;
+    uint64_t            vmaddr;
+    const uint8_t*      table;
+    struct table_layout layout;     /* only kind, stride and offsets are set */
+};
+
+#define MEASURE_MAX_STRIDE  64
+
+static const char* const g_table_symbols[] = { "_sysent", "_mach_trap_table" };    // by TABLE_*
+static const char* const g_table_kinds[] = { "sysent", "mach_trap" };
+
+// Every entry up to the last probed one has a handler, nosys and kern_invalid fill the gaps
+static int measure_calls(const uint8_t* table, size_t entries, const struct table_layout* layout, const struct segment_command_64* text)
+{
+    for (size_t i = 0; i < entries; ++i) {
+        uint64_t call;
+        memcpy(&call, table + i * layout->stride + layout->call_offset, sizeof(call));
+        if (call < text->vmaddr || call - text->vmaddr >= text->vmsize) {
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+// Try every stride and field placement on the table start, smallest stride and offsets first
+static void measure_table(const struct kimage* image, int kind, struct table_measure* measure)
+{
+    memset(measure, 0, sizeof(*measure));
+    
+    const struct mach_header_64* mh = (const struct mach_header_64*)image->data;
+    const struct segment_command_64* data = find_segment_64(mh, SEG_DATA);
+    const struct segment_command_64* text = find_segment_64(mh, SEG_TEXT);
+    if (!data || !text || data->fileoff > image->size || data->filesize > image->size - data->fileoff) {
+        return;
+    }
+    
+    const struct macho_symbol* symbol = kimage_symbol(image, g_table_symbols[kind]);
+    uint64_t vmaddr = (symbol ? symbol->value : 0);
+    for (size_t i = 0; !vmaddr && i < g_table_layout_count; ++i) {
+        struct table_match match;
+        if (g_table_layouts[i].kind == kind && (match_table(image, &g_table_layouts[i], &match), match.found)) {
+            vmaddr = match.vmaddr;
+        }
+    }
+    if (vmaddr < data->vmaddr || vmaddr - data->vmaddr >= data->filesize) {
+        return;
+    }
+    
+    const uint8_t* table = image->data + data->fileoff + (vmaddr - data->vmaddr);
+    size_t avail = (size_t)(data->filesize - (vmaddr - data->vmaddr));
+    
+    struct table_layout candidate;
+    memset(&candidate, 0, sizeof(candidate));
+    candidate.kind = kind;
+    for (uint32_t stride = 8; stride <= MEASURE_MAX_STRIDE; stride += 8) {
+        for (uint32_t narg_size = 4; narg_size >= 2; narg_size -= 2) {
+            for (uint32_t narg_offset = 0; narg_offset + narg_size <= stride; narg_offset += narg_size) {
+                for (uint32_t call_offset = 0; call_offset + sizeof(uint64_t) <= stride; call_offset += sizeof(uint64_t)) {
+                    if (narg_offset < call_offset + sizeof(uint64_t) && call_offset < narg_offset + narg_size) {
+                        continue;
+                    }
+                    
+                    candidate.stride = stride;
+                    candidate.call_offset = call_offset;
+                    candidate.narg_offset = narg_offset;
+                    candidate.narg_size = narg_size;
+                    
+                    size_t entries = (tables_span(&candidate) - narg_offset - narg_size) / stride + 1;
+                    if (entries * stride > avail || !tables_match(&candidate, table) ||
+                        !measure_calls(table, entries, &candidate, text)) {
+                        continue;
+                    }
+                    
+                    measure->found = 1;
+                    measure->vmaddr = vmaddr;
+                    measure->table = table;
+                    measure->layout = candidate;
+                    return;
+                }
+            }
+        }
+    }
+}
+
+static void print_measure(const char* image_name, int kind, const struct table_measure* measure)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%s %s", g_table_kinds[kind], image_name);
+    if (!measure->found) {
+        printf("%-22s %6s %6s %6s %18s\n", name, "-", "-", "-", "-");
+        return;
+    }
+    
+    printf("%-22s %6u %6u %4u/%u %#18llx\n", name, measure->layout.stride, measure->layout.call_offset,
+           measure->layout.narg_offset, measure->layout.narg_size, (unsigned long long)measure->vmaddr);
+}
+
+// Report every field of the kext layout that differs from the one measured in new image
+static int check_measure(const struct table_layout* expected, const struct table_measure* measure)
+{
+    int mismatches = 0;
+    if (!measure->found) {
+        printf("%s table could not be measured in new image\n", g_table_kinds[expected->kind]);
+        return 0;
+    }
+    
+    if (expected->stride != measure->layout.stride) {
+        printf("kext layout %s: stride %u, measured %u\n", expected->name, expected->stride, measure->layout.stride);
+        mismatches++;
+    }
+    if (expected->call_offset != measure->layout.call_offset) {
+        printf("kext layout %s: call offset %u, measured %u\n", expected->name, expected->call_offset, measure->layout.call_offset);
+        mismatches++;
+    }
+    // Field width only shows when the bytes next to it are not zero, expected width is fine if it reads the same counts
+    struct table_layout sized = measure->layout;
+    sized.narg_size = expected->narg_size;
+    if (expected->narg_offset != measure->layout.narg_offset || sized.narg_offset + sized.narg_size > sized.stride ||
+        !tables_match(&sized, measure->table)) {
+        printf("kext layout %s: narg %u/%u, measured %u/%u\n", expected->name, expected->narg_offset, expected->narg_size,
+               measure->layout.narg_offset, measure->layout.narg_size);
+        mismatches++;
+    }
+    
+    return mismatches;
+}
+
+static int diff_tables(const struct kimage* old_image, const struct kimage* new_image)
+{
+    int broken = 0;
+    
+    printf("\ndarwin major: %d -> %d\n", old_image->version_major, new_image->version_major);
+    printf("%-22s %6s %6s %6s %18s %18s\n", "layout", "stride", "call", "narg", "old", "new");
+    
+    for (size_t i = 0; i < g_table_layout_count; ++i) {
+        const struct table_layout* layout = &g_table_layouts[i];
+        
+        struct table_match old_match, new_match;
+        match_table(old_image, layout, &old_match);
+        match_table(new_image, layout, &new_match);
+        
+        char old_desc[32] = "-";
+        char new_desc[32] = "-";
+        if (old_match.found) {
+            snprintf(old_desc, sizeof(old_desc), "%#llx%s", (unsigned long long)old_match.vmaddr, (old_match.call_in_text ? "" : "?"));
+        }
+        if (new_match.found) {
+            snprintf(new_desc, sizeof(new_desc), "%#llx%s", (unsigned long long)new_match.vmaddr, (new_match.call_in_text ? "" : "?"));
+        }
+        
+        printf("%-22s %6u %6u %6u %18s %18s%s\n", layout->name, layout->stride, layout->call_offset, layout->narg_offset,
+               old_desc, new_desc, (old_match.found != new_match.found ? "  changed" : ""));
+    }
+    
+    // Layouts actually found at the tables, narg is offset/size
+    int kinds[] = { TABLE_SYSENT, TABLE_MACH_TRAP };
+    struct table_measure measures[2];
+    printf("\n%-22s %6s %6s %6s %18s\n", "measured", "stride", "call", "narg", "address");
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); ++i) {
+        struct table_measure old_measure;
+        measure_table(old_image, kinds[i], &old_measure);
+        measure_table(new_image, kinds[i], &measures[i]);
+        print_measure("old", kinds[i], &old_measure);
+        print_measure("new", kinds[i], &measures[i]);
+    }
+    
+    // Layout the kext will pick for new image has to match there
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); ++i) {
+        const struct table_layout* layout = tables_layout(kinds[i], new_image->version_major);
+        if (!layout) {
+            printf("unknown darwin version of new image\n");
+            broken++;
+            break;
+        }
+        
+        struct table_match match;
+        match_table(new_image, layout, &match);
+        
+        int mismatches = check_measure(layout, &measures[i]);
+        if (!match.found || !match.call_in_text || mismatches) {
+            printf("kext layout %s does not match new image\n", layout->name);
+            broken++;
+        }
+    }
+    
+    return broken;
+}
+
+int kdiff_run(const char* old_path, const char* new_path, int verbose)
+{
+    struct kimage old_image, new_image;
+    if (kimage_load(&old_image, old_path)) {
+        return -1;
+    }
+    if (kimage_load(&new_image, new_path)) {
+        kimage_free(&old_image);
+        return -1;
+    }
+    
+    diff_symbols(&old_image, &new_image, verbose);
+    int res = check_required(&old_image, &new_image);
+    res += diff_tables(&old_image, &new_image);
+    
+    kimage_free(&old_image);
+    kimage_free(&new_image);
+    return res;
+}
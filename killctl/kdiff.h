@@ -0,0 +1,18 @@
+//
+//  kdiff.h
+//  killctl
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Compares two kernel images: symbol tables and syscall table layouts the kext depends on.
+//
+
+#ifndef kdiff_h
+#define kdiff_h
+
+/**
+ * \brief   Print symbol and table layout differences between kernel images. Returns 0 if all kext dependencies are met by new image.
+ */
+int kdiff_run(const char* old_path, const char* new_path, int verbose);
+
+#endif /* kdiff_h */
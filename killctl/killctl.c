@@ -0,0 +1,468 @@
+//
+//  killctl.c
+//  killctl
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Userspace client for kill hook kext sysctl API
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#if defined(__APPLE__)
+#   include <sys/sysctl.h>
+#else
+// Kext commands need macOS, trace tools run anywhere
+static int sysctlbyname(const char* name, void* oldp, size_t* oldlenp, void* newp, size_t newlen)
+{
+    (void)name;
+    (void)oldp;
+    (void)oldlenp;
+    (void)newp;
+    (void)newlen;
+    errno = ENOTSUP;
+    return -1;
+}
+#endif
+
+#include "../test/killhook.h"
+#include "../test/hookstat.h"
+#include "../test/ctlmsg.h"
+#include "../test/protect.h"
+#include "../test/telemetry.h"
+#include "trace.h"
+#include "replay.h"
+#include "kdiff.h"
+#include "startbench.h"
+#include "symbench.h"
+
+static const char* g_hook_names[HOOKSTAT_COUNT] = {
+    "kill",
+    "mach_msg_trap",
+    "mach_msg_overwrite_trap",
+    "task_for_pid",
+    "process_tree",
+};
+
+static int DoStats(void)
+{
+    struct hookstat_snapshot snapshot;
+    size_t size = sizeof(snapshot);
+    if (0 != sysctlbyname("debug.killhook.hookstat", &snapshot, &size, NULL, 0)) {
+        perror("sysctlbyname(debug.killhook.hookstat)");
+        return EXIT_FAILURE;
+    }
+    
+    if (size != sizeof(snapshot) || snapshot.version != HOOKSTAT_VERSION) {
+        printf("hookstat version mismatch\n");
+        return EXIT_FAILURE;
+    }
+    
+    printf("%-24s %12s %10s %10s %10s\n", "hook", "calls", "p50", "p99", "p999");
+    for (unsigned i = 0; i < HOOKSTAT_COUNT && i < snapshot.nhooks; ++i) {
+        const struct hookstat_hist* hist = &snapshot.hist[i];
+        printf("%-24s %12llu %10llu %10llu %10llu\n",
+               g_hook_names[i],
+               (unsigned long long)hist->count,
+               (unsigned long long)hookstat_percentile(hist, 5000),
+               (unsigned long long)hookstat_percentile(hist, 9900),
+               (unsigned long long)hookstat_percentile(hist, 9990));
+    }
+    
+    printf("(cycles, upper bound of log2 bucket)\n");
+    return EXIT_SUCCESS;
+}
+
+static int DoStatsReset(void)
+{
+    int reset = 1;
+    if (0 != sysctlbyname("debug.killhook.hookstat_reset", NULL, NULL, &reset, sizeof(reset))) {
+        perror("sysctlbyname(debug.killhook.hookstat_reset)");
+        return EXIT_FAILURE;
+    }
+    
+    return EXIT_SUCCESS;
+}
+
+static int DoIntegrity(void)
+{
+    struct killhook_integrity_stats stats;
+    size_t size = sizeof(stats);
+    if (0 != sysctlbyname("debug.killhook.integrity", &stats, &size, NULL, 0)) {
+        perror("sysctlbyname(debug.killhook.integrity)");
+        return EXIT_FAILURE;
+    }
+    
+    if (size != sizeof(stats) || stats.version != KILLHOOK_INTEGRITY_VERSION) {
+        printf("integrity stats version mismatch\n");
+        return EXIT_FAILURE;
+    }
+    
+    printf("scope:      %s\n", stats.full ? "whole tables" : "hooked entries");
+    printf("passes:     %llu\n", (unsigned long long)stats.passes);
+    printf("mismatches: %llu\n", (unsigned long long)stats.mismatches);
+    printf("baseline:   0x%016llx\n", (unsigned long long)stats.baseline);
+    return (stats.mismatches ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+static int DoHooks(void)
+{
+    struct killhook_hooks_status status;
+    size_t size = sizeof(status);
+    if (0 != sysctlbyname("debug.killhook.hooks", &status, &size, NULL, 0)) {
+        perror("sysctlbyname(debug.killhook.hooks)");
+        return EXIT_FAILURE;
+    }
+    
+    if (size != sizeof(status) || status.version != KILLHOOK_HOOKS_VERSION) {
+        printf("hooks status version mismatch\n");
+        return EXIT_FAILURE;
+    }
+    
+    printf("%u of %u hooks installed\n", status.nhooks - status.nlost, status.nhooks);
+    for (unsigned i = 0; i < status.nhooks && i < KILLHOOK_MAX_HOOKS; ++i) {
+        if (status.lost[i / 64] & (1ull << (i % 64))) {
+            printf("hook %u lost\n", i);
+        }
+    }
+    
+    return (status.nlost ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+// Map telemetry page once, then poll it without syscalls
+static int DoTelemetry(unsigned count)
+{
+    struct killhook_telemetry_map map;
+    size_t size = sizeof(map);
+    if (0 != sysctlbyname("debug.killhook.telemetry", &map, &size, NULL, 0)) {
+        perror("sysctlbyname(debug.killhook.telemetry)");
+        return EXIT_FAILURE;
+    }
+    
+    if (size != sizeof(map) || map.version != KILLHOOK_TELEMETRY_VERSION) {
+        printf("telemetry version mismatch\n");
+        return EXIT_FAILURE;
+    }
+    
+    const struct killhook_telemetry* page = (const struct killhook_telemetry*)(uintptr_t)map.address;
+    int res = EXIT_SUCCESS;
+    
+    for (unsigned i = 0; i < count; ++i) {
+        if (i) {
+            sleep(1);
+        }
+        
+        struct killhook_telemetry_data data;
+        if (TELEMETRY_OK != telemetry_read(page, &data, 100)) {
+            printf("telemetry page is unreadable\n");
+            res = EXIT_FAILURE;
+            break;
+        }
+        
+        printf("update %llu: %u targets, %u groups, %u trusted, %u of %u hooks installed, msg filter %u\n",
+               (unsigned long long)data.updates, data.targets, data.groups, data.trusted, data.nhooks - data.nlost, data.nhooks, data.msg_filter);
+        printf("integrity %llu passes, %llu mismatches, %llu audit records dropped\n",
+               (unsigned long long)data.integrity_passes, (unsigned long long)data.integrity_mismatches,
+               (unsigned long long)data.audit_dropped);
+        for (unsigned hook = 0; hook < HOOKSTAT_COUNT; ++hook) {
+            printf("%-24s %12llu calls\n", g_hook_names[hook], (unsigned long long)data.hook_calls[hook]);
+        }
+        for (uint32_t t = 0; t < data.targets && t < KILLHOOK_MAX_TARGETS; ++t) {
+            printf("target %d\n", data.target_pids[t]);
+        }
+    }
+    
+    munmap((void*)page, map.size);
+    return res;
+}
+
+static int DoStartProfile(void)
+{
+    struct startprof_history history;
+    size_t size = sizeof(history);
+    if (0 != sysctlbyname("debug.killhook.startprof", &history, &size, NULL, 0)) {
+        perror("sysctlbyname(debug.killhook.startprof)");
+        return EXIT_FAILURE;
+    }
+    
+    if (!startprof_history_valid(&history, size)) {
+        printf("start-up profile version mismatch\n");
+        return EXIT_FAILURE;
+    }
+    
+    const struct startprof_profile* profile;
+    for (unsigned age = 0; (profile = startprof_history_get(&history, age)); ++age) {
+        startbench_print(profile);
+    }
+    
+    return EXIT_SUCCESS;
+}
+
+// Send encoded batch and print reply
+static int SendCtl(const void* msg, size_t size)
+{
+    struct killhook_ctl_reply reply;
+    size_t reply_size = sizeof(reply);
+    if (0 != sysctlbyname("debug.killhook.ctl", &reply, &reply_size, (void*)msg, size)) {
+        perror("sysctlbyname(debug.killhook.ctl)");
+        return EXIT_FAILURE;
+    }
+    
+    if (reply_size != sizeof(reply) || reply.version != KILLHOOK_CTL_VERSION) {
+        printf("ctl reply version mismatch\n");
+        return EXIT_FAILURE;
+    }
+    
+    if (reply.status) {
+        printf("batch malformed: ctlmsg error %d\n", reply.status);
+        return EXIT_FAILURE;
+    }
+    
+    if (reply.op_errno) {
+        if (reply.failed_op == KILLHOOK_CTL_NO_OP) {
+            printf("batch rejected: %s\n", strerror(reply.op_errno));
+        } else {
+            printf("batch rejected at operation %u: %s\n", reply.failed_op, strerror(reply.op_errno));
+        }
+        return EXIT_FAILURE;
+    }
+    
+    if (reply.flags & KILLHOOK_CTL_REPLY_STATS) {
+        printf("targets:              %u\n", reply.stats.targets);
+        printf("groups:               %u\n", reply.stats.groups);
+        printf("trusted callers:      %u\n", reply.stats.trusted);
+        printf("hooks lost:           %u\n", reply.stats.hooks_lost);
+        printf("integrity mismatches: %llu\n", (unsigned long long)reply.stats.integrity_mismatches);
+    }
+    
+    return EXIT_SUCCESS;
+}
+
+// Start time of running process in microseconds, 0 if it can't be determined
+static uint64_t ProcStartTime(int pid)
+{
+#if defined(__APPLE__)
+    struct kinfo_proc info;
+    size_t size = sizeof(info);
+    int mib[4] = { CTL_KERN, KERN_PROC, KERN_PROC_PID, pid };
+    if (0 != sysctl(mib, 4, &info, &size, NULL, 0) || size != sizeof(info)) {
+        return 0;
+    }
+    
+    return (uint64_t)info.kp_proc.p_starttime.tv_sec * 1000000ull + (uint64_t)info.kp_proc.p_starttime.tv_usec;
+#else
+    (void)pid;
+    return 0;
+#endif
+}
+
+// Build one batch out of command line pids
+static int DoTargets(uint16_t type, uint32_t flags, int argc, char** argv)
+{
+    static uint8_t buf[CTLMSG_MAX_SIZE];
+    struct ctlmsg_writer writer;
+    ctlmsg_writer_init(&writer, buf, sizeof(buf));
+    
+    for (int i = 0; i < argc; ++i) {
+        struct ctlmsg_op op;
+        memset(&op, 0, sizeof(op));
+        op.type = type;
+        if (type == CTLMSG_OP_REMOVE_TARGET || type == CTLMSG_OP_TRUST_REMOVE) {
+            op.u.pid.pid = atoi(argv[i]);
+        } else if (type == CTLMSG_OP_TRUST_ADD) {
+            // Pin the identity we looked at, kernel refuses it if pid was reused meanwhile
+            op.u.trust.pid = atoi(argv[i]);
+            op.u.trust.start_time = ProcStartTime(op.u.trust.pid);
+        } else {
+            op.u.target.pid = atoi(argv[i]);
+            op.u.target.flags = flags;
+        }
+        
+        ctlmsg_write_op(&writer, &op);
+    }
+    
+    struct ctlmsg_op query = { CTLMSG_OP_QUERY_STATS };
+    ctlmsg_write_op(&writer, &query);
+    
+    size_t size = 0;
+    int res = ctlmsg_writer_finish(&writer, &size);
+    if (res != CTLMSG_OK) {
+        printf("failed to encode batch: %d\n", res);
+        return EXIT_FAILURE;
+    }
+    
+    return SendCtl(buf, size);
+}
+
+static int DoTraceImport(const char* text_path, const char* trace_path)
+{
+    FILE* in = fopen(text_path, "r");
+    if (!in) {
+        perror(text_path);
+        return EXIT_FAILURE;
+    }
+    
+    struct trace trace;
+    int res = trace_import_text(&trace, in);
+    fclose(in);
+    if (res) {
+        printf("failed to parse %s\n", text_path);
+        return EXIT_FAILURE;
+    }
+    
+    FILE* out = fopen(trace_path, "wb");
+    if (!out) {
+        perror(trace_path);
+        trace_free(&trace);
+        return EXIT_FAILURE;
+    }
+    
+    res = trace_save(&trace, out);
+    fclose(out);
+    
+    printf("%u targets, %u records\n", trace.header.target_count, trace.header.record_count);
+    trace_free(&trace);
+    return (res ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+static int DoReplay(int argc, char** argv)
+{
+    struct replay_options options = { 1, 1, 0, PROTECT_MSG_NARROW };
+    if (argc > 1) {
+        options.threads = (unsigned)atoi(argv[1]);
+    }
+    if (argc > 2) {
+        options.loops = (unsigned)atoi(argv[2]);
+    }
+    if (argc > 3) {
+        options.realtime = (0 == strcmp(argv[3], "realtime"));
+    }
+    if (argc > 4) {
+        options.msg_filter = atoi(argv[4]);
+    }
+    
+    FILE* in = fopen(argv[0], "rb");
+    if (!in) {
+        perror(argv[0]);
+        return EXIT_FAILURE;
+    }
+    
+    struct trace trace;
+    int res = trace_load(&trace, in);
+    fclose(in);
+    if (res) {
+        printf("failed to load trace %s\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    
+    res = replay_run(&trace, &options, NULL);
+    trace_free(&trace);
+    return (res ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+static void Usage(const char* self)
+{
+    printf("%s stats [reset]\n", self);
+    printf("%s integrity\n", self);
+    printf("%s hooks\n", self);
+    printf("%s telemetry [count]\n", self);
+    printf("%s startprof\n", self);
+    printf("%s protect|unprotect <pid>...\n", self);
+    printf("%s protect-tree <pid>...\n", self);
+    printf("%s trust|untrust <pid>...\n", self);
+    printf("%s status\n", self);
+    printf("%s trace-import <text trace> <trace>\n", self);
+    printf("%s replay <trace> [threads] [loops] [realtime] [msg filter]\n", self);
+    printf("%s kdiff <old kernel> <new kernel> [verbose]\n", self);
+    printf("%s startbench <kernel> [runs]\n", self);
+    printf("%s symbench <kernel> [queries] [verbose]\n", self);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        Usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    
+    if (0 == strcmp(argv[1], "stats")) {
+        if (argc > 2 && 0 == strcmp(argv[2], "reset")) {
+            return DoStatsReset();
+        }
+        
+        return DoStats();
+    }
+    
+    if (0 == strcmp(argv[1], "integrity")) {
+        return DoIntegrity();
+    }
+    
+    if (0 == strcmp(argv[1], "hooks")) {
+        return DoHooks();
+    }
+    
+    if (0 == strcmp(argv[1], "telemetry")) {
+        return DoTelemetry(argc > 2 ? (unsigned)atoi(argv[2]) : 1);
+    }
+    
+    if (0 == strcmp(argv[1], "startprof")) {
+        return DoStartProfile();
+    }
+    
+    if (0 == strcmp(argv[1], "protect")) {
+        return DoTargets(CTLMSG_OP_ADD_TARGET, 0, argc - 2, argv + 2);
+    }
+    
+    if (0 == strcmp(argv[1], "protect-tree")) {
+        return DoTargets(CTLMSG_OP_ADD_TARGET, PROTECT_FLAG_INHERIT, argc - 2, argv + 2);
+    }
+    
+    if (0 == strcmp(argv[1], "unprotect")) {
+        return DoTargets(CTLMSG_OP_REMOVE_TARGET, 0, argc - 2, argv + 2);
+    }
+    
+    if (0 == strcmp(argv[1], "trust")) {
+        return DoTargets(CTLMSG_OP_TRUST_ADD, 0, argc - 2, argv + 2);
+    }
+    
+    if (0 == strcmp(argv[1], "untrust")) {
+        return DoTargets(CTLMSG_OP_TRUST_REMOVE, 0, argc - 2, argv + 2);
+    }
+    
+    if (0 == strcmp(argv[1], "status")) {
+        return SendCtl(NULL, 0);
+    }
+    
+    if (0 == strcmp(argv[1], "trace-import") && argc > 3) {
+        return DoTraceImport(argv[2], argv[3]);
+    }
+    
+    if (0 == strcmp(argv[1], "replay") && argc > 2) {
+        return DoReplay(argc - 2, argv + 2);
+    }
+    
+    if (0 == strcmp(argv[1], "kdiff") && argc > 3) {
+        int verbose = (argc > 4 && 0 == strcmp(argv[4], "verbose"));
+        return (kdiff_run(argv[2], argv[3], verbose) ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+    
+    if (0 == strcmp(argv[1], "startbench") && argc > 2) {
+        unsigned runs = (argc > 3 ? (unsigned)atoi(argv[3]) : 1);
+        return (startbench_run(argv[2], runs) ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+    
+    if (0 == strcmp(argv[1], "symbench") && argc > 2) {
+        unsigned queries = (argc > 3 ? (unsigned)atoi(argv[3]) : 1000000);
+        int verbose = (argc > 4 && 0 == strcmp(argv[4], "verbose"));
+        return (symbench_run(argv[2], queries, verbose) ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+    
+    Usage(argv[0]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,140 @@
+//
+//  kimage.c
+//  killctl
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "kimage.h"
+#include "../test/kextsyms.h"
+
+#define KEXT_SYMBOL(name, variable, required)   { name, required },
+const struct kext_symbol g_kext_symbols[] = {
+    KILLHOOK_SYMBOLS(KEXT_SYMBOL)
+};
+#undef KEXT_SYMBOL
+
+const size_t g_kext_symbol_count = sizeof(g_kext_symbols) / sizeof(g_kext_symbols[0]);
+
+static int symbol_compare(const void* a, const void* b)
+{
+    const struct macho_symbol* sa = (const struct macho_symbol*)a;
+    const struct macho_symbol* sb = (const struct macho_symbol*)b;
+    
+    int res = strcmp(sa->name, sb->name);
+    if (res) {
+        return res;
+    }
+    
+    return (sa->value < sb->value ? -1 : (sa->value > sb->value));
+}
+
+// Binary search in sorted symbols
+const struct macho_symbol* kimage_symbol(const struct kimage* image, const char* name)
+{
+    size_t lo = 0;
+    size_t hi = image->nsyms;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int res = strcmp(image->symbols[mid].name, name);
+        if (res == 0) {
+            return &image->symbols[mid];
+        } else if (res < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    
+    return NULL;
+}
+
+// Map unslid vm address to file contents, NULL if not backed by file
+const void* kimage_vmaddr(const struct kimage* image, uint64_t vmaddr, size_t size)
+{
+    const struct mach_header_64* mh = (const struct mach_header_64*)image->data;
+    if (image->size < sizeof(*mh) || mh->sizeofcmds > image->size - sizeof(*mh)) {
+        return NULL;
+    }
+    
+    // Walk sizeofcmds bytes rather than ncmds commands, a bad cmdsize ends the walk
+    for (const struct load_command* lc = macho_next_command(mh, NULL); lc; lc = macho_next_command(mh, lc)) {
+        if (lc->cmd != LC_SEGMENT_64 || lc->cmdsize < sizeof(struct segment_command_64)) {
+            continue;
+        }
+        
+        const struct segment_command_64* seg = (const struct segment_command_64*)lc;
+        if (vmaddr >= seg->vmaddr && vmaddr - seg->vmaddr <= seg->filesize && size <= seg->filesize - (vmaddr - seg->vmaddr) &&
+            seg->fileoff <= image->size && seg->filesize <= image->size - seg->fileoff) {
+            return image->data + seg->fileoff + (vmaddr - seg->vmaddr);
+        }
+    }
+    
+    return NULL;
+}
+
+void kimage_free(struct kimage* image)
+{
+    free(image->symbols);
+    free(image->data);
+    memset(image, 0, sizeof(*image));
+}
+
+int kimage_load(struct kimage* image, const char* path)
+{
+    memset(image, 0, sizeof(*image));
+    image->path = path;
+    image->version_major = -1;
+    
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        return -1;
+    }
+    
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    
+    // Extra zero byte terminates a string table without trailing NUL
+    image->data = (size > 0 ? malloc((size_t)size + 1) : NULL);
+    if (!image->data || fread(image->data, 1, (size_t)size, file) != (size_t)size) {
+        printf("%s: failed to read image\n", path);
+        fclose(file);
+        kimage_free(image);
+        return -1;
+    }
+    fclose(file);
+    
+    image->size = (size_t)size;
+    image->data[image->size] = 0;
+    
+    const struct mach_header_64* mh = (const struct mach_header_64*)image->data;
+    if (!macho_image_valid(mh, image->size)) {
+        printf("%s: not a 64-bit mach-o image\n", path);
+        kimage_free(image);
+        return -1;
+    }
+    
+    image->nsyms = macho_symbols(mh, NULL, 0);
+    image->symbols = malloc((image->nsyms ? image->nsyms : 1) * sizeof(*image->symbols));
+    if (!image->symbols) {
+        kimage_free(image);
+        return -1;
+    }
+    
+    macho_symbols(mh, image->symbols, image->nsyms);
+    qsort(image->symbols, image->nsyms, sizeof(*image->symbols), symbol_compare);
+    
+    const struct macho_symbol* sym = kimage_symbol(image, "_version_major");
+    const int32_t* version = (sym ? kimage_vmaddr(image, sym->value, sizeof(*version)) : NULL);
+    if (version) {
+        image->version_major = *version;
+    }
+    
+    return 0;
+}
@@ -0,0 +1,56 @@
+//
+//  kimage.h
+//  killctl
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Kernel image file loaded into memory with a sorted symbol table.
+//
+
+#ifndef kimage_h
+#define kimage_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../test/macho.h"
+
+// Kernel symbols test_start resolves in the same order (see kextsyms.h)
+struct kext_symbol {
+    const char* name;
+    int         required;   /* kext does not start without it */
+};
+
+extern const struct kext_symbol g_kext_symbols[];
+extern const size_t g_kext_symbol_count;
+
+struct kimage {
+    const char*             path;
+    uint8_t*                data;
+    size_t                  size;
+    struct macho_symbol*    symbols;
+    size_t                  nsyms;
+    int                     version_major;  /* -1 if unknown */
+};
+
+/**
+ * \brief   Read and validate image, sort its symbols and find darwin version. Returns 0 on success.
+ */
+int kimage_load(struct kimage* image, const char* path);
+
+/**
+ * \brief   Release image memory
+ */
+void kimage_free(struct kimage* image);
+
+/**
+ * \brief   Find symbol by name, NULL if there is none
+ */
+const struct macho_symbol* kimage_symbol(const struct kimage* image, const char* name);
+
+/**
+ * \brief   Map unslid vm address range to file contents, NULL if not backed by file
+ */
+const void* kimage_vmaddr(const struct kimage* image, uint64_t vmaddr, size_t size);
+
+#endif /* kimage_h */
@@ -0,0 +1,531 @@
+//
+//  replay.c
+//  killctl
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "replay.h"
+#include "../test/protect.h"
+#include "../test/hookstat.h"
+#include "../test/ratelimit.h"
+#include "../test/auditq.h"
+#include "../test/filter.h"
+
+// Record replayed by a thread. Fork of a reused pid first waits for the exit of its previous
+// owner when that one was replayed by another thread, wait_done counts records of wait_thread per loop.
+#define REPLAY_NO_WAIT  0xffff
+struct replay_step {
+    uint32_t                    record;
+    uint16_t                    wait_thread;
+    uint16_t                    wait_loop;  /* 1 if the exit is from the previous loop */
+    uint32_t                    wait_done;
+};
+
+struct replay_thread {
+    pthread_t                   thread;
+    unsigned                    index;
+    const struct trace*         trace;
+    struct replay_thread*       peers;
+    struct replay_step*         steps;      /* records replayed by this thread, in trace order */
+    uint32_t                    count;
+    uint64_t                    done;       /* steps finished over all loops, read by peers */
+    const struct replay_options* options;
+    uint64_t                    start_ns;
+    uint64_t                    calls;
+    uint64_t                    denied;
+    uint64_t                    audited;
+};
+
+// Shared state mirrors the kext: protected set and trusted callers behind a rw lock, latency histograms per thread
+static struct protect_set g_replay_set;
+static struct trustcache g_replay_trust;
+static pthread_rwlock_t g_replay_lock = PTHREAD_RWLOCK_INITIALIZER;
+static struct hookstat_percpu g_replay_stats[REPLAY_MAX_THREADS];
+static struct ratelimit g_replay_limit;
+
+// Process table stand-in for protect_sweep, bit is set while pid is known to be gone
+#define REPLAY_PID_MAX  (1 << 20)
+#define REPLAY_NO_LANE  0xff
+static uint64_t g_replay_dead[REPLAY_PID_MAX / 64];
+static uint8_t g_replay_lanes[REPLAY_PID_MAX];  // Thread of every known process, children join their parent's
+
+static uint64_t g_replay_inherit_ok;
+static uint64_t g_replay_inherit_failed;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Task pointers only matter as keys, use a pid derived cookie as the kext uses task_t
+static inline const void* replay_task(int32_t pid)
+{
+    return (const void*)(uintptr_t)((uint32_t)pid << 4 | 0x8);
+}
+
+static uint64_t replay_start_time(void* ctx)
+{
+    // Trace carries no start times, trusted callers are added with 0 as well
+    return 0;
+}
+
+static uint64_t replay_now_ms(void* ctx)
+{
+    return now_ns() / 1000000;
+}
+
+// process_reach equivalent, trace carries no credentials so every caller is treated as superuser
+static int replay_reach(const struct protect_entry* entry, void* ctx)
+{
+    const struct trace_record* record = ctx;
+    return (entry->pid != record->caller);
+}
+
+// kill_filter, task_for_pid_filter and mach_msg_filter equivalent, port name translation is already done by the trace.
+// Returns FILTER_* verdict, event and target are those the kext would audit.
+static int replay_filter(const struct trace_record* record, int mode, uint16_t* event, int32_t* target)
+{
+    // Unlocked peeks the hooks make
+    if (!g_replay_set.count || (record->call == TRACE_MACH_MSG && mode == PROTECT_MSG_OFF)) {
+        return FILTER_ALLOW;
+    }
+    
+    struct filter_caller caller = { record->caller, record->caller_pgid, replay_start_time, replay_now_ms, replay_reach, (void*)record };
+    struct filter_policy policy = { &g_replay_set, &g_replay_trust, &g_replay_limit, 0 };
+    const void* remote_task = (mode == PROTECT_MSG_FULL && record->target ? replay_task(record->target) : NULL);
+    int verdict;
+    
+    *target = record->target;
+    pthread_rwlock_rdlock(&g_replay_lock);
+    switch (record->call) {
+        case TRACE_KILL:
+            *event = AUDIT_KILL_DENIED;
+            verdict = filter_kill(&policy, &caller, record->target, record->arg);
+            break;
+        case TRACE_TASK_FOR_PID:
+            *event = AUDIT_TASK_FOR_PID_DENIED;
+            verdict = filter_task_for_pid(&policy, &caller, record->target);
+            break;
+        default:
+            *event = AUDIT_MACH_MSG_DENIED;
+            verdict = filter_mach_msg(&policy, &caller, record->arg, remote_task, target);
+            break;
+    }
+    pthread_rwlock_unlock(&g_replay_lock);
+    
+    return verdict;
+}
+
+// audit_deny equivalent, returns nonzero if denial would be audited
+static int replay_audit(const struct trace_record* record, uint16_t event, int32_t target)
+{
+    struct filter_caller caller = { record->caller, record->caller_pgid, replay_start_time, replay_now_ms, replay_reach, (void*)record };
+    struct filter_policy policy = { &g_replay_set, &g_replay_trust, &g_replay_limit, 0 };
+    int32_t arg = (event == AUDIT_TASK_FOR_PID_DENIED ? 0 : record->arg);
+    return filter_audit(&policy, &caller, event, target, arg);
+}
+
+// Inherited entry of pid. Call with g_replay_lock held.
+static int replay_inherited(int32_t pid)
+{
+    const struct protect_entry* entry = protect_find_pid(&g_replay_set, pid);
+    return (entry && (entry->flags & PROTECT_FLAG_INHERITED));
+}
+
+static inline void replay_set_dead(int32_t pid, int dead)
+{
+    if (pid <= 0 || pid >= REPLAY_PID_MAX) {
+        return;
+    }
+    
+    uint64_t bit = 1ull << (pid % 64);
+    if (dead) {
+        __atomic_fetch_or(&g_replay_dead[pid / 64], bit, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_and(&g_replay_dead[pid / 64], ~bit, __ATOMIC_RELAXED);
+    }
+}
+
+// process_alive equivalent
+static int replay_alive(const struct protect_entry* entry, void* ctx)
+{
+    int32_t pid = entry->pid;
+    return (pid <= 0 || pid >= REPLAY_PID_MAX || !(__atomic_load_n(&g_replay_dead[pid / 64], __ATOMIC_RELAXED) & (1ull << (pid % 64))));
+}
+
+// process_spawned equivalent
+static void replay_fork(const struct trace_record* record)
+{
+    replay_set_dead(record->target, 0);
+    if (!g_replay_set.ninherit && !g_replay_set.ninherited) {
+        return;
+    }
+    
+    pthread_rwlock_rdlock(&g_replay_lock);
+    const struct protect_entry* entry = protect_find_pid(&g_replay_set, record->caller);
+    int update = ((entry && (entry->flags & PROTECT_FLAG_INHERIT)) || replay_inherited(record->target));
+    pthread_rwlock_unlock(&g_replay_lock);
+    
+    if (update) {
+        pthread_rwlock_wrlock(&g_replay_lock);
+        int res = protect_fork(&g_replay_set, record->caller, record->target, record->caller, record->caller_pgid, replay_task(record->target));
+        if (res == PROTECT_FULL && protect_sweep(&g_replay_set, replay_alive, NULL)) {
+            res = protect_fork(&g_replay_set, record->caller, record->target, record->caller, record->caller_pgid, replay_task(record->target));
+        }
+        pthread_rwlock_unlock(&g_replay_lock);
+        
+        __atomic_fetch_add((res == PROTECT_OK ? &g_replay_inherit_ok : &g_replay_inherit_failed), (res != PROTECT_NOT_FOUND), __ATOMIC_RELAXED);
+    }
+}
+
+// my_execve equivalent, task cookies never change so this is the lookup alone
+static void replay_exec(const struct trace_record* record)
+{
+    if (!g_replay_set.count) {
+        return;
+    }
+    
+    pthread_rwlock_rdlock(&g_replay_lock);
+    const struct protect_entry* entry = protect_find_pid(&g_replay_set, record->caller);
+    int update = (entry && entry->task != replay_task(record->caller));
+    pthread_rwlock_unlock(&g_replay_lock);
+    
+    if (update) {
+        pthread_rwlock_wrlock(&g_replay_lock);
+        protect_exec(&g_replay_set, record->caller, replay_task(record->caller));
+        pthread_rwlock_unlock(&g_replay_lock);
+    }
+}
+
+// process_regrouped equivalent
+static void replay_setpgid(const struct trace_record* record)
+{
+    if (!g_replay_set.count) {
+        return;
+    }
+    
+    int32_t pid = (record->target ? record->target : record->caller);
+    pthread_rwlock_rdlock(&g_replay_lock);
+    const struct protect_entry* entry = protect_find_pid(&g_replay_set, pid);
+    int update = (entry && entry->pgid != record->arg);
+    pthread_rwlock_unlock(&g_replay_lock);
+    
+    if (update) {
+        pthread_rwlock_wrlock(&g_replay_lock);
+        protect_setpgid(&g_replay_set, pid, record->arg);
+        pthread_rwlock_unlock(&g_replay_lock);
+    }
+}
+
+// my_exit equivalent, processes killed by a signal only leave the process table
+static void replay_exit(const struct trace_record* record)
+{
+    replay_set_dead(record->caller, 1);
+    if (record->arg || !g_replay_set.ninherited) {
+        return;
+    }
+    
+    pthread_rwlock_rdlock(&g_replay_lock);
+    int inherited = replay_inherited(record->caller);
+    pthread_rwlock_unlock(&g_replay_lock);
+    
+    if (inherited) {
+        pthread_rwlock_wrlock(&g_replay_lock);
+        protect_exit(&g_replay_set, record->caller);
+        pthread_rwlock_unlock(&g_replay_lock);
+    }
+}
+
+static void* replay_thread_main(void* arg)
+{
+    struct replay_thread* ctx = arg;
+    const struct trace* trace = ctx->trace;
+    
+    for (unsigned loop = 0; loop < ctx->options->loops; ++loop) {
+        uint64_t loop_start = now_ns();
+        
+        for (uint32_t i = 0; i < ctx->count; ++i) {
+            const struct replay_step* step = &ctx->steps[i];
+            const struct trace_record* record = &trace->records[step->record];
+            
+            if (ctx->options->realtime) {
+                while (now_ns() - loop_start < record->time_ns) {
+                    ;
+                }
+            }
+            
+            if (step->wait_thread != REPLAY_NO_WAIT && loop >= step->wait_loop) {
+                const struct replay_thread* peer = &ctx->peers[step->wait_thread];
+                uint64_t wait = (uint64_t)(loop - step->wait_loop) * peer->count + step->wait_done;
+                while (__atomic_load_n(&peer->done, __ATOMIC_ACQUIRE) < wait) {
+                    sched_yield();
+                }
+            }
+            
+            int verdict = FILTER_ALLOW;
+            unsigned hook;
+            uint16_t event = 0;
+            int32_t target = 0;
+            uint64_t start = now_ns();
+            switch (record->call) {
+                case TRACE_KILL:
+                    verdict = replay_filter(record, ctx->options->msg_filter, &event, &target);
+                    hook = HOOKSTAT_KILL;
+                    break;
+                case TRACE_TASK_FOR_PID:
+                    verdict = replay_filter(record, ctx->options->msg_filter, &event, &target);
+                    hook = HOOKSTAT_TASK_FOR_PID;
+                    break;
+                case TRACE_FORK:
+                    replay_fork(record);
+                    hook = HOOKSTAT_PROCESS_TREE;
+                    break;
+                case TRACE_EXEC:
+                    replay_exec(record);
+                    hook = HOOKSTAT_PROCESS_TREE;
+                    break;
+                case TRACE_EXIT:
+                    replay_exit(record);
+                    hook = HOOKSTAT_PROCESS_TREE;
+                    break;
+                case TRACE_SETPGID:
+                    replay_setpgid(record);
+                    hook = HOOKSTAT_PROCESS_TREE;
+                    break;
+                default:
+                    verdict = replay_filter(record, ctx->options->msg_filter, &event, &target);
+                    hook = HOOKSTAT_MACH_MSG;
+                    break;
+            }
+            
+            // Cached denials are already counted as suppressed, only full checks reach the limiter
+            if (verdict == FILTER_DENY && replay_audit(record, event, target)) {
+                ctx->audited++;
+            }
+            uint64_t elapsed = now_ns() - start;
+            
+            hookstat_record(g_replay_stats, ctx->index, hook, elapsed);
+            ctx->calls++;
+            ctx->denied += (uint64_t)(verdict != FILTER_ALLOW);
+            __atomic_store_n(&ctx->done, ctx->done + 1, __ATOMIC_RELEASE);
+        }
+    }
+    
+    return NULL;
+}
+
+// Thread a process is replayed on, taken from its parent if the trace saw it being created
+static unsigned replay_lane(int32_t pid, unsigned threads)
+{
+    if (pid <= 0 || pid >= REPLAY_PID_MAX) {
+        return (unsigned)((uint32_t)pid % threads);
+    }
+    
+    if (g_replay_lanes[pid] == REPLAY_NO_LANE) {
+        g_replay_lanes[pid] = (uint8_t)((uint32_t)pid % threads);
+    }
+    
+    return g_replay_lanes[pid];
+}
+
+// Split records between threads by process tree. Records of a process and of all its descendants
+// stay on one thread in trace order, and a reused pid is not forked before its previous owner exited,
+// so tree bookkeeping replays deterministically. Calls crossing trees race like they do on a real machine.
+static int replay_split(const struct trace* trace, struct replay_thread* threads, unsigned count)
+{
+    uint32_t total = trace->header.record_count;
+    uint8_t* lanes = malloc(total ? total : 1);
+    uint64_t* exits = calloc(REPLAY_PID_MAX, sizeof(*exits));   // (thread << 32) | steps done at last exit
+    if (!lanes || !exits) {
+        free(lanes);
+        free(exits);
+        return -1;
+    }
+    
+    memset(g_replay_lanes, REPLAY_NO_LANE, sizeof(g_replay_lanes));
+    for (uint32_t i = 0; i < total; ++i) {
+        const struct trace_record* record = &trace->records[i];
+        unsigned lane = replay_lane(record->caller, count);
+        if (record->call == TRACE_FORK && record->target > 0 && record->target < REPLAY_PID_MAX) {
+            // Reused pid joins its new parent
+            g_replay_lanes[record->target] = (uint8_t)lane;
+        }
+        
+        lanes[i] = (uint8_t)lane;
+        threads[lane].count++;
+    }
+    
+    int res = 0;
+    for (unsigned t = 0; t < count; ++t) {
+        threads[t].steps = malloc((threads[t].count ? threads[t].count : 1) * sizeof(struct replay_step));
+        threads[t].count = 0;
+        if (!threads[t].steps) {
+            res = -1;
+        }
+    }
+    
+    for (uint32_t i = 0; i < total && !res; ++i) {
+        const struct trace_record* record = &trace->records[i];
+        struct replay_thread* thread = &threads[lanes[i]];
+        struct replay_step* step = &thread->steps[thread->count++];
+        
+        step->record = i;
+        step->wait_thread = REPLAY_NO_WAIT;
+        step->wait_loop = 0;
+        step->wait_done = 0;
+        if (record->caller <= 0 || record->caller >= REPLAY_PID_MAX ||
+            (record->call == TRACE_FORK && (record->target <= 0 || record->target >= REPLAY_PID_MAX))) {
+            continue;
+        }
+        
+        if (record->call == TRACE_EXIT) {
+            exits[record->caller] = ((uint64_t)lanes[i] << 32) | thread->count;
+        } else if (record->call == TRACE_FORK) {
+            uint64_t last = exits[record->target];
+            if (!last) {
+                // Owner may have exited at the end of the previous loop, resolved below
+                step->wait_loop = 1;
+            } else if ((last >> 32) != lanes[i]) {
+                step->wait_thread = (uint16_t)(last >> 32);
+                step->wait_done = (uint32_t)last;
+            }
+        }
+    }
+    
+    for (unsigned t = 0; t < count && !res; ++t) {
+        for (uint32_t i = 0; i < threads[t].count; ++i) {
+            struct replay_step* step = &threads[t].steps[i];
+            if (step->wait_loop) {
+                uint64_t last = exits[trace->records[step->record].target];
+                if (last && (last >> 32) != t) {
+                    step->wait_thread = (uint16_t)(last >> 32);
+                    step->wait_done = (uint32_t)last;
+                }
+            }
+        }
+    }
+    
+    free(exits);
+    free(lanes);
+    return res;
+}
+
+int replay_run(const struct trace* trace, const struct replay_options* options, struct replay_result* result)
+{
+    if (options->threads == 0 || options->threads > REPLAY_MAX_THREADS) {
+        fprintf(stderr, "thread count must be 1..%d\n", REPLAY_MAX_THREADS);
+        return -1;
+    }
+    
+    protect_init(&g_replay_set);
+    trustcache_init(&g_replay_trust);
+    for (uint32_t i = 0; i < trace->header.target_count; ++i) {
+        const struct trace_target* target = &trace->targets[i];
+        if (target->flags & TRACE_TARGET_TRUSTED) {
+            if (TRUSTCACHE_OK != trustcache_add(&g_replay_trust, target->pid, 0, 0)) {
+                fprintf(stderr, "can't trust caller %d\n", target->pid);
+                return -1;
+            }
+            continue;
+        }
+        
+        if (PROTECT_OK != protect_add(&g_replay_set, target->pid, target->pgid, target->sigmask,
+                                      target->flags & PROTECT_FLAGS_USER, replay_task(target->pid))) {
+            fprintf(stderr, "can't add target %d\n", target->pid);
+            return -1;
+        }
+    }
+    
+    hookstat_reset(g_replay_stats, REPLAY_MAX_THREADS);
+    memset(g_replay_dead, 0, sizeof(g_replay_dead));
+    g_replay_inherit_ok = 0;
+    g_replay_inherit_failed = 0;
+    ratelimit_init(&g_replay_limit, REPLAY_RATELIMIT_RATE, REPLAY_RATELIMIT_BURST);
+    
+    struct replay_thread* threads = calloc(options->threads, sizeof(*threads));
+    if (!threads) {
+        return -1;
+    }
+    
+    if (replay_split(trace, threads, options->threads)) {
+        for (unsigned i = 0; i < options->threads; ++i) {
+            free(threads[i].steps);
+        }
+        free(threads);
+        return -1;
+    }
+    
+    uint64_t start = now_ns();
+    for (unsigned i = 0; i < options->threads; ++i) {
+        threads[i].index = i;
+        threads[i].trace = trace;
+        threads[i].peers = threads;
+        threads[i].options = options;
+        if (0 != pthread_create(&threads[i].thread, NULL, replay_thread_main, &threads[i])) {
+            fprintf(stderr, "pthread_create failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    uint64_t calls = 0;
+    uint64_t denied = 0;
+    uint64_t audited = 0;
+    for (unsigned i = 0; i < options->threads; ++i) {
+        pthread_join(threads[i].thread, NULL);
+        calls += threads[i].calls;
+        denied += threads[i].denied;
+        audited += threads[i].audited;
+        free(threads[i].steps);
+    }
+    
+    uint64_t elapsed = now_ns() - start;
+    free(threads);
+    
+    if (result) {
+        result->calls = calls;
+        result->denied = denied;
+        result->audited = audited;
+        result->inherit_ok = g_replay_inherit_ok;
+        result->inherit_failed = g_replay_inherit_failed;
+    }
+    
+    struct hookstat_snapshot snapshot;
+    hookstat_merge(g_replay_stats, REPLAY_MAX_THREADS, &snapshot);
+    
+    printf("%llu calls (%llu denied) in %.3f ms on %u threads, %.0f calls/s\n",
+           (unsigned long long)calls, (unsigned long long)denied, elapsed / 1e6, options->threads,
+           elapsed ? calls * 1e9 / elapsed : 0.0);
+    printf("%llu denials audited, %llu suppressed (%llu without a full check), %llu limiter evictions\n",
+           (unsigned long long)audited, (unsigned long long)(denied - audited),
+           (unsigned long long)g_replay_limit.cached, (unsigned long long)g_replay_limit.evictions);
+    
+    printf("protected set: %u entries, %u inherited; %llu children protected, %llu did not fit\n",
+           g_replay_set.count, g_replay_set.ninherited,
+           (unsigned long long)g_replay_inherit_ok, (unsigned long long)g_replay_inherit_failed);
+    
+    static const char* names[] = { "kill", "mach_msg", "tfp", "tree" };
+    static const unsigned hooks[] = { HOOKSTAT_KILL, HOOKSTAT_MACH_MSG, HOOKSTAT_TASK_FOR_PID, HOOKSTAT_PROCESS_TREE };
+    
+    printf("%-10s %12s %10s %10s %10s\n", "call", "calls", "p50", "p99", "p999");
+    for (unsigned i = 0; i < sizeof(hooks) / sizeof(hooks[0]); ++i) {
+        const struct hookstat_hist* hist = &snapshot.hist[hooks[i]];
+        printf("%-10s %12llu %10llu %10llu %10llu\n", names[i],
+               (unsigned long long)hist->count,
+               (unsigned long long)hookstat_percentile(hist, 5000),
+               (unsigned long long)hookstat_percentile(hist, 9900),
+               (unsigned long long)hookstat_percentile(hist, 9990));
+    }
+    
+    printf("(ns including clock overhead, upper bound of log2 bucket)\n");
+    return 0;
+}
@@ -0,0 +1,42 @@
+//
+//  replay.h
+//  killctl
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Replays a trace through the same decision logic kext hooks use
+//  to measure its throughput and per-call latency without a kernel.
+//
+
+#ifndef replay_h
+#define replay_h
+
+#include "trace.h"
+
+#define REPLAY_MAX_THREADS  64
+#define REPLAY_RATELIMIT_RATE   10  /* Same budget as the kext */
+#define REPLAY_RATELIMIT_BURST  20
+
+struct replay_options {
+    unsigned threads;       /* records are split between threads by process tree */
+    unsigned loops;         /* how many times to replay the trace */
+    int      realtime;      /* honor recorded timestamps instead of running at full speed */
+    int      msg_filter;    /* PROTECT_MSG_* mode of mach message filter */
+};
+
+// Totals over all threads and loops
+struct replay_result {
+    uint64_t calls;
+    uint64_t denied;        /* denials, cached ones included */
+    uint64_t audited;
+    uint64_t inherit_ok;    /* children protected by fork records */
+    uint64_t inherit_failed;
+};
+
+/**
+ * \brief   Replay trace and print throughput and latency percentiles. Fills result unless it is NULL.
+ *          Returns 0 on success.
+ */
+int replay_run(const struct trace* trace, const struct replay_options* options, struct replay_result* result);
+
+#endif /* replay_h */
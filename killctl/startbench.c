@@ -0,0 +1,271 @@
+//
+//  startbench.c
+//  killctl
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Phases follow test_start as closely as userspace allows:
+//  - kernel base: page-wise backward scan for mach header, starting at the end of __TEXT instead of MSR_LSTAR
+//  - resolve: image file is read once for all lookups and the symbol index, as between resolver_open and resolver_close
+//  - data segment and table scan: same code as the kext, over file contents of __DATA
+//  - hook install: registry slots are patched in the loaded copy
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "startbench.h"
+#include "kimage.h"
+#include "../test/hooks.h"
+#include "../test/tables.h"
+#include "../test/symindex.h"
+
+#define STARTBENCH_PAGE_SIZE    4096
+
+// Entries the kext hooks, install phase writes the same slots
+struct bench_hook {
+    int table;      /* HOOK_TABLE_* */
+    int num;
+};
+
+#define BENCH_HOOK(table, num, handler, original)   { table, num },
+static const struct bench_hook g_bench_hooks[] = {
+    KILLHOOK_HOOKS(BENCH_HOOK)
+};
+#undef BENCH_HOOK
+
+#define BENCH_HOOK_COUNT    (sizeof(g_bench_hooks) / sizeof(g_bench_hooks[0]))
+
+static const char* g_phase_names[STARTPROF_PHASE_COUNT] = {
+    "kernel base",
+    "resolve",
+    "data segment",
+    "table scan",
+    "hook install",
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void startbench_print(const struct startprof_profile* profile)
+{
+    time_t when = (time_t)profile->time;
+    char date[32] = "";
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&when));
+    
+    printf("%s result %d, %.3f ms total\n", date, profile->result, profile->total_ns / 1e6);
+    printf("  %-14s %12s %14s %14s\n", "phase", "us", "bytes", "probes");
+    for (unsigned i = 0; i < STARTPROF_PHASE_COUNT; ++i) {
+        const struct startprof_phase* phase = &profile->phases[i];
+        if (!(profile->completed & (1u << i))) {
+            printf("  %-14s %12s\n", g_phase_names[i], "-");
+            continue;
+        }
+        
+        printf("  %-14s %12.1f %14llu %14llu\n", g_phase_names[i], phase->ns / 1e3,
+               (unsigned long long)phase->bytes, (unsigned long long)phase->probes);
+    }
+}
+
+// resolver_open equivalent: whole file read into memory
+static void* bench_read(const char* path, size_t* size)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    
+    void* data = (length > 0 ? malloc((size_t)length) : NULL);
+    if (data) {
+        *size = fread(data, 1, (size_t)length, file);
+        if (*size != (size_t)length || !macho_image_valid(data, *size)) {
+            free(data);
+            data = NULL;
+        }
+    }
+    
+    fclose(file);
+    return data;
+}
+
+// resolver_build_symindex equivalent, storage is released right away
+static void bench_symindex(const struct mach_header_64* mh, uint64_t loaded_base)
+{
+    uint32_t count = 0;
+    uint32_t names_size = 0;
+    if (!symindex_measure(mh, &count, &names_size)) {
+        return;
+    }
+    
+    struct symindex_entry* entries = malloc((size_t)count * sizeof(*entries));
+    char* names = malloc(names_size);
+    struct symindex index;
+    if (entries && names && !symindex_build(&index, mh, loaded_base, entries, count, names, names_size)) {
+        printf("symbol index build failed\n");
+    }
+    
+    free(entries);
+    free(names);
+}
+
+// find_syscall_tables equivalent
+static int bench_find_tables(const uint8_t* data, size_t size, int version_major,
+                             size_t* sysent, size_t* mach_traps, uint64_t* scanned, uint64_t* probes)
+{
+    const struct table_layout* sysent_layout = tables_layout(TABLE_SYSENT, version_major);
+    const struct table_layout* traps_layout = tables_layout(TABLE_MACH_TRAP, version_major);
+    size_t sysent_span = tables_span(sysent_layout);
+    size_t traps_span = tables_span(traps_layout);
+    
+    int found_sysent = 0;
+    int found_traps = 0;
+    
+    for (size_t pos = 0; pos < size; ++pos) {
+        (*scanned)++;
+        
+        if (!found_sysent && size - pos >= sysent_span) {
+            (*probes)++;
+            if (tables_match(sysent_layout, data + pos)) {
+                *sysent = pos;
+                found_sysent = 1;
+            }
+        }
+        
+        if (!found_traps && size - pos >= traps_span) {
+            (*probes)++;
+            if (tables_match(traps_layout, data + pos)) {
+                *mach_traps = pos;
+                found_traps = 1;
+            }
+        }
+        
+        if (found_sysent && found_traps) {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+static int bench_once(const char* path, struct kimage* image, struct startprof_run* run)
+{
+    const struct mach_header_64* mh = (const struct mach_header_64*)image->data;
+    uint64_t probes = 0;
+    
+    startprof_enter(run, STARTPROF_KERNEL_BASE, now_ns());
+    const struct segment_command_64* text = find_segment_64(mh, SEG_TEXT);
+    size_t offset = (text ? (size_t)((text->fileoff + text->filesize) & ~(uint64_t)(STARTBENCH_PAGE_SIZE - 1)) : 0);
+    if (offset >= image->size) {
+        offset = (image->size - 1) & ~(size_t)(STARTBENCH_PAGE_SIZE - 1);
+    }
+    for (;;) {
+        probes++;
+        uint32_t magic;
+        memcpy(&magic, image->data + offset, sizeof(magic));
+        if (magic == MH_MAGIC_64 || offset == 0) {
+            break;
+        }
+        offset -= STARTBENCH_PAGE_SIZE;
+    }
+    startprof_leave(run, now_ns(), 0, probes);
+    
+    size_t bytes = 0;
+    size_t missing = 0;
+    startprof_enter(run, STARTPROF_RESOLVE, now_ns());
+    struct mach_header_64* file = bench_read(path, &bytes);
+    const struct segment_command_64* file_text = (file ? find_segment_64(file, SEG_TEXT) : NULL);
+    for (size_t i = 0; i < g_kext_symbol_count; ++i) {
+        if ((!file_text || !find_symbol(file, g_kext_symbols[i].name, file_text->vmaddr)) && g_kext_symbols[i].required) {
+            missing++;
+        }
+    }
+    if (file_text) {
+        bench_symindex(file, file_text->vmaddr);
+    }
+    free(file);
+    startprof_leave(run, now_ns(), bytes, g_kext_symbol_count);
+    if (missing) {
+        printf("could not resolve private symbols\n");
+        return -1;
+    }
+    
+    startprof_enter(run, STARTPROF_DATA_SEGMENT, now_ns());
+    const struct segment_command_64* dataseg = find_segment_64(mh, SEG_DATA);
+    startprof_leave(run, now_ns(), 0, mh->ncmds);
+    if (!dataseg || dataseg->fileoff > image->size || dataseg->filesize > image->size - dataseg->fileoff) {
+        printf("can't find kernel data segment\n");
+        return -1;
+    }
+    
+    uint64_t scanned = 0;
+    size_t sysent = 0;
+    size_t mach_traps = 0;
+    uint8_t* data = image->data + dataseg->fileoff;
+    probes = 0;
+    startprof_enter(run, STARTPROF_TABLE_SCAN, now_ns());
+    int found = bench_find_tables(data, (size_t)dataseg->filesize, image->version_major, &sysent, &mach_traps, &scanned, &probes);
+    startprof_leave(run, now_ns(), scanned, probes);
+    if (!found) {
+        printf("can't find syscall tables\n");
+        return -1;
+    }
+    
+    // Same entries as the kext hook registry
+    const struct table_layout* sysent_layout = tables_layout(TABLE_SYSENT, image->version_major);
+    const struct table_layout* traps_layout = tables_layout(TABLE_MACH_TRAP, image->version_major);
+    uint64_t hook = (uint64_t)(uintptr_t)&bench_once;
+    
+    startprof_enter(run, STARTPROF_HOOK_INSTALL, now_ns());
+    for (size_t i = 0; i < BENCH_HOOK_COUNT; ++i) {
+        const struct bench_hook* entry = &g_bench_hooks[i];
+        size_t slot = (entry->table == HOOK_TABLE_SYSENT ?
+                       sysent + (size_t)entry->num * sysent_layout->stride + sysent_layout->call_offset :
+                       mach_traps + (size_t)entry->num * traps_layout->stride + traps_layout->call_offset);
+        if (slot + sizeof(hook) <= dataseg->filesize) {
+            memcpy(data + slot, &hook, sizeof(hook));
+        }
+    }
+    startprof_leave(run, now_ns(), 0, BENCH_HOOK_COUNT);
+    
+    return 0;
+}
+
+int startbench_run(const char* image_path, unsigned runs)
+{
+    for (unsigned i = 0; i < runs; ++i) {
+        // Every run starts from a pristine image, loading it stands in for the kernel being in memory
+        struct kimage image;
+        if (kimage_load(&image, image_path)) {
+            return -1;
+        }
+        if (!tables_layout(TABLE_SYSENT, image.version_major)) {
+            printf("%s: unknown darwin version\n", image_path);
+            kimage_free(&image);
+            return -1;
+        }
+        
+        struct startprof_run run;
+        startprof_start(&run, (uint64_t)time(NULL), now_ns());
+        int res = bench_once(image_path, &image, &run);
+        startprof_finish(&run, now_ns(), res);
+        
+        kimage_free(&image);
+        
+        startbench_print(&run.profile);
+        if (res) {
+            return -1;
+        }
+    }
+    
+    return 0;
+}
@@ -0,0 +1,25 @@
+//
+//  startbench.h
+//  killctl
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Runs kext start-up phases against a kernel image file and records them with the kext phase timer.
+//
+
+#ifndef startbench_h
+#define startbench_h
+
+#include "../test/startprof.h"
+
+/**
+ * \brief   Print start-up profile as a phase table
+ */
+void startbench_print(const struct startprof_profile* profile);
+
+/**
+ * \brief   Run start-up phases runs times and print profiles. Returns 0 on success.
+ */
+int startbench_run(const char* image_path, unsigned runs);
+
+#endif /* startbench_h */
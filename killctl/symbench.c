@@ -0,0 +1,173 @@
+//
+//  symbench.c
+//  killctl
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Image is indexed as loaded at its unslid address, so table entries attribute directly
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "symbench.h"
+#include "kimage.h"
+#include "../test/symindex.h"
+#include "../test/tables.h"
+
+#define SYMBENCH_BUILD_RUNS     5
+#define SYMBENCH_TRAP_COUNT     128     /* MACH_TRAP_TABLE_COUNT of the kext */
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// xorshift, query addresses only need to be spread over __TEXT
+static inline uint64_t next_random(uint64_t* state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+// tables_attribute equivalent over file contents. Returns number of entries pointing outside the image.
+static unsigned attribute_table(const struct kimage* image, const struct symindex* index, int kind, unsigned count, int verbose)
+{
+    const struct table_layout* layout = tables_layout(kind, image->version_major);
+    const struct mach_header_64* mh = (const struct mach_header_64*)image->data;
+    const struct segment_command_64* data = find_segment_64(mh, SEG_DATA);
+    if (!layout || !data || data->fileoff > image->size || data->filesize > image->size - data->fileoff) {
+        printf("no %s table layout for this image\n", (kind == TABLE_SYSENT ? "sysent" : "mach trap"));
+        return 0;
+    }
+    
+    size_t offset;
+    if (!tables_find(layout, image->data + data->fileoff, (size_t)data->filesize, &offset)) {
+        printf("%s not found\n", layout->name);
+        return 0;
+    }
+    
+    // Table may be shorter in a test image, stop at the end of __DATA
+    size_t available = ((size_t)data->filesize - offset) / layout->stride;
+    if (count > available) {
+        count = (unsigned)available;
+    }
+    
+    unsigned unnamed = 0;
+    unsigned outside = 0;
+    const uint8_t* table = image->data + data->fileoff + offset;
+    for (unsigned i = 0; i < count; ++i) {
+        uint64_t handler;
+        memcpy(&handler, table + i * layout->stride + layout->call_offset, sizeof(handler));
+        
+        const char* name = NULL;
+        uint64_t symoff = 0;
+        int res = symindex_lookup(index, handler, &name, &symoff);
+        outside += (res == SYMINDEX_OUTSIDE);
+        unnamed += (res == SYMINDEX_UNNAMED);
+        
+        if (verbose) {
+            char desc[128];
+            symindex_format(index, handler, desc, sizeof(desc));
+            printf("  %s[%u] %#llx %s\n", layout->name, i, (unsigned long long)handler, desc);
+        }
+    }
+    
+    printf("%s: %u entries, %u named, %u unnamed, %u outside kernel image\n",
+           layout->name, count, count - unnamed - outside, unnamed, outside);
+    return outside;
+}
+
+int symbench_run(const char* image_path, unsigned queries, int verbose)
+{
+    struct kimage image;
+    if (kimage_load(&image, image_path)) {
+        return -1;
+    }
+    
+    const struct mach_header_64* mh = (const struct mach_header_64*)image.data;
+    const struct segment_command_64* text = find_segment_64(mh, SEG_TEXT);
+    uint32_t count = 0;
+    uint32_t names_size = 0;
+    if (!text || !symindex_measure(mh, &count, &names_size)) {
+        printf("%s: no __TEXT symbols\n", image_path);
+        kimage_free(&image);
+        return -1;
+    }
+    
+    struct symindex_entry* entries = malloc((size_t)count * sizeof(*entries));
+    char* names = malloc(names_size);
+    if (!entries || !names) {
+        free(entries);
+        free(names);
+        kimage_free(&image);
+        return -1;
+    }
+    
+    struct symindex index;
+    uint64_t best = UINT64_MAX;
+    for (unsigned run = 0; run < SYMBENCH_BUILD_RUNS; ++run) {
+        uint64_t start = now_ns();
+        int built = (symindex_measure(mh, &count, &names_size) &&
+                     symindex_build(&index, mh, text->vmaddr, entries, count, names, names_size));
+        uint64_t elapsed = now_ns() - start;
+        if (!built) {
+            printf("symbol index build failed\n");
+            free(entries);
+            free(names);
+            kimage_free(&image);
+            return -1;
+        }
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+    
+    printf("%u __TEXT symbols of %zu, %u bytes of names, index is %zu bytes\n",
+           index.count, image.nsyms, index.names_size, (size_t)index.count * sizeof(*entries) + index.names_size);
+    printf("build: %.3f ms (best of %d)\n", best / 1e6, SYMBENCH_BUILD_RUNS);
+    
+    // Mostly inside __TEXT, a quarter of queries fall just outside of it
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+    uint64_t found = 0;
+    volatile uint64_t sink = 0;
+    uint64_t start = now_ns();
+    for (unsigned i = 0; i < queries; ++i) {
+        uint64_t r = next_random(&state);
+        uint64_t addr = index.text_start + (r % (text->vmsize + text->vmsize / 3));
+        
+        const char* name = NULL;
+        uint64_t offset = 0;
+        if (symindex_lookup(&index, addr, &name, &offset) == SYMINDEX_FOUND) {
+            found++;
+            sink += offset;
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+    
+    printf("lookup: %u queries, %llu named, %.1f ns/query\n", queries, (unsigned long long)found,
+           (queries ? (double)elapsed / queries : 0.0));
+    
+    // Table length comes from the image as in the kext
+    const struct macho_symbol* nsysent_symbol = kimage_symbol(&image, "_nsysent");
+    const int32_t* nsysent = (nsysent_symbol ? kimage_vmaddr(&image, nsysent_symbol->value, sizeof(*nsysent)) : NULL);
+    if (nsysent && *nsysent > 0) {
+        attribute_table(&image, &index, TABLE_SYSENT, (unsigned)*nsysent, verbose);
+    } else {
+        printf("_nsysent is missing, sysent skipped\n");
+    }
+    attribute_table(&image, &index, TABLE_MACH_TRAP, SYMBENCH_TRAP_COUNT, verbose);
+    
+    free(entries);
+    free(names);
+    kimage_free(&image);
+    return 0;
+}
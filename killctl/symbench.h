@@ -0,0 +1,20 @@
+//
+//  symbench.h
+//  killctl
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Kernel symbol index build and lookup timing against a kernel image file,
+//  followed by attribution of every syscall and trap entry of that image.
+//
+
+#ifndef symbench_h
+#define symbench_h
+
+/**
+ * \brief   Time index build and queries random __TEXT addresses, then attribute table entries.
+ *          Every entry is printed if verbose is set. Returns 0 on success.
+ */
+int symbench_run(const char* image_path, unsigned queries, int verbose);
+
+#endif /* symbench_h */
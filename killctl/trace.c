@@ -0,0 +1,181 @@
+//
+//  trace.c
+//  killctl
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "trace.h"
+
+// Append element to a growing array
+static int trace_push(void** array, uint32_t* count, uint32_t* capacity, const void* elem, size_t elem_size)
+{
+    if (*count == *capacity) {
+        if (*capacity >= TRACE_MAX_COUNT) {
+            return -1;
+        }
+        
+        uint32_t new_capacity = (*capacity ? *capacity * 2 : 1024);
+        void* new_array = realloc(*array, (size_t)new_capacity * elem_size);
+        if (!new_array) {
+            return -1;
+        }
+        
+        *array = new_array;
+        *capacity = new_capacity;
+    }
+    
+    memcpy((uint8_t*)*array + (size_t)*count * elem_size, elem, elem_size);
+    (*count)++;
+    return 0;
+}
+
+// Counts come from the file, both arrays have to fit in what is left of it
+static int trace_counts_valid(const struct trace_header* header, FILE* file)
+{
+    if (header->target_count > TRACE_MAX_COUNT || header->record_count > TRACE_MAX_COUNT) {
+        return 0;
+    }
+    
+    // Pipes can't tell their size, reads below catch a short one
+    long pos = ftell(file);
+    if (pos < 0 || fseek(file, 0, SEEK_END)) {
+        return 1;
+    }
+    
+    long end = ftell(file);
+    if (end < pos || fseek(file, pos, SEEK_SET)) {
+        return 0;
+    }
+    
+    uint64_t size = (uint64_t)header->target_count * sizeof(struct trace_target) +
+                    (uint64_t)header->record_count * sizeof(struct trace_record);
+    return (size <= (uint64_t)(end - pos));
+}
+
+int trace_load(struct trace* trace, FILE* file)
+{
+    memset(trace, 0, sizeof(*trace));
+    
+    if (1 != fread(&trace->header, sizeof(trace->header), 1, file)) {
+        return -1;
+    }
+    
+    if (trace->header.magic != TRACE_MAGIC || trace->header.version != TRACE_VERSION ||
+        !trace_counts_valid(&trace->header, file)) {
+        memset(&trace->header, 0, sizeof(trace->header));
+        return -1;
+    }
+    
+    trace->targets = calloc((size_t)trace->header.target_count + 1, sizeof(*trace->targets));
+    trace->records = calloc((size_t)trace->header.record_count + 1, sizeof(*trace->records));
+    if (!trace->targets || !trace->records) {
+        trace_free(trace);
+        return -1;
+    }
+    
+    if (trace->header.target_count != fread(trace->targets, sizeof(*trace->targets), trace->header.target_count, file) ||
+        trace->header.record_count != fread(trace->records, sizeof(*trace->records), trace->header.record_count, file)) {
+        trace_free(trace);
+        return -1;
+    }
+    
+    return 0;
+}
+
+int trace_save(const struct trace* trace, FILE* file)
+{
+    if (1 != fwrite(&trace->header, sizeof(trace->header), 1, file) ||
+        trace->header.target_count != fwrite(trace->targets, sizeof(*trace->targets), trace->header.target_count, file) ||
+        trace->header.record_count != fwrite(trace->records, sizeof(*trace->records), trace->header.record_count, file)) {
+        return -1;
+    }
+    
+    return 0;
+}
+
+int trace_import_text(struct trace* trace, FILE* file)
+{
+    uint32_t target_capacity = 0;
+    uint32_t record_capacity = 0;
+    
+    memset(trace, 0, sizeof(*trace));
+    trace->header.magic = TRACE_MAGIC;
+    trace->header.version = TRACE_VERSION;
+    
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        
+        struct trace_target target;
+        memset(&target, 0, sizeof(target));
+        if (3 <= sscanf(line, "target %" SCNd32 " %" SCNd32 " %" SCNx64 " %" SCNx32, &target.pid, &target.pgid, &target.sigmask, &target.flags)) {
+            if (trace_push((void**)&trace->targets, &trace->header.target_count, &target_capacity, &target, sizeof(target))) {
+                goto fail;
+            }
+            continue;
+        }
+        
+        if (1 == sscanf(line, "trust %" SCNd32, &target.pid)) {
+            target.flags = TRACE_TARGET_TRUSTED;
+            if (trace_push((void**)&trace->targets, &trace->header.target_count, &target_capacity, &target, sizeof(target))) {
+                goto fail;
+            }
+            continue;
+        }
+        
+        struct trace_record record;
+        char call[16];
+        memset(&record, 0, sizeof(record));
+        if (6 != sscanf(line, "%" SCNu64 " %15s %" SCNd32 " %" SCNd32 " %" SCNd32 " %" SCNd32,
+                        &record.time_ns, call, &record.caller, &record.caller_pgid, &record.target, &record.arg)) {
+            fprintf(stderr, "malformed trace line: %s", line);
+            goto fail;
+        }
+        
+        if (0 == strcmp(call, "kill")) {
+            record.call = TRACE_KILL;
+        } else if (0 == strcmp(call, "msg")) {
+            record.call = TRACE_MACH_MSG;
+        } else if (0 == strcmp(call, "tfp")) {
+            record.call = TRACE_TASK_FOR_PID;
+        } else if (0 == strcmp(call, "fork")) {
+            record.call = TRACE_FORK;
+        } else if (0 == strcmp(call, "exec")) {
+            record.call = TRACE_EXEC;
+        } else if (0 == strcmp(call, "exit")) {
+            record.call = TRACE_EXIT;
+        } else if (0 == strcmp(call, "setpgid")) {
+            record.call = TRACE_SETPGID;
+        } else {
+            fprintf(stderr, "unknown call in trace line: %s", line);
+            goto fail;
+        }
+        
+        if (trace_push((void**)&trace->records, &trace->header.record_count, &record_capacity, &record, sizeof(record))) {
+            goto fail;
+        }
+    }
+    
+    return 0;
+    
+fail:
+    trace_free(trace);
+    return -1;
+}
+
+void trace_free(struct trace* trace)
+{
+    free(trace->targets);
+    free(trace->records);
+    trace->targets = NULL;
+    trace->records = NULL;
+    trace->header.target_count = 0;
+    trace->header.record_count = 0;
+}
@@ -0,0 +1,98 @@
+//
+//  trace.h
+//  killctl
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Binary trace of hooked calls for replay through the kext decision logic.
+//
+//  Layout:
+//      struct trace_header
+//      target_count times struct trace_target (processes protected and callers trusted while trace was recorded)
+//      record_count times struct trace_record, ordered by time
+//
+
+#ifndef trace_h
+#define trace_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define TRACE_MAGIC     0x4b485452u     /* 'KHTR' */
+#define TRACE_VERSION   3
+#define TRACE_MAX_COUNT (1u << 26)      /* targets or records, bounds what trace_load allocates */
+
+// Traced calls
+enum {
+    TRACE_KILL = 0,         /* arg is signal number */
+    TRACE_MACH_MSG,         /* arg is msgh_id, target is pid owning remote task port */
+    TRACE_TASK_FOR_PID,     /* target is pid argument, arg is unused */
+    TRACE_FORK,             /* caller created target, caller_pgid is child's group, arg is unused */
+    TRACE_EXEC,             /* caller replaced its image, target and arg are unused */
+    TRACE_EXIT,             /* caller exited, arg is nonzero if it was killed by a signal and the kext never saw it */
+    TRACE_SETPGID,          /* caller moved target to process group arg, setsid is recorded as a move of caller */
+    TRACE_CALL_COUNT
+};
+
+struct trace_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t target_count;
+    uint32_t record_count;
+};
+
+// Target is a trusted caller instead of a protected process, pgid and sigmask are unused
+#define TRACE_TARGET_TRUSTED    0x80000000u
+
+struct trace_target {
+    int32_t  pid;
+    int32_t  pgid;
+    uint64_t sigmask;
+    uint32_t flags;         /* PROTECT_FLAG_* or TRACE_TARGET_TRUSTED */
+    uint32_t reserved;
+};
+
+struct trace_record {
+    uint64_t time_ns;       /* since start of recording */
+    int32_t  caller;
+    int32_t  caller_pgid;
+    int32_t  target;        /* kill(2) pid argument or task owner pid */
+    uint16_t call;          /* TRACE_* */
+    uint16_t reserved;
+    int32_t  arg;
+};
+
+struct trace {
+    struct trace_header  header;
+    struct trace_target* targets;
+    struct trace_record* records;
+};
+
+/**
+ * \brief   Load whole trace file into memory. Counts above TRACE_MAX_COUNT or past the end of file are rejected.
+ *          Returns 0 on success.
+ */
+int trace_load(struct trace* trace, FILE* file);
+
+/**
+ * \brief   Write trace to file. Returns 0 on success.
+ */
+int trace_save(const struct trace* trace, FILE* file);
+
+/**
+ * \brief   Parse text trace. Each line is either
+ *              target <pid> <pgid> <sigmask> [flags]
+ *          or
+ *              trust <pid>
+ *          or
+ *              <time_ns> kill|msg|tfp|fork|exec|exit|setpgid <caller> <caller_pgid> <target> <arg>
+ *          Returns 0 on success.
+ */
+int trace_import_text(struct trace* trace, FILE* file);
+
+/**
+ * \brief   Release trace memory
+ */
+void trace_free(struct trace* trace);
+
+#endif /* trace_h */
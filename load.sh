@@ -1,7 +1,7 @@
 #!/bin/bash
 
 if [[ $# < 1 ]]; then
-    echo "$0 load|unload|reload|setpid <pid>";
+    echo "$0 load|unload|reload|setpid <pid>|msgfilter <0|1|2>|stats [reset]|hooks";
     exit 0;
 fi
 
@@ -33,4 +33,16 @@ case $command in
 "setpid")
     sysctl -w debug.killhook.pid=$2
 ;;
+
+"msgfilter")
+    sysctl -w debug.killhook.msg_filter=$2
+;;
+
+"stats")
+    $build_dir/killctl stats $2
+;;
+
+"hooks")
+    $build_dir/killctl hooks
+;;
 esac
\ No newline at end of file
@@ -0,0 +1,120 @@
+//
+//  auditq.c
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+
+#include <string.h>
+
+#include "auditq.h"
+
+#define AUDITQ_MASK (AUDITQ_SIZE - 1)
+
+//
+// Queue. Bounded queue with per-cell sequence numbers (D. Vyukov), single consumer.
+//
+
+void auditq_init(struct auditq* queue)
+{
+    memset(queue, 0, sizeof(*queue));
+    for (uint64_t i = 0; i < AUDITQ_SIZE; ++i) {
+        queue->cells[i].seq = i;
+    }
+}
+
+int auditq_post(struct auditq* queue, const struct audit_record* record)
+{
+    uint64_t pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    struct auditq_cell* cell;
+
+    for (;;) {
+        cell = &queue->cells[pos & AUDITQ_MASK];
+        uint64_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)(seq - pos);
+
+        if (diff == 0) {
+            // Cell is free for this position, try to claim it
+            if (__atomic_compare_exchange_n(&queue->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Consumer has not released this cell yet
+            __atomic_fetch_add(&queue->dropped, 1, __ATOMIC_RELAXED);
+            return 0;
+        } else {
+            pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->record = *record;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+int auditq_take(struct auditq* queue, struct audit_record* record)
+{
+    uint64_t pos = queue->head;
+    struct auditq_cell* cell = &queue->cells[pos & AUDITQ_MASK];
+
+    uint64_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    if (seq != pos + 1) {
+        return 0;
+    }
+
+    *record = cell->record;
+    __atomic_store_n(&cell->seq, pos + AUDITQ_SIZE, __ATOMIC_RELEASE);
+    queue->head = pos + 1;
+    return 1;
+}
+
+//
+// Caller details cache
+//
+
+void audit_lru_init(struct audit_lru* lru)
+{
+    memset(lru, 0, sizeof(*lru));
+}
+
+static const char* audit_lru_get(struct audit_lru* lru, int32_t pid, audit_enrich_t enrich, void* ctx)
+{
+    struct audit_lru_entry* victim = &lru->entries[0];
+    lru->clock++;
+
+    for (unsigned i = 0; i < AUDIT_LRU_SIZE; ++i) {
+        struct audit_lru_entry* entry = &lru->entries[i];
+        if (entry->stamp && entry->pid == pid) {
+            entry->stamp = lru->clock;
+            lru->hits++;
+            return entry->name;
+        }
+
+        if (entry->stamp < victim->stamp) {
+            victim = entry;
+        }
+    }
+
+    // Evict least recently used entry
+    lru->misses++;
+    victim->pid = pid;
+    victim->stamp = lru->clock;
+    victim->name[0] = '\0';
+    enrich(pid, victim->name, sizeof(victim->name), ctx);
+    victim->name[sizeof(victim->name) - 1] = '\0';
+    return victim->name;
+}
+
+unsigned auditq_process(struct auditq* queue, struct audit_lru* lru, unsigned max,
+                        audit_enrich_t enrich, audit_emit_t emit, void* ctx)
+{
+    struct audit_record record;
+    unsigned count = 0;
+
+    while (count < max && auditq_take(queue, &record)) {
+        emit(&record, audit_lru_get(lru, record.caller, enrich, ctx), ctx);
+        count++;
+    }
+
+    return count;
+}
@@ -0,0 +1,96 @@
+//
+//  auditq.h
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Bounded lock-free audit queue. Hooks post raw records, a single worker drains them in batches
+//  and enriches each distinct caller once through a small LRU cache.
+//  Does not depend on kernel headers.
+//
+
+#ifndef auditq_h
+#define auditq_h
+
+#include <stdint.h>
+
+#define AUDITQ_SIZE         1024    /* power of 2 */
+#define AUDIT_LRU_SIZE      16
+#define AUDIT_NAME_LEN      32
+
+// Audit events
+enum {
+    AUDIT_KILL_DENIED = 1,      /* arg is signal number */
+    AUDIT_MACH_MSG_DENIED,      /* arg is msgh_id */
+    AUDIT_TASK_FOR_PID_DENIED,  /* arg is unused */
+    AUDIT_SUPPRESSED,           /* arg is number of denials rate limiter kept out of the log, caller 0 for unlisted callers */
+    AUDIT_INHERIT_FAILED,       /* caller is parent, target is child that could not be protected, arg is PROTECT_* code */
+};
+
+struct audit_record {
+    uint64_t time;          /* caller supplied timestamp */
+    int32_t  caller;
+    int32_t  target;
+    int32_t  arg;
+    uint16_t event;         /* AUDIT_* */
+    uint16_t reserved;
+};
+
+struct auditq_cell {
+    uint64_t            seq;
+    struct audit_record record;
+};
+
+struct auditq {
+    struct auditq_cell  cells[AUDITQ_SIZE];
+    uint64_t            tail __attribute__((aligned(64)));  /* producers */
+    uint64_t            head __attribute__((aligned(64)));  /* single consumer */
+    uint64_t            dropped __attribute__((aligned(64)));
+};
+
+struct audit_lru_entry {
+    int32_t  pid;
+    uint32_t stamp;
+    char     name[AUDIT_NAME_LEN];
+};
+
+struct audit_lru {
+    struct audit_lru_entry entries[AUDIT_LRU_SIZE];
+    uint32_t clock;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+// Resolves caller details, called once per distinct caller missing from the cache
+typedef void (*audit_enrich_t)(int32_t pid, char* name, uint32_t size, void* ctx);
+
+// Consumes enriched record
+typedef void (*audit_emit_t)(const struct audit_record* record, const char* caller_name, void* ctx);
+
+/**
+ * \brief   Initialize empty queue
+ */
+void auditq_init(struct auditq* queue);
+
+/**
+ * \brief   Post record from any thread without blocking. Returns 0 and counts a drop if queue is full.
+ */
+int auditq_post(struct auditq* queue, const struct audit_record* record);
+
+/**
+ * \brief   Take next record. Must be called from a single consumer thread. Returns 0 if queue is empty.
+ */
+int auditq_take(struct auditq* queue, struct audit_record* record);
+
+/**
+ * \brief   Initialize empty LRU cache
+ */
+void audit_lru_init(struct audit_lru* lru);
+
+/**
+ * \brief   Drain at most max records, enrich and emit them. Returns number of records processed.
+ */
+unsigned auditq_process(struct auditq* queue, struct audit_lru* lru, unsigned max,
+                        audit_enrich_t enrich, audit_emit_t emit, void* ctx);
+
+#endif /* auditq_h */
@@ -0,0 +1,164 @@
+//
+//  ctlmsg.c
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+
+#include <string.h>
+
+#include "ctlmsg.h"
+
+// Expected payload length for operation type, -1 if type is unknown
+static int ctlmsg_payload_length(uint16_t type)
+{
+    switch (type) {
+        case CTLMSG_OP_ADD_TARGET:      return sizeof(struct ctlmsg_target);
+        case CTLMSG_OP_REMOVE_TARGET:   return sizeof(struct ctlmsg_pid);
+        case CTLMSG_OP_SET_SIGMASK:     return sizeof(struct ctlmsg_target);
+        case CTLMSG_OP_CLEAR_TARGETS:   return 0;
+        case CTLMSG_OP_QUERY_STATS:     return 0;
+        case CTLMSG_OP_TRUST_ADD:       return sizeof(struct ctlmsg_trust);
+        case CTLMSG_OP_TRUST_REMOVE:    return sizeof(struct ctlmsg_pid);
+        default:                        return -1;
+    }
+}
+
+//
+// Encoder
+//
+
+void ctlmsg_writer_init(struct ctlmsg_writer* writer, void* buf, size_t size)
+{
+    writer->buf = buf;
+    writer->size = size;
+    writer->offset = sizeof(struct ctlmsg_header);
+    writer->op_count = 0;
+    writer->error = (size < sizeof(struct ctlmsg_header) ? CTLMSG_E_NOSPACE : CTLMSG_OK);
+}
+
+void ctlmsg_write_op(struct ctlmsg_writer* writer, const struct ctlmsg_op* op)
+{
+    if (writer->error) {
+        return;
+    }
+
+    int length = ctlmsg_payload_length(op->type);
+    if (length < 0) {
+        writer->error = CTLMSG_E_OP;
+        return;
+    }
+
+    struct ctlmsg_op_header hdr = { op->type, (uint16_t)length };
+    if (writer->size - writer->offset < sizeof(hdr) + length ||
+        writer->offset + sizeof(hdr) + length > CTLMSG_MAX_SIZE) {
+        writer->error = CTLMSG_E_NOSPACE;
+        return;
+    }
+
+    memcpy(writer->buf + writer->offset, &hdr, sizeof(hdr));
+    memcpy(writer->buf + writer->offset + sizeof(hdr), &op->u, length);
+    writer->offset += sizeof(hdr) + length;
+    writer->op_count++;
+}
+
+int ctlmsg_writer_finish(struct ctlmsg_writer* writer, size_t* psize)
+{
+    if (writer->error) {
+        return writer->error;
+    }
+
+    struct ctlmsg_header hdr;
+    hdr.magic = CTLMSG_MAGIC;
+    hdr.version = CTLMSG_VERSION;
+    hdr.flags = 0;
+    hdr.length = (uint32_t)writer->offset;
+    hdr.op_count = writer->op_count;
+    memcpy(writer->buf, &hdr, sizeof(hdr));
+
+    *psize = writer->offset;
+    return CTLMSG_OK;
+}
+
+//
+// Decoder
+//
+
+int ctlmsg_reader_init(struct ctlmsg_reader* reader, const void* buf, size_t size)
+{
+    struct ctlmsg_header hdr;
+    if (size < sizeof(hdr)) {
+        return CTLMSG_E_TRUNCATED;
+    }
+
+    memcpy(&hdr, buf, sizeof(hdr));
+    if (hdr.magic != CTLMSG_MAGIC) {
+        return CTLMSG_E_MAGIC;
+    }
+
+    if (hdr.version != CTLMSG_VERSION) {
+        return CTLMSG_E_VERSION;
+    }
+
+    if (hdr.length < sizeof(hdr) || hdr.length > size || hdr.length > CTLMSG_MAX_SIZE) {
+        return CTLMSG_E_TRUNCATED;
+    }
+
+    reader->buf = buf;
+    reader->size = hdr.length;
+    reader->offset = sizeof(hdr);
+    reader->op_left = hdr.op_count;
+    return CTLMSG_OK;
+}
+
+int ctlmsg_read_op(struct ctlmsg_reader* reader, struct ctlmsg_op* op)
+{
+    if (reader->op_left == 0) {
+        // Trailing garbage means declared length and op count disagree
+        return (reader->offset == reader->size ? CTLMSG_END : CTLMSG_E_LENGTH);
+    }
+
+    struct ctlmsg_op_header hdr;
+    if (reader->size - reader->offset < sizeof(hdr)) {
+        return CTLMSG_E_TRUNCATED;
+    }
+
+    memcpy(&hdr, reader->buf + reader->offset, sizeof(hdr));
+
+    int length = ctlmsg_payload_length(hdr.type);
+    if (length < 0) {
+        return CTLMSG_E_OP;
+    }
+
+    if (hdr.length != length) {
+        return CTLMSG_E_LENGTH;
+    }
+
+    if (reader->size - reader->offset - sizeof(hdr) < (size_t)length) {
+        return CTLMSG_E_TRUNCATED;
+    }
+
+    memset(op, 0, sizeof(*op));
+    op->type = hdr.type;
+    memcpy(&op->u, reader->buf + reader->offset + sizeof(hdr), length);
+
+    reader->offset += sizeof(hdr) + length;
+    reader->op_left--;
+    return CTLMSG_OK;
+}
+
+int ctlmsg_validate(const void* buf, size_t size)
+{
+    struct ctlmsg_reader reader;
+    int res = ctlmsg_reader_init(&reader, buf, size);
+    if (res != CTLMSG_OK) {
+        return res;
+    }
+
+    struct ctlmsg_op op;
+    while ((res = ctlmsg_read_op(&reader, &op)) == CTLMSG_OK) {
+        ;
+    }
+
+    return (res == CTLMSG_END ? CTLMSG_OK : res);
+}
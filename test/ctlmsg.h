@@ -0,0 +1,134 @@
+//
+//  ctlmsg.h
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Versioned, length-prefixed batch of control operations sent through 'debug.killhook.ctl'.
+//  Fields are in host byte order, the message never leaves the machine.
+//  Does not depend on kernel headers.
+//
+//  Layout:
+//      struct ctlmsg_header
+//      op_count times: struct ctlmsg_op_header followed by op payload of op_header.length bytes
+//
+
+#ifndef ctlmsg_h
+#define ctlmsg_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CTLMSG_MAGIC        0x4b48434du     /* 'KHCM' */
+#define CTLMSG_VERSION      1
+#define CTLMSG_MAX_SIZE     (64 * 1024)
+
+// Operation types
+enum {
+    CTLMSG_OP_ADD_TARGET = 1,       /* struct ctlmsg_target */
+    CTLMSG_OP_REMOVE_TARGET,        /* struct ctlmsg_pid */
+    CTLMSG_OP_SET_SIGMASK,          /* struct ctlmsg_target, flags are ignored */
+    CTLMSG_OP_CLEAR_TARGETS,        /* no payload */
+    CTLMSG_OP_QUERY_STATS,          /* no payload, requests stats in reply */
+    CTLMSG_OP_TRUST_ADD,            /* struct ctlmsg_trust */
+    CTLMSG_OP_TRUST_REMOVE,         /* struct ctlmsg_pid */
+};
+
+// ctlmsg_* return codes
+enum {
+    CTLMSG_OK = 0,
+    CTLMSG_END,             /* no more operations */
+    CTLMSG_E_TRUNCATED,     /* buffer is shorter than declared lengths */
+    CTLMSG_E_MAGIC,
+    CTLMSG_E_VERSION,
+    CTLMSG_E_OP,            /* unknown operation type */
+    CTLMSG_E_LENGTH,        /* payload length does not match operation type */
+    CTLMSG_E_NOSPACE,       /* encoder ran out of buffer */
+};
+
+struct ctlmsg_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint32_t length;        /* total message length including this header */
+    uint32_t op_count;
+};
+
+struct ctlmsg_op_header {
+    uint16_t type;
+    uint16_t length;        /* payload length */
+};
+
+struct ctlmsg_pid {
+    int32_t  pid;
+};
+
+struct ctlmsg_target {
+    int32_t  pid;
+    uint32_t flags;
+    uint64_t sigmask;
+};
+
+struct ctlmsg_trust {
+    int32_t  pid;
+    uint32_t flags;
+    uint64_t start_time;    /* process start time in microseconds, 0 to take current one */
+};
+
+// Decoded operation
+struct ctlmsg_op {
+    uint16_t type;
+    union {
+        struct ctlmsg_pid       pid;
+        struct ctlmsg_target    target;
+        struct ctlmsg_trust     trust;
+    } u;
+};
+
+struct ctlmsg_writer {
+    uint8_t* buf;
+    size_t   size;
+    size_t   offset;
+    uint32_t op_count;
+    int      error;
+};
+
+struct ctlmsg_reader {
+    const uint8_t* buf;
+    size_t   size;
+    size_t   offset;
+    uint32_t op_left;
+};
+
+/**
+ * \brief   Start encoding a message into buffer
+ */
+void ctlmsg_writer_init(struct ctlmsg_writer* writer, void* buf, size_t size);
+
+/**
+ * \brief   Append operation. Errors are sticky and reported by ctlmsg_writer_finish.
+ */
+void ctlmsg_write_op(struct ctlmsg_writer* writer, const struct ctlmsg_op* op);
+
+/**
+ * \brief   Finalize message header. Returns CTLMSG_OK and message size in psize.
+ */
+int ctlmsg_writer_finish(struct ctlmsg_writer* writer, size_t* psize);
+
+/**
+ * \brief   Check message header and every operation without decoding them.
+ *          Succeeds only if the whole message is well formed, so a batch can be applied all or nothing.
+ */
+int ctlmsg_validate(const void* buf, size_t size);
+
+/**
+ * \brief   Start decoding a message, checks header only
+ */
+int ctlmsg_reader_init(struct ctlmsg_reader* reader, const void* buf, size_t size);
+
+/**
+ * \brief   Decode next operation. Returns CTLMSG_END after the last one.
+ */
+int ctlmsg_read_op(struct ctlmsg_reader* reader, struct ctlmsg_op* op);
+
+#endif /* ctlmsg_h */
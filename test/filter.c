@@ -0,0 +1,72 @@
+//
+//  filter.c
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+
+#include "filter.h"
+
+static inline uint64_t filter_verdict(const struct filter_policy* policy, uint16_t event, int32_t target, int32_t arg)
+{
+    return ratelimit_verdict(target, event, arg, policy->generation);
+}
+
+// Policy has decided to deny. Repeat of caller's last denial skips trust lookup, trusted callers are let through.
+// Allowed calls never get here, so neither the limiter nor the trust cache cost them anything.
+static int filter_denied(const struct filter_policy* policy, const struct filter_caller* caller, uint16_t event, int32_t target, int32_t arg)
+{
+    if (ratelimit_cached_deny(policy->limit, caller->pid, filter_verdict(policy, event, target, arg), caller->now_ms(caller->ctx))) {
+        return FILTER_DENY_CACHED;
+    }
+
+    if (trustcache_check(policy->trust, caller->pid, caller->start_time, caller->ctx)) {
+        return FILTER_ALLOW;
+    }
+
+    return FILTER_DENY;
+}
+
+int filter_kill(const struct filter_policy* policy, const struct filter_caller* caller, int32_t pid, int signum)
+{
+    // Process cannot ignore or handle SIGKILL and SIGSTOP, other signals from the entry mask
+    // will terminate or stop it unless handled, so we intercept them all here.
+    // Group and broadcast kills are blocked as a whole if they would reach a protected process.
+    if (!protect_check_kill(policy->protect, pid, signum, caller->pgid, caller->reach, caller->ctx)) {
+        return FILTER_ALLOW;
+    }
+
+    return filter_denied(policy, caller, AUDIT_KILL_DENIED, pid, signum);
+}
+
+int filter_task_for_pid(const struct filter_policy* policy, const struct filter_caller* caller, int32_t pid)
+{
+    if (!protect_check_task_for_pid(policy->protect, caller->pid, pid)) {
+        return FILTER_ALLOW;
+    }
+
+    return filter_denied(policy, caller, AUDIT_TASK_FOR_PID_DENIED, pid, 0);
+}
+
+int filter_mach_msg(const struct filter_policy* policy, const struct filter_caller* caller,
+                    int32_t msgh_id, const void* remote_task, int32_t* target)
+{
+    *target = 0;
+
+    // Message id alone decides unless destination task is given
+    if (!protect_check_msg_id(policy->protect, msgh_id)) {
+        const struct protect_entry* entry = protect_find_task(policy->protect, remote_task);
+        if (!entry) {
+            return FILTER_ALLOW;
+        }
+
+        *target = entry->pid;
+    }
+
+    return filter_denied(policy, caller, AUDIT_MACH_MSG_DENIED, *target, msgh_id);
+}
+
+int filter_audit(const struct filter_policy* policy, const struct filter_caller* caller, uint16_t event, int32_t target, int32_t arg)
+{
+    return ratelimit_deny(policy->limit, caller->pid, filter_verdict(policy, event, target, arg), caller->now_ms(caller->ctx));
+}
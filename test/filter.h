@@ -0,0 +1,70 @@
+//
+//  filter.h
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Decisions of kill, task_for_pid and mach_msg hooks.
+//  Compiled into the kext and into killctl replay, so that replay measures the code hooks run.
+//  Does not depend on kernel headers, callers provide locking of protected set and trust cache.
+//
+
+#ifndef filter_h
+#define filter_h
+
+#include <stdint.h>
+
+#include "protect.h"
+#include "trustcache.h"
+#include "ratelimit.h"
+#include "auditq.h"
+
+// filter_* verdicts
+enum {
+    FILTER_ALLOW = 0,
+    FILTER_DENY,            /* denied by policy, has to be accounted through filter_audit */
+    FILTER_DENY_CACHED,     /* repeat of caller's last denial while it is out of tokens, already counted as suppressed */
+};
+
+// Policy hooks decide on, a snapshot taken under caller's lock
+struct filter_policy {
+    const struct protect_set*   protect;
+    const struct trustcache*    trust;
+    struct ratelimit*           limit;      /* lock-free, may be used after the lock is dropped */
+    uint32_t                    generation; /* changes whenever protect or trust do */
+};
+
+// Calling process. Callbacks are only made for calls policy would deny.
+struct filter_caller {
+    int32_t     pid;
+    int32_t     pgid;                       /* caller's process group, only read by kill(0, sig) */
+    uint64_t    (*start_time)(void* ctx);   /* process start time in microseconds for trust cache */
+    uint64_t    (*now_ms)(void* ctx);       /* monotonic clock for rate limiter */
+    protect_reach_t reach;                  /* who kill(-1, sig) reaches, see protect_check_kill */
+    void*       ctx;
+};
+
+/**
+ * \brief   Decide on kill(2) with given pid argument
+ */
+int filter_kill(const struct filter_policy* policy, const struct filter_caller* caller, int32_t pid, int signum);
+
+/**
+ * \brief   Decide on task_for_pid for target pid
+ */
+int filter_task_for_pid(const struct filter_policy* policy, const struct filter_caller* caller, int32_t pid);
+
+/**
+ * \brief   Decide on mach message send. remote_task is the task behind destination port in PROTECT_MSG_FULL mode, NULL otherwise.
+ *          Pid owning a protected destination task is returned in target, 0 for messages denied by id.
+ */
+int filter_mach_msg(const struct filter_policy* policy, const struct filter_caller* caller,
+                    int32_t msgh_id, const void* remote_task, int32_t* target);
+
+/**
+ * \brief   Account a FILTER_DENY verdict with the rate limiter, may be called after the lock is dropped.
+ *          event is AUDIT_*, target and arg are those of the audit record. Returns nonzero if denial has to be audited.
+ */
+int filter_audit(const struct filter_policy* policy, const struct filter_caller* caller, uint16_t event, int32_t target, int32_t arg);
+
+#endif /* filter_h */
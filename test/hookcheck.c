@@ -0,0 +1,27 @@
+//
+//  hookcheck.c
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+
+#include <string.h>
+
+#include "hookcheck.h"
+
+unsigned hookcheck_verify(const struct hookcheck_slot* slots, unsigned count, uint64_t* lost)
+{
+    unsigned nlost = 0;
+    memset(lost, 0, HOOKCHECK_BITMAP_WORDS(count) * sizeof(*lost));
+
+    // Branchless so that cost does not depend on how many hooks were lost
+    for (unsigned i = 0; i < count; ++i) {
+        const void* current = *(const void* const volatile*)slots[i].slot;
+        uint64_t bit = (current != slots[i].expected);
+
+        lost[i / 64] |= bit << (i % 64);
+        nlost += (unsigned)bit;
+    }
+
+    return nlost;
+}
@@ -0,0 +1,31 @@
+//
+//  hookcheck.h
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Batch verification of installed hooks.
+//  Does not depend on kernel headers.
+//
+
+#ifndef hookcheck_h
+#define hookcheck_h
+
+#include <stdint.h>
+
+// Table slot holding a hooked function pointer and the value we expect in it
+struct hookcheck_slot {
+    const void* const*  slot;
+    const void*         expected;
+};
+
+#define HOOKCHECK_BITMAP_WORDS(count)   (((count) + 63) / 64)
+
+/**
+ * \brief   Compare every slot against its expected pointer.
+ *          Sets bit N in lost bitmap (HOOKCHECK_BITMAP_WORDS(count) words) if slot N was overwritten.
+ *          Returns number of lost slots.
+ */
+unsigned hookcheck_verify(const struct hookcheck_slot* slots, unsigned count, uint64_t* lost);
+
+#endif /* hookcheck_h */
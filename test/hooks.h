@@ -0,0 +1,40 @@
+//
+//  hooks.h
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Table entries the kext replaces, shared by the kext hook registry and killctl startbench.
+//  Does not depend on kernel headers.
+//
+
+#ifndef hooks_h
+#define hooks_h
+
+#include "sysent.h"
+
+enum {
+    HOOK_TABLE_SYSENT,
+    HOOK_TABLE_MACH,
+};
+
+/**
+ * \brief   Expands HOOK(table, num, handler, original) for every hooked entry, table is HOOK_TABLE_*.
+ *          handler and original name kext functions and variables, users outside the kext only take table and num.
+ *          Both exec flavours are hooked, execve and __mac_execve replace the task of a protected process alike.
+ */
+#define KILLHOOK_HOOKS(HOOK) \
+    HOOK(HOOK_TABLE_SYSENT, SYS_kill,                   my_kill,                    g_orig_kill) \
+    HOOK(HOOK_TABLE_SYSENT, SYS_exit,                   my_exit,                    g_orig_exit) \
+    HOOK(HOOK_TABLE_SYSENT, SYS_fork,                   my_fork,                    g_orig_fork) \
+    HOOK(HOOK_TABLE_SYSENT, SYS_vfork,                  my_vfork,                   g_orig_vfork) \
+    HOOK(HOOK_TABLE_SYSENT, SYS_posix_spawn,            my_posix_spawn,             g_orig_posix_spawn) \
+    HOOK(HOOK_TABLE_SYSENT, SYS_execve,                 my_execve,                  g_orig_execve) \
+    HOOK(HOOK_TABLE_SYSENT, SYS___mac_execve,           my_mac_execve,              g_orig_mac_execve) \
+    HOOK(HOOK_TABLE_SYSENT, SYS_setpgid,                my_setpgid,                 g_orig_setpgid) \
+    HOOK(HOOK_TABLE_SYSENT, SYS_setsid,                 my_setsid,                  g_orig_setsid) \
+    HOOK(HOOK_TABLE_MACH,   MACH_MSG_TRAP,              my_mach_msg_trap,           g_mach_msg_trap) \
+    HOOK(HOOK_TABLE_MACH,   MACH_MSG_OVERWRITE_TRAP,    my_mach_msg_overwrite_trap, g_mach_msg_overwrite_trap) \
+    HOOK(HOOK_TABLE_MACH,   TASK_FOR_PID_TRAP,          my_task_for_pid,            g_task_for_pid)
+
+#endif /* hooks_h */
@@ -0,0 +1,71 @@
+//
+//  hookstat.c
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+
+#include <string.h>
+
+#include "hookstat.h"
+
+void hookstat_merge(const struct hookstat_percpu* cpus, unsigned ncpus, struct hookstat_snapshot* snapshot)
+{
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->version = HOOKSTAT_VERSION;
+    snapshot->nhooks = HOOKSTAT_COUNT;
+
+    if (ncpus > HOOKSTAT_MAX_CPUS) {
+        ncpus = HOOKSTAT_MAX_CPUS;
+    }
+
+    for (unsigned cpu = 0; cpu < ncpus; ++cpu) {
+        for (unsigned hook = 0; hook < HOOKSTAT_COUNT; ++hook) {
+            const struct hookstat_hist* src = &cpus[cpu].hist[hook];
+            struct hookstat_hist* dst = &snapshot->hist[hook];
+
+            dst->count += src->count;
+            for (unsigned i = 0; i < HOOKSTAT_BUCKETS; ++i) {
+                dst->buckets[i] += src->buckets[i];
+            }
+        }
+    }
+}
+
+void hookstat_reset(struct hookstat_percpu* cpus, unsigned ncpus)
+{
+    if (ncpus > HOOKSTAT_MAX_CPUS) {
+        ncpus = HOOKSTAT_MAX_CPUS;
+    }
+
+    memset(cpus, 0, sizeof(*cpus) * ncpus);
+}
+
+uint64_t hookstat_percentile(const struct hookstat_hist* hist, unsigned basis_points)
+{
+    // Sum buckets instead of trusting count: concurrent writers may leave them slightly out of sync
+    uint64_t total = 0;
+    for (unsigned i = 0; i < HOOKSTAT_BUCKETS; ++i) {
+        total += hist->buckets[i];
+    }
+
+    if (total == 0) {
+        return 0;
+    }
+
+    // Rank of the sample we're after, rounded up
+    uint64_t rank = (total * basis_points + 9999) / 10000;
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < HOOKSTAT_BUCKETS; ++i) {
+        seen += hist->buckets[i];
+        if (seen >= rank) {
+            return (i == 0 ? 0 : (i >= 64 ? UINT64_MAX : (1ull << i) - 1));
+        }
+    }
+
+    return UINT64_MAX;
+}
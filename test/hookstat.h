@@ -0,0 +1,79 @@
+//
+//  hookstat.h
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Per-CPU log2 cycle histograms for hook overhead.
+//  Does not depend on kernel headers so it can be shared with userspace tools.
+//
+
+#ifndef hookstat_h
+#define hookstat_h
+
+#include <stdint.h>
+
+#define HOOKSTAT_VERSION    3
+#define HOOKSTAT_BUCKETS    64      /* bucket N holds samples in [2^(N-1), 2^N) cycles */
+#define HOOKSTAT_MAX_CPUS   64
+
+// Instrumented hooks
+enum {
+    HOOKSTAT_KILL = 0,
+    HOOKSTAT_MACH_MSG,
+    HOOKSTAT_MACH_MSG_OVERWRITE,
+    HOOKSTAT_TASK_FOR_PID,
+    HOOKSTAT_PROCESS_TREE,      /* inheritance and group bookkeeping on fork, exec, exit, setpgid and setsid */
+    HOOKSTAT_COUNT
+};
+
+struct hookstat_hist {
+    uint64_t count;
+    uint64_t buckets[HOOKSTAT_BUCKETS];
+};
+
+// Histograms owned by a single CPU, cache line aligned to avoid false sharing
+struct hookstat_percpu {
+    struct hookstat_hist hist[HOOKSTAT_COUNT];
+} __attribute__((aligned(64)));
+
+// Merged histograms as exported through 'debug.killhook.hookstat'
+struct hookstat_snapshot {
+    uint32_t version;
+    uint32_t nhooks;
+    struct hookstat_hist hist[HOOKSTAT_COUNT];
+};
+
+/**
+ * \brief   Record a single sample for hook on given CPU.
+ *          Not atomic: a preempted writer may lose a sample, which is fine for statistics.
+ */
+static inline void hookstat_record(struct hookstat_percpu* cpus, unsigned cpu, unsigned hook, uint64_t cycles)
+{
+    unsigned bucket = (cycles ? 64 - __builtin_clzll(cycles) : 0);
+    if (bucket >= HOOKSTAT_BUCKETS) {
+        bucket = HOOKSTAT_BUCKETS - 1;
+    }
+
+    struct hookstat_hist* hist = &cpus[cpu % HOOKSTAT_MAX_CPUS].hist[hook];
+    hist->count++;
+    hist->buckets[bucket]++;
+}
+
+/**
+ * \brief   Merge per-CPU histograms into snapshot
+ */
+void hookstat_merge(const struct hookstat_percpu* cpus, unsigned ncpus, struct hookstat_snapshot* snapshot);
+
+/**
+ * \brief   Zero per-CPU histograms
+ */
+void hookstat_reset(struct hookstat_percpu* cpus, unsigned ncpus);
+
+/**
+ * \brief   Upper cycle bound of the bucket containing given percentile.
+ *          Percentile is given in basis points, i.e. 9900 for p99.
+ */
+uint64_t hookstat_percentile(const struct hookstat_hist* hist, unsigned basis_points);
+
+#endif /* hookstat_h */
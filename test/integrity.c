@@ -0,0 +1,120 @@
+//
+//  integrity.c
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+
+#include <string.h>
+
+#include "integrity.h"
+
+#define INTEGRITY_SEED  0xcbf29ce484222325ull
+#define INTEGRITY_PRIME 0x100000001b3ull
+
+// Mix one 64bit word into hash. Word-wise FNV-1a variant with an extra rotation
+// so that swapped neighbour words do not cancel out.
+static inline uint64_t integrity_mix(uint64_t hash, uint64_t word)
+{
+    hash ^= word;
+    hash *= INTEGRITY_PRIME;
+    return (hash << 31) | (hash >> 33);
+}
+
+// Hash size bytes at ptr. Tables are pointer aligned but memcpy keeps this safe for any region.
+static uint64_t integrity_hash_bytes(uint64_t hash, const uint8_t* ptr, size_t size)
+{
+    while (size >= sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, ptr, sizeof(word));
+        hash = integrity_mix(hash, word);
+        ptr += sizeof(word);
+        size -= sizeof(word);
+    }
+
+    if (size) {
+        uint64_t word = 0;
+        memcpy(&word, ptr, size);
+        hash = integrity_mix(hash, word);
+    }
+
+    return hash;
+}
+
+void integrity_init(struct integrity_state* state)
+{
+    memset(state, 0, sizeof(*state));
+    state->hash = INTEGRITY_SEED;
+}
+
+int integrity_add_region(struct integrity_state* state, const void* base, size_t size)
+{
+    if (state->nregions >= INTEGRITY_MAX_REGIONS) {
+        return 0;
+    }
+
+    state->regions[state->nregions].base = base;
+    state->regions[state->nregions].size = size;
+    state->nregions++;
+    return 1;
+}
+
+uint64_t integrity_hash_full(const struct integrity_state* state)
+{
+    uint64_t hash = INTEGRITY_SEED;
+    for (unsigned i = 0; i < state->nregions; ++i) {
+        hash = integrity_hash_bytes(hash, state->regions[i].base, state->regions[i].size);
+    }
+
+    return hash;
+}
+
+void integrity_rebaseline(struct integrity_state* state)
+{
+    state->baseline = integrity_hash_full(state);
+    state->region = 0;
+    state->offset = 0;
+    state->hash = INTEGRITY_SEED;
+}
+
+int integrity_step(struct integrity_state* state, size_t budget)
+{
+    // Keep chunks word aligned so that chunked and full hashes agree
+    budget &= ~(sizeof(uint64_t) - 1);
+    if (budget == 0) {
+        budget = sizeof(uint64_t);
+    }
+
+    while (budget && state->region < state->nregions) {
+        const struct integrity_region* region = &state->regions[state->region];
+
+        size_t left = region->size - state->offset;
+        size_t chunk = (left < budget ? left : budget);
+
+        state->hash = integrity_hash_bytes(state->hash, (const uint8_t*)region->base + state->offset, chunk);
+        state->offset += chunk;
+        budget = (budget - chunk) & ~(sizeof(uint64_t) - 1);
+
+        if (state->offset == region->size) {
+            state->region++;
+            state->offset = 0;
+        }
+    }
+
+    if (state->region < state->nregions) {
+        return INTEGRITY_PENDING;
+    }
+
+    // Pass complete, compare and start over
+    int res = (state->hash == state->baseline ? INTEGRITY_OK : INTEGRITY_MISMATCH);
+
+    state->passes++;
+    if (res == INTEGRITY_MISMATCH) {
+        state->mismatches++;
+    }
+
+    state->region = 0;
+    state->offset = 0;
+    state->hash = INTEGRITY_SEED;
+    return res;
+}
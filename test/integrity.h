@@ -0,0 +1,73 @@
+//
+//  integrity.h
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Incremental fingerprinting of memory regions (syscall table entries).
+//  A full pass is split into bounded steps so that no single timer tick takes long.
+//  Does not depend on kernel headers.
+//
+
+#ifndef integrity_h
+#define integrity_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define INTEGRITY_MAX_REGIONS   16
+
+// integrity_step results
+enum {
+    INTEGRITY_PENDING = 0,      /* pass is not complete yet */
+    INTEGRITY_OK,               /* pass completed, fingerprint matches baseline */
+    INTEGRITY_MISMATCH,         /* pass completed, fingerprint differs from baseline */
+};
+
+struct integrity_region {
+    const void* base;
+    size_t      size;
+};
+
+struct integrity_state {
+    struct integrity_region regions[INTEGRITY_MAX_REGIONS];
+    unsigned    nregions;
+    uint64_t    baseline;
+
+    // Cursor of the pass in progress
+    unsigned    region;
+    size_t      offset;
+    uint64_t    hash;
+
+    // Statistics
+    uint64_t    passes;
+    uint64_t    mismatches;
+};
+
+/**
+ * \brief   Reset state and forget all regions
+ */
+void integrity_init(struct integrity_state* state);
+
+/**
+ * \brief   Add region to fingerprint. Returns 0 if there is no room left.
+ */
+int integrity_add_region(struct integrity_state* state, const void* base, size_t size);
+
+/**
+ * \brief   Hash all regions in one go
+ */
+uint64_t integrity_hash_full(const struct integrity_state* state);
+
+/**
+ * \brief   Take current region contents as a reference and restart the pass
+ */
+void integrity_rebaseline(struct integrity_state* state);
+
+/**
+ * \brief   Hash at most budget bytes of the current pass.
+ *          Compares fingerprint against baseline when the pass is complete and starts a new one.
+ */
+int integrity_step(struct integrity_state* state, size_t budget);
+
+#endif /* integrity_h */
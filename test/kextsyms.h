@@ -0,0 +1,32 @@
+//
+//  kextsyms.h
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Private kernel symbols the kext resolves on start, shared by test_start and killctl kdiff and startbench.
+//  Does not depend on kernel headers.
+//
+
+#ifndef kextsyms_h
+#define kextsyms_h
+
+/**
+ * \brief   Expands SYMBOL(name, variable, required) for every symbol in resolve order.
+ *          variable names the kext pointer it is stored in, start fails if a required symbol is missing.
+ */
+#define KILLHOOK_SYMBOLS(SYMBOL) \
+    SYMBOL("_proc_task",                    proc_task,                  1) \
+    SYMBOL("_get_task_ipcspace",            get_task_ipcspace,          1) \
+    SYMBOL("_port_name_to_task",            port_name_to_task,          1) \
+    SYMBOL("_cpu_number",                   get_cpu_number,             1) \
+    SYMBOL("_nsysent",                      nsysent,                    1) \
+    SYMBOL("_proc_starttime",               proc_starttime,             1) \
+    SYMBOL("_kernel_map",                   kernel_map_ptr,             0) \
+    SYMBOL("_get_task_map",                 get_task_map,               0) \
+    SYMBOL("_mach_make_memory_entry_64",    mach_make_memory_entry_64,  0) \
+    SYMBOL("_mach_vm_map",                  mach_vm_map,                0) \
+    SYMBOL("_mach_vm_deallocate",           mach_vm_deallocate,         0) \
+    SYMBOL("_ipc_port_release_send",        ipc_port_release_send,      0)
+
+#endif /* kextsyms_h */
@@ -0,0 +1,107 @@
+//
+//  killhook.h
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Structures exported through 'debug.killhook' sysctl nodes.
+//  Shared between the kext and userspace clients.
+//
+
+#ifndef killhook_h
+#define killhook_h
+
+#include <stdint.h>
+
+#define KILLHOOK_INTEGRITY_VERSION  1
+#define KILLHOOK_HOOKS_VERSION      1
+
+#define KILLHOOK_CTL_VERSION        2
+
+#define KILLHOOK_TELEMETRY_MAGIC    0x4b48544du     /* 'KHTM' */
+#define KILLHOOK_TELEMETRY_VERSION  1
+
+#define KILLHOOK_MAX_HOOKS          256
+#define KILLHOOK_MAX_TARGETS        256     /* PROTECT_MAX_ENTRIES */
+#define KILLHOOK_MAX_COUNTERS       8       /* room for HOOKSTAT_COUNT */
+
+// 'debug.killhook.integrity'
+struct killhook_integrity_stats {
+    uint32_t version;
+    uint32_t full;          /* 1 if whole tables are fingerprinted */
+    uint64_t passes;        /* completed verification passes */
+    uint64_t mismatches;    /* passes which found foreign modifications */
+    uint64_t baseline;      /* current reference fingerprint */
+};
+
+// 'debug.killhook.hooks'
+struct killhook_hooks_status {
+    uint32_t version;
+    uint32_t nhooks;        /* registered hooks */
+    uint32_t nlost;         /* hooks no longer installed */
+    uint32_t reserved;
+    uint64_t lost[KILLHOOK_MAX_HOOKS / 64];    /* bit N is set if hook N was overwritten */
+};
+
+// Reply flags
+#define KILLHOOK_CTL_REPLY_STATS    0x1     /* stats field is valid */
+
+// failed_op of a batch which failed before any operation was applied
+#define KILLHOOK_CTL_NO_OP          0xffffffffu
+
+// 'debug.killhook.ctl' reply for a batch written as struct ctlmsg_header and operations (see ctlmsg.h).
+// Batch is applied only if both status and op_errno are 0. A malformed batch is reported in status alone,
+// a well formed batch which could not be applied is reported in op_errno and failed_op.
+struct killhook_ctl_reply {
+    uint32_t version;
+    int32_t  status;        /* CTLMSG_OK or CTLMSG_E_* decoding error, never an errno */
+    int32_t  op_errno;      /* errno of the failure if batch decoded fine, 0 otherwise */
+    uint32_t failed_op;     /* index of operation op_errno belongs to or KILLHOOK_CTL_NO_OP */
+    uint32_t flags;         /* KILLHOOK_CTL_REPLY_* */
+    uint32_t reserved;
+    struct {
+        uint32_t targets;               /* protected processes */
+        uint32_t groups;                /* protected process groups */
+        uint32_t hooks_lost;            /* hooks overwritten by someone else */
+        uint32_t trusted;               /* trusted caller identities */
+        uint64_t integrity_mismatches;  /* integrity watchdog reports */
+    } stats;
+};
+
+// Telemetry published by the kext, consistent only when read through telemetry_read (see telemetry.h)
+struct killhook_telemetry_data {
+    uint64_t updates;               /* number of times data was published */
+    uint64_t time;                  /* mach_absolute_time of last update */
+    uint32_t targets;               /* protected processes, first ones are listed in target_pids */
+    uint32_t groups;                /* protected process groups */
+    uint32_t trusted;               /* trusted caller identities */
+    uint32_t msg_filter;            /* mach message filtering mode, PROTECT_MSG_* */
+    uint32_t nhooks;                /* registered hooks */
+    uint32_t nlost;                 /* hooks no longer installed */
+    uint64_t lost[KILLHOOK_MAX_HOOKS / 64];    /* bit N is set if hook N was overwritten */
+    uint64_t integrity_passes;      /* completed verification passes */
+    uint64_t integrity_mismatches;  /* passes which found foreign modifications */
+    uint64_t audit_dropped;         /* audit records lost to a full queue */
+    uint64_t hook_calls[KILLHOOK_MAX_COUNTERS];    /* calls per HOOKSTAT_* hook */
+    int32_t  target_pids[KILLHOOK_MAX_TARGETS];
+};
+
+// Page shared read-only with userspace
+struct killhook_telemetry {
+    uint32_t magic;                 /* KILLHOOK_TELEMETRY_MAGIC */
+    uint32_t version;               /* KILLHOOK_TELEMETRY_VERSION */
+    uint32_t size;                  /* sizeof(struct killhook_telemetry) */
+    uint32_t reserved;
+    uint64_t seq;                   /* odd while kext is updating data */
+    struct killhook_telemetry_data data;
+};
+
+// 'debug.killhook.telemetry', every read maps telemetry page into the caller again.
+// Map it once and keep polling, each read leaves a mapping behind until the caller unmaps it.
+struct killhook_telemetry_map {
+    uint32_t version;
+    uint32_t size;                  /* mapping size, caller unmaps it when done */
+    uint64_t address;
+};
+
+#endif /* killhook_h */
@@ -0,0 +1,238 @@
+//
+//  macho.c
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Parsing code split out of resolver.c, see there for origins
+//
+
+#if defined(KERNEL)
+#   include <sys/systm.h>
+#   include <libkern/libkern.h>
+#else
+#   include <stdio.h>
+#   include <string.h>
+#endif
+
+#include "macho.h"
+
+struct segment_command_64* find_segment_64(const struct mach_header_64* mh, const char* segname)
+{
+    if (!mh) {
+        return NULL;
+    }
+    
+    if (mh->magic != MH_MAGIC_64) {
+        return NULL;
+    }
+    
+    if (!segname) {
+        return NULL;
+    }
+    
+    struct load_command *lc;
+    struct segment_command_64 *seg, *foundseg = NULL;
+    
+    /* First LC begins straight after the mach header */
+    lc = (struct load_command *)((uint64_t)mh + sizeof(struct mach_header_64));
+    while ((uint64_t)lc < (uint64_t)mh + sizeof(struct mach_header_64) + (uint64_t)mh->sizeofcmds) {
+        if (lc->cmd == LC_SEGMENT_64) {
+            /* Check load command's segment name */
+            seg = (struct segment_command_64 *)lc;
+            if (strcmp(seg->segname, segname) == 0) {
+                foundseg = seg;
+                break;
+            }
+        }
+        
+        /* Next LC */
+        lc = (struct load_command *)((uint64_t)lc + (uint64_t)lc->cmdsize);
+    }
+    
+    /* Return the segment (NULL if we didn't find it) */
+    return foundseg;
+}
+
+struct section_64* find_section_64(struct segment_command_64 *seg, const char *name)
+{
+    struct section_64 *sect, *foundsect = NULL;
+    uint32_t i = 0;
+    
+    /* First section begins straight after the segment header */
+    for (i = 0, sect = (struct section_64 *)((uint64_t)seg + (uint64_t)sizeof(struct segment_command_64));
+         i < seg->nsects;
+         i++, sect = (struct section_64 *)((uint64_t)sect + sizeof(struct section_64)))
+    {
+        /* Check section name */
+        if (strcmp(sect->sectname, name) == 0) {
+            foundsect = sect;
+            break;
+        }
+    }
+    
+    /* Return the section (NULL if we didn't find it) */
+    return foundsect;
+}
+
+struct load_command *
+find_load_command(struct mach_header_64 *mh, uint32_t cmd)
+{
+    struct load_command *lc, *foundlc = NULL;
+    
+    /* First LC begins straight after the mach header */
+    lc = (struct load_command *)((uint64_t)mh + sizeof(struct mach_header_64));
+    while ((uint64_t)lc < (uint64_t)mh + sizeof(struct mach_header_64) + (uint64_t)mh->sizeofcmds) {
+        if (lc->cmd == cmd) {
+            foundlc = (struct load_command *)lc;
+            break;
+        }
+        
+        /* Next LC */
+        lc = (struct load_command *)((uint64_t)lc + (uint64_t)lc->cmdsize);
+    }
+    
+    /* Return the load command (NULL if we didn't find it) */
+    return foundlc;
+}
+
+void *find_symbol(struct mach_header_64 *mh, const char *name, uint64_t loaded_base)
+{
+    /*
+     * Check header
+     */
+    if (mh->magic != MH_MAGIC_64) {
+        printf("magic number doesn't match - 0x%x\n", mh->magic);
+        return NULL;
+    }
+    
+    /*
+     * Find __TEXT - we need it for fixed kernel base
+     */
+    struct segment_command_64 *seg_text = find_segment_64(mh, SEG_TEXT);
+    if (!seg_text) {
+        printf("couldn't find __TEXT\n");
+        return NULL;
+    }
+    
+    uint64_t fixed_base = seg_text->vmaddr;
+    
+    /*
+     * Find the LINKEDIT and SYMTAB sections
+     */
+    struct segment_command_64 *seg_linkedit = find_segment_64(mh, SEG_LINKEDIT);
+    if (!seg_linkedit) {
+        printf("couldn't find __LINKEDIT\n");
+        return NULL;
+    }
+    
+    struct symtab_command *lc_symtab = (struct symtab_command *)find_load_command(mh, LC_SYMTAB);
+    if (!lc_symtab) {
+        printf("couldn't find SYMTAB\n");
+        return NULL;
+    }
+   
+    /*
+     * Enumerate symbols until we find the one we're after
+     */
+    uintptr_t base = (uintptr_t)mh;
+    void* strtab = (void*)(base + lc_symtab->stroff);
+    void* symtab = (void*)(base + lc_symtab->symoff);
+    
+    //printf("Symbol table offset 0x%x (%p)\n", lc_symtab->symoff, symtab);
+    //printf("String table offset 0x%x (%p)\n", lc_symtab->stroff, strtab);
+    
+    struct nlist_64* nl = (struct nlist_64 *)(symtab);
+    for (uint64_t i = 0; i < lc_symtab->nsyms; i++, nl = (struct nlist_64 *)((uint64_t)nl + sizeof(struct nlist_64)))
+    {
+        const char* str = (const char *)strtab + nl->n_un.n_strx;
+        if (strcmp(str, name) == 0) {
+            /* Return relocated address */
+            return (void*) (nl->n_value - fixed_base + loaded_base);
+        }
+    }
+    
+    /* Return the address (NULL if we didn't find it) */
+    return NULL;
+}
+
+int macho_image_valid(const struct mach_header_64* mh, size_t size)
+{
+    if (size < sizeof(*mh) || mh->magic != MH_MAGIC_64) {
+        return 0;
+    }
+    
+    if (mh->sizeofcmds > size - sizeof(*mh)) {
+        return 0;
+    }
+    
+    /* Every load command has to fit into sizeofcmds */
+    uint64_t end = sizeof(*mh) + (uint64_t)mh->sizeofcmds;
+    uint64_t offset = sizeof(*mh);
+    while (offset < end) {
+        if (end - offset < sizeof(struct load_command)) {
+            return 0;
+        }
+        
+        const struct load_command* lc = (const struct load_command *)((uintptr_t)mh + offset);
+        if (lc->cmdsize < sizeof(struct load_command) || lc->cmdsize > end - offset) {
+            return 0;
+        }
+        
+        if (lc->cmd == LC_SYMTAB) {
+            const struct symtab_command* symtab = (const struct symtab_command *)lc;
+            if (lc->cmdsize < sizeof(*symtab) ||
+                symtab->symoff > size || (uint64_t)symtab->nsyms * sizeof(struct nlist_64) > size - symtab->symoff ||
+                symtab->stroff > size || symtab->strsize > size - symtab->stroff) {
+                return 0;
+            }
+        }
+        
+        offset += lc->cmdsize;
+    }
+    
+    return 1;
+}
+
+const struct load_command* macho_next_command(const struct mach_header_64* mh, const struct load_command* lc)
+{
+    uint64_t end = sizeof(*mh) + (uint64_t)mh->sizeofcmds;
+    uint64_t offset = (lc ? (uint64_t)((uintptr_t)lc - (uintptr_t)mh) + lc->cmdsize : sizeof(*mh));
+    if (offset >= end || end - offset < sizeof(struct load_command)) {
+        return NULL;
+    }
+    
+    const struct load_command* next = (const struct load_command *)((uintptr_t)mh + offset);
+    if (next->cmdsize < sizeof(struct load_command) || next->cmdsize > end - offset) {
+        return NULL;
+    }
+    
+    return next;
+}
+
+size_t macho_symbols(const struct mach_header_64* mh, struct macho_symbol* symbols, size_t max)
+{
+    const struct symtab_command *lc_symtab = (const struct symtab_command *)find_load_command((struct mach_header_64 *)mh, LC_SYMTAB);
+    if (!lc_symtab) {
+        return 0;
+    }
+    
+    uintptr_t base = (uintptr_t)mh;
+    const char* strtab = (const char*)(base + lc_symtab->stroff);
+    const struct nlist_64* nl = (const struct nlist_64 *)(base + lc_symtab->symoff);
+    
+    size_t count = 0;
+    for (uint32_t i = 0; i < lc_symtab->nsyms; i++, nl++) {
+        if ((nl->n_type & MACHO_N_STAB) || nl->n_un.n_strx >= lc_symtab->strsize) {
+            continue;
+        }
+        
+        if (count < max) {
+            symbols[count].name = strtab + nl->n_un.n_strx;
+            symbols[count].value = nl->n_value;
+        }
+        count++;
+    }
+    
+    return count;
+}
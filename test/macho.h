@@ -0,0 +1,80 @@
+//
+//  macho.h
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Mach-O image parsing shared by the kernel resolver and userspace tools
+//
+
+#ifndef macho_h
+#define macho_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__APPLE__)
+#   include <mach-o/loader.h>
+#else
+#   include "macho_defs.h"
+#endif
+
+/* Borrowed from kernel source. It doesn't exist in Kernel.framework. */
+struct nlist_64 {
+    union {
+        uint32_t  n_strx;   /* index into the string table */
+    } n_un;
+    uint8_t n_type;         /* type flag, see below */
+    uint8_t n_sect;         /* section number or NO_SECT */
+    uint16_t n_desc;        /* see <mach-o/stab.h> */
+    uint64_t n_value;       /* value of this symbol (or stab offset) */
+};
+
+#define MACHO_N_STAB    0xe0    /* symbolic debugging entry mask */
+#define MACHO_N_TYPE    0x0e    /* type bits mask */
+#define MACHO_N_SECT    0x0e    /* defined in section n_sect */
+
+// Symbol name and unslid address
+struct macho_symbol {
+    const char* name;
+    uint64_t    value;
+};
+
+/**
+ * \brief   Find segment with name
+ */
+struct segment_command_64* find_segment_64(const struct mach_header_64* mh, const char* segname);
+
+/**
+ * \brief   Find section with name in segment
+ */
+struct section_64* find_section_64(struct segment_command_64* seg, const char* name);
+
+/**
+ * \brief   Find first load command of type
+ */
+struct load_command* find_load_command(struct mach_header_64* mh, uint32_t cmd);
+
+/**
+ * \brief   Find symbol in image and relocate it to loaded_base
+ */
+void* find_symbol(struct mach_header_64* mh, const char* name, uint64_t loaded_base);
+
+/**
+ * \brief   Check that header, load commands and symbol table of an image read from file fit into size bytes
+ */
+int macho_image_valid(const struct mach_header_64* mh, size_t size);
+
+/**
+ * \brief   Load command following lc, first one if lc is NULL. Caller guarantees sizeofcmds bytes of commands are readable.
+ *          Returns NULL at the end of commands and at a command which has cmdsize smaller than a load command
+ *          or does not fit into sizeofcmds, so a malformed image can't loop or run past its commands.
+ */
+const struct load_command* macho_next_command(const struct mach_header_64* mh, const struct load_command* lc);
+
+/**
+ * \brief   Fill up to max non-debug symbols of a validated image. Returns number of symbols in image.
+ */
+size_t macho_symbols(const struct mach_header_64* mh, struct macho_symbol* symbols, size_t max);
+
+#endif /* macho_h */
@@ -0,0 +1,78 @@
+//
+//  macho_defs.h
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Subset of <mach-o/loader.h> for hosts without Mach-O headers
+//
+
+#ifndef macho_defs_h
+#define macho_defs_h
+
+#include <stdint.h>
+
+#define MH_MAGIC_64     0xfeedfacf
+
+#define LC_SYMTAB       0x2
+#define LC_SEGMENT_64   0x19
+
+#define SEG_TEXT        "__TEXT"
+#define SEG_DATA        "__DATA"
+#define SEG_LINKEDIT    "__LINKEDIT"
+
+struct mach_header_64 {
+    uint32_t    magic;
+    int32_t     cputype;
+    int32_t     cpusubtype;
+    uint32_t    filetype;
+    uint32_t    ncmds;
+    uint32_t    sizeofcmds;
+    uint32_t    flags;
+    uint32_t    reserved;
+};
+
+struct load_command {
+    uint32_t    cmd;
+    uint32_t    cmdsize;
+};
+
+struct segment_command_64 {
+    uint32_t    cmd;
+    uint32_t    cmdsize;
+    char        segname[16];
+    uint64_t    vmaddr;
+    uint64_t    vmsize;
+    uint64_t    fileoff;
+    uint64_t    filesize;
+    int32_t     maxprot;
+    int32_t     initprot;
+    uint32_t    nsects;
+    uint32_t    flags;
+};
+
+struct section_64 {
+    char        sectname[16];
+    char        segname[16];
+    uint64_t    addr;
+    uint64_t    size;
+    uint32_t    offset;
+    uint32_t    align;
+    uint32_t    reloff;
+    uint32_t    nreloc;
+    uint32_t    flags;
+    uint32_t    reserved1;
+    uint32_t    reserved2;
+    uint32_t    reserved3;
+};
+
+struct symtab_command {
+    uint32_t    cmd;
+    uint32_t    cmdsize;
+    uint32_t    symoff;
+    uint32_t    nsyms;
+    uint32_t    stroff;
+    uint32_t    strsize;
+};
+
+#endif /* macho_defs_h */
@@ -0,0 +1,409 @@
+//
+//  protect.c
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+
+#include <string.h>
+
+#include "protect.h"
+
+#define PROTECT_HASH_MASK   (PROTECT_HASH_SIZE - 1)
+#define PROTECT_NO_VALUE    0xffff
+
+//
+// Linear probing hash index
+//
+
+static inline uint32_t protect_hash(uint64_t key)
+{
+    // Fibonacci hashing, take the top bits
+    return (uint32_t)((key * 0x9e3779b97f4a7c15ull) >> 32) & PROTECT_HASH_MASK;
+}
+
+static uint16_t index_find(const struct protect_index* index, uint64_t key)
+{
+    for (uint32_t slot = protect_hash(key); index->keys[slot] != 0; slot = (slot + 1) & PROTECT_HASH_MASK) {
+        if (index->keys[slot] == key) {
+            return index->values[slot];
+        }
+    }
+
+    return PROTECT_NO_VALUE;
+}
+
+// Insert or update key
+static void index_set(struct protect_index* index, uint64_t key, uint16_t value)
+{
+    uint32_t slot = protect_hash(key);
+    while (index->keys[slot] != 0 && index->keys[slot] != key) {
+        slot = (slot + 1) & PROTECT_HASH_MASK;
+    }
+
+    index->keys[slot] = key;
+    index->values[slot] = value;
+}
+
+// Remove key with backward shift so that no tombstones are needed
+static void index_remove(struct protect_index* index, uint64_t key)
+{
+    uint32_t slot = protect_hash(key);
+    while (index->keys[slot] != key) {
+        if (index->keys[slot] == 0) {
+            return;
+        }
+        slot = (slot + 1) & PROTECT_HASH_MASK;
+    }
+
+    uint32_t hole = slot;
+    for (uint32_t next = (hole + 1) & PROTECT_HASH_MASK; index->keys[next] != 0; next = (next + 1) & PROTECT_HASH_MASK) {
+        // Move entry into the hole unless its home slot lies cyclically in (hole, next]
+        uint32_t home = protect_hash(index->keys[next]);
+        if (((next - home) & PROTECT_HASH_MASK) >= ((next - hole) & PROTECT_HASH_MASK)) {
+            index->keys[hole] = index->keys[next];
+            index->values[hole] = index->values[next];
+            hole = next;
+        }
+    }
+
+    index->keys[hole] = 0;
+}
+
+//
+// Groups
+//
+
+static void group_recalc_masks(struct protect_set* set)
+{
+    set->sigmask = 0;
+    for (uint32_t i = 0; i < set->ngroups; ++i) {
+        set->groups[i].sigmask = 0;
+    }
+
+    for (uint32_t i = 0; i < set->count; ++i) {
+        const struct protect_entry* entry = &set->entries[i];
+        set->sigmask |= entry->sigmask;
+
+        uint16_t group = index_find(&set->by_pgid, (uint32_t)entry->pgid);
+        if (group != PROTECT_NO_VALUE) {
+            set->groups[group].sigmask |= entry->sigmask;
+        }
+    }
+}
+
+static void group_ref(struct protect_set* set, int32_t pgid, uint64_t sigmask)
+{
+    if (pgid <= 0) {
+        return;
+    }
+
+    uint16_t group = index_find(&set->by_pgid, (uint32_t)pgid);
+    if (group == PROTECT_NO_VALUE) {
+        group = (uint16_t)set->ngroups++;
+        set->groups[group].pgid = pgid;
+        set->groups[group].refs = 0;
+        set->groups[group].sigmask = 0;
+        index_set(&set->by_pgid, (uint32_t)pgid, group);
+    }
+
+    set->groups[group].refs++;
+    set->groups[group].sigmask |= sigmask;
+}
+
+static void group_unref(struct protect_set* set, int32_t pgid)
+{
+    if (pgid <= 0) {
+        return;
+    }
+
+    uint16_t group = index_find(&set->by_pgid, (uint32_t)pgid);
+    if (group == PROTECT_NO_VALUE || --set->groups[group].refs != 0) {
+        return;
+    }
+
+    // Swap last group into freed place
+    index_remove(&set->by_pgid, (uint32_t)pgid);
+    uint32_t last = --set->ngroups;
+    if (group != last) {
+        set->groups[group] = set->groups[last];
+        index_set(&set->by_pgid, (uint32_t)set->groups[group].pgid, group);
+    }
+}
+
+// Keep inheritance counters in line with entry flags
+static inline void flags_account(struct protect_set* set, uint32_t flags, int delta)
+{
+    if (flags & PROTECT_FLAG_INHERIT) {
+        set->ninherit += (uint32_t)delta;
+    }
+    if (flags & PROTECT_FLAG_INHERITED) {
+        set->ninherited += (uint32_t)delta;
+    }
+}
+
+//
+// Public interface
+//
+
+void protect_init(struct protect_set* set)
+{
+    memset(set, 0, sizeof(*set));
+}
+
+int protect_add(struct protect_set* set, int32_t pid, int32_t pgid, uint64_t sigmask, uint32_t flags, const void* task)
+{
+    if (pid <= 0) {
+        return PROTECT_INVALID;
+    }
+
+    uint16_t idx = index_find(&set->by_pid, (uint32_t)pid);
+    if (idx != PROTECT_NO_VALUE) {
+        // Update in place, masks may only shrink here so recalculate them
+        struct protect_entry* entry = &set->entries[idx];
+
+        group_unref(set, entry->pgid);
+        if (entry->task) {
+            index_remove(&set->by_task, (uintptr_t)entry->task);
+        }
+        flags_account(set, entry->flags, -1);
+
+        entry->pgid = pgid;
+        entry->sigmask = sigmask;
+        entry->flags = flags;
+        entry->task = task;
+
+        group_ref(set, pgid, sigmask);
+        if (task) {
+            index_set(&set->by_task, (uintptr_t)task, idx);
+        }
+        flags_account(set, flags, 1);
+
+        group_recalc_masks(set);
+        return PROTECT_OK;
+    }
+
+    if (set->count >= PROTECT_MAX_ENTRIES) {
+        return PROTECT_FULL;
+    }
+
+    idx = (uint16_t)set->count++;
+    struct protect_entry* entry = &set->entries[idx];
+    entry->pid = pid;
+    entry->pgid = pgid;
+    entry->sigmask = sigmask;
+    entry->flags = flags;
+    entry->task = task;
+
+    index_set(&set->by_pid, (uint32_t)pid, idx);
+    if (task) {
+        index_set(&set->by_task, (uintptr_t)task, idx);
+    }
+
+    group_ref(set, pgid, sigmask);
+    flags_account(set, flags, 1);
+    set->sigmask |= sigmask;
+    return PROTECT_OK;
+}
+
+int protect_remove(struct protect_set* set, int32_t pid)
+{
+    uint16_t idx = index_find(&set->by_pid, (uint32_t)pid);
+    if (idx == PROTECT_NO_VALUE) {
+        return PROTECT_NOT_FOUND;
+    }
+
+    struct protect_entry* entry = &set->entries[idx];
+    index_remove(&set->by_pid, (uint32_t)pid);
+    if (entry->task) {
+        index_remove(&set->by_task, (uintptr_t)entry->task);
+    }
+    group_unref(set, entry->pgid);
+    flags_account(set, entry->flags, -1);
+
+    // Swap last entry into freed place
+    uint32_t last = --set->count;
+    if (idx != last) {
+        *entry = set->entries[last];
+        index_set(&set->by_pid, (uint32_t)entry->pid, idx);
+        if (entry->task) {
+            index_set(&set->by_task, (uintptr_t)entry->task, idx);
+        }
+    }
+
+    group_recalc_masks(set);
+    return PROTECT_OK;
+}
+
+const struct protect_entry* protect_find_pid(const struct protect_set* set, int32_t pid)
+{
+    if (pid <= 0) {
+        return NULL;
+    }
+
+    uint16_t idx = index_find(&set->by_pid, (uint32_t)pid);
+    return (idx == PROTECT_NO_VALUE ? NULL : &set->entries[idx]);
+}
+
+const struct protect_entry* protect_find_task(const struct protect_set* set, const void* task)
+{
+    if (!task) {
+        return NULL;
+    }
+
+    uint16_t idx = index_find(&set->by_task, (uintptr_t)task);
+    return (idx == PROTECT_NO_VALUE ? NULL : &set->entries[idx]);
+}
+
+int protect_fork(struct protect_set* set, int32_t parent, int32_t child, int32_t ppid, int32_t pgid, const void* task)
+{
+    // Child pid may come from user memory, anything but our own child must not add or drop entries
+    if (child <= 0 || ppid != parent) {
+        return PROTECT_INVALID;
+    }
+
+    const struct protect_entry* entry = protect_find_pid(set, parent);
+    if (!entry || !(entry->flags & PROTECT_FLAG_INHERIT)) {
+        // Exits of killed processes are never seen, so inherited entries may outlive their pid
+        const struct protect_entry* stale = protect_find_pid(set, child);
+        if (stale && (stale->flags & PROTECT_FLAG_INHERITED)) {
+            protect_remove(set, child);
+        }
+        return PROTECT_NOT_FOUND;
+    }
+
+    // Entry may move on protect_add, take what we need first
+    uint64_t sigmask = entry->sigmask;
+    uint32_t flags = entry->flags | PROTECT_FLAG_INHERITED;
+    return protect_add(set, child, pgid, sigmask, flags, task);
+}
+
+int protect_setpgid(struct protect_set* set, int32_t pid, int32_t pgid)
+{
+    uint16_t idx = (pid > 0 ? index_find(&set->by_pid, (uint32_t)pid) : PROTECT_NO_VALUE);
+    if (idx == PROTECT_NO_VALUE) {
+        return PROTECT_NOT_FOUND;
+    }
+
+    struct protect_entry* entry = &set->entries[idx];
+    if (entry->pgid == pgid) {
+        return PROTECT_OK;
+    }
+
+    // Old group may keep other members, its mask has to lose this entry's signals
+    group_unref(set, entry->pgid);
+    entry->pgid = pgid;
+    group_ref(set, pgid, entry->sigmask);
+    group_recalc_masks(set);
+    return PROTECT_OK;
+}
+
+int protect_exec(struct protect_set* set, int32_t pid, const void* task)
+{
+    uint16_t idx = (pid > 0 ? index_find(&set->by_pid, (uint32_t)pid) : PROTECT_NO_VALUE);
+    if (idx == PROTECT_NO_VALUE) {
+        return PROTECT_NOT_FOUND;
+    }
+
+    // Only task index changes, masks stay as they are
+    struct protect_entry* entry = &set->entries[idx];
+    if (entry->task != task) {
+        if (entry->task) {
+            index_remove(&set->by_task, (uintptr_t)entry->task);
+        }
+        entry->task = task;
+        if (task) {
+            index_set(&set->by_task, (uintptr_t)task, idx);
+        }
+    }
+
+    return PROTECT_OK;
+}
+
+int protect_exit(struct protect_set* set, int32_t pid)
+{
+    const struct protect_entry* entry = protect_find_pid(set, pid);
+    if (!entry || !(entry->flags & PROTECT_FLAG_INHERITED)) {
+        return PROTECT_NOT_FOUND;
+    }
+
+    return protect_remove(set, pid);
+}
+
+unsigned protect_sweep(struct protect_set* set, protect_alive_t alive, void* ctx)
+{
+    // Removal swaps the last entry in, walking backwards visits every entry once
+    unsigned dropped = 0;
+    for (uint32_t i = set->count; i-- > 0; ) {
+        const struct protect_entry* entry = &set->entries[i];
+        if ((entry->flags & PROTECT_FLAG_INHERITED) && !alive(entry, ctx)) {
+            protect_remove(set, entry->pid);
+            dropped++;
+        }
+    }
+
+    return dropped;
+}
+
+int protect_check_kill(const struct protect_set* set, int32_t pid, int signum, int32_t caller_pgid, protect_reach_t reach, void* ctx)
+{
+    // Signal 0 only checks for existence
+    if (signum <= 0 || signum >= 64) {
+        return 0;
+    }
+
+    uint64_t sigbit = PROTECT_SIGBIT(signum);
+    if (!(set->sigmask & sigbit)) {
+        return 0;
+    }
+
+    if (pid > 0) {
+        const struct protect_entry* entry = protect_find_pid(set, pid);
+        return (entry && (entry->sigmask & sigbit));
+    }
+
+    if (pid == -1) {
+        // Broadcast reaches every process the caller may signal, rare enough to walk the set
+        if (!reach) {
+            return 1;
+        }
+
+        for (uint32_t i = 0; i < set->count; ++i) {
+            const struct protect_entry* entry = &set->entries[i];
+            if ((entry->sigmask & sigbit) && reach(entry, ctx)) {
+                return 1;
+            }
+        }
+
+        return 0;
+    }
+
+    // kill(2) rejects INT32_MIN as a group, and negating it would overflow
+    if (pid == INT32_MIN) {
+        return 0;
+    }
+
+    int32_t pgid = (pid == 0 ? caller_pgid : -pid);
+    if (pgid <= 0) {
+        return 0;
+    }
+
+    uint16_t group = index_find(&set->by_pgid, (uint32_t)pgid);
+    return (group != PROTECT_NO_VALUE && (set->groups[group].sigmask & sigbit));
+}
+
+int protect_check_task_for_pid(const struct protect_set* set, int32_t caller, int32_t pid)
+{
+    if (!set->count || pid <= 0 || pid == caller) {
+        return 0;
+    }
+
+    return (protect_find_pid(set, pid) != NULL);
+}
+
+int protect_check_msg_id(const struct protect_set* set, int32_t msgh_id)
+{
+    // Enumeration replies carry every task in the set, no way to filter out only ours
+    return (set->count &&
+            (msgh_id == PROTECT_MIG_PROCESSOR_SET_TASKS || msgh_id == PROTECT_MIG_PROCESSOR_SET_THREADS));
+}
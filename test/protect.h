@@ -0,0 +1,163 @@
+//
+//  protect.h
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Set of protected processes with per-entry signal masks.
+//  Entries are indexed by pid, process group and task so that every hook decision is a single hashed probe.
+//  Does not depend on kernel headers, callers provide locking.
+//
+
+#ifndef protect_h
+#define protect_h
+
+#include <stdint.h>
+
+#define PROTECT_MAX_ENTRIES     256
+#define PROTECT_HASH_SIZE       512     /* power of 2, at least twice PROTECT_MAX_ENTRIES */
+
+// Signal mask bit for signal number (1..63)
+#define PROTECT_SIGBIT(sig)     (1ull << (sig))
+
+// MIG routine ids that hand out ports of arbitrary tasks, taken from osfmk/mach/processor_set.defs
+#define PROTECT_MIG_PROCESSOR_SET_TASKS     4005
+#define PROTECT_MIG_PROCESSOR_SET_THREADS   4006
+
+// Entry flags
+#define PROTECT_FLAG_INHERIT    0x1     /* children forked or spawned by the process are protected as well */
+#define PROTECT_FLAG_INHERITED  0x2     /* entry was added by protect_fork and is dropped on exit */
+#define PROTECT_FLAGS_USER      PROTECT_FLAG_INHERIT
+
+// Mach message filtering modes
+enum {
+    PROTECT_MSG_OFF = 0,    /* task ports are only guarded at task_for_pid */
+    PROTECT_MSG_NARROW,     /* also block task enumeration messages */
+    PROTECT_MSG_FULL,       /* also block any message sent to a protected task port */
+};
+
+// protect_* return codes
+enum {
+    PROTECT_OK = 0,
+    PROTECT_NOT_FOUND,
+    PROTECT_FULL,
+    PROTECT_INVALID,
+};
+
+struct protect_entry {
+    int32_t     pid;
+    int32_t     pgid;       /* current process group, kept up to date through protect_setpgid */
+    uint64_t    sigmask;    /* signals to block, see PROTECT_SIGBIT */
+    uint32_t    flags;
+    const void* task;       /* opaque task pointer for mach message filtering, may be NULL */
+};
+
+// Open addressing index of 64bit keys (0 is reserved for empty slots) to entry numbers
+struct protect_index {
+    uint64_t    keys[PROTECT_HASH_SIZE];
+    uint16_t    values[PROTECT_HASH_SIZE];
+};
+
+// Protected process group with a union of member signal masks
+struct protect_group {
+    int32_t     pgid;
+    uint32_t    refs;
+    uint64_t    sigmask;
+};
+
+struct protect_set {
+    struct protect_entry    entries[PROTECT_MAX_ENTRIES];
+    struct protect_group    groups[PROTECT_MAX_ENTRIES];
+    uint32_t                count;
+    uint32_t                ngroups;
+    uint64_t                sigmask;    /* union of all entry masks, for broadcast kills */
+    uint32_t                ninherit;   /* entries with PROTECT_FLAG_INHERIT, for unlocked peeks on fork */
+    uint32_t                ninherited; /* entries with PROTECT_FLAG_INHERITED, for unlocked peeks on exit */
+
+    struct protect_index    by_pid;
+    struct protect_index    by_pgid;
+    struct protect_index    by_task;
+};
+
+/**
+ * \brief   Reset set to empty state
+ */
+void protect_init(struct protect_set* set);
+
+/**
+ * \brief   Add pid to the set or update existing entry
+ */
+int protect_add(struct protect_set* set, int32_t pid, int32_t pgid, uint64_t sigmask, uint32_t flags, const void* task);
+
+/**
+ * \brief   Remove pid from the set
+ */
+int protect_remove(struct protect_set* set, int32_t pid);
+
+/**
+ * \brief   Find entry by pid, NULL if pid is not protected
+ */
+const struct protect_entry* protect_find_pid(const struct protect_set* set, int32_t pid);
+
+/**
+ * \brief   Find entry by task pointer, NULL if task is not protected
+ */
+const struct protect_entry* protect_find_task(const struct protect_set* set, const void* task);
+
+/**
+ * \brief   Process parent created child. Child is added with parent's mask and flags if parent has PROTECT_FLAG_INHERIT,
+ *          an inherited entry left behind by a previous owner of child pid is dropped otherwise.
+ *          ppid is the parent of child as the kernel knows it, a report with any other ppid leaves the set untouched.
+ *          Returns PROTECT_OK if child was added, PROTECT_NOT_FOUND if parent does not pass protection on,
+ *          PROTECT_INVALID if child is not a child of parent.
+ */
+int protect_fork(struct protect_set* set, int32_t parent, int32_t child, int32_t ppid, int32_t pgid, const void* task);
+
+/**
+ * \brief   Process pid moved to process group pgid. Returns PROTECT_NOT_FOUND if pid is not protected.
+ */
+int protect_setpgid(struct protect_set* set, int32_t pid, int32_t pgid);
+
+/**
+ * \brief   Process pid replaced its image and may have a new task. Returns PROTECT_NOT_FOUND if pid is not protected.
+ */
+int protect_exec(struct protect_set* set, int32_t pid, const void* task);
+
+/**
+ * \brief   Process pid exited. Inherited entries are dropped, explicit ones are left to their owner.
+ *          Returns PROTECT_NOT_FOUND if there was no inherited entry.
+ */
+int protect_exit(struct protect_set* set, int32_t pid);
+
+// Tells protect_sweep whether the process behind an entry still exists
+typedef int (*protect_alive_t)(const struct protect_entry* entry, void* ctx);
+
+/**
+ * \brief   Drop inherited entries of processes that are gone without an exit we saw. Returns number of dropped entries.
+ */
+unsigned protect_sweep(struct protect_set* set, protect_alive_t alive, void* ctx);
+
+// Tells protect_check_kill whether a broadcast kill reaches the process behind an entry, see kill(2) permission rules
+typedef int (*protect_reach_t)(const struct protect_entry* entry, void* ctx);
+
+/**
+ * \brief   Decide on kill(2) with given pid argument.
+ *          Handles single process (pid > 0), caller's group (0), broadcast (-1) and process group (< -1) targets.
+ *          Broadcast is blocked if reach accepts any entry whose mask has the signal, NULL reach accepts them all.
+ *          Returns nonzero if signal has to be blocked.
+ */
+int protect_check_kill(const struct protect_set* set, int32_t pid, int signum, int32_t caller_pgid, protect_reach_t reach, void* ctx);
+
+/**
+ * \brief   Decide on task_for_pid for target pid. Processes may always get their own task port.
+ *          Returns nonzero if task port has to be withheld.
+ */
+int protect_check_task_for_pid(const struct protect_set* set, int32_t caller, int32_t pid);
+
+/**
+ * \brief   Decide on mach message with given id by its id alone.
+ *          Returns nonzero if message would hand out ports of protected tasks.
+ */
+int protect_check_msg_id(const struct protect_set* set, int32_t msgh_id);
+
+#endif /* protect_h */
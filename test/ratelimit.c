@@ -0,0 +1,157 @@
+//
+//  ratelimit.c
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+
+#include <string.h>
+
+#include "ratelimit.h"
+
+#define BUCKET_TOKENS(b)        ((uint32_t)((b) & 0xffff))
+#define BUCKET_TIME(b)          ((b) >> 16)
+#define BUCKET(time, tokens)    (((time) << 16) | (tokens))
+
+void ratelimit_init(struct ratelimit* rl, uint32_t rate, uint32_t burst)
+{
+    memset(rl, 0, sizeof(*rl));
+    rl->rate = rate;
+    rl->burst = (burst > 0xffff ? 0xffff : burst);
+}
+
+// Bucket refilled up to now
+static inline uint64_t bucket_refill(const struct ratelimit* rl, uint64_t bucket, uint64_t now_ms)
+{
+    uint64_t last = BUCKET_TIME(bucket);
+    uint32_t tokens = BUCKET_TOKENS(bucket);
+    if (now_ms <= last || tokens >= rl->burst) {
+        return BUCKET(now_ms > last ? now_ms : last, tokens);
+    }
+    
+    uint64_t add = (now_ms - last) * rl->rate / 1000;
+    if (add == 0) {
+        return bucket;      // keep accumulating time towards the next token
+    }
+    
+    uint64_t total = tokens + add;
+    return BUCKET(now_ms, (uint32_t)(total > rl->burst ? rl->burst : total));
+}
+
+// Find caller's slot, or claim a free or idle one if create is set
+static struct ratelimit_slot* ratelimit_slot(struct ratelimit* rl, int32_t pid, uint64_t now_ms, int create)
+{
+    if (pid <= 0) {
+        return NULL;
+    }
+    
+    uint32_t hash = (uint32_t)(((uint64_t)(uint32_t)pid * 0x9e3779b97f4a7c15ull) >> 32);
+    struct ratelimit_slot* idle = NULL;
+    
+    for (unsigned i = 0; i < RATELIMIT_PROBES; ++i) {
+        struct ratelimit_slot* slot = &rl->slots[(hash + i) & (RATELIMIT_SLOTS - 1)];
+        int32_t owner = __atomic_load_n(&slot->pid, __ATOMIC_ACQUIRE);
+        if (owner == pid) {
+            return slot;
+        }
+        
+        if (!create) {
+            continue;
+        }
+        
+        if (owner == 0) {
+            int32_t expected = 0;
+            if (__atomic_compare_exchange_n(&slot->pid, &expected, pid, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                return slot;
+            }
+            if (expected == pid) {
+                return slot;
+            }
+        } else if (!idle) {
+            // Caller with a full bucket and nothing to report has been quiet long enough to forget
+            uint64_t bucket = bucket_refill(rl, __atomic_load_n(&slot->bucket, __ATOMIC_RELAXED), now_ms);
+            if (BUCKET_TOKENS(bucket) >= rl->burst && !__atomic_load_n(&slot->suppressed, __ATOMIC_RELAXED)) {
+                idle = slot;
+            }
+        }
+    }
+    
+    if (idle) {
+        int32_t owner = __atomic_load_n(&idle->pid, __ATOMIC_RELAXED);
+        if (owner != pid && __atomic_compare_exchange_n(&idle->pid, &owner, pid, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&idle->bucket, BUCKET(now_ms, rl->burst), __ATOMIC_RELAXED);
+            __atomic_store_n(&idle->verdict, 0, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&rl->evictions, 1, __ATOMIC_RELAXED);
+            return idle;
+        }
+    }
+    
+    return NULL;
+}
+
+// Take a token if there is one
+static int ratelimit_take(struct ratelimit* rl, struct ratelimit_slot* slot, uint64_t now_ms)
+{
+    uint64_t bucket = __atomic_load_n(&slot->bucket, __ATOMIC_RELAXED);
+    for (;;) {
+        uint64_t refilled = bucket_refill(rl, bucket, now_ms);
+        uint32_t tokens = BUCKET_TOKENS(refilled);
+        uint64_t next = (tokens ? refilled - 1 : refilled);
+        
+        if (next == bucket ||
+            __atomic_compare_exchange_n(&slot->bucket, &bucket, next, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return (tokens != 0);
+        }
+    }
+}
+
+int ratelimit_cached_deny(struct ratelimit* rl, int32_t pid, uint64_t verdict, uint64_t now_ms)
+{
+    struct ratelimit_slot* slot = ratelimit_slot(rl, pid, now_ms, 0);
+    if (!slot || __atomic_load_n(&slot->verdict, __ATOMIC_RELAXED) != verdict) {
+        return 0;
+    }
+    
+    // Peek only, tokens are taken by denials
+    uint64_t bucket = bucket_refill(rl, __atomic_load_n(&slot->bucket, __ATOMIC_RELAXED), now_ms);
+    if (BUCKET_TOKENS(bucket)) {
+        return 0;
+    }
+    
+    __atomic_fetch_add(&slot->suppressed, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&rl->cached, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+int ratelimit_deny(struct ratelimit* rl, int32_t pid, uint64_t verdict, uint64_t now_ms)
+{
+    struct ratelimit_slot* slot = ratelimit_slot(rl, pid, now_ms, 1);
+    if (slot) {
+        __atomic_store_n(&slot->verdict, verdict, __ATOMIC_RELAXED);
+    } else {
+        slot = &rl->overflow;
+    }
+    
+    if (ratelimit_take(rl, slot, now_ms)) {
+        return 1;
+    }
+    
+    __atomic_fetch_add(&slot->suppressed, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void ratelimit_flush(struct ratelimit* rl, ratelimit_flush_t flush, void* ctx)
+{
+    for (unsigned i = 0; i <= RATELIMIT_SLOTS; ++i) {
+        struct ratelimit_slot* slot = (i < RATELIMIT_SLOTS ? &rl->slots[i] : &rl->overflow);
+        if (!__atomic_load_n(&slot->suppressed, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        
+        int32_t pid = __atomic_load_n(&slot->pid, __ATOMIC_ACQUIRE);
+        uint32_t suppressed = __atomic_exchange_n(&slot->suppressed, 0, __ATOMIC_ACQ_REL);
+        if (suppressed) {
+            flush(pid, suppressed, ctx);
+        }
+    }
+}
@@ -0,0 +1,73 @@
+//
+//  ratelimit.h
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Per-caller token buckets for denied operations.
+//  Every denial takes a token. A caller out of tokens gets its audit records collapsed into a
+//  suppressed count, and a repeat of its last denied request is denied from cache without a full check.
+//  Fixed-size lock-free table, callers that don't fit share a single overflow bucket reported as pid 0.
+//  Does not depend on kernel headers.
+//
+
+#ifndef ratelimit_h
+#define ratelimit_h
+
+#include <stdint.h>
+
+#define RATELIMIT_SLOTS     64      /* power of 2 */
+#define RATELIMIT_PROBES    4       /* slots checked per caller */
+
+struct ratelimit_slot {
+    int32_t  pid;           /* 0 if slot is free */
+    uint32_t suppressed;    /* denials not audited yet */
+    uint64_t bucket;        /* last refill time in ms << 16 | tokens */
+    uint64_t verdict;       /* last denied request, see ratelimit_verdict */
+    uint64_t reserved;
+};
+
+struct ratelimit {
+    struct ratelimit_slot slots[RATELIMIT_SLOTS];
+    struct ratelimit_slot overflow;
+    uint32_t rate;          /* tokens added per second */
+    uint32_t burst;         /* bucket size, at most 0xffff */
+    uint64_t cached;        /* denials served from cache */
+    uint64_t evictions;     /* idle callers replaced */
+};
+
+// Called by ratelimit_flush for every caller with suppressed denials, pid is 0 for overflow bucket
+typedef void (*ratelimit_flush_t)(int32_t pid, uint32_t suppressed, void* ctx);
+
+/**
+ * \brief   Key of a denied request. Generation has to change whenever decisions might have.
+ */
+static inline uint64_t ratelimit_verdict(int32_t target, uint16_t event, int32_t arg, uint32_t generation)
+{
+    return ((uint64_t)(uint32_t)target << 32) | ((uint64_t)(event & 0xf) << 28) |
+           ((uint64_t)(arg & 0xff) << 20) | (generation & 0xfffff);
+}
+
+/**
+ * \brief   Initialize empty table
+ */
+void ratelimit_init(struct ratelimit* rl, uint32_t rate, uint32_t burst);
+
+/**
+ * \brief   Fast path before a full check. Returns nonzero if caller is out of tokens and verdict repeats
+ *          its last denial, in which case the request is denied and counted as suppressed.
+ */
+int ratelimit_cached_deny(struct ratelimit* rl, int32_t pid, uint64_t verdict, uint64_t now_ms);
+
+/**
+ * \brief   Account a denial made by a full check. Returns nonzero if it should be audited,
+ *          zero if caller is out of tokens and it was counted as suppressed instead.
+ */
+int ratelimit_deny(struct ratelimit* rl, int32_t pid, uint64_t verdict, uint64_t now_ms);
+
+/**
+ * \brief   Report and reset suppressed counts. Safe to run concurrently with the other calls.
+ */
+void ratelimit_flush(struct ratelimit* rl, ratelimit_flush_t flush, void* ctx);
+
+#endif /* ratelimit_h */
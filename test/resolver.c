@@ -18,6 +18,9 @@
 #include <libkern/OSMalloc.h>
 
 #include "test.h"
+#include "macho.h"
+#include "resolver.h"
+#include "symindex.h"
 
 //
 // Original KernelResolver code by snare:
@@ -29,165 +32,22 @@
 // Modified to parse static kernel images
 //
 
-/* Borrowed from kernel source. It doesn't exist in Kernel.framework. */
-struct nlist_64 {
-    union {
-        uint32_t  n_strx;   /* index into the string table */
-    } n_un;
-    uint8_t n_type;         /* type flag, see below */
-    uint8_t n_sect;         /* section number or NO_SECT */
-    uint16_t n_desc;        /* see <mach-o/stab.h> */
-    uint64_t n_value;       /* value of this symbol (or stab offset) */
-};
+static struct resolver_stats g_stats;     // Accumulated over all lookups
 
-struct segment_command_64* find_segment_64(const struct mach_header_64* mh, const char* segname)
+void resolver_get_stats(struct resolver_stats* stats)
 {
-    if (!mh) {
-        return NULL;
-    }
-    
-    if (mh->magic != MH_MAGIC_64) {
-        return NULL;
-    }
-    
-    if (!segname) {
-        return NULL;
-    }
-    
-    struct load_command *lc;
-    struct segment_command_64 *seg, *foundseg = NULL;
-    
-    /* First LC begins straight after the mach header */
-    lc = (struct load_command *)((uint64_t)mh + sizeof(struct mach_header_64));
-    while ((uint64_t)lc < (uint64_t)mh + (uint64_t)mh->sizeofcmds) {
-        if (lc->cmd == LC_SEGMENT_64) {
-            /* Check load command's segment name */
-            seg = (struct segment_command_64 *)lc;
-            if (strcmp(seg->segname, segname) == 0) {
-                foundseg = seg;
-                break;
-            }
-        }
-        
-        /* Next LC */
-        lc = (struct load_command *)((uint64_t)lc + (uint64_t)lc->cmdsize);
-    }
-    
-    /* Return the segment (NULL if we didn't find it) */
-    return foundseg;
+    *stats = g_stats;
 }
 
-struct section_64* find_section_64(struct segment_command_64 *seg, const char *name)
-{
-    struct section_64 *sect, *foundsect = NULL;
-    u_int i = 0;
-    
-    /* First section begins straight after the segment header */
-    for (i = 0, sect = (struct section_64 *)((uint64_t)seg + (uint64_t)sizeof(struct segment_command_64));
-         i < seg->nsects;
-         i++, sect = (struct section_64 *)((uint64_t)sect + sizeof(struct section_64)))
-    {
-        /* Check section name */
-        if (strcmp(sect->sectname, name) == 0) {
-            foundsect = sect;
-            break;
-        }
-    }
-    
-    /* Return the section (NULL if we didn't find it) */
-    return foundsect;
-}
-
-struct load_command *
-find_load_command(struct mach_header_64 *mh, uint32_t cmd)
-{
-    struct load_command *lc, *foundlc;
-    
-    /* First LC begins straight after the mach header */
-    lc = (struct load_command *)((uint64_t)mh + sizeof(struct mach_header_64));
-    while ((uint64_t)lc < (uint64_t)mh + (uint64_t)mh->sizeofcmds) {
-        if (lc->cmd == cmd) {
-            foundlc = (struct load_command *)lc;
-            break;
-        }
-        
-        /* Next LC */
-        lc = (struct load_command *)((uint64_t)lc + (uint64_t)lc->cmdsize);
-    }
-    
-    /* Return the load command (NULL if we didn't find it) */
-    return foundlc;
-}
-
-void *find_symbol(struct mach_header_64 *mh, const char *name, uint64_t loaded_base)
-{
-    /*
-     * Check header
-     */
-    if (mh->magic != MH_MAGIC_64) {
-        printf("magic number doesn't match - 0x%x\n", mh->magic);
-        return NULL;
-    }
-    
-    /*
-     * Find __TEXT - we need it for fixed kernel base
-     */
-    struct segment_command_64 *seg_text = find_segment_64(mh, SEG_TEXT);
-    if (!seg_text) {
-        printf("couldn't find __TEXT\n");
-        return NULL;
-    }
-    
-    uint64_t fixed_base = seg_text->vmaddr;
-    
-    /*
-     * Find the LINKEDIT and SYMTAB sections
-     */
-    struct segment_command_64 *seg_linkedit = find_segment_64(mh, SEG_LINKEDIT);
-    if (!seg_linkedit) {
-        printf("couldn't find __LINKEDIT\n");
-        return NULL;
-    }
-    
-    struct symtab_command *lc_symtab = (struct symtab_command *)find_load_command(mh, LC_SYMTAB);
-    if (!lc_symtab) {
-        printf("couldn't find SYMTAB\n");
-        return NULL;
-    }
-   
-    /*
-     * Enumerate symbols until we find the one we're after
-     */
-    uintptr_t base = (uintptr_t)mh;
-    void* strtab = (void*)(base + lc_symtab->stroff);
-    void* symtab = (void*)(base + lc_symtab->symoff);
-    
-    //printf("Symbol table offset 0x%x (%p)\n", lc_symtab->symoff, symtab);
-    //printf("String table offset 0x%x (%p)\n", lc_symtab->stroff, strtab);
-    
-    struct nlist_64* nl = (struct nlist_64 *)(symtab);
-    for (uint64_t i = 0; i < lc_symtab->nsyms; i++, nl = (struct nlist_64 *)((uint64_t)nl + sizeof(struct nlist_64)))
-    {
-        const char* str = (const char *)strtab + nl->n_un.n_strx;
-        if (strcmp(str, name) == 0) {
-            /* Return relocated address */
-            return (void*) (nl->n_value - fixed_base + loaded_base);
-        }
-    }
-    
-    /* Return the address (NULL if we didn't find it) */
-    return NULL;
-}
+// Kernel image kept in memory between resolver_open and resolver_close
+static char* g_image = NULL;
+static uint32_t g_image_size = 0;
 
-void* resolve_kernel_symbol(const char* name, uintptr_t loaded_kernel_base)
+// Read whole kernel file into memory. Returns NULL on failure.
+static char* read_kernel_image(uint32_t* size)
 {
-    void* addr = NULL;
     errno_t err = 0;
     
-    if (!name) {
-        return NULL;
-    }
-    
     const char* image_path = "/mach_kernel";
     if (version_major >= 14) {
         image_path = "/System/Library/Kernels/kernel"; // Since yosemite mach_kernel is moved
@@ -200,6 +60,7 @@ void* resolve_kernel_symbol(const char* name, uintptr_t loaded_kernel_base)
     }
     
     char* data = NULL;
+    uint32_t data_size = 0;
     uio_t uio = NULL;
     vnode_t vnode = NULL;
     err = vnode_lookup(image_path, 0, &vnode, context);
@@ -208,7 +69,6 @@ void* resolve_kernel_symbol(const char* name, uintptr_t loaded_kernel_base)
         goto done;
     }
     
-    // Read whole kernel file into memory.
     // It is not very efficient but it is the easiest way to adapt existing parsing code
     // For production builds we need to use less memory
     
@@ -219,7 +79,7 @@ void* resolve_kernel_symbol(const char* name, uintptr_t loaded_kernel_base)
         goto done;
     }
     
-    uint32_t data_size = (uint32_t)attr.va_data_size;
+    data_size = (uint32_t)attr.va_data_size;
     data = OSMalloc(data_size, g_tag);
     if (!data) {
         printf("Could not allocate kernel buffer\n");
@@ -229,6 +89,7 @@ void* resolve_kernel_symbol(const char* name, uintptr_t loaded_kernel_base)
     uio = uio_create(1, 0, UIO_SYSSPACE, UIO_READ);
     if (!uio) {
         printf("uio_create failed: %d\n", err);
+        err = ENOMEM;
         goto done;
     }
     
@@ -239,19 +100,119 @@ void* resolve_kernel_symbol(const char* name, uintptr_t loaded_kernel_base)
     }
     
     err = VNOP_READ(vnode, uio, 0, context);
+    g_stats.bytes_read += data_size - (uint64_t)uio_resid(uio);
     if (err) {
         printf("VNOP_READ failed: %d\n", err);
         goto done;
     }
     
-    addr = find_symbol((struct mach_header_64*)data, name, loaded_kernel_base);
-    
+    if (!macho_image_valid((struct mach_header_64*)data, data_size)) {
+        printf("%s is not a valid kernel image\n", image_path);
+        err = EINVAL;
+        goto done;
+    }
     
 done:
+    if (err && data) {
+        OSFree(data, data_size, g_tag);
+        data = NULL;
+    }
+    
     uio_free(uio);
-    OSFree(data, data_size, g_tag);
     vnode_put(vnode);
     vfs_context_rele(context);
     
+    *size = data_size;
+    return data;
+}
+
+int resolver_open(void)
+{
+    if (!g_image) {
+        g_image = read_kernel_image(&g_image_size);
+    }
+    
+    return (g_image != NULL);
+}
+
+void resolver_close(void)
+{
+    if (g_image) {
+        OSFree(g_image, g_image_size, g_tag);
+        g_image = NULL;
+        g_image_size = 0;
+    }
+}
+
+void* resolve_kernel_symbol(const char* name, uintptr_t loaded_kernel_base)
+{
+    if (!name) {
+        return NULL;
+    }
+    
+    g_stats.lookups++;
+    
+    if (g_image) {
+        return find_symbol((struct mach_header_64*)g_image, name, loaded_kernel_base);
+    }
+    
+    uint32_t data_size = 0;
+    char* data = read_kernel_image(&data_size);
+    if (!data) {
+        return NULL;
+    }
+    
+    void* addr = find_symbol((struct mach_header_64*)data, name, loaded_kernel_base);
+    OSFree(data, data_size, g_tag);
     return addr;
 }
+
+// Entries and names share one allocation
+static size_t symindex_storage_size(uint32_t count, uint32_t names_size)
+{
+    return (size_t)count * sizeof(struct symindex_entry) + names_size;
+}
+
+int resolver_build_symindex(struct symindex* index, uintptr_t loaded_kernel_base)
+{
+    memset(index, 0, sizeof(*index));
+    if (!g_image) {
+        return 0;
+    }
+    
+    uint32_t count = 0;
+    uint32_t names_size = 0;
+    const struct mach_header_64* mh = (const struct mach_header_64*)g_image;
+    if (!symindex_measure(mh, &count, &names_size)) {
+        return 0;
+    }
+    
+    size_t size = symindex_storage_size(count, names_size);
+    if (size > UINT32_MAX) {
+        return 0;
+    }
+    
+    uint8_t* storage = OSMalloc((uint32_t)size, g_tag);
+    if (!storage) {
+        return 0;
+    }
+    
+    struct symindex_entry* entries = (struct symindex_entry*)storage;
+    char* names = (char*)(storage + (size_t)count * sizeof(struct symindex_entry));
+    if (!symindex_build(index, mh, loaded_kernel_base, entries, count, names, names_size)) {
+        OSFree(storage, (uint32_t)size, g_tag);
+        memset(index, 0, sizeof(*index));
+        return 0;
+    }
+    
+    return 1;
+}
+
+void resolver_free_symindex(struct symindex* index)
+{
+    if (index->entries) {
+        OSFree((void*)index->entries, (uint32_t)symindex_storage_size(index->count, index->names_size), g_tag);
+    }
+    
+    memset(index, 0, sizeof(*index));
+}
@@ -11,14 +11,44 @@
 #ifndef resolver_h
 #define resolver_h
 
+#include "macho.h"
+#include "symindex.h"
+
+/**
+ * \brief   Read kernel image from disk once and keep it for following calls. Returns 0 on failure.
+ *          Without it every resolve_kernel_symbol call reads the whole image.
+ */
+int resolver_open(void);
+
 /**
- * \brief   Find kernel segment with name
+ * \brief   Release image read by resolver_open
  */
-struct segment_command_64* find_segment_64(const struct mach_header_64* mh, const char* segname);
+void resolver_close(void);
 
 /**
  * \brief   Resolve private kernel symbol for loaded kernel image
  */
 void* resolve_kernel_symbol(const char* name, uintptr_t loaded_kernel_base);
 
+struct resolver_stats {
+    uint64_t lookups;       /* resolve_kernel_symbol calls */
+    uint64_t bytes_read;    /* kernel image bytes read */
+};
+
+/**
+ * \brief   Get totals of all resolve_kernel_symbol calls
+ */
+void resolver_get_stats(struct resolver_stats* stats);
+
+/**
+ * \brief   Build address index over __TEXT symbols of image read by resolver_open. Returns 0 on failure.
+ *          Index does not reference the image and outlives resolver_close.
+ */
+int resolver_build_symindex(struct symindex* index, uintptr_t loaded_kernel_base);
+
+/**
+ * \brief   Release index built by resolver_build_symindex
+ */
+void resolver_free_symindex(struct symindex* index);
+
 #endif /* resolver_h */
@@ -0,0 +1,83 @@
+//
+//  startprof.c
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+
+#include <string.h>
+
+#include "startprof.h"
+
+void startprof_start(struct startprof_run* run, uint64_t wall_time, uint64_t now_ns)
+{
+    memset(run, 0, sizeof(*run));
+    run->profile.time = wall_time;
+    run->begin_ns = now_ns;
+    run->phase = STARTPROF_PHASE_COUNT;
+}
+
+void startprof_enter(struct startprof_run* run, unsigned phase, uint64_t now_ns)
+{
+    if (phase >= STARTPROF_PHASE_COUNT) {
+        return;
+    }
+    
+    run->phase = phase;
+    run->phase_ns = now_ns;
+}
+
+void startprof_leave(struct startprof_run* run, uint64_t now_ns, uint64_t bytes, uint64_t probes)
+{
+    if (run->phase >= STARTPROF_PHASE_COUNT) {
+        return;
+    }
+    
+    struct startprof_phase* phase = &run->profile.phases[run->phase];
+    phase->ns += now_ns - run->phase_ns;
+    phase->bytes += bytes;
+    phase->probes += probes;
+    
+    run->profile.completed |= (1u << run->phase);
+    run->phase = STARTPROF_PHASE_COUNT;
+}
+
+void startprof_finish(struct startprof_run* run, uint64_t now_ns, int32_t result)
+{
+    run->profile.total_ns = now_ns - run->begin_ns;
+    run->profile.result = result;
+}
+
+void startprof_history_init(struct startprof_history* history)
+{
+    memset(history, 0, sizeof(*history));
+    history->version = STARTPROF_VERSION;
+    history->size = sizeof(*history);
+}
+
+int startprof_history_valid(const struct startprof_history* history, size_t size)
+{
+    return (size == sizeof(*history) &&
+            history->version == STARTPROF_VERSION &&
+            history->size == sizeof(*history) &&
+            history->count <= STARTPROF_HISTORY &&
+            history->next < STARTPROF_HISTORY);
+}
+
+void startprof_history_push(struct startprof_history* history, const struct startprof_profile* profile)
+{
+    history->profiles[history->next] = *profile;
+    history->next = (history->next + 1) % STARTPROF_HISTORY;
+    if (history->count < STARTPROF_HISTORY) {
+        history->count++;
+    }
+}
+
+const struct startprof_profile* startprof_history_get(const struct startprof_history* history, unsigned age)
+{
+    if (age >= history->count) {
+        return NULL;
+    }
+    
+    return &history->profiles[(history->next + STARTPROF_HISTORY - 1 - age) % STARTPROF_HISTORY];
+}
@@ -0,0 +1,102 @@
+//
+//  startprof.h
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Phase timer for kext start-up and a ring of the last start-up profiles.
+//  Callers supply timestamps in nanoseconds so that the kext and userspace harness share the code.
+//  Does not depend on kernel headers.
+//
+
+#ifndef startprof_h
+#define startprof_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STARTPROF_VERSION   1
+#define STARTPROF_HISTORY   8       /* profiles kept */
+
+// Start-up phases in order of execution
+enum {
+    STARTPROF_KERNEL_BASE = 0,      /* probes are pages checked for mach header */
+    STARTPROF_RESOLVE,              /* bytes are read from kernel image file, probes are symbols resolved */
+    STARTPROF_DATA_SEGMENT,         /* probes are load commands in kernel header */
+    STARTPROF_TABLE_SCAN,           /* bytes are data segment bytes scanned, probes are table matcher calls */
+    STARTPROF_HOOK_INSTALL,         /* probes are hooks installed */
+    STARTPROF_PHASE_COUNT
+};
+
+struct startprof_phase {
+    uint64_t ns;
+    uint64_t bytes;
+    uint64_t probes;
+};
+
+struct startprof_profile {
+    uint64_t time;          /* wall clock seconds when start-up began */
+    uint64_t total_ns;      /* whole start-up including untimed steps */
+    int32_t  result;        /* start-up return code */
+    uint32_t completed;     /* bit N is set if phase N completed */
+    struct startprof_phase phases[STARTPROF_PHASE_COUNT];
+};
+
+// Ring of profiles, also the on-disk format and 'debug.killhook.startprof' output
+struct startprof_history {
+    uint32_t version;
+    uint32_t size;          /* sizeof(struct startprof_history) */
+    uint32_t count;         /* valid profiles */
+    uint32_t next;          /* slot for the next profile */
+    struct startprof_profile profiles[STARTPROF_HISTORY];
+};
+
+// Profile being recorded
+struct startprof_run {
+    struct startprof_profile profile;
+    uint64_t begin_ns;
+    uint64_t phase_ns;
+    unsigned phase;
+};
+
+/**
+ * \brief   Begin recording a start-up profile
+ */
+void startprof_start(struct startprof_run* run, uint64_t wall_time, uint64_t now_ns);
+
+/**
+ * \brief   Enter phase
+ */
+void startprof_enter(struct startprof_run* run, unsigned phase, uint64_t now_ns);
+
+/**
+ * \brief   Leave current phase and account its work
+ */
+void startprof_leave(struct startprof_run* run, uint64_t now_ns, uint64_t bytes, uint64_t probes);
+
+/**
+ * \brief   Finish recording with start-up result
+ */
+void startprof_finish(struct startprof_run* run, uint64_t now_ns, int32_t result);
+
+/**
+ * \brief   Reset history to empty state
+ */
+void startprof_history_init(struct startprof_history* history);
+
+/**
+ * \brief   Check that history of given size, e.g. loaded from disk, can be used
+ */
+int startprof_history_valid(const struct startprof_history* history, size_t size);
+
+/**
+ * \brief   Add profile, dropping the oldest one if history is full
+ */
+void startprof_history_push(struct startprof_history* history, const struct startprof_profile* profile);
+
+/**
+ * \brief   Profile by age, 0 is the newest. NULL if there are not that many.
+ */
+const struct startprof_profile* startprof_history_get(const struct startprof_history* history, unsigned age);
+
+#endif /* startprof_h */
@@ -0,0 +1,200 @@
+//
+//  symindex.c
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+
+#if defined(KERNEL)
+#   include <sys/systm.h>
+#   include <libkern/libkern.h>
+#else
+#   include <stdio.h>
+#   include <string.h>
+#endif
+
+#include "symindex.h"
+
+// Symbol defined in a section of __TEXT
+static inline int symindex_wanted(const struct nlist_64* nl, uint32_t strsize, const struct segment_command_64* text)
+{
+    return !(nl->n_type & MACHO_N_STAB) &&
+           (nl->n_type & MACHO_N_TYPE) == MACHO_N_SECT &&
+           nl->n_un.n_strx != 0 && nl->n_un.n_strx < strsize &&
+           nl->n_value >= text->vmaddr && nl->n_value - text->vmaddr < text->vmsize;
+}
+
+int symindex_measure(const struct mach_header_64* mh, uint32_t* count, uint32_t* names_size)
+{
+    const struct segment_command_64* text = find_segment_64(mh, SEG_TEXT);
+    const struct symtab_command* lc_symtab = (const struct symtab_command *)find_load_command((struct mach_header_64 *)mh, LC_SYMTAB);
+    if (!text || !lc_symtab) {
+        return 0;
+    }
+    
+    const char* strtab = (const char*)((uintptr_t)mh + lc_symtab->stroff);
+    const struct nlist_64* nl = (const struct nlist_64 *)((uintptr_t)mh + lc_symtab->symoff);
+    
+    uint32_t n = 0;
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < lc_symtab->nsyms; i++, nl++) {
+        if (!symindex_wanted(nl, lc_symtab->strsize, text)) {
+            continue;
+        }
+        
+        n++;
+        bytes += strnlen(strtab + nl->n_un.n_strx, lc_symtab->strsize - nl->n_un.n_strx) + 1;
+    }
+    
+    if (n == 0 || bytes > UINT32_MAX) {
+        return 0;
+    }
+    
+    *count = n;
+    *names_size = (uint32_t)bytes;
+    return 1;
+}
+
+// Heap sort by address, no allocations and no libc dependency
+static void symindex_sift(struct symindex_entry* entries, uint32_t root, uint32_t count)
+{
+    for (;;) {
+        uint32_t child = root * 2 + 1;
+        if (child >= count) {
+            return;
+        }
+        
+        if (child + 1 < count && entries[child + 1].addr > entries[child].addr) {
+            child++;
+        }
+        
+        if (entries[root].addr >= entries[child].addr) {
+            return;
+        }
+        
+        struct symindex_entry tmp = entries[root];
+        entries[root] = entries[child];
+        entries[child] = tmp;
+        root = child;
+    }
+}
+
+static void symindex_sort(struct symindex_entry* entries, uint32_t count)
+{
+    for (uint32_t i = count / 2; i-- > 0; ) {
+        symindex_sift(entries, i, count);
+    }
+    
+    for (uint32_t end = count; end-- > 1; ) {
+        struct symindex_entry tmp = entries[0];
+        entries[0] = entries[end];
+        entries[end] = tmp;
+        symindex_sift(entries, 0, end);
+    }
+}
+
+int symindex_build(struct symindex* index, const struct mach_header_64* mh, uint64_t loaded_base,
+                   struct symindex_entry* entries, uint32_t count, char* names, uint32_t names_size)
+{
+    memset(index, 0, sizeof(*index));
+    
+    const struct segment_command_64* text = find_segment_64(mh, SEG_TEXT);
+    const struct symtab_command* lc_symtab = (const struct symtab_command *)find_load_command((struct mach_header_64 *)mh, LC_SYMTAB);
+    if (!text || !lc_symtab) {
+        return 0;
+    }
+    
+    const char* strtab = (const char*)((uintptr_t)mh + lc_symtab->stroff);
+    const struct nlist_64* nl = (const struct nlist_64 *)((uintptr_t)mh + lc_symtab->symoff);
+    
+    uint32_t n = 0;
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < lc_symtab->nsyms; i++, nl++) {
+        if (!symindex_wanted(nl, lc_symtab->strsize, text)) {
+            continue;
+        }
+        
+        const char* name = strtab + nl->n_un.n_strx;
+        size_t len = strnlen(name, lc_symtab->strsize - nl->n_un.n_strx);
+        if (n == count || len + 1 > names_size - used) {
+            return 0;
+        }
+        
+        memcpy(names + used, name, len);
+        names[used + len] = '\0';
+        
+        entries[n].addr = nl->n_value;
+        entries[n].name = used;
+        entries[n].reserved = 0;
+        n++;
+        used += (uint32_t)len + 1;
+    }
+    
+    // Sizes have to be exact, caller frees storage by them
+    if (n != count || used != names_size) {
+        return 0;
+    }
+    
+    symindex_sort(entries, n);
+    
+    index->entries = entries;
+    index->count = n;
+    index->names = names;
+    index->names_size = used;
+    index->slide = loaded_base - text->vmaddr;
+    index->text_start = loaded_base;
+    index->text_end = loaded_base + text->vmsize;
+    return 1;
+}
+
+int symindex_lookup(const struct symindex* index, uint64_t addr, const char** name, uint64_t* offset)
+{
+    if (!symindex_contains(index, addr)) {
+        return SYMINDEX_OUTSIDE;
+    }
+    
+    // Last entry at or below unslid address
+    uint64_t unslid = addr - index->slide;
+    uint32_t lo = 0;
+    uint32_t hi = index->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (index->entries[mid].addr <= unslid) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    
+    if (lo == 0) {
+        *name = NULL;
+        *offset = addr - index->text_start;
+        return SYMINDEX_UNNAMED;
+    }
+    
+    const struct symindex_entry* entry = &index->entries[lo - 1];
+    *name = index->names + entry->name;
+    *offset = unslid - entry->addr;
+    return SYMINDEX_FOUND;
+}
+
+void symindex_format(const struct symindex* index, uint64_t addr, char* buf, size_t size)
+{
+    const char* name = NULL;
+    uint64_t offset = 0;
+    switch (symindex_lookup(index, addr, &name, &offset)) {
+        case SYMINDEX_FOUND:
+            if (offset) {
+                snprintf(buf, size, "%s+0x%llx", name, (unsigned long long)offset);
+            } else {
+                snprintf(buf, size, "%s", name);
+            }
+            break;
+        case SYMINDEX_UNNAMED:
+            snprintf(buf, size, "__TEXT+0x%llx", (unsigned long long)offset);
+            break;
+        default:
+            snprintf(buf, size, "outside kernel image");
+            break;
+    }
+}
@@ -0,0 +1,72 @@
+//
+//  symindex.h
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Address to symbol index over __TEXT symbols of a kernel image.
+//  Does not depend on kernel headers, storage is provided by the caller.
+//
+
+#ifndef symindex_h
+#define symindex_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "macho.h"
+
+struct symindex_entry {
+    uint64_t    addr;       /* unslid symbol address */
+    uint32_t    name;       /* offset into names */
+    uint32_t    reserved;
+};
+
+struct symindex {
+    const struct symindex_entry* entries;  /* sorted by address */
+    uint32_t    count;
+    const char* names;
+    uint32_t    names_size;
+    uint64_t    text_start;     /* loaded __TEXT range */
+    uint64_t    text_end;
+    uint64_t    slide;          /* loaded minus unslid address */
+};
+
+// symindex_lookup results
+enum {
+    SYMINDEX_OUTSIDE = 0,       /* address is not in kernel __TEXT */
+    SYMINDEX_FOUND,             /* name and offset are set */
+    SYMINDEX_UNNAMED,           /* in __TEXT but before the first symbol, offset is from start of __TEXT */
+};
+
+/**
+ * \brief   Count __TEXT symbols of a validated image and bytes needed for their names. Returns 0 if image has none.
+ */
+int symindex_measure(const struct mach_header_64* mh, uint32_t* count, uint32_t* names_size);
+
+/**
+ * \brief   Fill index from image loaded at loaded_base, entries and names sized by symindex_measure.
+ *          Index keeps pointers to entries and names but not to the image. Returns 0 on failure.
+ */
+int symindex_build(struct symindex* index, const struct mach_header_64* mh, uint64_t loaded_base,
+                   struct symindex_entry* entries, uint32_t count, char* names, uint32_t names_size);
+
+/**
+ * \brief   Check if loaded address is in kernel __TEXT
+ */
+static inline int symindex_contains(const struct symindex* index, uint64_t addr)
+{
+    return (addr >= index->text_start && addr < index->text_end);
+}
+
+/**
+ * \brief   Find symbol covering loaded address
+ */
+int symindex_lookup(const struct symindex* index, uint64_t addr, const char** name, uint64_t* offset);
+
+/**
+ * \brief   Format address as "symbol+0x10" or "outside kernel image"
+ */
+void symindex_format(const struct symindex* index, uint64_t addr, char* buf, size_t size);
+
+#endif /* symindex_h */
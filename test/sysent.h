@@ -55,11 +55,31 @@
 /* wait4 syscall */
 #define SYS_wait4 7
 
+/* execve syscall */
+#define SYS_execve 59
+
+/* __mac_execve syscall */
+#define SYS___mac_execve 380
+
+/* vfork syscall */
+#define SYS_vfork 66
+
+/* setpgid syscall */
+#define SYS_setpgid 82
+
+/* setsid syscall */
+#define SYS_setsid 147
+
+/* posix_spawn syscall */
+#define SYS_posix_spawn 244
+
 /* ptrace() syscall */
 #define SYS_ptrace 26
 
 #define	SYS_kill 37
 
+struct proc;
+
 typedef int32_t	sy_call_t (struct proc *, void *, int *);
 typedef void	sy_munge_t (const void *, void *);
 
@@ -101,6 +121,7 @@ struct sysent_yosemite {            /* system call table */
 
 #define MACH_MSG_TRAP 31
 #define MACH_MSG_OVERWRITE_TRAP 32
+#define TASK_FOR_PID_TRAP 45
 
 // 10.8
 typedef struct {
@@ -0,0 +1,126 @@
+//
+//  tables.c
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sysent.h"
+#include "tables.h"
+
+#define LAYOUT(_name, _kind, _min, _max, _type, _call, _narg) \
+    { _name, _kind, _min, _max, sizeof(_type), offsetof(_type, _call), offsetof(_type, _narg), sizeof(((_type*)0)->_narg) }
+
+const struct table_layout g_table_layouts[] = {
+    LAYOUT("sysent_yosemite",       TABLE_SYSENT,       14, 14, struct sysent_yosemite,     sy_call,            sy_narg),
+    LAYOUT("sysent_mavericks",      TABLE_SYSENT,       13, 13, struct sysent_mavericks,    sy_call,            sy_narg),
+    LAYOUT("sysent",                TABLE_SYSENT,       0,  0,  struct sysent,              sy_call,            sy_narg),
+    LAYOUT("mach_trap_mavericks_t", TABLE_MACH_TRAP,    13, 0,  mach_trap_mavericks_t,      mach_trap_function, mach_trap_arg_count),
+    LAYOUT("mach_trap_t",           TABLE_MACH_TRAP,    0,  0,  mach_trap_t,                mach_trap_function, mach_trap_arg_count),
+};
+
+const size_t g_table_layout_count = sizeof(g_table_layouts) / sizeof(g_table_layouts[0]);
+
+// Expected argument counts of well known entries
+struct table_probe {
+    int index;
+    int narg;
+};
+
+static const struct table_probe g_sysent_probes[] = {
+    { SYS_exit, 1 },
+    { SYS_fork, 0 },
+    { SYS_read, 3 },
+    { SYS_wait4, 4 },
+    { SYS_ptrace, 4 },
+};
+
+static const struct table_probe g_mach_trap_probes[] = {
+    { 0, 0 },
+    { 1, 0 },
+    { MACH_MSG_TRAP, 7 },
+    { MACH_MSG_OVERWRITE_TRAP, 8 },
+};
+
+#define PROBES(_kind) \
+    ((_kind) == TABLE_SYSENT ? g_sysent_probes : g_mach_trap_probes)
+#define PROBE_COUNT(_kind) \
+    ((_kind) == TABLE_SYSENT ? sizeof(g_sysent_probes) / sizeof(g_sysent_probes[0]) : sizeof(g_mach_trap_probes) / sizeof(g_mach_trap_probes[0]))
+
+const struct table_layout* tables_layout(int kind, int version_major)
+{
+    for (size_t i = 0; i < g_table_layout_count; ++i) {
+        const struct table_layout* layout = &g_table_layouts[i];
+        if (layout->kind == kind &&
+            version_major >= layout->min_major &&
+            (layout->max_major == 0 || version_major <= layout->max_major)) {
+            return layout;
+        }
+    }
+
+    return NULL;
+}
+
+static inline int tables_narg(const struct table_layout* layout, const uint8_t* entry)
+{
+    if (layout->narg_size == sizeof(int16_t)) {
+        int16_t narg;
+        memcpy(&narg, entry + layout->narg_offset, sizeof(narg));
+        return narg;
+    } else {
+        int32_t narg;
+        memcpy(&narg, entry + layout->narg_offset, sizeof(narg));
+        return narg;
+    }
+}
+
+int tables_match(const struct table_layout* layout, const void* addr)
+{
+    const struct table_probe* probes = PROBES(layout->kind);
+    size_t count = PROBE_COUNT(layout->kind);
+
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t* entry = (const uint8_t*)addr + probes[i].index * layout->stride;
+        if (tables_narg(layout, entry) != probes[i].narg) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+size_t tables_span(const struct table_layout* layout)
+{
+    const struct table_probe* probes = PROBES(layout->kind);
+    size_t count = PROBE_COUNT(layout->kind);
+
+    int max_index = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (probes[i].index > max_index) {
+            max_index = probes[i].index;
+        }
+    }
+
+    return (size_t)max_index * layout->stride + layout->narg_offset + layout->narg_size;
+}
+
+int tables_find(const struct table_layout* layout, const void* data, size_t size, size_t* offset)
+{
+    size_t span = tables_span(layout);
+    if (size < span) {
+        return 0;
+    }
+
+    for (size_t pos = 0; pos <= size - span; ++pos) {
+        if (tables_match(layout, (const uint8_t*)data + pos)) {
+            *offset = pos;
+            return 1;
+        }
+    }
+
+    return 0;
+}
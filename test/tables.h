@@ -0,0 +1,58 @@
+//
+//  tables.h
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Layout descriptions and pattern matchers for BSD sysent and mach trap tables.
+//  Shared by the kext and userspace tools.
+//
+
+#ifndef tables_h
+#define tables_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    TABLE_SYSENT = 0,
+    TABLE_MACH_TRAP,
+};
+
+struct table_layout {
+    const char* name;
+    int         kind;           /* TABLE_* */
+    int         min_major;      /* first darwin major version using this layout */
+    int         max_major;      /* last darwin major version using this layout, 0 if still current */
+    uint32_t    stride;         /* entry size */
+    uint32_t    call_offset;    /* implementing function pointer */
+    uint32_t    narg_offset;    /* number of arguments */
+    uint32_t    narg_size;      /* size of number of arguments field, 2 or 4 */
+};
+
+// All known layouts, most specific first within each kind
+extern const struct table_layout g_table_layouts[];
+extern const size_t g_table_layout_count;
+
+/**
+ * \brief   Layout used by given darwin major version
+ */
+const struct table_layout* tables_layout(int kind, int version_major);
+
+/**
+ * \brief   Check if table with layout starts at addr.
+ *          Caller guarantees that tables_span(layout) bytes are readable.
+ */
+int tables_match(const struct table_layout* layout, const void* addr);
+
+/**
+ * \brief   Number of bytes tables_match reads
+ */
+size_t tables_span(const struct table_layout* layout);
+
+/**
+ * \brief   Byte-wise scan of buffer for a table with layout. Returns 1 and offset of the table if found.
+ */
+int tables_find(const struct table_layout* layout, const void* data, size_t size, size_t* offset);
+
+#endif /* tables_h */
@@ -0,0 +1,55 @@
+//
+//  telemetry.c
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+
+#include <string.h>
+
+#include "telemetry.h"
+
+void telemetry_init(struct killhook_telemetry* page)
+{
+    memset(page, 0, sizeof(*page));
+    page->magic = KILLHOOK_TELEMETRY_MAGIC;
+    page->version = KILLHOOK_TELEMETRY_VERSION;
+    page->size = sizeof(*page);
+}
+
+void telemetry_publish(struct killhook_telemetry* page, const struct killhook_telemetry_data* data)
+{
+    uint64_t seq = __atomic_load_n(&page->seq, __ATOMIC_RELAXED);
+    
+    // Odd sequence has to be visible before any data store
+    __atomic_store_n(&page->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    
+    memcpy(&page->data, data, sizeof(*data));
+    
+    __atomic_store_n(&page->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+int telemetry_read(const struct killhook_telemetry* page, struct killhook_telemetry_data* data, unsigned max_retries)
+{
+    if (page->magic != KILLHOOK_TELEMETRY_MAGIC || page->version != KILLHOOK_TELEMETRY_VERSION || page->size != sizeof(*page)) {
+        return TELEMETRY_INVALID;
+    }
+    
+    for (unsigned i = 0; i <= max_retries; ++i) {
+        uint64_t begin = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        if (begin & 1) {
+            continue;
+        }
+        
+        memcpy(data, &page->data, sizeof(*data));
+        
+        // Data loads have to complete before sequence is checked again
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) == begin) {
+            return TELEMETRY_OK;
+        }
+    }
+    
+    return TELEMETRY_BUSY;
+}
@@ -0,0 +1,39 @@
+//
+//  telemetry.h
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Seqlock over the telemetry page: a single writer publishes, any number of readers
+//  copy data out and retry if they raced with an update. Readers never write to the page,
+//  so it can be mapped read-only. Does not depend on kernel headers, writers are serialized by callers.
+//
+
+#ifndef telemetry_h
+#define telemetry_h
+
+#include "killhook.h"
+
+// telemetry_read return codes
+enum {
+    TELEMETRY_OK = 0,
+    TELEMETRY_BUSY,         /* writer kept updating for all retries */
+    TELEMETRY_INVALID,      /* page magic, version or size mismatch */
+};
+
+/**
+ * \brief   Initialize page header and zero data
+ */
+void telemetry_init(struct killhook_telemetry* page);
+
+/**
+ * \brief   Publish new data. Must not be called concurrently with itself.
+ */
+void telemetry_publish(struct killhook_telemetry* page, const struct killhook_telemetry_data* data);
+
+/**
+ * \brief   Copy consistent data out of the page, retrying at most max_retries times
+ */
+int telemetry_read(const struct killhook_telemetry* page, struct killhook_telemetry_data* data, unsigned max_retries);
+
+#endif /* telemetry_h */
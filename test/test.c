@@ -16,12 +16,17 @@
 
 #include <kern/task.h>
 #include <kern/clock.h>
+#include <kern/thread_call.h>
+#include <kern/thread.h>
 
 #include <sys/systm.h>
 #include <sys/kernel.h>
 #include <sys/sysctl.h>
 #include <sys/types.h>
 #include <sys/proc.h>
+#include <sys/kauth.h>
+#include <sys/vnode.h>
+#include <sys/fcntl.h>
 
 #include <libkern/OSMalloc.h>
 #include <libkern/version.h>
@@ -29,8 +34,24 @@
 #include <IOKit/IOLib.h>
 
 #include "test.h"
+#include "killhook.h"
 #include "sysent.h"
+#include "hooks.h"
+#include "kextsyms.h"
 #include "resolver.h"
+#include "hookstat.h"
+#include "integrity.h"
+#include "protect.h"
+#include "hookcheck.h"
+#include "ctlmsg.h"
+#include "auditq.h"
+#include "trustcache.h"
+#include "tables.h"
+#include "telemetry.h"
+#include "startprof.h"
+#include "ratelimit.h"
+#include "symindex.h"
+#include "filter.h"
 
 #define MSR_EFER        0xc0000080 /* extended feature register */
 #define MSR_STAR        0xc0000081 /* legacy mode SYSCALL target */
@@ -39,6 +60,31 @@
 
 #define INVALID_VADDR   ((uintptr_t)-1)
 
+#define MACH_TRAP_TABLE_COUNT   128 /* Taken from osfmk/kern/syscall_sw.c */
+
+// Signals which terminate or stop a process unless it handles them, blocked by default for protected processes
+#define PROTECT_SIGMASK_DEFAULT                                                         \
+    (PROTECT_SIGBIT(SIGHUP)  | PROTECT_SIGBIT(SIGINT)    | PROTECT_SIGBIT(SIGQUIT)  |   \
+     PROTECT_SIGBIT(SIGILL)  | PROTECT_SIGBIT(SIGTRAP)   | PROTECT_SIGBIT(SIGABRT)  |   \
+     PROTECT_SIGBIT(SIGEMT)  | PROTECT_SIGBIT(SIGFPE)    | PROTECT_SIGBIT(SIGKILL)  |   \
+     PROTECT_SIGBIT(SIGBUS)  | PROTECT_SIGBIT(SIGSEGV)   | PROTECT_SIGBIT(SIGSYS)   |   \
+     PROTECT_SIGBIT(SIGPIPE) | PROTECT_SIGBIT(SIGALRM)   | PROTECT_SIGBIT(SIGTERM)  |   \
+     PROTECT_SIGBIT(SIGSTOP) | PROTECT_SIGBIT(SIGTSTP)   | PROTECT_SIGBIT(SIGTTIN)  |   \
+     PROTECT_SIGBIT(SIGTTOU) | PROTECT_SIGBIT(SIGXCPU)   | PROTECT_SIGBIT(SIGXFSZ)  |   \
+     PROTECT_SIGBIT(SIGVTALRM) | PROTECT_SIGBIT(SIGPROF) | PROTECT_SIGBIT(SIGUSR1)  |   \
+     PROTECT_SIGBIT(SIGUSR2))
+
+#define AUDIT_INTERVAL_MS       100     /* Delay between audit queue drains */
+#define AUDIT_BATCH             64      /* Records processed by audit tick between checks for stop request */
+
+#define RATELIMIT_RATE          10      /* Audited denials per second per caller */
+#define RATELIMIT_BURST         20      /* Denials audited before rate limiting kicks in */
+
+#define INTEGRITY_INTERVAL_MS   1000    /* Delay between integrity watchdog ticks */
+#define INTEGRITY_CHUNK_BYTES   4096    /* Bytes hashed per integrity watchdog tick */
+
+#define STARTPROF_PATH          "/var/db/acme.test.startprof"   /* Start-up profiles survive kext reloads here */
+
 #if !defined(assert)
 #   define assert(cond)    \
          ((void) ((cond) ? 0 : panic("assertion failed: %s", # cond)))
@@ -47,22 +93,85 @@
 OSMallocTag g_tag = NULL;
 lck_grp_t* g_lock_group = NULL;
 
-// Traced task context
-static task_t g_task = NULL;
+// Protected processes
+static struct protect_set g_protect;
+static struct trustcache g_trust;     // Callers allowed to signal protected processes, also guarded by g_protect_lock
+static uint32_t g_protect_gen = 0;      // Bumped on every change of g_protect or g_trust, invalidates cached denials
+static struct ratelimit g_ratelimit;    // Per-caller denial budgets
+static lck_rw_t* g_protect_lock = NULL;
 static int32_t g_pid = 0;       // PID we will protect, set through sysctl node
 static int g_unhook = 0;        // Dummy sysctl node var to unhook everything before exiting
+static int g_msg_filter = PROTECT_MSG_NARROW;  // Mach message filtering mode, see PROTECT_MSG_*
 
 // Hooked syscall tables
 static void* g_sysent_table = NULL;
 static void* g_mach_trap_table = NULL;
 
+// Kernel __TEXT symbols and table handlers seen on the last pass, used to attribute foreign table modifications
+static struct symindex g_symindex;
+static void** g_table_snapshot = NULL;
+static uint32_t g_table_snapshot_size = 0;
+
 // Private kernel symbols manually resolved on kext start
 static task_t(*proc_task)(proc_t) = NULL;
 static ipc_space_t(*get_task_ipcspace)(task_t) = NULL;
 static task_t(*port_name_to_task)(mach_port_name_t) = NULL;
+static int(*get_cpu_number)(void) = NULL;
+static int* nsysent = NULL;
+static void(*proc_starttime)(proc_t, struct timeval*) = NULL;
+
+// Optional private symbols, telemetry page can't be mapped without them
+static vm_map_t* kernel_map_ptr = NULL;
+static vm_map_t(*get_task_map)(task_t) = NULL;
+static kern_return_t(*mach_make_memory_entry_64)(vm_map_t, memory_object_size_t*, memory_object_offset_t, vm_prot_t, ipc_port_t*, ipc_port_t) = NULL;
+static kern_return_t(*mach_vm_map)(vm_map_t, mach_vm_offset_t*, mach_vm_size_t, mach_vm_offset_t, int, ipc_port_t, vm_object_offset_t, boolean_t, vm_prot_t, vm_prot_t, vm_inherit_t) = NULL;
+static kern_return_t(*mach_vm_deallocate)(vm_map_t, mach_vm_offset_t, mach_vm_size_t) = NULL;
+static void(*ipc_port_release_send)(ipc_port_t) = NULL;
 
 static lck_mtx_t* g_task_lock = NULL;
 
+// Hook overhead histograms, see hookstat.h
+static struct hookstat_percpu g_hookstat[HOOKSTAT_MAX_CPUS];
+static int g_hookstat_reset = 0;    // Dummy sysctl node var to reset histograms
+
+// Deferred audit, hooks only post raw records
+static struct auditq g_auditq;
+static struct audit_lru g_audit_lru;   // Owned by audit worker
+static thread_call_t g_audit_call = NULL;
+static uint64_t g_audit_reported_drops = 0;
+static volatile int g_audit_stop = 0;
+
+// Syscall table integrity watchdog
+static struct integrity_state g_integrity;
+static lck_mtx_t* g_integrity_lock = NULL;
+static thread_call_t g_integrity_call = NULL;
+static int g_integrity_full = 0;    // Fingerprint whole tables instead of hooked entries only
+
+// Telemetry page mapped read-only into clients, refreshed by integrity watchdog under g_integrity_lock.
+// Page is a VM object of its own behind g_telemetry_entry, kernel and client mappings each hold a reference to it.
+static struct killhook_telemetry* g_telemetry = NULL;
+static struct killhook_telemetry_data g_telemetry_scratch;
+static ipc_port_t g_telemetry_entry = NULL;
+
+// Last start-up profiles, loaded from and saved to STARTPROF_PATH
+static struct startprof_history g_startprof;
+
+_Static_assert(sizeof(struct killhook_telemetry) <= PAGE_SIZE, "telemetry has to fit a single page");
+_Static_assert(HOOKSTAT_COUNT <= KILLHOOK_MAX_COUNTERS, "telemetry hook counters are too few");
+_Static_assert(PROTECT_MAX_ENTRIES <= KILLHOOK_MAX_TARGETS, "telemetry target list is too small");
+
+static size_t sysent_entry_size(void) {
+    switch(version_major) {
+        case 14: return sizeof(struct sysent_yosemite);
+        case 13: return sizeof(struct sysent_mavericks);
+        default: return sizeof(struct sysent);
+    }
+}
+
+static void* sysent_get_entry(int callnum) {
+    return (uint8_t*)g_sysent_table + callnum * sysent_entry_size();
+}
+
 static void* sysent_get_call(int callnum) {
     switch(version_major) {
         case 14: return ((struct sysent_yosemite*)g_sysent_table)[callnum].sy_call;
@@ -79,12 +188,28 @@ static void sysent_set_call(int callnum, void* sy_call) {
     }
 }
 
+static void** sysent_get_call_slot(int callnum) {
+    switch(version_major) {
+        case 14: return (void**)&((struct sysent_yosemite*)g_sysent_table)[callnum].sy_call;
+        case 13: return (void**)&((struct sysent_mavericks*)g_sysent_table)[callnum].sy_call;
+        default: return (void**)&((struct sysent*)g_sysent_table)[callnum].sy_call;
+    }
+}
+
 static void* sysent_hook_call(int callnum, void* hook) {
     void* orig = sysent_get_call(callnum);
     sysent_set_call(callnum, hook);
     return orig;
 }
 
+static size_t mach_table_entry_size(void) {
+    return (version_major >= 13 ? sizeof(mach_trap_mavericks_t) : sizeof(mach_trap_t));
+}
+
+static void* mach_table_get_entry(int trapnum) {
+    return (uint8_t*)g_mach_trap_table + trapnum * mach_table_entry_size();
+}
+
 static void* mach_table_get_trap(int trapnum) {
     if (version_major >= 13) {
         return ((mach_trap_mavericks_t*)g_mach_trap_table)[trapnum].mach_trap_function;
@@ -101,6 +226,14 @@ static void mach_table_set_trap(int trapnum, void* trap_function) {
     }
 }
 
+static void** mach_table_get_trap_slot(int trapnum) {
+    if (version_major >= 13) {
+        return &((mach_trap_mavericks_t*)g_mach_trap_table)[trapnum].mach_trap_function;
+    } else {
+        return &((mach_trap_t*)g_mach_trap_table)[trapnum].mach_trap_function;
+    }
+}
+
 static void* mach_table_hook_trap(int trapnum, void* hook) {
     void* orig = mach_table_get_trap(trapnum);
     mach_table_set_trap(trapnum, hook);
@@ -114,6 +247,20 @@ static uint64_t rdmsr(uint32_t index)
     return (((uint64_t)hi) << 32) | ((uint64_t)lo);
 }
 
+static inline uint64_t rdtsc(void)
+{
+    uint32_t lo=0, hi=0;
+    __asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
+    return (((uint64_t)hi) << 32) | ((uint64_t)lo);
+}
+
+// Account cycles spent in hook wrapper since start
+static inline void hookstat_account(unsigned hook, uint64_t start)
+{
+    uint64_t cycles = rdtsc() - start;
+    hookstat_record(g_hookstat, (unsigned)get_cpu_number(), hook, cycles);
+}
+
 // Clear CR0 page read only protection bit
 static void disable_vm_protection(void)
 {
@@ -141,7 +288,7 @@ static void enable_vm_protection(void)
 }
 
 // Finds and returns 64bit loaded kernel base address or INVALID_VADDR if failed
-static uintptr_t find_kernel_base(void)
+static uintptr_t find_kernel_base(uint64_t* probes)
 {
     // In case of ASLR kernel find real kernel base.
     // For that dump MSR_LSTAR which contains a pointer to kernel syscall handler
@@ -150,6 +297,7 @@ static uintptr_t find_kernel_base(void)
     // Round up to next page boundary - kernel should start at a page boundary ASLR or no ALSR
     ptr = ptr & ~PAGE_MASK_64;
     while (ptr) {
+        (*probes)++;
         if (*(uint32_t*)ptr == MH_MAGIC_64) {
             return ptr;
         }
@@ -163,51 +311,19 @@ static uintptr_t find_kernel_base(void)
 // Matches sysent table in memory at given address
 static int is_sysent_table(uintptr_t addr)
 {
-    #define sysent_verify(_sysent)              \
-        ((_sysent)[SYS_exit].sy_narg == 1 &&    \
-         (_sysent)[SYS_fork].sy_narg == 0 &&    \
-         (_sysent)[SYS_read].sy_narg == 3 &&    \
-         (_sysent)[SYS_wait4].sy_narg == 4 &&   \
-         (_sysent)[SYS_ptrace].sy_narg == 4)
-    
-    if (version_major == 14) {
-        struct sysent_yosemite* sysent = (struct sysent_yosemite*)addr;
-        return sysent_verify(sysent);
-    } else if (version_major == 13) {
-        struct sysent_mavericks* sysent = (struct sysent_mavericks*)addr;
-        return sysent_verify(sysent);
-    } else {
-        struct sysent* sysent = (struct sysent*)addr;
-        return sysent_verify(sysent);
-    }
-    
-    #undef sysent_verify
-    return FALSE;
+    return tables_match(tables_layout(TABLE_SYSENT, version_major), (const void*)addr);
 }
 
 // Matches mach trap table in memory at given address
 static int is_mach_trap_table(uintptr_t addr)
 {
-    #define traps_verify(_traps)                                \
-        ((_traps)[0].mach_trap_arg_count == 0 &&                \
-         (_traps)[1].mach_trap_arg_count == 0 &&                \
-         (_traps)[MACH_MSG_TRAP].mach_trap_arg_count == 7 &&    \
-         (_traps)[MACH_MSG_OVERWRITE_TRAP].mach_trap_arg_count == 8)
-    
-    if (version_major >= 13) {
-        mach_trap_mavericks_t* res = (mach_trap_mavericks_t*)addr;
-        return traps_verify(res);
-    } else {
-        mach_trap_t* res = (mach_trap_t*)addr;
-        return traps_verify(res);
-    }
-    
-    #undef traps_verify
-    return FALSE;
+    return tables_match(tables_layout(TABLE_MACH_TRAP, version_major), (const void*)addr);
 }
 
 // Search kernel data segment for BSD sysent table and mach trap table
-static int find_syscall_tables(const struct segment_command_64* dataseg, void** psysent, void** pmach_traps)
+// Counts scanned bytes and matcher calls for start-up profile
+static int find_syscall_tables(const struct segment_command_64* dataseg, void** psysent, void** pmach_traps,
+                               uint64_t* scanned, uint64_t* probes)
 {
     assert(dataseg);
     assert(psysent);
@@ -221,12 +337,20 @@ static int find_syscall_tables(const struct segment_command_64* dataseg, void**
     
     while(size != 0) {
         
-        if (!sysent && is_sysent_table(addr)) {
-            sysent = (void*)addr;
+        (*scanned)++;
+        
+        if (!sysent) {
+            (*probes)++;
+            if (is_sysent_table(addr)) {
+                sysent = (void*)addr;
+            }
         }
         
-        if (!mach_traps && is_mach_trap_table(addr)) {
-            mach_traps = (void*)addr;
+        if (!mach_traps) {
+            (*probes)++;
+            if (is_mach_trap_table(addr)) {
+                mach_traps = (void*)addr;
+            }
         }
     
         if (sysent && mach_traps) {
@@ -242,6 +366,156 @@ static int find_syscall_tables(const struct segment_command_64* dataseg, void**
     return FALSE;
 }
 
+// Process start time in microseconds, identifies process instance together with pid
+static uint64_t proc_start_usec(void* ctx)
+{
+    struct timeval tv;
+    proc_starttime((proc_t)ctx, &tv);
+    return (uint64_t)tv.tv_sec * USEC_PER_SEC + (uint64_t)tv.tv_usec;
+}
+
+// Broadcast kill reaches processes the caller may signal: superuser may signal anyone but itself,
+// others only processes whose real or saved uid matches caller's real or effective uid
+static int process_reach(const struct protect_entry* entry, void* ctx)
+{
+    proc_t cp = (proc_t)ctx;
+    if (entry->pid == proc_pid(cp)) {
+        return 0;
+    }
+    
+    proc_t proc = proc_find(entry->pid);
+    if (!proc) {
+        return 0;
+    }
+    
+    kauth_cred_t caller_cred = kauth_cred_proc_ref(cp);
+    kauth_cred_t target_cred = kauth_cred_proc_ref(proc);
+    uid_t ruid = kauth_cred_getruid(caller_cred);
+    uid_t euid = kauth_cred_getuid(caller_cred);
+    uid_t target_ruid = kauth_cred_getruid(target_cred);
+    uid_t target_svuid = kauth_cred_getsvuid(target_cred);
+    int reach = (kauth_cred_issuser(caller_cred) ||
+                 ruid == target_ruid || ruid == target_svuid ||
+                 euid == target_ruid || euid == target_svuid);
+    kauth_cred_unref(&target_cred);
+    kauth_cred_unref(&caller_cred);
+    proc_rele(proc);
+    return reach;
+}
+
+// Policy hooks decide on. Call with g_protect_lock held.
+static inline void policy_get(struct filter_policy* policy)
+{
+    policy->protect = &g_protect;
+    policy->trust = &g_trust;
+    policy->limit = &g_ratelimit;
+    policy->generation = g_protect_gen;
+}
+
+//
+// Deferred audit
+//
+
+static inline void audit_post(uint16_t event, int32_t caller, int32_t target, int32_t arg)
+{
+    struct audit_record record;
+    record.time = mach_absolute_time();
+    record.caller = caller;
+    record.target = target;
+    record.arg = arg;
+    record.event = event;
+    record.reserved = 0;
+    
+    auditq_post(&g_auditq, &record);
+}
+
+// Rate limiter clock
+static uint64_t uptime_ms(void* ctx)
+{
+    uint64_t ns = 0;
+    absolutetime_to_nanoseconds(mach_absolute_time(), &ns);
+    return ns / NSEC_PER_MSEC;
+}
+
+// Denials are audited while caller has tokens, the rest are counted and reported by audit worker
+static inline void audit_deny(const struct filter_policy* policy, const struct filter_caller* caller, uint16_t event, int32_t target, int32_t arg)
+{
+    if (filter_audit(policy, caller, event, target, arg)) {
+        audit_post(event, caller->pid, target, arg);
+    }
+}
+
+static void audit_post_suppressed(int32_t pid, uint32_t suppressed, void* ctx)
+{
+    audit_post(AUDIT_SUPPRESSED, pid, 0, (int32_t)suppressed);
+}
+
+// Slow caller lookups happen here on the worker thread, once per distinct caller
+static void audit_enrich(int32_t pid, char* name, uint32_t size, void* ctx)
+{
+    proc_name(pid, name, (int)size);
+}
+
+static void audit_emit(const struct audit_record* record, const char* caller_name, void* ctx)
+{
+    switch (record->event) {
+        case AUDIT_KILL_DENIED:
+            printf("blocked signal %d from pid %d (%s) to pid %d\n", record->arg, record->caller, caller_name, record->target);
+            break;
+        case AUDIT_MACH_MSG_DENIED:
+            printf("blocked mach message %d from pid %d (%s) to task of pid %d\n", record->arg, record->caller, caller_name, record->target);
+            break;
+        case AUDIT_TASK_FOR_PID_DENIED:
+            printf("blocked task_for_pid from pid %d (%s) for pid %d\n", record->caller, caller_name, record->target);
+            break;
+        case AUDIT_INHERIT_FAILED:
+            printf("can't protect pid %d spawned by pid %d (%s): %d\n", record->target, record->caller, caller_name, record->arg);
+            break;
+        case AUDIT_SUPPRESSED:
+            if (record->caller) {
+                printf("suppressed %d more denials for pid %d (%s)\n", record->arg, record->caller, caller_name);
+            } else {
+                printf("suppressed %d more denials for other callers\n", record->arg);
+            }
+            break;
+    }
+}
+
+// Audit worker is a self rearming thread call rather than a kernel thread, so that unload can wait for it
+// with thread_call_cancel_wait. A thread flagging its own exit still runs kext code after the flag is seen.
+static void audit_tick(thread_call_param_t param0, thread_call_param_t param1)
+{
+    ratelimit_flush(&g_ratelimit, audit_post_suppressed, NULL);
+    
+    while (!g_audit_stop && auditq_process(&g_auditq, &g_audit_lru, AUDIT_BATCH, audit_enrich, audit_emit, NULL) == AUDIT_BATCH) {
+        ;
+    }
+    
+    uint64_t drops = g_auditq.dropped;
+    if (drops != g_audit_reported_drops) {
+        printf("audit: %llu records dropped, queue is full\n", drops - g_audit_reported_drops);
+        g_audit_reported_drops = drops;
+    }
+    
+    if (!g_audit_stop) {
+        uint64_t deadline = 0;
+        clock_interval_to_deadline(AUDIT_INTERVAL_MS, kMillisecondScale, &deadline);
+        thread_call_enter_delayed(g_audit_call, deadline);
+    }
+}
+
+static void audit_worker_stop(void)
+{
+    // Stop flag keeps a running tick from rearming, cancel once more in case it did before seeing the flag
+    g_audit_stop = 1;
+    thread_call_cancel_wait(g_audit_call);
+    thread_call_cancel(g_audit_call);
+    
+    // Hooks are gone by now and the tick can't run anymore, flush what's left from here
+    ratelimit_flush(&g_ratelimit, audit_post_suppressed, NULL);
+    auditq_process(&g_auditq, &g_audit_lru, AUDITQ_SIZE, audit_enrich, audit_emit, NULL);
+}
+
 //
 // Mach hooks
 //
@@ -274,10 +548,15 @@ typedef	struct
     mach_msg_id_t		msgh_id;
 } mach_user_msg_header_t;
 
-mach_msg_return_t mach_msg_trap_common(struct mach_msg_overwrite_trap_args *args, mach_msg_return_t(*orig_handler)(void* args))
+// Decides if message may be sent. Returns MACH_MSG_SUCCESS to pass message to original handler.
+// Task ports of protected processes are withheld by task_for_pid hook, so unless in full mode
+// only messages that enumerate tasks are inspected.
+static mach_msg_return_t mach_msg_filter(struct mach_msg_overwrite_trap_args *args)
 {
-    if (!g_task || !(args->option & MACH_SEND_MSG)) {
-        return orig_handler(args);
+    // Unlocked peek, set is empty most of the time
+    int mode = g_msg_filter;
+    if (mode == PROTECT_MSG_OFF || !g_protect.count || !(args->option & MACH_SEND_MSG)) {
+        return MACH_MSG_SUCCESS;
     }
     
     mach_user_msg_header_t hdr;
@@ -285,12 +564,44 @@ mach_msg_return_t mach_msg_trap_common(struct mach_msg_overwrite_trap_args *args
         return MACH_SEND_MSG_TOO_SMALL; // "Sorry, your message is too small for this rootkit to process correctly"
     }
     
-    copyin(args->msg, &hdr, sizeof(hdr));
-    task_t remote_task = port_name_to_task(hdr.msgh_remote_port);
-    if (g_task == remote_task) {
-        // TODO: also check if this is a task kernel port
-        printf("my_mach_msg_trap: blocking task_terminate\n");
-        return MACH_SEND_INVALID_RIGHT;
+    // Unreadable message is reported by the original handler
+    if (copyin(args->msg, &hdr, sizeof(hdr))) {
+        return MACH_MSG_SUCCESS;
+    }
+    
+    // Port translation takes ipc locks of its own, do it before taking ours and only when it is needed
+    // TODO: also check if this is a task kernel port
+    task_t remote_task = (mode == PROTECT_MSG_FULL ? port_name_to_task(hdr.msgh_remote_port) : TASK_NULL);
+    
+    proc_t self = current_proc();
+    struct filter_caller caller = { proc_pid(self), 0, proc_start_usec, uptime_ms, process_reach, self };
+    struct filter_policy policy;
+    int32_t target = 0;
+    
+    lck_rw_lock_shared(g_protect_lock);
+    policy_get(&policy);
+    int verdict = filter_mach_msg(&policy, &caller, hdr.msgh_id, remote_task, &target);
+    lck_rw_unlock_shared(g_protect_lock);
+    
+    if (verdict == FILTER_ALLOW) {
+        return MACH_MSG_SUCCESS;
+    }
+    
+    if (verdict == FILTER_DENY) {
+        audit_deny(&policy, &caller, AUDIT_MACH_MSG_DENIED, target, hdr.msgh_id);
+    }
+    return MACH_SEND_INVALID_RIGHT;
+}
+
+mach_msg_return_t mach_msg_trap_common(struct mach_msg_overwrite_trap_args *args, mach_msg_return_t(*orig_handler)(void* args), unsigned hook)
+{
+    // Time spent in original handler is not accounted
+    uint64_t start = rdtsc();
+    mach_msg_return_t res = mach_msg_filter(args);
+    hookstat_account(hook, start);
+    
+    if (res != MACH_MSG_SUCCESS) {
+        return res;
     }
     
     return orig_handler(args);
@@ -299,13 +610,70 @@ mach_msg_return_t mach_msg_trap_common(struct mach_msg_overwrite_trap_args *args
 // mach_msg_trap hook
 mach_msg_return_t my_mach_msg_trap(struct mach_msg_overwrite_trap_args *args)
 {
-    return mach_msg_trap_common(args, g_mach_msg_trap);
+    return mach_msg_trap_common(args, g_mach_msg_trap, HOOKSTAT_MACH_MSG);
 }
 
 // mach_msg_overwrite_trap hook
 mach_msg_return_t my_mach_msg_overwrite_trap(struct mach_msg_overwrite_trap_args *args)
 {
-    return mach_msg_trap_common(args, g_mach_msg_overwrite_trap);
+    return mach_msg_trap_common(args, g_mach_msg_overwrite_trap, HOOKSTAT_MACH_MSG_OVERWRITE);
+}
+
+//
+// task_for_pid trap hook
+//
+
+static kern_return_t (*g_task_for_pid)(void* args) = NULL;
+
+struct task_for_pid_args {
+    PAD_ARG_(mach_port_name_t, target_tport);
+    PAD_ARG_(int, pid);
+    PAD_ARG_(user_addr_t, t);
+};
+
+// Decides if caller may get task port of pid. Returns KERN_SUCCESS to pass call to original handler.
+static kern_return_t task_for_pid_filter(struct task_for_pid_args *args)
+{
+    // Unlocked peek, set is empty most of the time
+    if (!g_protect.count) {
+        return KERN_SUCCESS;
+    }
+    
+    proc_t self = current_proc();
+    struct filter_caller caller = { proc_pid(self), 0, proc_start_usec, uptime_ms, process_reach, self };
+    struct filter_policy policy;
+    
+    lck_rw_lock_shared(g_protect_lock);
+    policy_get(&policy);
+    int verdict = filter_task_for_pid(&policy, &caller, args->pid);
+    lck_rw_unlock_shared(g_protect_lock);
+    
+    if (verdict == FILTER_ALLOW) {
+        return KERN_SUCCESS;
+    }
+    
+    if (verdict == FILTER_DENY) {
+        audit_deny(&policy, &caller, AUDIT_TASK_FOR_PID_DENIED, args->pid, 0);
+    }
+    
+    // Same result as a denied task_for_pid, caller gets MACH_PORT_NULL
+    mach_port_name_t null_port = MACH_PORT_NULL;
+    copyout(&null_port, args->t, sizeof(null_port));
+    return KERN_FAILURE;
+}
+
+kern_return_t my_task_for_pid(struct task_for_pid_args *args)
+{
+    // Time spent in original handler is not accounted
+    uint64_t start = rdtsc();
+    kern_return_t res = task_for_pid_filter(args);
+    hookstat_account(HOOKSTAT_TASK_FOR_PID, start);
+    
+    if (res != KERN_SUCCESS) {
+        return res;
+    }
+    
+    return g_task_for_pid(args);
 }
 
 //
@@ -320,170 +688,1301 @@ struct kill_args {
     char posix_l_[PADL_(int)]; int posix; char posix_r_[PADR_(int)];
 };
 
-int my_kill(proc_t cp, struct kill_args *uap, __unused int32_t *retval)
+// Decides if signal may be delivered. Returns 0 to pass signal to original handler.
+static int kill_filter(proc_t cp, struct kill_args *uap)
 {
-    // Negative pid is a killpg case
-    pid_t pid = (uap->pid > 0 ? uap->pid : -uap->pid);
+    // Unlocked peek, nothing to deny if set is empty
+    if (!g_protect.count) {
+        return 0;
+    }
+    
+    // Caller's group is only needed for kill(0, sig)
+    struct filter_caller caller = { proc_pid(cp), (uap->pid == 0 ? proc_pgrpid(cp) : 0), proc_start_usec, uptime_ms, process_reach, cp };
+    struct filter_policy policy;
     
-    if (!g_pid || (pid != g_pid)) {
-        return g_orig_kill(cp, uap, retval);
+    lck_rw_lock_shared(g_protect_lock);
+    policy_get(&policy);
+    int verdict = filter_kill(&policy, &caller, uap->pid, uap->signum);
+    lck_rw_unlock_shared(g_protect_lock);
+    
+    if (verdict == FILTER_ALLOW) {
+        return 0;
     }
     
-    printf("signal %d from pid %d to pid %d, posix %d\n", uap->signum, proc_pid(cp), uap->pid, uap->posix);
+    if (verdict == FILTER_DENY) {
+        audit_deny(&policy, &caller, AUDIT_KILL_DENIED, uap->pid, uap->signum);
+    }
+    return EPERM;
+}
+
+int my_kill(proc_t cp, struct kill_args *uap, __unused int32_t *retval)
+{
+    // Time spent in original handler is not accounted
+    uint64_t start = rdtsc();
+    int err = kill_filter(cp, uap);
+    hookstat_account(HOOKSTAT_KILL, start);
     
-    // TODO: process cannot ignore or handle SIGKILL so we intercept it here.
-    // However there are other signals that will terminate a process if it doesn't handle or ignore these signals (i.e. SIGTERM)
-    // We don't handle those here for now.
-    if (uap->signum == SIGKILL || uap->signum == SIGTERM) {
-        printf("blocking SIGKILL\n");
-        return EPERM;
+    if (err) {
+        return err;
     }
     
     return g_orig_kill(cp, uap, retval);
 }
 
 //
-// Entry and init
+// BSD exit(2) hook
 //
 
-// kext uses sysctl nodes to communicate with the client:
-// 'debug.killhook.pid' - set 32bit pid value for process to protect
-// 'debug.killhook.unhook' - set to 1 to unhook all syscalls before unloading kext
-
-static int sysctl_killhook_pid SYSCTL_HANDLER_ARGS;
-static int sysctl_killhook_unhook SYSCTL_HANDLER_ARGS;
+static int(*g_orig_exit)(proc_t cp, void *uap, __unused int32_t *retval) = NULL;
 
-SYSCTL_NODE(_debug, OID_AUTO, killhook, CTLFLAG_RW, 0, "kill hook API");
-SYSCTL_PROC(_debug_killhook, OID_AUTO, pid, (CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_SECURE), &g_pid, 0, sysctl_killhook_pid, "I", "");
-SYSCTL_PROC(_debug_killhook, OID_AUTO, unhook, (CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_SECURE), &g_unhook, 0, sysctl_killhook_unhook, "I", "");
+// Inherited entry of pid, if any. Call with g_protect_lock held.
+static int inherited_entry(int32_t pid)
+{
+    const struct protect_entry* entry = protect_find_pid(&g_protect, pid);
+    return (entry && (entry->flags & PROTECT_FLAG_INHERITED));
+}
 
-static int sysctl_killhook_pid(struct sysctl_oid *oidp, void *arg1, int arg2, struct sysctl_req *req)
+// Processes killed by a signal don't go through exit(2), start time in trust cache key covers those
+// and inherited entries they leave behind are dropped when their pid is reused
+int my_exit(proc_t cp, void *uap, __unused int32_t *retval)
 {
-    int32_t curPid = g_pid;
-    int res = sysctl_handle_int(oidp, oidp->oid_arg1, oidp->oid_arg2, req);
+    int32_t pid = proc_pid(cp);
     
-    if (g_pid != curPid) {
+    // Unlocked peek, exiting processes are almost never trusted and shouldn't take the lock exclusively
+    if (trustcache_find(&g_trust, pid)) {
+        lck_rw_lock_exclusive(g_protect_lock);
+        trustcache_remove(&g_trust, pid);
+        lck_rw_unlock_exclusive(g_protect_lock);
+    }
+    
+    // Same for inherited entries, explicit ones are left to whoever added them
+    if (g_protect.ninherited) {
+        uint64_t start = rdtsc();
         
-        proc_t proc = proc_find(g_pid);
-        if (proc) {
-            g_task = proc_task(proc);
-            proc_rele(proc);
-            printf("PID changed to %d, task %p\n", g_pid, g_task);
+        lck_rw_lock_shared(g_protect_lock);
+        int inherited = inherited_entry(pid);
+        lck_rw_unlock_shared(g_protect_lock);
+        
+        if (inherited) {
+            lck_rw_lock_exclusive(g_protect_lock);
+            protect_exit(&g_protect, pid);
+            g_protect_gen++;
+            lck_rw_unlock_exclusive(g_protect_lock);
         }
+        
+        hookstat_account(HOOKSTAT_PROCESS_TREE, start);
     }
     
-    return res;
+    return g_orig_exit(cp, uap, retval);
 }
 
-static int syscalls_hooked(void)
+//
+// Process tree hooks, children of inheriting entries are protected as soon as they exist
+// and group index follows protected processes to their new groups
+//
+
+static int(*g_orig_fork)(proc_t cp, void *uap, int32_t *retval) = NULL;
+static int(*g_orig_vfork)(proc_t cp, void *uap, int32_t *retval) = NULL;
+static int(*g_orig_posix_spawn)(proc_t cp, void *uap, int32_t *retval) = NULL;
+static int(*g_orig_execve)(proc_t cp, void *uap, int32_t *retval) = NULL;
+static int(*g_orig_mac_execve)(proc_t cp, void *uap, int32_t *retval) = NULL;
+static int(*g_orig_setpgid)(proc_t cp, void *uap, int32_t *retval) = NULL;
+static int(*g_orig_setsid)(proc_t cp, void *uap, int32_t *retval) = NULL;
+
+struct posix_spawn_args {
+    PAD_ARG_(user_addr_t, pid);
+    PAD_ARG_(user_addr_t, path);
+    PAD_ARG_(user_addr_t, adesc);
+    PAD_ARG_(user_addr_t, argv);
+    PAD_ARG_(user_addr_t, envp);
+};
+
+struct setpgid_args {
+    PAD_ARG_(int, pid);
+    PAD_ARG_(int, pgid);
+};
+
+// Entry still belongs to a live process, a reused pid comes with a different task
+static int process_alive(const struct protect_entry* entry, void* ctx)
 {
-    return ((mach_table_get_trap(MACH_MSG_OVERWRITE_TRAP) == my_mach_msg_overwrite_trap) &&
-            (mach_table_get_trap(MACH_MSG_TRAP) == my_mach_msg_trap) &&
-            (sysent_get_call(SYS_kill) == my_kill));
+    proc_t proc = proc_find(entry->pid);
+    if (!proc) {
+        return 0;
+    }
+    
+    int alive = (!entry->task || proc_task(proc) == entry->task);
+    proc_rele(proc);
+    return alive;
 }
 
-static int sysctl_killhook_unhook(struct sysctl_oid *oidp, void *arg1, int arg2, struct sysctl_req *req)
+// Unlocked peek: nothing to pass on and no inherited entry a reused pid could pick up
+static inline int process_tree_active(void)
 {
-    int res = sysctl_handle_int(oidp, oidp->oid_arg1, oidp->oid_arg2, req);
-    if (g_unhook && syscalls_hooked())
-    {
-        // Unhook syscalls
-        // See comments in test_stop why this is done in sysctl handler
-        disable_vm_protection();
-        {
-            mach_table_set_trap(MACH_MSG_OVERWRITE_TRAP, g_mach_msg_overwrite_trap);
-            mach_table_set_trap(MACH_MSG_TRAP, g_mach_msg_trap);
-            sysent_set_call(SYS_kill, (sy_call_t*)g_orig_kill);
+    return (g_protect.ninherit || g_protect.ninherited);
+}
+
+// Parent cp created child. Child has already been running for a moment, which the original handlers don't let us avoid.
+static void process_spawned(proc_t cp, int32_t child)
+{
+    uint64_t start = rdtsc();
+    int32_t parent = proc_pid(cp);
+    
+    // Two hashed probes decide if the set changes at all
+    lck_rw_lock_shared(g_protect_lock);
+    const struct protect_entry* entry = protect_find_pid(&g_protect, parent);
+    int update = ((entry && (entry->flags & PROTECT_FLAG_INHERIT)) || inherited_entry(child));
+    lck_rw_unlock_shared(g_protect_lock);
+    
+    proc_t proc = (update ? proc_find(child) : NULL);
+    if (proc) {
+        // posix_spawn child pid is read back from user memory, another caller thread may have replaced it
+        int32_t ppid = proc_ppid(proc);
+        
+        // vfork child borrows parent's task until it execs, exec hook fills it in then
+        task_t task = proc_task(proc);
+        if (task == proc_task(cp)) {
+            task = NULL;
+        }
+        
+        int res = PROTECT_INVALID;
+        if (ppid == parent) {
+            lck_rw_lock_exclusive(g_protect_lock);
+            res = protect_fork(&g_protect, parent, child, ppid, proc_pgrpid(proc), task);
+            if (res == PROTECT_FULL && protect_sweep(&g_protect, process_alive, NULL)) {
+                // Children killed by signals never went through exit(2), make room from those
+                res = protect_fork(&g_protect, parent, child, ppid, proc_pgrpid(proc), task);
+            }
+            g_protect_gen++;
+            lck_rw_unlock_exclusive(g_protect_lock);
+        }
+        proc_rele(proc);
+        
+        if (res != PROTECT_OK && res != PROTECT_NOT_FOUND) {
+            audit_post(AUDIT_INHERIT_FAILED, parent, child, res);
         }
-        enable_vm_protection();
     }
     
-    return res;
+    hookstat_account(HOOKSTAT_PROCESS_TREE, start);
 }
 
-kern_return_t test_start(kmod_info_t * ki, void *d)
+// Protected process pid may have moved to another group, group index has to follow it
+static void process_regrouped(int32_t pid)
 {
-    g_tag = OSMalloc_Tagalloc("test.kext", OSMT_DEFAULT);
-    if (!g_tag) {
-        printf("Failed to allocate OSMalloc tag\n");
-        return KERN_FAILURE;
-    }
+    uint64_t start = rdtsc();
     
-    g_lock_group = lck_grp_alloc_init("test.kext", LCK_GRP_ATTR_NULL);
-    if (!g_lock_group) {
-        printf("Failed to create lock group\n");
-        return KERN_FAILURE;
-    }
+    lck_rw_lock_shared(g_protect_lock);
+    const struct protect_entry* entry = protect_find_pid(&g_protect, pid);
+    int protected = (entry != NULL);
+    int32_t pgid = (entry ? entry->pgid : 0);
+    lck_rw_unlock_shared(g_protect_lock);
     
-    g_task_lock = lck_mtx_alloc_init(g_lock_group, LCK_ATTR_NULL);
-    if (!g_task_lock) {
-        printf("Failed to create lock group\n");
-        return KERN_FAILURE;
+    proc_t proc = (protected ? proc_find(pid) : NULL);
+    if (proc) {
+        int32_t new_pgid = proc_pgrpid(proc);
+        proc_rele(proc);
+        
+        if (new_pgid != pgid) {
+            lck_rw_lock_exclusive(g_protect_lock);
+            protect_setpgid(&g_protect, pid, new_pgid);
+            g_protect_gen++;
+            lck_rw_unlock_exclusive(g_protect_lock);
+        }
     }
     
-    //
-    // We will attempt to hook sysent table to intercept syscalls we are interested in
-    // For that we will find kernel base address, find data segment in kernel mach-o headers
-    // and finally search for sysent pattern in data segment
-    //
-    
-    uintptr_t kernel_base = find_kernel_base();
-    if (kernel_base == INVALID_VADDR) {
-        printf("Can't find kernel base address\n");
-        return KERN_FAILURE;
+    hookstat_account(HOOKSTAT_PROCESS_TREE, start);
+}
+
+// Parent gets child pid in retval[0]
+int my_fork(proc_t cp, void *uap, int32_t *retval)
+{
+    int err = g_orig_fork(cp, uap, retval);
+    if (!err && process_tree_active()) {
+        process_spawned(cp, retval[0]);
     }
     
-    struct mach_header_64* kernel_hdr = (struct mach_header_64*)kernel_base;
-    if (kernel_hdr->magic != MH_MAGIC_64) {
-        printf("Wrong kernel header\n");
-        return KERN_FAILURE;
-    }
-
-    printf("kernel base @ %p\n", kernel_hdr);
+    return err;
+}
 
-    // Resolve some private symbols we're going to need
-    proc_task = resolve_kernel_symbol("_proc_task", kernel_base);
-    get_task_ipcspace = resolve_kernel_symbol("_get_task_ipcspace", kernel_base);
-    port_name_to_task = resolve_kernel_symbol("_port_name_to_task", kernel_base);
-    if (!proc_task || !get_task_ipcspace || !port_name_to_task) {
-        printf("Could not resolve private symbols\n");
-        return KERN_FAILURE;
+int my_vfork(proc_t cp, void *uap, int32_t *retval)
+{
+    int err = g_orig_vfork(cp, uap, retval);
+    if (!err && process_tree_active()) {
+        process_spawned(cp, retval[0]);
     }
     
-    struct segment_command_64* dataseg = find_segment_64(kernel_hdr, SEG_DATA);
-    if (!dataseg) {
-        printf("Can't find kernel data segment\n");
-        return KERN_FAILURE;
+    return err;
+}
+
+// Child pid is only known if caller asked for it, NULL pid pointer leaves child unprotected.
+// It is read back from user memory, process_spawned checks that the pid really is a child of cp.
+int my_posix_spawn(proc_t cp, struct posix_spawn_args *uap, int32_t *retval)
+{
+    int err = g_orig_posix_spawn(cp, uap, retval);
+    if (!err && uap->pid && process_tree_active()) {
+        int32_t child = 0;
+        if (!copyin(uap->pid, &child, sizeof(child))) {
+            process_spawned(cp, child);
+        }
     }
     
-    printf("kernel data segment @ 0x%llx, %llu bytes\n", dataseg->vmaddr, dataseg->vmsize);
+    return err;
+}
 
-    // TODO: non-yosemite structures
-    if (!find_syscall_tables(dataseg, &g_sysent_table, &g_mach_trap_table)) {
-        printf("Can't find syscall tables\n");
-        return KERN_FAILURE;
+// Caller may move itself or one of its children, group of a protected process is updated once the move is done
+int my_setpgid(proc_t cp, struct setpgid_args *uap, int32_t *retval)
+{
+    int err = g_orig_setpgid(cp, uap, retval);
+    if (!err && g_protect.count) {
+        process_regrouped(uap->pid ? uap->pid : proc_pid(cp));
+    }
+    
+    return err;
+}
+
+int my_setsid(proc_t cp, void *uap, int32_t *retval)
+{
+    int err = g_orig_setsid(cp, uap, retval);
+    if (!err && g_protect.count) {
+        process_regrouped(proc_pid(cp));
+    }
+    
+    return err;
+}
+
+// Protected process may get a new task on exec, keep task index pointing at the live one
+static void process_execed(proc_t cp)
+{
+    uint64_t start = rdtsc();
+    int32_t pid = proc_pid(cp);
+    task_t task = proc_task(cp);
+    
+    lck_rw_lock_shared(g_protect_lock);
+    const struct protect_entry* entry = protect_find_pid(&g_protect, pid);
+    int update = (entry && entry->task != task);
+    lck_rw_unlock_shared(g_protect_lock);
+    
+    if (update) {
+        lck_rw_lock_exclusive(g_protect_lock);
+        protect_exec(&g_protect, pid, task);
+        lck_rw_unlock_exclusive(g_protect_lock);
+    }
+    
+    hookstat_account(HOOKSTAT_PROCESS_TREE, start);
+}
+
+int my_execve(proc_t cp, void *uap, int32_t *retval)
+{
+    int err = g_orig_execve(cp, uap, retval);
+    if (!err && g_protect.count) {
+        process_execed(cp);
+    }
+    
+    return err;
+}
+
+// execve with a MAC label, same exec path in the kernel
+int my_mac_execve(proc_t cp, void *uap, int32_t *retval)
+{
+    int err = g_orig_mac_execve(cp, uap, retval);
+    if (!err && g_protect.count) {
+        process_execed(cp);
+    }
+    
+    return err;
+}
+
+//
+// Hook registry
+//
+
+struct hook_desc {
+    int     table;      /* HOOK_TABLE_* */
+    int     num;        /* syscall or trap number */
+    void*   hook;       /* our handler */
+    void**  orig;       /* where to save original handler */
+};
+
+// Entries are listed in hooks.h, so killctl startbench installs the same set
+#define HOOK_DESC(table, num, handler, original)    { table, num, handler, (void**)&original },
+static const struct hook_desc g_hooks[] = {
+    KILLHOOK_HOOKS(HOOK_DESC)
+};
+#undef HOOK_DESC
+
+#define HOOK_COUNT  (sizeof(g_hooks) / sizeof(g_hooks[0]))
+
+_Static_assert(HOOK_COUNT <= KILLHOOK_MAX_HOOKS, "hook status bitmap is too small");
+_Static_assert(2 + HOOK_COUNT <= INTEGRITY_MAX_REGIONS, "integrity watchdog can't watch both tables and every hooked entry");
+
+// Table slots of registered hooks, filled once syscall tables are found
+static struct hookcheck_slot g_hook_slots[HOOK_COUNT];
+
+static void hooks_init_slots(void)
+{
+    for (unsigned i = 0; i < HOOK_COUNT; ++i) {
+        const struct hook_desc* desc = &g_hooks[i];
+        g_hook_slots[i].slot = (desc->table == HOOK_TABLE_SYSENT ? sysent_get_call_slot(desc->num) : mach_table_get_trap_slot(desc->num));
+        g_hook_slots[i].expected = desc->hook;
+    }
+}
+
+// Install all registered hooks. Call with vm protection disabled.
+static void hooks_install(void)
+{
+    for (unsigned i = 0; i < HOOK_COUNT; ++i) {
+        const struct hook_desc* desc = &g_hooks[i];
+        if (desc->table == HOOK_TABLE_SYSENT) {
+            *desc->orig = sysent_hook_call(desc->num, desc->hook);
+        } else {
+            *desc->orig = mach_table_hook_trap(desc->num, desc->hook);
+        }
+    }
+}
+
+// Restore original handlers in slots which still hold our hooks,
+// entries overwritten by someone else are left alone. Call with vm protection disabled.
+static void hooks_uninstall(void)
+{
+    for (unsigned i = 0; i < HOOK_COUNT; ++i) {
+        const struct hook_desc* desc = &g_hooks[i];
+        if (*g_hook_slots[i].slot != desc->hook) {
+            continue;
+        }
+        
+        if (desc->table == HOOK_TABLE_SYSENT) {
+            sysent_set_call(desc->num, *desc->orig);
+        } else {
+            mach_table_set_trap(desc->num, *desc->orig);
+        }
+    }
+}
+
+// Returns number of registered hooks which are no longer installed, marks them in lost bitmap
+static unsigned hooks_verify(uint64_t lost[HOOKCHECK_BITMAP_WORDS(HOOK_COUNT)])
+{
+    return hookcheck_verify(g_hook_slots, HOOK_COUNT, lost);
+}
+
+//
+// Table entry attribution
+//
+
+#define TABLES_REPORT_MAX   16      /* Entries logged individually per pass */
+
+static int is_own_hook(const void* handler)
+{
+    for (unsigned i = 0; i < HOOK_COUNT; ++i) {
+        if (handler == g_hooks[i].hook) {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+// Our hook, kernel symbol or raw pointer if kernel symbols are not available
+static void describe_handler(const void* handler, char* buf, size_t size)
+{
+    if (is_own_hook(handler)) {
+        snprintf(buf, size, "killhook");
+    } else if (g_symindex.count) {
+        symindex_format(&g_symindex, (uint64_t)(uintptr_t)handler, buf, size);
+    } else {
+        snprintf(buf, size, "%p", handler);
+    }
+}
+
+// Entries of both tables, sysent comes first
+static unsigned tables_entry_count(void)
+{
+    return (unsigned)*nsysent + MACH_TRAP_TABLE_COUNT;
+}
+
+static void* tables_entry_handler(unsigned n, const char** table, int* num)
+{
+    if (n < (unsigned)*nsysent) {
+        *table = "sysent";
+        *num = (int)n;
+        return sysent_get_call(*num);
+    }
+    
+    *table = "mach_trap";
+    *num = (int)(n - (unsigned)*nsysent);
+    return mach_table_get_trap(*num);
+}
+
+// Single pass over both tables taking a new snapshot of all handlers.
+// First pass reports entries pointing outside kernel image, later passes report entries changed since the previous one.
+// Entries switched to our own hooks are not reported. Returns number of reported entries.
+static unsigned tables_attribute(int first_pass)
+{
+    if (!g_table_snapshot) {
+        return 0;
+    }
+    
+    unsigned reported = 0;
+    unsigned count = tables_entry_count();
+    for (unsigned n = 0; n < count; ++n) {
+        const char* table;
+        int num;
+        void* handler = tables_entry_handler(n, &table, &num);
+        void* previous = g_table_snapshot[n];
+        g_table_snapshot[n] = handler;
+        
+        if (is_own_hook(handler)) {
+            continue;
+        }
+        
+        if (first_pass ? (!g_symindex.count || symindex_contains(&g_symindex, (uint64_t)(uintptr_t)handler)) : (handler == previous)) {
+            continue;
+        }
+        
+        if (reported++ >= TABLES_REPORT_MAX) {
+            continue;
+        }
+        
+        char now[96];
+        describe_handler(handler, now, sizeof(now));
+        if (first_pass) {
+            printf("%s[%d] already points to %s (%p)\n", table, num, now, handler);
+        } else {
+            char was[96];
+            describe_handler(previous, was, sizeof(was));
+            printf("%s[%d] changed from %s to %s (%p)\n", table, num, was, now, handler);
+        }
+    }
+    
+    if (reported > TABLES_REPORT_MAX) {
+        printf("... and %u more table entries\n", reported - TABLES_REPORT_MAX);
+    }
+    
+    return reported;
+}
+
+//
+// Syscall table integrity watchdog
+//
+
+// Collect counters into telemetry page. Call with g_integrity_lock held.
+static void telemetry_refresh(void)
+{
+    if (!g_telemetry) {
+        return;
+    }
+    
+    struct killhook_telemetry_data* data = &g_telemetry_scratch;
+    memset(data, 0, sizeof(*data));
+    
+    data->updates = g_telemetry->data.updates + 1;
+    data->time = mach_absolute_time();
+    
+    lck_rw_lock_shared(g_protect_lock);
+    data->targets = g_protect.count;
+    data->groups = g_protect.ngroups;
+    data->trusted = g_trust.count;
+    for (uint32_t i = 0; i < g_protect.count && i < KILLHOOK_MAX_TARGETS; ++i) {
+        data->target_pids[i] = g_protect.entries[i].pid;
+    }
+    lck_rw_unlock_shared(g_protect_lock);
+    
+    data->msg_filter = (uint32_t)g_msg_filter;
+    data->nhooks = (uint32_t)HOOK_COUNT;
+    data->nlost = hooks_verify(data->lost);
+    data->integrity_passes = g_integrity.passes;
+    data->integrity_mismatches = g_integrity.mismatches;
+    data->audit_dropped = g_auditq.dropped;
+    
+    for (unsigned cpu = 0; cpu < HOOKSTAT_MAX_CPUS; ++cpu) {
+        for (unsigned hook = 0; hook < HOOKSTAT_COUNT; ++hook) {
+            data->hook_calls[hook] += g_hookstat[cpu].hist[hook].count;
+        }
+    }
+    
+    telemetry_publish(g_telemetry, data);
+}
+
+// Tick handler: hash next chunk of the watched entries and report foreign modifications
+static void integrity_tick(thread_call_param_t param0, thread_call_param_t param1)
+{
+    lck_mtx_lock(g_integrity_lock);
+    
+    int res = integrity_step(&g_integrity, INTEGRITY_CHUNK_BYTES);
+    if (res == INTEGRITY_MISMATCH) {
+        printf("integrity: syscall tables modified by someone else (%llu mismatches in %llu passes)\n",
+               g_integrity.mismatches, g_integrity.passes);
+        tables_attribute(0);
+        
+        // Report once per modification
+        integrity_rebaseline(&g_integrity);
+    }
+    
+    telemetry_refresh();
+    
+    lck_mtx_unlock(g_integrity_lock);
+    
+    uint64_t deadline = 0;
+    clock_interval_to_deadline(INTEGRITY_INTERVAL_MS, kMillisecondScale, &deadline);
+    thread_call_enter_delayed(g_integrity_call, deadline);
+}
+
+// (Re)build watched region list and take a new baseline. Call with g_integrity_lock held.
+static void integrity_setup_regions(void)
+{
+    uint64_t passes = g_integrity.passes;
+    uint64_t mismatches = g_integrity.mismatches;
+    
+    integrity_init(&g_integrity);
+    g_integrity.passes = passes;
+    g_integrity.mismatches = mismatches;
+    
+    unsigned dropped = 0;
+    if (g_integrity_full) {
+        dropped += !integrity_add_region(&g_integrity, g_sysent_table, *nsysent * sysent_entry_size());
+        dropped += !integrity_add_region(&g_integrity, g_mach_trap_table, MACH_TRAP_TABLE_COUNT * mach_table_entry_size());
+    } else {
+        for (unsigned i = 0; i < HOOK_COUNT; ++i) {
+            if (g_hooks[i].table == HOOK_TABLE_SYSENT) {
+                dropped += !integrity_add_region(&g_integrity, sysent_get_entry(g_hooks[i].num), sysent_entry_size());
+            } else {
+                dropped += !integrity_add_region(&g_integrity, mach_table_get_entry(g_hooks[i].num), mach_table_entry_size());
+            }
+        }
+    }
+    
+    // Assert below keeps this from happening, a region left out would never be checked
+    if (dropped) {
+        printf("integrity: %u regions are not watched, region table is full\n", dropped);
+    }
+    
+    integrity_rebaseline(&g_integrity);
+}
+
+static void integrity_watchdog_start(void)
+{
+    lck_mtx_lock(g_integrity_lock);
+    integrity_setup_regions();
+    telemetry_refresh();
+    lck_mtx_unlock(g_integrity_lock);
+    
+    thread_call_enter(g_integrity_call);
+}
+
+static void integrity_watchdog_stop(void)
+{
+    // Tick handler rearms itself, so wait for it to finish and cancel once more
+    thread_call_cancel_wait(g_integrity_call);
+    thread_call_cancel(g_integrity_call);
+}
+
+//
+// Telemetry page
+//
+
+// Create telemetry page as a named entry and map it into the kernel. Failure only disables mapping.
+// Page never comes from kalloc, so a client mapping that outlives the kext can't see reused kernel memory.
+static void telemetry_start(void)
+{
+    if (!kernel_map_ptr || !get_task_map || !mach_make_memory_entry_64 || !mach_vm_map || !mach_vm_deallocate || !ipc_port_release_send) {
+        printf("telemetry page is not available on this kernel\n");
+        return;
+    }
+    
+    memory_object_size_t size = PAGE_SIZE;
+    if (KERN_SUCCESS != mach_make_memory_entry_64(*kernel_map_ptr, &size, 0, MAP_MEM_NAMED_CREATE | VM_PROT_READ | VM_PROT_WRITE, &g_telemetry_entry, NULL)) {
+        printf("Failed to create telemetry memory entry\n");
+        return;
+    }
+    
+    mach_vm_offset_t address = 0;
+    if (KERN_SUCCESS != mach_vm_map(*kernel_map_ptr, &address, PAGE_SIZE, 0, VM_FLAGS_ANYWHERE, g_telemetry_entry, 0, FALSE,
+                                    VM_PROT_READ | VM_PROT_WRITE, VM_PROT_READ | VM_PROT_WRITE, VM_INHERIT_NONE)) {
+        printf("Failed to map telemetry page\n");
+        ipc_port_release_send(g_telemetry_entry);
+        g_telemetry_entry = NULL;
+        return;
+    }
+    
+    // Fresh VM object is zero filled
+    struct killhook_telemetry* page = (struct killhook_telemetry*)(uintptr_t)address;
+    telemetry_init(page);
+    g_telemetry = page;
+}
+
+// Drops kernel references only, VM object stays until the last client unmaps it
+static void telemetry_stop(void)
+{
+    if (!g_telemetry) {
+        return;
+    }
+    
+    mach_vm_deallocate(*kernel_map_ptr, (mach_vm_offset_t)(uintptr_t)g_telemetry, PAGE_SIZE);
+    ipc_port_release_send(g_telemetry_entry);
+    g_telemetry_entry = NULL;
+    g_telemetry = NULL;
+}
+
+//
+// Start-up profile
+//
+
+static uint64_t startprof_now(void)
+{
+    uint64_t ns = 0;
+    absolutetime_to_nanoseconds(mach_absolute_time(), &ns);
+    return ns;
+}
+
+// Read or write whole history file. Returns 0 on success.
+static int startprof_file_io(struct startprof_history* history, int write)
+{
+    vfs_context_t context = vfs_context_create(NULL);
+    if (!context) {
+        return ENOMEM;
+    }
+    
+    int fmode = (write ? (FWRITE | O_CREAT | O_TRUNC) : FREAD);
+    vnode_t vnode = NULL;
+    int err = vnode_open(STARTPROF_PATH, fmode, S_IRUSR | S_IWUSR, 0, &vnode, context);
+    if (err) {
+        vfs_context_rele(context);
+        return err;
+    }
+    
+    uio_t uio = uio_create(1, 0, UIO_SYSSPACE, (write ? UIO_WRITE : UIO_READ));
+    if (!uio) {
+        err = ENOMEM;
+        goto done;
+    }
+    
+    err = uio_addiov(uio, CAST_USER_ADDR_T(history), sizeof(*history));
+    if (!err) {
+        err = (write ? VNOP_WRITE(vnode, uio, 0, context) : VNOP_READ(vnode, uio, 0, context));
+    }
+    if (!err && uio_resid(uio) != 0) {
+        err = EIO;
+    }
+    
+done:
+    if (uio) {
+        uio_free(uio);
+    }
+    vnode_close(vnode, (write ? FWRITE : FREAD), context);
+    vfs_context_rele(context);
+    return err;
+}
+
+// Add profile of this start-up to persisted history
+static void startprof_record(const struct startprof_profile* profile)
+{
+    if (startprof_file_io(&g_startprof, 0) || !startprof_history_valid(&g_startprof, sizeof(g_startprof))) {
+        startprof_history_init(&g_startprof);
+    }
+    
+    startprof_history_push(&g_startprof, profile);
+    
+    int err = startprof_file_io(&g_startprof, 1);
+    if (err) {
+        printf("Failed to save start-up profile: %d\n", err);
+    }
+}
+
+//
+// Entry and init
+//
+
+// kext uses sysctl nodes to communicate with the client:
+// 'debug.killhook.pid' - set 32bit pid value for process to protect
+// 'debug.killhook.unhook' - set to 1 to unhook all syscalls before unloading kext
+// 'debug.killhook.hookstat' - read struct hookstat_snapshot with hook overhead histograms
+// 'debug.killhook.hookstat_reset' - set to 1 to reset hook overhead histograms
+// 'debug.killhook.integrity' - read struct killhook_integrity_stats
+// 'debug.killhook.integrity_full' - set to 1 to fingerprint whole syscall tables instead of hooked entries only
+// 'debug.killhook.hooks' - read struct killhook_hooks_status with a bitmap of lost hooks
+// 'debug.killhook.ctl' - write a batch of operations (see ctlmsg.h) applied atomically, read struct killhook_ctl_reply
+// 'debug.killhook.msg_filter' - mach message filtering mode, see PROTECT_MSG_*
+// 'debug.killhook.startprof' - read struct startprof_history with the last start-up phase timings
+// 'debug.killhook.telemetry' - root only, map telemetry page (see telemetry.h) read-only and read struct killhook_telemetry_map,
+//                              every read adds a mapping the caller has to munmap
+
+static int sysctl_killhook_pid SYSCTL_HANDLER_ARGS;
+static int sysctl_killhook_unhook SYSCTL_HANDLER_ARGS;
+static int sysctl_killhook_hookstat SYSCTL_HANDLER_ARGS;
+static int sysctl_killhook_hookstat_reset SYSCTL_HANDLER_ARGS;
+static int sysctl_killhook_integrity SYSCTL_HANDLER_ARGS;
+static int sysctl_killhook_integrity_full SYSCTL_HANDLER_ARGS;
+static int sysctl_killhook_hooks SYSCTL_HANDLER_ARGS;
+static int sysctl_killhook_ctl SYSCTL_HANDLER_ARGS;
+static int sysctl_killhook_msg_filter SYSCTL_HANDLER_ARGS;
+static int sysctl_killhook_telemetry SYSCTL_HANDLER_ARGS;
+static int sysctl_killhook_startprof SYSCTL_HANDLER_ARGS;
+
+SYSCTL_NODE(_debug, OID_AUTO, killhook, CTLFLAG_RW, 0, "kill hook API");
+SYSCTL_PROC(_debug_killhook, OID_AUTO, pid, (CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_SECURE), &g_pid, 0, sysctl_killhook_pid, "I", "");
+SYSCTL_PROC(_debug_killhook, OID_AUTO, unhook, (CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_SECURE), &g_unhook, 0, sysctl_killhook_unhook, "I", "");
+SYSCTL_PROC(_debug_killhook, OID_AUTO, hookstat, (CTLTYPE_OPAQUE | CTLFLAG_RD), NULL, 0, sysctl_killhook_hookstat, "S,hookstat_snapshot", "");
+SYSCTL_PROC(_debug_killhook, OID_AUTO, hookstat_reset, (CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_SECURE), &g_hookstat_reset, 0, sysctl_killhook_hookstat_reset, "I", "");
+SYSCTL_PROC(_debug_killhook, OID_AUTO, integrity, (CTLTYPE_OPAQUE | CTLFLAG_RD), NULL, 0, sysctl_killhook_integrity, "S,killhook_integrity_stats", "");
+SYSCTL_PROC(_debug_killhook, OID_AUTO, integrity_full, (CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_SECURE), &g_integrity_full, 0, sysctl_killhook_integrity_full, "I", "");
+SYSCTL_PROC(_debug_killhook, OID_AUTO, hooks, (CTLTYPE_OPAQUE | CTLFLAG_RD), NULL, 0, sysctl_killhook_hooks, "S,killhook_hooks_status", "");
+SYSCTL_PROC(_debug_killhook, OID_AUTO, ctl, (CTLTYPE_OPAQUE | CTLFLAG_RW | CTLFLAG_SECURE), NULL, 0, sysctl_killhook_ctl, "S,killhook_ctl_reply", "");
+SYSCTL_PROC(_debug_killhook, OID_AUTO, msg_filter, (CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_SECURE), &g_msg_filter, 0, sysctl_killhook_msg_filter, "I", "");
+SYSCTL_PROC(_debug_killhook, OID_AUTO, telemetry, (CTLTYPE_OPAQUE | CTLFLAG_RD), NULL, 0, sysctl_killhook_telemetry, "S,killhook_telemetry_map", "");
+SYSCTL_PROC(_debug_killhook, OID_AUTO, startprof, (CTLTYPE_OPAQUE | CTLFLAG_RD), NULL, 0, sysctl_killhook_startprof, "S,startprof_history", "");
+
+static int sysctl_killhook_pid(struct sysctl_oid *oidp, void *arg1, int arg2, struct sysctl_req *req)
+{
+    int32_t curPid = g_pid;
+    int res = sysctl_handle_int(oidp, oidp->oid_arg1, oidp->oid_arg2, req);
+    
+    if (g_pid != curPid) {
+        
+        lck_rw_lock_exclusive(g_protect_lock);
+        
+        if (curPid) {
+            protect_remove(&g_protect, curPid);
+        }
+        
+        proc_t proc = (g_pid ? proc_find(g_pid) : NULL);
+        if (proc) {
+            task_t task = proc_task(proc);
+            protect_add(&g_protect, g_pid, proc_pgrpid(proc), PROTECT_SIGMASK_DEFAULT, 0, task);
+            proc_rele(proc);
+            printf("PID changed to %d, task %p\n", g_pid, task);
+        }
+        
+        g_protect_gen++;
+        
+        lck_rw_unlock_exclusive(g_protect_lock);
+    }
+    
+    return res;
+}
+
+// Returns TRUE if any of our hooks is still installed
+static int syscalls_hooked(void)
+{
+    uint64_t lost[HOOKCHECK_BITMAP_WORDS(HOOK_COUNT)];
+    return (hooks_verify(lost) < HOOK_COUNT);
+}
+
+static int sysctl_killhook_unhook(struct sysctl_oid *oidp, void *arg1, int arg2, struct sysctl_req *req)
+{
+    int res = sysctl_handle_int(oidp, oidp->oid_arg1, oidp->oid_arg2, req);
+    if (g_unhook && syscalls_hooked())
+    {
+        // Unhook syscalls
+        // See comments in test_stop why this is done in sysctl handler
+        // Our own modification is not a foreign one
+        integrity_watchdog_stop();
+        
+        disable_vm_protection();
+        {
+            hooks_uninstall();
+        }
+        enable_vm_protection();
+    }
+    
+    return res;
+}
+
+static int sysctl_killhook_hookstat(struct sysctl_oid *oidp, void *arg1, int arg2, struct sysctl_req *req)
+{
+    // Snapshot is too large for kernel stack
+    struct hookstat_snapshot* snapshot = OSMalloc(sizeof(*snapshot), g_tag);
+    if (!snapshot) {
+        return ENOMEM;
+    }
+    
+    hookstat_merge(g_hookstat, HOOKSTAT_MAX_CPUS, snapshot);
+    int res = SYSCTL_OUT(req, snapshot, sizeof(*snapshot));
+    
+    OSFree(snapshot, sizeof(*snapshot), g_tag);
+    return res;
+}
+
+static int sysctl_killhook_hookstat_reset(struct sysctl_oid *oidp, void *arg1, int arg2, struct sysctl_req *req)
+{
+    int res = sysctl_handle_int(oidp, oidp->oid_arg1, oidp->oid_arg2, req);
+    if (g_hookstat_reset) {
+        hookstat_reset(g_hookstat, HOOKSTAT_MAX_CPUS);
+        g_hookstat_reset = 0;
+    }
+    
+    return res;
+}
+
+static int sysctl_killhook_integrity(struct sysctl_oid *oidp, void *arg1, int arg2, struct sysctl_req *req)
+{
+    struct killhook_integrity_stats stats;
+    
+    lck_mtx_lock(g_integrity_lock);
+    stats.version = KILLHOOK_INTEGRITY_VERSION;
+    stats.full = g_integrity_full;
+    stats.passes = g_integrity.passes;
+    stats.mismatches = g_integrity.mismatches;
+    stats.baseline = g_integrity.baseline;
+    lck_mtx_unlock(g_integrity_lock);
+    
+    return SYSCTL_OUT(req, &stats, sizeof(stats));
+}
+
+static int sysctl_killhook_integrity_full(struct sysctl_oid *oidp, void *arg1, int arg2, struct sysctl_req *req)
+{
+    int cur_full = g_integrity_full;
+    int res = sysctl_handle_int(oidp, oidp->oid_arg1, oidp->oid_arg2, req);
+    
+    if (g_integrity_full != cur_full) {
+        lck_mtx_lock(g_integrity_lock);
+        integrity_setup_regions();
+        lck_mtx_unlock(g_integrity_lock);
+    }
+    
+    return res;
+}
+
+static int sysctl_killhook_msg_filter(struct sysctl_oid *oidp, void *arg1, int arg2, struct sysctl_req *req)
+{
+    int mode = g_msg_filter;
+    int res = sysctl_handle_int(oidp, &mode, 0, req);
+    
+    if (!res && req->newptr) {
+        if (mode < PROTECT_MSG_OFF || mode > PROTECT_MSG_FULL) {
+            return EINVAL;
+        }
+        
+        g_msg_filter = mode;
+    }
+    
+    return res;
+}
+
+static int sysctl_killhook_telemetry(struct sysctl_oid *oidp, void *arg1, int arg2, struct sysctl_req *req)
+{
+    if (!g_telemetry) {
+        return ENOTSUP;
+    }
+    
+    // Page lists protected pids
+    if (!kauth_cred_issuser(kauth_cred_get())) {
+        return EPERM;
+    }
+    
+    struct killhook_telemetry_map map;
+    memset(&map, 0, sizeof(map));
+    
+    // Size probe shouldn't leave a mapping behind
+    vm_map_t task_map = get_task_map(current_task());
+    if (req->oldptr) {
+        mach_vm_offset_t address = 0;
+        kern_return_t kr = mach_vm_map(task_map, &address, PAGE_SIZE, 0, VM_FLAGS_ANYWHERE,
+                                       g_telemetry_entry, 0, FALSE, VM_PROT_READ, VM_PROT_READ, VM_INHERIT_NONE);
+        if (kr != KERN_SUCCESS) {
+            return ENOMEM;
+        }
+        
+        map.version = KILLHOOK_TELEMETRY_VERSION;
+        map.size = PAGE_SIZE;
+        map.address = address;
+    }
+    
+    // Caller never learns about the mapping if copyout fails, so it can't unmap it either
+    int err = SYSCTL_OUT(req, &map, sizeof(map));
+    if (err && map.address) {
+        mach_vm_deallocate(task_map, map.address, PAGE_SIZE);
+    }
+    
+    return err;
+}
+
+static int sysctl_killhook_startprof(struct sysctl_oid *oidp, void *arg1, int arg2, struct sysctl_req *req)
+{
+    return SYSCTL_OUT(req, &g_startprof, sizeof(g_startprof));
+}
+
+static int sysctl_killhook_hooks(struct sysctl_oid *oidp, void *arg1, int arg2, struct sysctl_req *req)
+{
+    struct killhook_hooks_status status;
+    memset(&status, 0, sizeof(status));
+    
+    status.version = KILLHOOK_HOOKS_VERSION;
+    status.nhooks = (uint32_t)HOOK_COUNT;
+    status.nlost = hooks_verify(status.lost);
+    
+    return SYSCTL_OUT(req, &status, sizeof(status));
+}
+
+static int protect_errno(int res)
+{
+    switch (res) {
+        case PROTECT_OK:        return 0;
+        case PROTECT_NOT_FOUND: return ENOENT;
+        case PROTECT_FULL:      return ENOSPC;
+        default:                return EINVAL;
+    }
+}
+
+static int trustcache_errno(int res)
+{
+    switch (res) {
+        case TRUSTCACHE_OK:         return 0;
+        case TRUSTCACHE_NOT_FOUND:  return ENOENT;
+        case TRUSTCACHE_FULL:       return ENOSPC;
+        default:                    return EINVAL;
+    }
+}
+
+// Policy copy a control batch is applied to
+struct ctl_scratch {
+    struct protect_set  protect;
+    struct trustcache   trust;
+};
+
+// Apply a single control operation to policy copy
+static int ctl_apply_op(struct ctl_scratch* scratch, const struct ctlmsg_op* op, struct killhook_ctl_reply* reply)
+{
+    struct protect_set* set = &scratch->protect;
+    
+    switch (op->type) {
+        case CTLMSG_OP_ADD_TARGET: {
+            proc_t proc = proc_find(op->u.target.pid);
+            if (!proc) {
+                return ESRCH;
+            }
+            
+            uint64_t sigmask = (op->u.target.sigmask ? op->u.target.sigmask : PROTECT_SIGMASK_DEFAULT);
+            int res = protect_add(set, op->u.target.pid, proc_pgrpid(proc), sigmask, op->u.target.flags & PROTECT_FLAGS_USER, proc_task(proc));
+            proc_rele(proc);
+            return protect_errno(res);
+        }
+            
+        case CTLMSG_OP_SET_SIGMASK: {
+            const struct protect_entry* entry = protect_find_pid(set, op->u.target.pid);
+            if (!entry) {
+                return ENOENT;
+            }
+            
+            return protect_errno(protect_add(set, entry->pid, entry->pgid, op->u.target.sigmask, entry->flags, entry->task));
+        }
+            
+        case CTLMSG_OP_REMOVE_TARGET:
+            return protect_errno(protect_remove(set, op->u.pid.pid));
+            
+        case CTLMSG_OP_CLEAR_TARGETS:
+            protect_init(set);
+            return 0;
+            
+        case CTLMSG_OP_QUERY_STATS:
+            reply->flags |= KILLHOOK_CTL_REPLY_STATS;
+            return 0;
+            
+        case CTLMSG_OP_TRUST_ADD: {
+            proc_t proc = proc_find(op->u.trust.pid);
+            if (!proc) {
+                return ESRCH;
+            }
+            
+            // Refuse identity of a process which has already been replaced under the same pid
+            uint64_t start_time = proc_start_usec(proc);
+            proc_rele(proc);
+            if (op->u.trust.start_time && op->u.trust.start_time != start_time) {
+                return ESRCH;
+            }
+            
+            return trustcache_errno(trustcache_add(&scratch->trust, op->u.trust.pid, start_time, op->u.trust.flags));
+        }
+            
+        case CTLMSG_OP_TRUST_REMOVE:
+            return trustcache_errno(trustcache_remove(&scratch->trust, op->u.pid.pid));
+            
+        default:
+            return EINVAL;
+    }
+}
+
+// Apply batch to a copy of the policy and publish it only if every operation succeeded
+static void ctl_apply(const void* buf, size_t size, struct killhook_ctl_reply* reply)
+{
+    int res = ctlmsg_validate(buf, size);
+    if (res != CTLMSG_OK) {
+        reply->status = res;
+        reply->failed_op = KILLHOOK_CTL_NO_OP;
+        return;
+    }
+    
+    struct ctl_scratch* scratch = OSMalloc(sizeof(*scratch), g_tag);
+    if (!scratch) {
+        reply->op_errno = ENOMEM;
+        reply->failed_op = KILLHOOK_CTL_NO_OP;
+        return;
+    }
+    
+    lck_rw_lock_exclusive(g_protect_lock);
+    memcpy(&scratch->protect, &g_protect, sizeof(g_protect));
+    memcpy(&scratch->trust, &g_trust, sizeof(g_trust));
+    
+    struct ctlmsg_reader reader;
+    struct ctlmsg_op op;
+    ctlmsg_reader_init(&reader, buf, size);
+    
+    uint32_t index = 0;
+    while (ctlmsg_read_op(&reader, &op) == CTLMSG_OK) {
+        res = ctl_apply_op(scratch, &op, reply);
+        if (res) {
+            reply->op_errno = res;
+            reply->failed_op = index;
+            break;
+        }
+        index++;
+    }
+    
+    if (!reply->op_errno) {
+        memcpy(&g_protect, &scratch->protect, sizeof(g_protect));
+        memcpy(&g_trust, &scratch->trust, sizeof(g_trust));
+        g_protect_gen++;
+    }
+    
+    lck_rw_unlock_exclusive(g_protect_lock);
+    OSFree(scratch, sizeof(*scratch), g_tag);
+}
+
+static int sysctl_killhook_ctl(struct sysctl_oid *oidp, void *arg1, int arg2, struct sysctl_req *req)
+{
+    struct killhook_ctl_reply reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.version = KILLHOOK_CTL_VERSION;
+    
+    if (req->newptr) {
+        size_t size = req->newlen;
+        if (size < sizeof(struct ctlmsg_header) || size > CTLMSG_MAX_SIZE) {
+            return EINVAL;
+        }
+        
+        void* buf = OSMalloc((uint32_t)size, g_tag);
+        if (!buf) {
+            return ENOMEM;
+        }
+        
+        int res = SYSCTL_IN(req, buf, size);
+        if (!res) {
+            ctl_apply(buf, size, &reply);
+        }
+        
+        OSFree(buf, (uint32_t)size, g_tag);
+        if (res) {
+            return res;
+        }
+    } else {
+        // Plain read is a stats query
+        reply.flags |= KILLHOOK_CTL_REPLY_STATS;
+    }
+    
+    if (reply.flags & KILLHOOK_CTL_REPLY_STATS) {
+        uint64_t lost[HOOKCHECK_BITMAP_WORDS(HOOK_COUNT)];
+        reply.stats.hooks_lost = hooks_verify(lost);
+        
+        lck_rw_lock_shared(g_protect_lock);
+        reply.stats.targets = g_protect.count;
+        reply.stats.groups = g_protect.ngroups;
+        reply.stats.trusted = g_trust.count;
+        lck_rw_unlock_shared(g_protect_lock);
+        
+        lck_mtx_lock(g_integrity_lock);
+        reply.stats.integrity_mismatches = g_integrity.mismatches;
+        lck_mtx_unlock(g_integrity_lock);
+    }
+    
+    return SYSCTL_OUT(req, &reply, sizeof(reply));
+}
+
+static kern_return_t start(struct startprof_run* run)
+{
+    g_tag = OSMalloc_Tagalloc("test.kext", OSMT_DEFAULT);
+    if (!g_tag) {
+        printf("Failed to allocate OSMalloc tag\n");
+        return KERN_FAILURE;
+    }
+    
+    g_lock_group = lck_grp_alloc_init("test.kext", LCK_GRP_ATTR_NULL);
+    if (!g_lock_group) {
+        printf("Failed to create lock group\n");
+        return KERN_FAILURE;
+    }
+    
+    g_task_lock = lck_mtx_alloc_init(g_lock_group, LCK_ATTR_NULL);
+    if (!g_task_lock) {
+        printf("Failed to create lock group\n");
+        return KERN_FAILURE;
+    }
+    
+    g_protect_lock = lck_rw_alloc_init(g_lock_group, LCK_ATTR_NULL);
+    if (!g_protect_lock) {
+        printf("Failed to create protect lock\n");
+        return KERN_FAILURE;
+    }
+    
+    protect_init(&g_protect);
+    trustcache_init(&g_trust);
+    ratelimit_init(&g_ratelimit, RATELIMIT_RATE, RATELIMIT_BURST);
+    
+    g_integrity_lock = lck_mtx_alloc_init(g_lock_group, LCK_ATTR_NULL);
+    if (!g_integrity_lock) {
+        printf("Failed to create integrity lock\n");
+        return KERN_FAILURE;
+    }
+    
+    g_integrity_call = thread_call_allocate(integrity_tick, NULL);
+    if (!g_integrity_call) {
+        printf("Failed to allocate integrity thread call\n");
+        return KERN_FAILURE;
+    }
+    
+    g_audit_call = thread_call_allocate(audit_tick, NULL);
+    if (!g_audit_call) {
+        printf("Failed to allocate audit thread call\n");
+        return KERN_FAILURE;
+    }
+    
+    //
+    // We will attempt to hook sysent table to intercept syscalls we are interested in
+    // For that we will find kernel base address, find data segment in kernel mach-o headers
+    // and finally search for sysent pattern in data segment
+    //
+    
+    uint64_t probes = 0;
+    startprof_enter(run, STARTPROF_KERNEL_BASE, startprof_now());
+    uintptr_t kernel_base = find_kernel_base(&probes);
+    startprof_leave(run, startprof_now(), 0, probes);
+    if (kernel_base == INVALID_VADDR) {
+        printf("Can't find kernel base address\n");
+        return KERN_FAILURE;
+    }
+    
+    struct mach_header_64* kernel_hdr = (struct mach_header_64*)kernel_base;
+    if (kernel_hdr->magic != MH_MAGIC_64) {
+        printf("Wrong kernel header\n");
+        return KERN_FAILURE;
+    }
+
+    printf("kernel base @ %p\n", kernel_hdr);
+
+    // Resolve some private symbols we're going to need
+    struct resolver_stats before, after;
+    resolver_get_stats(&before);
+    startprof_enter(run, STARTPROF_RESOLVE, startprof_now());
+    if (!resolver_open()) {
+        printf("Failed to read kernel image\n");
+    }
+    // Symbol list is shared with killctl kdiff, see kextsyms.h
+    unsigned missing = 0;
+#define RESOLVE_SYMBOL(name, variable, required) \
+    variable = resolve_kernel_symbol(name, kernel_base); \
+    missing += (unsigned)((required) && !variable);
+    KILLHOOK_SYMBOLS(RESOLVE_SYMBOL)
+#undef RESOLVE_SYMBOL
+    
+    // Only used to name table entries, raw pointers are logged without it
+    if (!resolver_build_symindex(&g_symindex, kernel_base)) {
+        printf("Kernel symbol index is not available\n");
+    }
+    resolver_close();
+    resolver_get_stats(&after);
+    startprof_leave(run, startprof_now(), after.bytes_read - before.bytes_read, after.lookups - before.lookups);
+    if (missing) {
+        printf("Could not resolve private symbols\n");
+        return KERN_FAILURE;
+    }
+    
+    startprof_enter(run, STARTPROF_DATA_SEGMENT, startprof_now());
+    struct segment_command_64* dataseg = find_segment_64(kernel_hdr, SEG_DATA);
+    startprof_leave(run, startprof_now(), 0, kernel_hdr->ncmds);
+    if (!dataseg) {
+        printf("Can't find kernel data segment\n");
+        return KERN_FAILURE;
+    }
+    
+    printf("kernel data segment @ 0x%llx, %llu bytes\n", dataseg->vmaddr, dataseg->vmsize);
+
+    uint64_t scanned = 0;
+    probes = 0;
+    startprof_enter(run, STARTPROF_TABLE_SCAN, startprof_now());
+    int found = find_syscall_tables(dataseg, &g_sysent_table, &g_mach_trap_table, &scanned, &probes);
+    startprof_leave(run, startprof_now(), scanned, probes);
+    
+    // TODO: non-yosemite structures
+    if (!found) {
+        printf("Can't find syscall tables\n");
+        return KERN_FAILURE;
     }
     
     printf("sysent @ %p\n", g_sysent_table);
     printf("mach trap table @ %p\n", g_mach_trap_table);
     
+    g_table_snapshot_size = (uint32_t)(tables_entry_count() * sizeof(void*));
+    g_table_snapshot = OSMalloc(g_table_snapshot_size, g_tag);
+    if (g_table_snapshot) {
+        memset(g_table_snapshot, 0, g_table_snapshot_size);
+        tables_attribute(1);
+    }
+    
+    // Audit worker is started last so that no earlier failure leaves it running
+    auditq_init(&g_auditq);
+    audit_lru_init(&g_audit_lru);
+    
+    g_audit_stop = 0;
+    g_audit_reported_drops = 0;
+    thread_call_enter(g_audit_call);
+    
+    startprof_enter(run, STARTPROF_HOOK_INSTALL, startprof_now());
+    hooks_init_slots();
+    
     // sysent is in read-only memory since 10.8.
     // good thing that intel architecture allows us to disable vm write protection completely from ring0 with a CR0 bit
     disable_vm_protection();
     {
-        g_orig_kill = sysent_hook_call(SYS_kill, (sy_call_t*)my_kill);
-        g_mach_msg_trap = mach_table_hook_trap(MACH_MSG_TRAP, my_mach_msg_trap);
-        g_mach_msg_overwrite_trap = mach_table_hook_trap(MACH_MSG_OVERWRITE_TRAP, my_mach_msg_overwrite_trap);
+        hooks_install();
     }
     enable_vm_protection();
+    startprof_leave(run, startprof_now(), 0, HOOK_COUNT);
+    
+    // Snapshot our own hooks, they are never reported
+    tables_attribute(0);
+    
+    telemetry_start();
+    integrity_watchdog_start();
 
     sysctl_register_oid(&sysctl__debug_killhook);
     sysctl_register_oid(&sysctl__debug_killhook_pid);
     sysctl_register_oid(&sysctl__debug_killhook_unhook);
+    sysctl_register_oid(&sysctl__debug_killhook_hookstat);
+    sysctl_register_oid(&sysctl__debug_killhook_hookstat_reset);
+    sysctl_register_oid(&sysctl__debug_killhook_integrity);
+    sysctl_register_oid(&sysctl__debug_killhook_integrity_full);
+    sysctl_register_oid(&sysctl__debug_killhook_hooks);
+    sysctl_register_oid(&sysctl__debug_killhook_ctl);
+    sysctl_register_oid(&sysctl__debug_killhook_msg_filter);
+    sysctl_register_oid(&sysctl__debug_killhook_telemetry);
+    sysctl_register_oid(&sysctl__debug_killhook_startprof);
 
     return KERN_SUCCESS;
 }
 
+kern_return_t test_start(kmod_info_t * ki, void *d)
+{
+    clock_sec_t secs = 0;
+    clock_usec_t usecs = 0;
+    clock_get_calendar_microtime(&secs, &usecs);
+    
+    struct startprof_run run;
+    startprof_start(&run, secs, startprof_now());
+    
+    kern_return_t res = start(&run);
+    
+    startprof_finish(&run, startprof_now(), res);
+    startprof_record(&run.profile);
+    
+    return res;
+}
+
 kern_return_t test_stop(kmod_info_t *ki, void *d)
 {
     // At this point a pointer to one of our hooked syscall may already be loaded by unix_syscall64
@@ -499,10 +1998,34 @@ kern_return_t test_stop(kmod_info_t *ki, void *d)
     sysctl_unregister_oid(&sysctl__debug_killhook);
     sysctl_unregister_oid(&sysctl__debug_killhook_pid);
     sysctl_unregister_oid(&sysctl__debug_killhook_unhook);
+    sysctl_unregister_oid(&sysctl__debug_killhook_hookstat);
+    sysctl_unregister_oid(&sysctl__debug_killhook_hookstat_reset);
+    sysctl_unregister_oid(&sysctl__debug_killhook_integrity);
+    sysctl_unregister_oid(&sysctl__debug_killhook_integrity_full);
+    sysctl_unregister_oid(&sysctl__debug_killhook_hooks);
+    sysctl_unregister_oid(&sysctl__debug_killhook_ctl);
+    sysctl_unregister_oid(&sysctl__debug_killhook_msg_filter);
+    sysctl_unregister_oid(&sysctl__debug_killhook_telemetry);
+    sysctl_unregister_oid(&sysctl__debug_killhook_startprof);
+    
+    integrity_watchdog_stop();
+    thread_call_free(g_integrity_call);
+    telemetry_stop();
+    
+    audit_worker_stop();
+    thread_call_free(g_audit_call);
 
     lck_mtx_free(g_task_lock, g_lock_group);
+    lck_mtx_free(g_integrity_lock, g_lock_group);
+    lck_rw_free(g_protect_lock, g_lock_group);
     lck_grp_free(g_lock_group);
     
+    if (g_table_snapshot) {
+        OSFree(g_table_snapshot, g_table_snapshot_size, g_tag);
+        g_table_snapshot = NULL;
+    }
+    resolver_free_symindex(&g_symindex);
+    
     OSMalloc_Tagfree(g_tag);
     
     return KERN_SUCCESS;
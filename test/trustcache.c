@@ -0,0 +1,88 @@
+//
+//  trustcache.c
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+
+#include <string.h>
+
+#include "trustcache.h"
+
+static inline struct trustcache_entry* trustcache_set(const struct trustcache* cache, int32_t pid)
+{
+    uint32_t hash = (uint32_t)(((uint64_t)(uint32_t)pid * 0x9e3779b97f4a7c15ull) >> 32);
+    return (struct trustcache_entry*)cache->sets[hash & (TRUSTCACHE_SETS - 1)];
+}
+
+void trustcache_init(struct trustcache* cache)
+{
+    memset(cache, 0, sizeof(*cache));
+}
+
+int trustcache_add(struct trustcache* cache, int32_t pid, uint64_t start_time, uint32_t flags)
+{
+    if (pid <= 0) {
+        return TRUSTCACHE_INVALID;
+    }
+
+    struct trustcache_entry* set = trustcache_set(cache, pid);
+    struct trustcache_entry* free_entry = NULL;
+
+    for (unsigned i = 0; i < TRUSTCACHE_WAYS; ++i) {
+        if (set[i].pid == pid) {
+            set[i].start_time = start_time;
+            set[i].flags = flags;
+            return TRUSTCACHE_OK;
+        }
+
+        if (!set[i].pid && !free_entry) {
+            free_entry = &set[i];
+        }
+    }
+
+    // Trusted identities are pushed by userspace, silently evicting one would be a surprise
+    if (!free_entry) {
+        return TRUSTCACHE_FULL;
+    }
+
+    free_entry->pid = pid;
+    free_entry->start_time = start_time;
+    free_entry->flags = flags;
+    cache->count++;
+    return TRUSTCACHE_OK;
+}
+
+int trustcache_remove(struct trustcache* cache, int32_t pid)
+{
+    if (pid <= 0) {
+        return TRUSTCACHE_INVALID;
+    }
+
+    struct trustcache_entry* set = trustcache_set(cache, pid);
+    for (unsigned i = 0; i < TRUSTCACHE_WAYS; ++i) {
+        if (set[i].pid == pid) {
+            memset(&set[i], 0, sizeof(set[i]));
+            cache->count--;
+            return TRUSTCACHE_OK;
+        }
+    }
+
+    return TRUSTCACHE_NOT_FOUND;
+}
+
+const struct trustcache_entry* trustcache_find(const struct trustcache* cache, int32_t pid)
+{
+    if (pid <= 0) {
+        return NULL;
+    }
+
+    const struct trustcache_entry* set = trustcache_set(cache, pid);
+    for (unsigned i = 0; i < TRUSTCACHE_WAYS; ++i) {
+        if (set[i].pid == pid) {
+            return &set[i];
+        }
+    }
+
+    return NULL;
+}
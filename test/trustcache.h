@@ -0,0 +1,73 @@
+//
+//  trustcache.h
+//  test
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Fixed size cache of pre-verified caller identities.
+//  Entries are keyed by pid and process start time so that a reused pid never inherits trust.
+//  Does not depend on kernel headers, callers provide locking.
+//
+
+#ifndef trustcache_h
+#define trustcache_h
+
+#include <stdint.h>
+
+#define TRUSTCACHE_SETS     64      /* power of 2 */
+#define TRUSTCACHE_WAYS     4       /* entries per set, one set fits a cache line pair */
+
+// trustcache_* return codes
+enum {
+    TRUSTCACHE_OK = 0,
+    TRUSTCACHE_NOT_FOUND,
+    TRUSTCACHE_FULL,
+    TRUSTCACHE_INVALID,
+};
+
+struct trustcache_entry {
+    int32_t  pid;           /* 0 if entry is free */
+    uint32_t flags;
+    uint64_t start_time;    /* process start time in microseconds */
+};
+
+struct trustcache {
+    struct trustcache_entry sets[TRUSTCACHE_SETS][TRUSTCACHE_WAYS];
+    uint32_t count;
+};
+
+/**
+ * \brief   Reset cache to empty state
+ */
+void trustcache_init(struct trustcache* cache);
+
+/**
+ * \brief   Add caller identity or update existing entry for pid
+ */
+int trustcache_add(struct trustcache* cache, int32_t pid, uint64_t start_time, uint32_t flags);
+
+/**
+ * \brief   Remove entry for pid
+ */
+int trustcache_remove(struct trustcache* cache, int32_t pid);
+
+/**
+ * \brief   Find entry for pid regardless of start time, NULL if there is none
+ */
+const struct trustcache_entry* trustcache_find(const struct trustcache* cache, int32_t pid);
+
+/**
+ * \brief   Check if caller is trusted. Start time is only fetched if pid is present,
+ *          so untrusted callers pay for a single set probe.
+ */
+static inline int trustcache_check(const struct trustcache* cache, int32_t pid, uint64_t (*start_time)(void* ctx), void* ctx)
+{
+    if (!cache->count) {
+        return 0;
+    }
+
+    const struct trustcache_entry* entry = trustcache_find(cache, pid);
+    return (entry && entry->start_time == start_time(ctx));
+}
+
+#endif /* trustcache_h */
@@ -0,0 +1,177 @@
+//
+//  bench_auditq.c
+//  tests
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Audit queue cost: uncontended post and take, batch processing with caller cache hits and misses,
+//  and throughput, full queue rate and post to emit latency with concurrent producers.
+//
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+#include "check.h"
+#include "auditq.h"
+
+#define AUDIT_BATCH     64      /* as in test.c */
+#define ROUNDS          2000000
+#define PER_PRODUCER    1000000
+#define MAX_PRODUCERS   4
+#define LATENCY_BUCKETS 64      /* log2 of nanoseconds */
+
+static struct auditq g_queue;
+
+static void enrich_name(int32_t pid, char* name, uint32_t size, void* ctx)
+{
+    snprintf(name, size, "process-%d", pid);
+}
+
+static void emit_nothing(const struct audit_record* record, const char* caller_name, void* ctx)
+{
+    CHECK_KEEP(caller_name);
+}
+
+static void bench_uncontended(void)
+{
+    auditq_init(&g_queue);
+    struct audit_record record = { 0 };
+    record.event = AUDIT_KILL_DENIED;
+
+    uint64_t start = check_now_ns();
+    for (unsigned i = 0; i < ROUNDS; ++i) {
+        record.arg = (int32_t)i;
+        CHECK(auditq_post(&g_queue, &record));
+        CHECK(auditq_take(&g_queue, &record));
+    }
+    uint64_t elapsed = check_now_ns() - start;
+    printf("%-30s %8.1f ns/record\n", "post and take, uncontended", (double)elapsed / ROUNDS);
+}
+
+static void bench_process(const char* name, unsigned ncallers)
+{
+    auditq_init(&g_queue);
+    struct audit_lru lru;
+    audit_lru_init(&lru);
+
+    struct audit_record record = { 0 };
+    record.event = AUDIT_KILL_DENIED;
+
+    uint64_t elapsed = 0;
+    for (unsigned done = 0; done < ROUNDS; done += AUDITQ_SIZE) {
+        for (unsigned i = 0; i < AUDITQ_SIZE; ++i) {
+            record.caller = (int32_t)((done + i) % ncallers) + 1;
+            auditq_post(&g_queue, &record);
+        }
+
+        uint64_t start = check_now_ns();
+        while (auditq_process(&g_queue, &lru, AUDIT_BATCH, enrich_name, emit_nothing, NULL) == AUDIT_BATCH) {
+        }
+        elapsed += check_now_ns() - start;
+    }
+
+    printf("%-30s %8.1f ns/record  %5.1f%% cache hits\n", name, (double)elapsed / ROUNDS,
+           100.0 * lru.hits / (lru.hits + lru.misses));
+}
+
+//
+// Concurrent producers
+//
+
+struct latency {
+    uint64_t buckets[LATENCY_BUCKETS];
+    uint64_t count;
+};
+
+static unsigned g_producers_done;
+
+static void* producer_main(void* arg)
+{
+    struct audit_record record = { 0 };
+    record.caller = (int32_t)(intptr_t)arg;
+    record.event = AUDIT_KILL_DENIED;
+
+    for (unsigned i = 0; i < PER_PRODUCER; ++i) {
+        record.time = check_now_ns();
+        record.arg = (int32_t)i;
+        // Back off on a full queue so every record reaches the consumer and latency covers all of them
+        while (!auditq_post(&g_queue, &record)) {
+            sched_yield();
+        }
+    }
+
+    __atomic_fetch_add(&g_producers_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void emit_latency(const struct audit_record* record, const char* caller_name, void* ctx)
+{
+    struct latency* latency = ctx;
+    uint64_t ns = check_now_ns() - record->time;
+    latency->buckets[ns ? 63 - __builtin_clzll(ns) : 0]++;
+    latency->count++;
+}
+
+static uint64_t percentile(const struct latency* latency, double p)
+{
+    uint64_t want = (uint64_t)(latency->count * p);
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < LATENCY_BUCKETS; ++i) {
+        seen += latency->buckets[i];
+        if (seen > want) {
+            return 2ull << i;
+        }
+    }
+    return 0;
+}
+
+static void bench_producers(unsigned nproducers)
+{
+    auditq_init(&g_queue);
+    struct audit_lru lru;
+    audit_lru_init(&lru);
+    struct latency latency;
+    memset(&latency, 0, sizeof(latency));
+    g_producers_done = 0;
+
+    pthread_t threads[MAX_PRODUCERS];
+    uint64_t start = check_now_ns();
+    for (unsigned i = 0; i < nproducers; ++i) {
+        CHECK(pthread_create(&threads[i], NULL, producer_main, (void*)(intptr_t)(i + 1)) == 0);
+    }
+
+    // Consumer drains in audit tick batches and yields when the queue runs dry
+    for (;;) {
+        int done = (__atomic_load_n(&g_producers_done, __ATOMIC_ACQUIRE) == nproducers);
+        while (auditq_process(&g_queue, &lru, AUDIT_BATCH, enrich_name, emit_latency, &latency) == AUDIT_BATCH) {
+        }
+        if (done) {
+            break;
+        }
+        sched_yield();
+    }
+    uint64_t elapsed = check_now_ns() - start;
+
+    for (unsigned i = 0; i < nproducers; ++i) {
+        CHECK(pthread_join(threads[i], NULL) == 0);
+    }
+
+    uint64_t posted = (uint64_t)nproducers * PER_PRODUCER;
+    CHECK_EQ(latency.count, posted);
+    printf("%u producer(s)                  %8.1f ns/record  %5.1f%% posts found queue full  latency p50 < %llu ns  p99 < %llu ns\n",
+           nproducers, (double)elapsed / posted, 100.0 * g_queue.dropped / posted,
+           (unsigned long long)percentile(&latency, 0.5), (unsigned long long)percentile(&latency, 0.99));
+}
+
+int main(void)
+{
+    bench_uncontended();
+    bench_process("process, one caller", 1);
+    bench_process("process, cache sized callers", AUDIT_LRU_SIZE);
+    bench_process("process, every caller misses", AUDIT_LRU_SIZE + 1);
+    for (unsigned n = 1; n <= MAX_PRODUCERS; n *= 2) {
+        bench_producers(n);
+    }
+    return 0;
+}
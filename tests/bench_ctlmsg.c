@@ -0,0 +1,92 @@
+//
+//  bench_ctlmsg.c
+//  tests
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Control message codec cost: encode, validate and decode of single operations and of full 64KB batches.
+//
+
+#include <string.h>
+
+#include "check.h"
+#include "ctlmsg.h"
+
+#define TOTAL_OPS   20000000u
+
+static uint8_t g_buf[CTLMSG_MAX_SIZE];
+static struct ctlmsg_op g_ops[CTLMSG_MAX_SIZE / sizeof(struct ctlmsg_op_header)];
+
+static void bench(const char* name, unsigned count)
+{
+    unsigned batches = TOTAL_OPS / count;
+    size_t size = 0;
+
+    // Phases are timed separately over all batches, clock reads would dominate a single operation
+    uint64_t start = check_now_ns();
+    for (unsigned b = 0; b < batches; ++b) {
+        struct ctlmsg_writer writer;
+        ctlmsg_writer_init(&writer, g_buf, sizeof(g_buf));
+        for (unsigned i = 0; i < count; ++i) {
+            ctlmsg_write_op(&writer, &g_ops[i]);
+        }
+        CHECK_EQ(ctlmsg_writer_finish(&writer, &size), CTLMSG_OK);
+        CHECK_KEEP(g_buf);
+    }
+    uint64_t encoded = check_now_ns();
+
+    for (unsigned b = 0; b < batches; ++b) {
+        CHECK_KEEP(g_buf);
+        CHECK_EQ(ctlmsg_validate(g_buf, size), CTLMSG_OK);
+    }
+    uint64_t validated = check_now_ns();
+
+    uint64_t sum = 0;
+    for (unsigned b = 0; b < batches; ++b) {
+        CHECK_KEEP(g_buf);
+        struct ctlmsg_reader reader;
+        struct ctlmsg_op op;
+        CHECK_EQ(ctlmsg_reader_init(&reader, g_buf, size), CTLMSG_OK);
+        while (ctlmsg_read_op(&reader, &op) == CTLMSG_OK) {
+            sum += (uint64_t)op.u.pid.pid;
+        }
+    }
+    CHECK_KEEP(sum);
+    uint64_t decoded = check_now_ns();
+
+    uint64_t encode_ns = encoded - start;
+    uint64_t validate_ns = validated - encoded;
+    uint64_t decode_ns = decoded - validated;
+
+    double ops = (double)batches * count;
+    printf("%-22s %6u ops %6zu bytes  encode %6.2f ns/op  validate %6.2f ns/op  decode %6.2f ns/op  validate %6.2f GB/s\n",
+           name, count, size, encode_ns / ops, validate_ns / ops, decode_ns / ops,
+           (double)size * batches / validate_ns);
+}
+
+int main(void)
+{
+    uint64_t seed = 30;
+    size_t count = 0;
+    for (size_t size = sizeof(struct ctlmsg_header); ; ++count) {
+        struct ctlmsg_op* op = &g_ops[count];
+        op->type = (uint16_t)(1 + check_rand(&seed) % 7);
+        op->u.trust.pid = (int32_t)(check_rand(&seed) % 100000);
+        op->u.trust.flags = 0;
+        op->u.trust.start_time = check_rand(&seed);
+
+        size_t length = (op->type == CTLMSG_OP_CLEAR_TARGETS || op->type == CTLMSG_OP_QUERY_STATS ? 0 :
+                         op->type == CTLMSG_OP_REMOVE_TARGET || op->type == CTLMSG_OP_TRUST_REMOVE ? sizeof(struct ctlmsg_pid) :
+                         sizeof(struct ctlmsg_target));
+        if (size + sizeof(struct ctlmsg_op_header) + length > CTLMSG_MAX_SIZE) {
+            break;
+        }
+        size += sizeof(struct ctlmsg_op_header) + length;
+    }
+
+    // killctl sends one operation per invocation, replay and scripts send batches
+    bench("single op", 1);
+    bench("16 ops", 16);
+    bench("full 64KB batch", (unsigned)count);
+    return 0;
+}
@@ -0,0 +1,71 @@
+//
+//  bench_hookstat.c
+//  tests
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Cost of hookstat_record on the hook path, alone and with writers on neighbouring CPU slots,
+//  and of merging all CPUs for a sysctl read.
+//
+
+#include <pthread.h>
+
+#include "check.h"
+#include "hookstat.h"
+
+#define SAMPLES     20000000
+#define WRITERS     4
+#define MERGES      20000
+
+static struct hookstat_percpu g_cpus[HOOKSTAT_MAX_CPUS];
+
+struct writer {
+    pthread_t   thread;
+    unsigned    cpu;
+    uint64_t    ns;
+};
+
+static void* writer(void* arg)
+{
+    struct writer* ctx = arg;
+    uint64_t start = check_now_ns();
+    for (uint64_t i = 0; i < SAMPLES / WRITERS; ++i) {
+        hookstat_record(g_cpus, ctx->cpu, HOOKSTAT_KILL, i & 0xfff);
+    }
+    ctx->ns = check_now_ns() - start;
+    return NULL;
+}
+
+int main(void)
+{
+    uint64_t start = check_now_ns();
+    for (uint64_t i = 0; i < SAMPLES; ++i) {
+        hookstat_record(g_cpus, 0, HOOKSTAT_KILL, i & 0xfff);
+    }
+    uint64_t elapsed = check_now_ns() - start;
+    printf("record, 1 writer:        %6.2f ns/sample\n", (double)elapsed / SAMPLES);
+
+    struct writer writers[WRITERS];
+    for (unsigned i = 0; i < WRITERS; ++i) {
+        writers[i].cpu = i;
+        CHECK(0 == pthread_create(&writers[i].thread, NULL, writer, &writers[i]));
+    }
+    uint64_t slowest = 0;
+    for (unsigned i = 0; i < WRITERS; ++i) {
+        pthread_join(writers[i].thread, NULL);
+        slowest = (writers[i].ns > slowest ? writers[i].ns : slowest);
+    }
+    printf("record, %u writers:       %6.2f ns/sample (slowest writer)\n", WRITERS, (double)slowest / (SAMPLES / WRITERS));
+
+    struct hookstat_snapshot snapshot;
+    start = check_now_ns();
+    for (unsigned i = 0; i < MERGES; ++i) {
+        hookstat_merge(g_cpus, HOOKSTAT_MAX_CPUS, &snapshot);
+        CHECK_KEEP(snapshot.hist[0].count);
+    }
+    elapsed = check_now_ns() - start;
+    printf("merge %u CPUs:            %6.2f us\n", HOOKSTAT_MAX_CPUS, (double)elapsed / MERGES / 1000.0);
+
+    CHECK_EQ(snapshot.hist[HOOKSTAT_KILL].count, SAMPLES * 2);
+    return 0;
+}
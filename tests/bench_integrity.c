@@ -0,0 +1,73 @@
+//
+//  bench_integrity.c
+//  tests
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Watchdog cost on table sized buffers: hooked entries only, and whole tables in 4KB ticks and in one step.
+//
+
+#include <string.h>
+
+#include "check.h"
+#include "integrity.h"
+#include "hooks.h"
+
+#define SYSENT_ENTRIES  520
+#define SYSENT_STRIDE   24
+#define TRAP_ENTRIES    128
+#define TRAP_STRIDE     32
+#define CHUNK_BYTES     4096    /* INTEGRITY_CHUNK_BYTES */
+#define PASSES          20000
+
+static uint8_t g_sysent[SYSENT_ENTRIES * SYSENT_STRIDE];
+static uint8_t g_traps[TRAP_ENTRIES * TRAP_STRIDE];
+
+static void bench(const char* name, struct integrity_state* state, size_t budget)
+{
+    integrity_rebaseline(state);
+
+    uint64_t steps = 0;
+    uint64_t start = check_now_ns();
+    while (state->passes < PASSES) {
+        CHECK(integrity_step(state, budget) != INTEGRITY_MISMATCH);
+        steps++;
+    }
+    uint64_t elapsed = check_now_ns() - start;
+
+    size_t bytes = 0;
+    for (unsigned i = 0; i < state->nregions; ++i) {
+        bytes += state->regions[i].size;
+    }
+    printf("%-28s %6zu bytes  %8.1f ns/pass  %8.1f ns/step  %6.2f GB/s\n", name, bytes,
+           (double)elapsed / PASSES, (double)elapsed / steps, (double)bytes * PASSES / elapsed);
+}
+
+int main(void)
+{
+    memset(g_sysent, 0x5a, sizeof(g_sysent));
+    memset(g_traps, 0xa5, sizeof(g_traps));
+
+    // Hooked entries, as the kext watches by default
+    struct integrity_state state;
+    integrity_init(&state);
+#define WATCH_HOOK(table, num, handler, original) \
+    integrity_add_region(&state, (table == HOOK_TABLE_SYSENT ? g_sysent + num * SYSENT_STRIDE : g_traps + num * TRAP_STRIDE), \
+                         (table == HOOK_TABLE_SYSENT ? SYSENT_STRIDE : TRAP_STRIDE));
+    KILLHOOK_HOOKS(WATCH_HOOK)
+#undef WATCH_HOOK
+
+    bench("hooked entries", &state, CHUNK_BYTES);
+
+    integrity_init(&state);
+    integrity_add_region(&state, g_sysent, sizeof(g_sysent));
+    integrity_add_region(&state, g_traps, sizeof(g_traps));
+    bench("whole tables, 4KB ticks", &state, CHUNK_BYTES);
+
+    integrity_init(&state);
+    integrity_add_region(&state, g_sysent, sizeof(g_sysent));
+    integrity_add_region(&state, g_traps, sizeof(g_traps));
+    bench("whole tables, one step", &state, sizeof(g_sysent) + sizeof(g_traps));
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+//
+//  bench_ratelimit.c
+//  tests
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Rate limiter cost under adversarial callers: one caller within budget, one flooding the same request,
+//  a spray of distinct pids overflowing the table, and threads hammering one shared caller.
+//
+
+#include <pthread.h>
+#include <string.h>
+
+#include "check.h"
+#include "ratelimit.h"
+
+#define RATE        10      /* as in test.c */
+#define BURST       20      /* as in test.c */
+#define ROUNDS      10000000
+#define THREADS     4
+#define BOOT_MS     100000
+
+static struct ratelimit g_rl;
+
+static void report(const char* name, uint64_t elapsed, unsigned rounds, uint64_t audited)
+{
+    printf("%-34s %6.2f ns/denial  %5.1f%% audited  %llu cached  %llu evictions\n", name, (double)elapsed / rounds,
+           100.0 * audited / rounds, (unsigned long long)g_rl.cached, (unsigned long long)g_rl.evictions);
+}
+
+// Cached check first, full check and accounting only when that misses, as the hooks do
+static int deny(int32_t pid, uint64_t verdict, uint64_t now)
+{
+    if (ratelimit_cached_deny(&g_rl, pid, verdict, now)) {
+        return 0;
+    }
+    return ratelimit_deny(&g_rl, pid, verdict, now);
+}
+
+static void bench_single(const char* name, unsigned ms_per_denial_x1000)
+{
+    ratelimit_init(&g_rl, RATE, BURST);
+    uint64_t verdict = ratelimit_verdict(1, 1, 9, 1);
+    uint64_t audited = 0;
+
+    uint64_t start = check_now_ns();
+    for (unsigned i = 0; i < ROUNDS; ++i) {
+        audited += (uint64_t)deny(100, verdict, BOOT_MS + (uint64_t)i * ms_per_denial_x1000 / 1000);
+    }
+    report(name, check_now_ns() - start, ROUNDS, audited);
+}
+
+static void bench_spray(const char* name, unsigned npids)
+{
+    ratelimit_init(&g_rl, RATE, BURST);
+    uint64_t verdict = ratelimit_verdict(1, 1, 9, 1);
+    uint64_t audited = 0;
+    uint64_t seed = 38;
+
+    uint64_t start = check_now_ns();
+    for (unsigned i = 0; i < ROUNDS; ++i) {
+        int32_t pid = 1 + (int32_t)(check_rand(&seed) % npids);
+        audited += (uint64_t)deny(pid, verdict, BOOT_MS + i / 1000);
+    }
+    report(name, check_now_ns() - start, ROUNDS, audited);
+}
+
+static void* hammer_main(void* arg)
+{
+    uint64_t verdict = ratelimit_verdict(1, 1, 9, 1);
+    uint64_t audited = 0;
+    for (unsigned i = 0; i < ROUNDS / THREADS; ++i) {
+        audited += (uint64_t)deny(100, verdict, BOOT_MS + i / 1000);
+    }
+    return (void*)(uintptr_t)audited;
+}
+
+static void bench_shared(void)
+{
+    ratelimit_init(&g_rl, RATE, BURST);
+    pthread_t threads[THREADS];
+    uint64_t audited = 0;
+
+    uint64_t start = check_now_ns();
+    for (unsigned i = 0; i < THREADS; ++i) {
+        CHECK(pthread_create(&threads[i], NULL, hammer_main, NULL) == 0);
+    }
+    for (unsigned i = 0; i < THREADS; ++i) {
+        void* res;
+        CHECK(pthread_join(threads[i], &res) == 0);
+        audited += (uintptr_t)res;
+    }
+    report("shared caller, 4 threads", check_now_ns() - start, ROUNDS, audited);
+}
+
+int main(void)
+{
+    // One denial every 150 ms stays below 10 per second
+    bench_single("caller within budget", 150000);
+    bench_single("caller flooding one request", 1);
+    bench_spray("spray over 48 pids", 48);
+    bench_spray("spray over 100000 pids", 100000);
+    bench_shared();
+    return 0;
+}
@@ -0,0 +1,89 @@
+//
+//  bench_symindex.c
+//  tests
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Symbol index cost on a synthetic image with about as many __TEXT symbols as a Yosemite kernel:
+//  measure and build, lookups against a linear scan of the symbol table, and formatting.
+//
+
+#include <string.h>
+
+#include "check.h"
+#include "image.h"
+#include "symindex.h"
+
+#define SYMBOLS     24000
+#define LOOKUPS     2000000
+#define SCANS       2000
+#define SLIDE       0x0000000012a00000ull
+
+static struct image g_image;
+
+int main(void)
+{
+    image_init(&g_image, SYMBOLS, 1 + SYMBOLS * 16);
+    uint64_t seed = 39;
+    uint32_t strx = 1;
+    for (uint32_t i = 0; i < SYMBOLS; ++i) {
+        char name[16];
+        snprintf(name, sizeof(name), "_sym_%u", i);
+        image_symbol(&g_image, i, strx, name, MACHO_N_SECT, IMAGE_TEXT_BASE + (check_rand(&seed) % IMAGE_TEXT_SIZE & ~0xfull));
+        strx += (uint32_t)strlen(name) + 1;
+    }
+
+    // Measure and build, as done once on kext load
+    const struct mach_header_64* mh = image_header(&g_image);
+    uint32_t count = 0, names_size = 0;
+    uint64_t start = check_now_ns();
+    CHECK(symindex_measure(mh, &count, &names_size));
+    struct symindex_entry* entries = malloc(count * sizeof(*entries));
+    char* names = malloc(names_size);
+    struct symindex index;
+    CHECK(entries && names && symindex_build(&index, mh, IMAGE_TEXT_BASE + SLIDE, entries, count, names, names_size));
+    uint64_t elapsed = check_now_ns() - start;
+    printf("%-24s %8.1f us  %u symbols  %zu KB\n", "measure and build", elapsed / 1000.0, count,
+           (count * sizeof(*entries) + names_size) / 1024);
+
+    uint64_t sum = 0;
+    start = check_now_ns();
+    for (unsigned i = 0; i < LOOKUPS; ++i) {
+        const char* name;
+        uint64_t offset;
+        uint64_t addr = IMAGE_TEXT_BASE + SLIDE + check_rand(&seed) % IMAGE_TEXT_SIZE;
+        sum += (uint64_t)symindex_lookup(&index, addr, &name, &offset) + offset;
+    }
+    elapsed = check_now_ns() - start;
+    CHECK_KEEP(sum);
+    printf("%-24s %8.1f ns/lookup\n", "index lookup", (double)elapsed / LOOKUPS);
+
+    // What attributing an address cost before the index: walk every nlist entry
+    start = check_now_ns();
+    for (unsigned i = 0; i < SCANS; ++i) {
+        uint64_t unslid = IMAGE_TEXT_BASE + check_rand(&seed) % IMAGE_TEXT_SIZE;
+        uint64_t best = 0;
+        for (uint32_t s = 0; s < SYMBOLS; ++s) {
+            uint64_t value = image_nlist(&g_image, s)->n_value;
+            best = (value <= unslid && value > best ? value : best);
+        }
+        sum += best;
+    }
+    elapsed = check_now_ns() - start;
+    CHECK_KEEP(sum);
+    printf("%-24s %8.1f ns/lookup\n", "linear symbol table scan", (double)elapsed / SCANS);
+
+    char buf[64];
+    start = check_now_ns();
+    for (unsigned i = 0; i < LOOKUPS; ++i) {
+        symindex_format(&index, IMAGE_TEXT_BASE + SLIDE + check_rand(&seed) % IMAGE_TEXT_SIZE, buf, sizeof(buf));
+        CHECK_KEEP(buf[0]);
+    }
+    elapsed = check_now_ns() - start;
+    printf("%-24s %8.1f ns/format\n", "format", (double)elapsed / LOOKUPS);
+
+    free(entries);
+    free(names);
+    image_free(&g_image);
+    return 0;
+}
@@ -0,0 +1,72 @@
+//
+//  bench_telemetry.c
+//  tests
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Telemetry page cost: publish, uncontended read, and reads racing a writer that publishes back to back.
+//
+
+#include <pthread.h>
+#include <string.h>
+
+#include "check.h"
+#include "telemetry.h"
+
+#define ROUNDS      2000000
+#define RETRIES     100     /* as killctl */
+
+static struct killhook_telemetry g_page;
+static unsigned g_stop;
+
+static void* writer_main(void* arg)
+{
+    struct killhook_telemetry_data data;
+    memset(&data, 0, sizeof(data));
+    while (!__atomic_load_n(&g_stop, __ATOMIC_RELAXED)) {
+        data.updates++;
+        telemetry_publish(&g_page, &data);
+    }
+    return NULL;
+}
+
+static void bench_reads(const char* name)
+{
+    struct killhook_telemetry_data data;
+    uint64_t busy = 0, seq = g_page.seq;
+
+    uint64_t start = check_now_ns();
+    for (unsigned i = 0; i < ROUNDS; ++i) {
+        busy += (telemetry_read(&g_page, &data, RETRIES) != TELEMETRY_OK);
+        CHECK_KEEP(data.updates);
+    }
+    uint64_t elapsed = check_now_ns() - start;
+
+    printf("%-28s %8.1f ns/read  %llu busy  %llu updates meanwhile\n", name, (double)elapsed / ROUNDS,
+           (unsigned long long)busy, (unsigned long long)(g_page.seq - seq) / 2);
+}
+
+int main(void)
+{
+    telemetry_init(&g_page);
+    struct killhook_telemetry_data data;
+    memset(&data, 0, sizeof(data));
+
+    uint64_t start = check_now_ns();
+    for (unsigned i = 0; i < ROUNDS; ++i) {
+        data.updates = i;
+        telemetry_publish(&g_page, &data);
+        CHECK_KEEP(&g_page);
+    }
+    uint64_t elapsed = check_now_ns() - start;
+    printf("%-28s %8.1f ns/publish  %zu byte page\n", "publish", (double)elapsed / ROUNDS, sizeof(g_page));
+
+    bench_reads("read, no writer");
+
+    pthread_t writer;
+    CHECK(pthread_create(&writer, NULL, writer_main, NULL) == 0);
+    bench_reads("read, writer publishing");
+    __atomic_store_n(&g_stop, 1, __ATOMIC_RELAXED);
+    CHECK(pthread_join(writer, NULL) == 0);
+    return 0;
+}
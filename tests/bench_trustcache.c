@@ -0,0 +1,73 @@
+//
+//  bench_trustcache.c
+//  tests
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Trust cache cost on the hook path: empty cache, untrusted and trusted callers in a loaded cache,
+//  and add and remove churn as userspace pushes identities.
+//
+
+#include <string.h>
+
+#include "check.h"
+#include "trustcache.h"
+
+#define ROUNDS      20000000
+#define LOADED      192         /* three quarters of the cache */
+
+static struct trustcache g_cache;
+
+static uint64_t start_time_of(void* ctx)
+{
+    return (uint64_t)*(const int32_t*)ctx * 7;
+}
+
+static void bench_check(const char* name, int32_t first, int32_t range, int expect)
+{
+    uint64_t hits = 0;
+    uint64_t start = check_now_ns();
+    for (unsigned i = 0; i < ROUNDS; ++i) {
+        int32_t pid = first + (int32_t)(i % (unsigned)range);
+        hits += (uint64_t)trustcache_check(&g_cache, pid, start_time_of, &pid);
+    }
+    uint64_t elapsed = check_now_ns() - start;
+
+    CHECK_EQ(hits, (expect ? ROUNDS : 0));
+    printf("%-32s %6.2f ns/check\n", name, (double)elapsed / ROUNDS);
+}
+
+static void bench_churn(void)
+{
+    trustcache_init(&g_cache);
+    uint64_t seed = 33;
+    unsigned full = 0;
+
+    uint64_t start = check_now_ns();
+    for (unsigned i = 0; i < ROUNDS; ++i) {
+        int32_t pid = 1 + (int32_t)(check_rand(&seed) % 400);
+        if (i & 1) {
+            trustcache_remove(&g_cache, pid);
+        } else {
+            full += (trustcache_add(&g_cache, pid, (uint64_t)pid * 7, 0) == TRUSTCACHE_FULL);
+        }
+    }
+    uint64_t elapsed = check_now_ns() - start;
+    printf("%-32s %6.2f ns/op  %u%% adds found set full\n", "add and remove churn", (double)elapsed / ROUNDS,
+           full * 200 / ROUNDS);
+}
+
+int main(void)
+{
+    trustcache_init(&g_cache);
+    bench_check("empty cache", 1, 1000, 0);
+
+    for (int32_t pid = 1; pid <= LOADED; ++pid) {
+        CHECK_EQ(trustcache_add(&g_cache, pid, start_time_of(&pid), 0), TRUSTCACHE_OK);
+    }
+    bench_check("untrusted caller, loaded cache", LOADED + 1, 1000, 0);
+    bench_check("trusted caller, loaded cache", 1, LOADED, 1);
+
+    bench_churn();
+    return 0;
+}
@@ -0,0 +1,58 @@
+//
+//  check.h
+//  tests
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Assertions and helpers for Linux tests and benchmarks of the portable kext modules.
+//  A failed check prints its location and exits, so every test is a plain program run by make check.
+//
+
+#ifndef check_h
+#define check_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) \
+    do { \
+        long long _a = (long long)(a); \
+        long long _b = (long long)(b); \
+        if (_a != _b) { \
+            fprintf(stderr, "%s:%d: check failed: %s == %s (%lld != %lld)\n", __FILE__, __LINE__, #a, #b, _a, _b); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+static inline uint64_t check_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// xorshift64, fixed seeds keep failures reproducible
+static inline uint64_t check_rand(uint64_t* state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+// Keep benchmark results alive without a memory barrier
+#define CHECK_KEEP(value)   __asm__ volatile("" : : "r"(value) : "memory")
+
+#endif /* check_h */
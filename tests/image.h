@@ -0,0 +1,111 @@
+//
+//  image.h
+//  tests
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Synthetic 64-bit Mach-O kernel images: __TEXT and __DATA segments and a symbol table
+//  with caller supplied symbols, laid out like a kernel file so macho_image_valid accepts them.
+//
+
+#ifndef image_h
+#define image_h
+
+#include <string.h>
+
+#include "check.h"
+#include "macho.h"
+
+#define IMAGE_TEXT_BASE     0xffffff8000200000ull
+#define IMAGE_TEXT_SIZE     0x00800000ull
+#define IMAGE_DATA_BASE     (IMAGE_TEXT_BASE + IMAGE_TEXT_SIZE)
+#define IMAGE_DATA_SIZE     0x00200000ull
+
+struct image {
+    uint8_t*    buf;
+    size_t      size;
+    uint32_t    nsyms;
+    uint32_t    strsize;
+};
+
+// Layout: header, two segments, symtab command, nlist array, string table. Names are written by image_symbol.
+static inline void image_init(struct image* image, uint32_t nsyms, uint32_t strsize)
+{
+    size_t cmds = 2 * sizeof(struct segment_command_64) + sizeof(struct symtab_command);
+    size_t symoff = sizeof(struct mach_header_64) + cmds;
+    size_t stroff = symoff + (size_t)nsyms * sizeof(struct nlist_64);
+
+    image->size = stroff + strsize;
+    image->buf = calloc(1, image->size);
+    image->nsyms = nsyms;
+    image->strsize = strsize;
+    CHECK(image->buf != NULL);
+
+    struct mach_header_64* mh = (struct mach_header_64*)image->buf;
+    mh->magic = MH_MAGIC_64;
+    mh->ncmds = 3;
+    mh->sizeofcmds = (uint32_t)cmds;
+
+    struct segment_command_64* text = (struct segment_command_64*)(mh + 1);
+    text->cmd = LC_SEGMENT_64;
+    text->cmdsize = sizeof(*text);
+    strcpy(text->segname, SEG_TEXT);
+    text->vmaddr = IMAGE_TEXT_BASE;
+    text->vmsize = IMAGE_TEXT_SIZE;
+
+    struct segment_command_64* data = text + 1;
+    data->cmd = LC_SEGMENT_64;
+    data->cmdsize = sizeof(*data);
+    strcpy(data->segname, SEG_DATA);
+    data->vmaddr = IMAGE_DATA_BASE;
+    data->vmsize = IMAGE_DATA_SIZE;
+
+    struct symtab_command* symtab = (struct symtab_command*)(data + 1);
+    symtab->cmd = LC_SYMTAB;
+    symtab->cmdsize = sizeof(*symtab);
+    symtab->symoff = (uint32_t)symoff;
+    symtab->nsyms = nsyms;
+    symtab->stroff = (uint32_t)stroff;
+    symtab->strsize = strsize;
+
+    CHECK(macho_image_valid(mh, image->size));
+}
+
+static inline const struct mach_header_64* image_header(const struct image* image)
+{
+    return (const struct mach_header_64*)image->buf;
+}
+
+static inline struct nlist_64* image_nlist(const struct image* image, uint32_t i)
+{
+    const struct symtab_command* symtab = (const struct symtab_command*)(image->buf + sizeof(struct mach_header_64) +
+                                                                         2 * sizeof(struct segment_command_64));
+    return (struct nlist_64*)(image->buf + symtab->symoff) + i;
+}
+
+static inline char* image_strtab(const struct image* image)
+{
+    return (char*)image->buf + image->size - image->strsize;
+}
+
+// Symbol i with name stored at strx, name is not copied if NULL
+static inline void image_symbol(struct image* image, uint32_t i, uint32_t strx, const char* name, uint8_t type, uint64_t value)
+{
+    struct nlist_64* nl = image_nlist(image, i);
+    nl->n_un.n_strx = strx;
+    nl->n_type = type;
+    nl->n_sect = 1;
+    nl->n_value = value;
+    if (name) {
+        CHECK(strx + strlen(name) + 1 <= image->strsize);
+        memcpy(image_strtab(image) + strx, name, strlen(name) + 1);
+    }
+}
+
+static inline void image_free(struct image* image)
+{
+    free(image->buf);
+    image->buf = NULL;
+}
+
+#endif /* image_h */
@@ -0,0 +1,277 @@
+//
+//  test_auditq.c
+//  tests
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Audit queue ordering, overflow accounting and wraparound, caller cache eviction,
+//  and concurrent producers against a consumer draining in batches like the audit tick.
+//
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+#include "check.h"
+#include "auditq.h"
+
+#define AUDIT_BATCH     64      /* as in test.c */
+#define PRODUCERS       4
+#define PER_PRODUCER    200000
+
+static struct auditq g_queue;
+
+static struct audit_record make_record(int32_t caller, int32_t arg)
+{
+    struct audit_record record = { 0 };
+    record.time = (uint64_t)arg * 3;
+    record.caller = caller;
+    record.target = caller + 1;
+    record.arg = arg;
+    record.event = AUDIT_KILL_DENIED;
+    return record;
+}
+
+static void test_fifo_and_overflow(void)
+{
+    auditq_init(&g_queue);
+    struct audit_record record;
+    CHECK(!auditq_take(&g_queue, &record));
+
+    // Many laps around the ring, filled to the brim each time and drained by a varying share
+    int32_t next_post = 0, next_take = 0;
+    uint64_t seed = 32;
+    for (unsigned lap = 0; lap < 200; ++lap) {
+        while (next_post - next_take < AUDITQ_SIZE) {
+            struct audit_record posted = make_record(7, next_post++);
+            CHECK(auditq_post(&g_queue, &posted));
+        }
+
+        // Full queue drops and counts, and does not disturb queued records
+        uint64_t dropped = g_queue.dropped;
+        struct audit_record extra = make_record(7, -1);
+        CHECK(!auditq_post(&g_queue, &extra));
+        CHECK(!auditq_post(&g_queue, &extra));
+        CHECK_EQ(g_queue.dropped, dropped + 2);
+
+        unsigned take = 1 + (unsigned)(check_rand(&seed) % AUDITQ_SIZE);
+        for (unsigned i = 0; i < take; ++i) {
+            CHECK(auditq_take(&g_queue, &record));
+            CHECK_EQ(record.arg, next_take);
+            CHECK(record.time == (uint64_t)next_take * 3);
+            CHECK_EQ(record.target, 8);
+            next_take++;
+        }
+    }
+
+    while (auditq_take(&g_queue, &record)) {
+        CHECK_EQ(record.arg, next_take);
+        next_take++;
+    }
+    CHECK_EQ(next_take, next_post);
+    CHECK_EQ(g_queue.dropped, 400);
+    CHECK(!auditq_take(&g_queue, &record));
+}
+
+//
+// Caller cache
+//
+
+struct lru_ctx {
+    unsigned enriched[64];
+    unsigned emitted;
+    int      bad_name;
+};
+
+static void enrich_pid(int32_t pid, char* name, uint32_t size, void* ctx)
+{
+    struct lru_ctx* lctx = ctx;
+    lctx->enriched[pid]++;
+    // Longer than the cache slot
+    snprintf(name, size, "process-%d-with-a-very-long-name-indeed", pid);
+}
+
+static void emit_check(const struct audit_record* record, const char* caller_name, void* ctx)
+{
+    struct lru_ctx* lctx = ctx;
+    char expected[64];
+    snprintf(expected, sizeof(expected), "process-%d-with-a-very-long-name-indeed", record->caller);
+    expected[AUDIT_NAME_LEN - 1] = '\0';
+    lctx->bad_name |= (strcmp(caller_name, expected) != 0);
+    lctx->emitted++;
+}
+
+static void run_callers(struct audit_lru* lru, struct lru_ctx* ctx, unsigned ncallers, unsigned rounds)
+{
+    unsigned total = ncallers * rounds;
+    for (unsigned done = 0; done < total; ) {
+        unsigned n = 0;
+        for (; n < AUDITQ_SIZE && done + n < total; ++n) {
+            struct audit_record record = make_record((int32_t)((done + n) % ncallers) + 1, 0);
+            CHECK(auditq_post(&g_queue, &record));
+        }
+        CHECK_EQ(auditq_process(&g_queue, lru, AUDITQ_SIZE, enrich_pid, emit_check, ctx), n);
+        done += n;
+    }
+}
+
+static void test_lru(void)
+{
+    auditq_init(&g_queue);
+    struct audit_lru lru;
+    struct lru_ctx ctx;
+
+    // Callers that fit are resolved once
+    audit_lru_init(&lru);
+    memset(&ctx, 0, sizeof(ctx));
+    run_callers(&lru, &ctx, AUDIT_LRU_SIZE, 100);
+    for (unsigned pid = 1; pid <= AUDIT_LRU_SIZE; ++pid) {
+        CHECK_EQ(ctx.enriched[pid], 1);
+    }
+    CHECK_EQ(lru.misses, AUDIT_LRU_SIZE);
+    CHECK_EQ(lru.hits, AUDIT_LRU_SIZE * 99);
+    CHECK_EQ(ctx.emitted, AUDIT_LRU_SIZE * 100);
+    CHECK(!ctx.bad_name);
+
+    // One caller too many cycling in order evicts exactly the one needed next
+    audit_lru_init(&lru);
+    memset(&ctx, 0, sizeof(ctx));
+    run_callers(&lru, &ctx, AUDIT_LRU_SIZE + 1, 10);
+    CHECK_EQ(lru.hits, 0);
+    CHECK_EQ(lru.misses, (AUDIT_LRU_SIZE + 1) * 10);
+    CHECK(!ctx.bad_name);
+
+    // A hot caller survives a stream of distinct ones
+    audit_lru_init(&lru);
+    memset(&ctx, 0, sizeof(ctx));
+    for (int32_t i = 0; i < 40; ++i) {
+        struct audit_record hot = make_record(1, 0);
+        struct audit_record cold = make_record(2 + i, 0);
+        CHECK(auditq_post(&g_queue, &hot));
+        CHECK(auditq_post(&g_queue, &cold));
+    }
+    CHECK_EQ(auditq_process(&g_queue, &lru, 7, enrich_pid, emit_check, &ctx), 7);
+    CHECK_EQ(auditq_process(&g_queue, &lru, AUDITQ_SIZE, enrich_pid, emit_check, &ctx), 73);
+    CHECK_EQ(ctx.enriched[1], 1);
+    CHECK_EQ(lru.hits, 39);
+    CHECK(!ctx.bad_name);
+}
+
+//
+// Concurrent producers
+//
+
+struct producer {
+    pthread_t thread;
+    int32_t   id;
+    uint64_t  posted;
+    uint64_t  failed;
+};
+
+static unsigned g_producers_done;
+
+static void* producer_main(void* arg)
+{
+    struct producer* p = arg;
+    for (int32_t i = 0; i < PER_PRODUCER; ++i) {
+        struct audit_record record = make_record(p->id, i);
+        if (auditq_post(&g_queue, &record)) {
+            p->posted++;
+        } else {
+            p->failed++;
+            sched_yield();
+        }
+    }
+    __atomic_fetch_add(&g_producers_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+struct consumer_ctx {
+    int32_t  last[PRODUCERS + 1];
+    uint64_t taken[PRODUCERS + 1];
+    int      bad;
+};
+
+static void enrich_none(int32_t pid, char* name, uint32_t size, void* ctx)
+{
+    snprintf(name, size, "%d", pid);
+}
+
+static void emit_order(const struct audit_record* record, const char* caller_name, void* ctx)
+{
+    struct consumer_ctx* cctx = ctx;
+    int32_t id = record->caller;
+    if (id < 1 || id > PRODUCERS || atoi(caller_name) != id ||
+        record->target != id + 1 || record->time != (uint64_t)record->arg * 3) {
+        cctx->bad = 1;
+        return;
+    }
+
+    // Records of one producer arrive in posting order, none twice
+    cctx->bad |= (record->arg <= cctx->last[id]);
+    cctx->last[id] = record->arg;
+    cctx->taken[id]++;
+}
+
+static void test_concurrent(void)
+{
+    auditq_init(&g_queue);
+    struct audit_lru lru;
+    audit_lru_init(&lru);
+
+    struct consumer_ctx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    for (unsigned i = 0; i <= PRODUCERS; ++i) {
+        ctx.last[i] = -1;
+    }
+
+    struct producer producers[PRODUCERS];
+    memset(producers, 0, sizeof(producers));
+    g_producers_done = 0;
+    for (unsigned i = 0; i < PRODUCERS; ++i) {
+        producers[i].id = (int32_t)i + 1;
+        CHECK(pthread_create(&producers[i].thread, NULL, producer_main, &producers[i]) == 0);
+    }
+
+    // Drain in audit tick batches, one last pass after every producer is done
+    uint64_t taken = 0;
+    for (;;) {
+        int done = (__atomic_load_n(&g_producers_done, __ATOMIC_ACQUIRE) == PRODUCERS);
+        unsigned n;
+        while ((n = auditq_process(&g_queue, &lru, AUDIT_BATCH, enrich_none, emit_order, &ctx)) == AUDIT_BATCH) {
+            taken += n;
+        }
+        taken += n;
+        if (done) {
+            break;
+        }
+        sched_yield();
+    }
+
+    for (unsigned i = 0; i < PRODUCERS; ++i) {
+        CHECK(pthread_join(producers[i].thread, NULL) == 0);
+    }
+
+    uint64_t posted = 0, failed = 0;
+    for (unsigned i = 0; i < PRODUCERS; ++i) {
+        CHECK_EQ(producers[i].posted + producers[i].failed, PER_PRODUCER);
+        CHECK_EQ(ctx.taken[i + 1], producers[i].posted);
+        posted += producers[i].posted;
+        failed += producers[i].failed;
+    }
+
+    CHECK(!ctx.bad);
+    CHECK_EQ(taken, posted);
+    CHECK_EQ(g_queue.dropped, failed);
+    CHECK_EQ(lru.misses, PRODUCERS);
+    printf("auditq: %llu posted, %llu dropped while full\n", (unsigned long long)posted, (unsigned long long)failed);
+}
+
+int main(void)
+{
+    test_fifo_and_overflow();
+    test_lru();
+    test_concurrent();
+    printf("auditq: ok\n");
+    return 0;
+}
@@ -0,0 +1,297 @@
+//
+//  test_ctlmsg.c
+//  tests
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Control message codec: round trips of every operation type, malformed headers and operations,
+//  and truncated or bit flipped messages decoded from exactly sized buffers under AddressSanitizer.
+//
+
+#include <string.h>
+
+#include "check.h"
+#include "ctlmsg.h"
+
+#define OP_TYPES        7
+#define MAX_OPS         64
+#define ROUNDS          20000
+
+static size_t payload_size(uint16_t type)
+{
+    switch (type) {
+        case CTLMSG_OP_ADD_TARGET:
+        case CTLMSG_OP_SET_SIGMASK:     return sizeof(struct ctlmsg_target);
+        case CTLMSG_OP_REMOVE_TARGET:
+        case CTLMSG_OP_TRUST_REMOVE:    return sizeof(struct ctlmsg_pid);
+        case CTLMSG_OP_TRUST_ADD:       return sizeof(struct ctlmsg_trust);
+        default:                        return 0;
+    }
+}
+
+static void random_op(struct ctlmsg_op* op, uint64_t* seed)
+{
+    memset(op, 0, sizeof(*op));
+    op->type = (uint16_t)(1 + check_rand(seed) % OP_TYPES);
+    uint8_t* payload = (uint8_t*)&op->u;
+    for (size_t i = 0; i < payload_size(op->type); ++i) {
+        payload[i] = (uint8_t)check_rand(seed);
+    }
+}
+
+static size_t encode(uint8_t* buf, size_t size, const struct ctlmsg_op* ops, unsigned count)
+{
+    struct ctlmsg_writer writer;
+    ctlmsg_writer_init(&writer, buf, size);
+    for (unsigned i = 0; i < count; ++i) {
+        ctlmsg_write_op(&writer, &ops[i]);
+    }
+
+    size_t length = 0;
+    CHECK_EQ(ctlmsg_writer_finish(&writer, &length), CTLMSG_OK);
+    return length;
+}
+
+// Decode whole message, returns the first error or CTLMSG_OK after a clean CTLMSG_END
+static int decode(const uint8_t* buf, size_t size, struct ctlmsg_op* ops, unsigned* count)
+{
+    struct ctlmsg_reader reader;
+    int res = ctlmsg_reader_init(&reader, buf, size);
+    *count = 0;
+    if (res != CTLMSG_OK) {
+        return res;
+    }
+
+    struct ctlmsg_op op;
+    while ((res = ctlmsg_read_op(&reader, &op)) == CTLMSG_OK) {
+        CHECK(op.type >= 1 && op.type <= OP_TYPES);
+        if (ops && *count < MAX_OPS) {
+            ops[*count] = op;
+        }
+        ++*count;
+    }
+    return (res == CTLMSG_END ? CTLMSG_OK : res);
+}
+
+static void test_round_trip(void)
+{
+    uint8_t buf[CTLMSG_MAX_SIZE];
+    struct ctlmsg_op ops[MAX_OPS];
+    struct ctlmsg_op decoded[MAX_OPS];
+    uint64_t seed = 30;
+
+    // Empty batch is valid
+    size_t size = encode(buf, sizeof(buf), NULL, 0);
+    CHECK_EQ(size, sizeof(struct ctlmsg_header));
+    CHECK_EQ(ctlmsg_validate(buf, size), CTLMSG_OK);
+
+    unsigned seen[OP_TYPES + 1] = { 0 };
+    for (unsigned round = 0; round < ROUNDS; ++round) {
+        unsigned count = (unsigned)(check_rand(&seed) % (MAX_OPS + 1));
+        size_t expected = sizeof(struct ctlmsg_header);
+        for (unsigned i = 0; i < count; ++i) {
+            random_op(&ops[i], &seed);
+            expected += sizeof(struct ctlmsg_op_header) + payload_size(ops[i].type);
+            seen[ops[i].type]++;
+        }
+
+        size = encode(buf, sizeof(buf), ops, count);
+        CHECK_EQ(size, expected);
+        CHECK_EQ(ctlmsg_validate(buf, size), CTLMSG_OK);
+
+        // Trailing bytes past the declared length are not part of the message
+        CHECK_EQ(ctlmsg_validate(buf, size + 1), CTLMSG_OK);
+
+        unsigned ndecoded;
+        CHECK_EQ(decode(buf, size, decoded, &ndecoded), CTLMSG_OK);
+        CHECK_EQ(ndecoded, count);
+        for (unsigned i = 0; i < count; ++i) {
+            CHECK_EQ(decoded[i].type, ops[i].type);
+            CHECK(memcmp(&decoded[i].u, &ops[i].u, payload_size(ops[i].type)) == 0);
+        }
+    }
+
+    for (unsigned type = 1; type <= OP_TYPES; ++type) {
+        CHECK(seen[type] > 0);
+    }
+}
+
+static void test_writer_errors(void)
+{
+    uint8_t buf[CTLMSG_MAX_SIZE + 64];
+    struct ctlmsg_writer writer;
+    size_t size = 0;
+
+    // Buffer too small for the header
+    ctlmsg_writer_init(&writer, buf, sizeof(struct ctlmsg_header) - 1);
+    CHECK_EQ(ctlmsg_writer_finish(&writer, &size), CTLMSG_E_NOSPACE);
+
+    // Operation that does not fit is rejected and the error sticks
+    struct ctlmsg_op op = { CTLMSG_OP_ADD_TARGET };
+    struct ctlmsg_op clear = { CTLMSG_OP_CLEAR_TARGETS };
+    size_t one = sizeof(struct ctlmsg_header) + sizeof(struct ctlmsg_op_header) + sizeof(struct ctlmsg_target);
+    ctlmsg_writer_init(&writer, buf, one + sizeof(struct ctlmsg_op_header) + 1);
+    ctlmsg_write_op(&writer, &op);
+    ctlmsg_write_op(&writer, &op);
+    CHECK_EQ(writer.offset, one);
+    ctlmsg_write_op(&writer, &clear);
+    CHECK_EQ(writer.offset, one);
+    CHECK_EQ(ctlmsg_writer_finish(&writer, &size), CTLMSG_E_NOSPACE);
+
+    // Unknown type
+    struct ctlmsg_op bad = { OP_TYPES + 1 };
+    ctlmsg_writer_init(&writer, buf, sizeof(buf));
+    ctlmsg_write_op(&writer, &bad);
+    CHECK_EQ(ctlmsg_writer_finish(&writer, &size), CTLMSG_E_OP);
+
+    // Never encodes more than the kernel accepts even into a larger buffer
+    ctlmsg_writer_init(&writer, buf, sizeof(buf));
+    unsigned count = 0;
+    while (!writer.error) {
+        ctlmsg_write_op(&writer, &op);
+        count++;
+    }
+    CHECK_EQ(writer.error, CTLMSG_E_NOSPACE);
+    CHECK(writer.offset <= CTLMSG_MAX_SIZE);
+    CHECK(writer.offset + sizeof(struct ctlmsg_op_header) + sizeof(struct ctlmsg_target) > CTLMSG_MAX_SIZE);
+    CHECK_EQ(writer.op_count, count - 1);
+}
+
+static void test_malformed(void)
+{
+    uint8_t buf[256];
+    struct ctlmsg_op ops[2] = { { CTLMSG_OP_TRUST_ADD }, { CTLMSG_OP_REMOVE_TARGET } };
+    size_t size = encode(buf, sizeof(buf), ops, 2);
+    uint8_t copy[256];
+    struct ctlmsg_header* hdr = (struct ctlmsg_header*)copy;
+    struct ctlmsg_op_header* op = (struct ctlmsg_op_header*)(copy + sizeof(*hdr));
+
+    CHECK_EQ(ctlmsg_validate(buf, 0), CTLMSG_E_TRUNCATED);
+    CHECK_EQ(ctlmsg_validate(buf, sizeof(*hdr) - 1), CTLMSG_E_TRUNCATED);
+    CHECK_EQ(ctlmsg_validate(buf, size - 1), CTLMSG_E_TRUNCATED);
+
+    memcpy(copy, buf, size);
+    hdr->magic ^= 1;
+    CHECK_EQ(ctlmsg_validate(copy, size), CTLMSG_E_MAGIC);
+
+    memcpy(copy, buf, size);
+    hdr->version = CTLMSG_VERSION + 1;
+    CHECK_EQ(ctlmsg_validate(copy, size), CTLMSG_E_VERSION);
+
+    // Declared length shorter than the header, or past the buffer
+    memcpy(copy, buf, size);
+    hdr->length = sizeof(*hdr) - 1;
+    CHECK_EQ(ctlmsg_validate(copy, size), CTLMSG_E_TRUNCATED);
+    hdr->length = (uint32_t)size + 1;
+    CHECK_EQ(ctlmsg_validate(copy, size), CTLMSG_E_TRUNCATED);
+
+    // Op count disagrees with declared length either way
+    memcpy(copy, buf, size);
+    hdr->op_count = 1;
+    CHECK_EQ(ctlmsg_validate(copy, size), CTLMSG_E_LENGTH);
+    hdr->op_count = 3;
+    CHECK_EQ(ctlmsg_validate(copy, size), CTLMSG_E_TRUNCATED);
+
+    memcpy(copy, buf, size);
+    op->type = 0;
+    CHECK_EQ(ctlmsg_validate(copy, size), CTLMSG_E_OP);
+    op->type = OP_TYPES + 1;
+    CHECK_EQ(ctlmsg_validate(copy, size), CTLMSG_E_OP);
+
+    memcpy(copy, buf, size);
+    op->length = sizeof(struct ctlmsg_pid);
+    CHECK_EQ(ctlmsg_validate(copy, size), CTLMSG_E_LENGTH);
+
+    // Decoder reports errors after the operations before them
+    struct ctlmsg_reader reader;
+    struct ctlmsg_op decoded;
+    memcpy(copy, buf, size);
+    ((struct ctlmsg_op_header*)(copy + size - sizeof(struct ctlmsg_pid) - sizeof(*op)))->type = 0;
+    CHECK_EQ(ctlmsg_reader_init(&reader, copy, size), CTLMSG_OK);
+    CHECK_EQ(ctlmsg_read_op(&reader, &decoded), CTLMSG_OK);
+    CHECK_EQ(decoded.type, CTLMSG_OP_TRUST_ADD);
+    CHECK_EQ(ctlmsg_read_op(&reader, &decoded), CTLMSG_E_OP);
+    CHECK_EQ(ctlmsg_validate(copy, size), CTLMSG_E_OP);
+}
+
+// Every damaged message is copied into a buffer of exactly its size, so any overread trips ASan
+static void check_damaged(const uint8_t* msg, size_t size, int expect_valid)
+{
+    uint8_t* copy = malloc(size ? size : 1);
+    CHECK(copy != NULL);
+    memcpy(copy, msg, size);
+
+    int res = ctlmsg_validate(copy, size);
+    unsigned count;
+    CHECK_EQ(decode(copy, size, NULL, &count), res);
+    if (expect_valid) {
+        CHECK_EQ(res, CTLMSG_OK);
+    }
+
+    if (res == CTLMSG_OK) {
+        // Anything accepted is self consistent
+        struct ctlmsg_header hdr;
+        memcpy(&hdr, copy, sizeof(hdr));
+        CHECK_EQ(hdr.magic, CTLMSG_MAGIC);
+        CHECK_EQ(hdr.version, CTLMSG_VERSION);
+        CHECK(hdr.length <= size);
+        CHECK_EQ(count, hdr.op_count);
+    } else {
+        CHECK(res >= CTLMSG_E_TRUNCATED && res <= CTLMSG_E_LENGTH);
+    }
+
+    free(copy);
+}
+
+static void test_fuzz(void)
+{
+    uint8_t buf[4096];
+    struct ctlmsg_op ops[MAX_OPS];
+    uint64_t seed = 300;
+    unsigned accepted = 0;
+
+    for (unsigned round = 0; round < ROUNDS; ++round) {
+        unsigned count = (unsigned)(check_rand(&seed) % (MAX_OPS + 1));
+        for (unsigned i = 0; i < count; ++i) {
+            random_op(&ops[i], &seed);
+        }
+        size_t size = encode(buf, sizeof(buf), ops, count);
+
+        // Any proper prefix is rejected
+        size_t cut = (size_t)(check_rand(&seed) % size);
+        check_damaged(buf, cut, 0);
+        CHECK(ctlmsg_validate(buf, cut) != CTLMSG_OK);
+
+        // Flip a few bits anywhere
+        unsigned flips = 1 + (unsigned)(check_rand(&seed) % 4);
+        for (unsigned i = 0; i < flips; ++i) {
+            uint64_t r = check_rand(&seed);
+            buf[(r >> 3) % size] ^= (uint8_t)(1u << (r & 7));
+        }
+        check_damaged(buf, size, 0);
+        accepted += (ctlmsg_validate(buf, size) == CTLMSG_OK);
+
+        // Random bytes after a valid header
+        struct ctlmsg_header hdr = { CTLMSG_MAGIC, CTLMSG_VERSION, 0, (uint32_t)size,
+                                     (uint32_t)(check_rand(&seed) % (MAX_OPS + 1)) };
+        memcpy(buf, &hdr, sizeof(hdr));
+        for (size_t i = sizeof(hdr); i < size; ++i) {
+            buf[i] = (uint8_t)check_rand(&seed);
+        }
+        check_damaged(buf, size, 0);
+        check_damaged(buf, size - (size > sizeof(hdr)), 0);
+    }
+
+    // Flips confined to payload bytes leave plenty of messages valid
+    CHECK(accepted > 0);
+}
+
+int main(void)
+{
+    test_round_trip();
+    test_writer_errors();
+    test_malformed();
+    test_fuzz();
+    printf("ctlmsg: ok\n");
+    return 0;
+}
@@ -0,0 +1,241 @@
+//
+//  test_filter.c
+//  tests
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Hook decisions: allowed calls never reach the caller callbacks, trusted callers pass only with their own
+//  start time, repeat denials come from the rate limiter cache until the policy generation changes,
+//  and mach messages are judged by id or by destination task.
+//
+
+#include <string.h>
+
+#include "check.h"
+#include "filter.h"
+
+#define CALLER      500
+#define TARGET      600
+#define GROUP       60
+#define RATE        10      /* as in test.c */
+#define BURST       20
+#define BOOT_MS     100000
+
+static struct protect_set g_protect;
+static struct trustcache g_trust;
+static struct ratelimit g_limit;
+
+struct caller_ctx {
+    uint64_t start_time;
+    uint64_t now;
+    unsigned start_time_calls;
+    unsigned now_calls;
+};
+
+static uint64_t caller_start_time(void* ctx)
+{
+    struct caller_ctx* c = ctx;
+    c->start_time_calls++;
+    return c->start_time;
+}
+
+static uint64_t caller_now_ms(void* ctx)
+{
+    struct caller_ctx* c = ctx;
+    c->now_calls++;
+    return c->now;
+}
+
+static void setup(struct filter_policy* policy, struct filter_caller* caller, struct caller_ctx* ctx)
+{
+    protect_init(&g_protect);
+    trustcache_init(&g_trust);
+    ratelimit_init(&g_limit, RATE, BURST);
+    CHECK_EQ(protect_add(&g_protect, TARGET, GROUP, PROTECT_SIGBIT(9) | PROTECT_SIGBIT(15), 0, (const void*)0x1000), PROTECT_OK);
+
+    policy->protect = &g_protect;
+    policy->trust = &g_trust;
+    policy->limit = &g_limit;
+    policy->generation = 1;
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->start_time = 777;
+    ctx->now = BOOT_MS;
+
+    memset(caller, 0, sizeof(*caller));
+    caller->pid = CALLER;
+    caller->pgid = CALLER;
+    caller->start_time = caller_start_time;
+    caller->now_ms = caller_now_ms;
+    caller->ctx = ctx;
+}
+
+static void test_allowed_calls_are_free(void)
+{
+    struct filter_policy policy;
+    struct filter_caller caller;
+    struct caller_ctx ctx;
+    setup(&policy, &caller, &ctx);
+    CHECK_EQ(trustcache_add(&g_trust, CALLER, ctx.start_time, 0), TRUSTCACHE_OK);
+
+    int32_t target;
+    CHECK_EQ(filter_kill(&policy, &caller, TARGET, 1), FILTER_ALLOW);
+    CHECK_EQ(filter_kill(&policy, &caller, TARGET, 0), FILTER_ALLOW);
+    CHECK_EQ(filter_kill(&policy, &caller, TARGET + 1, 9), FILTER_ALLOW);
+    CHECK_EQ(filter_kill(&policy, &caller, -(GROUP + 1), 9), FILTER_ALLOW);
+    CHECK_EQ(filter_kill(&policy, &caller, 0, 9), FILTER_ALLOW);
+    CHECK_EQ(filter_task_for_pid(&policy, &caller, TARGET + 1), FILTER_ALLOW);
+    CHECK_EQ(filter_mach_msg(&policy, &caller, 3402, NULL, &target), FILTER_ALLOW);
+    CHECK_EQ(target, 0);
+    CHECK_EQ(filter_mach_msg(&policy, &caller, 3402, (const void*)0x2000, &target), FILTER_ALLOW);
+
+    // A protected process may do anything to itself
+    caller.pid = TARGET;
+    CHECK_EQ(filter_task_for_pid(&policy, &caller, TARGET), FILTER_ALLOW);
+
+    CHECK_EQ(ctx.start_time_calls, 0);
+    CHECK_EQ(ctx.now_calls, 0);
+}
+
+static void test_trust(void)
+{
+    struct filter_policy policy;
+    struct filter_caller caller;
+    struct caller_ctx ctx;
+    setup(&policy, &caller, &ctx);
+
+    CHECK_EQ(filter_kill(&policy, &caller, TARGET, 9), FILTER_DENY);
+    CHECK_EQ(ctx.start_time_calls, 0);      // empty trust cache is not consulted
+
+    CHECK_EQ(trustcache_add(&g_trust, CALLER, ctx.start_time, 0), TRUSTCACHE_OK);
+    policy.generation++;
+    CHECK_EQ(filter_kill(&policy, &caller, TARGET, 9), FILTER_ALLOW);
+    CHECK_EQ(filter_kill(&policy, &caller, -GROUP, 15), FILTER_ALLOW);
+    CHECK_EQ(filter_task_for_pid(&policy, &caller, TARGET), FILTER_ALLOW);
+    CHECK_EQ(ctx.start_time_calls, 3);
+
+    // Same pid, different process
+    ctx.start_time++;
+    CHECK_EQ(filter_kill(&policy, &caller, TARGET, 9), FILTER_DENY);
+    CHECK_EQ(filter_task_for_pid(&policy, &caller, TARGET), FILTER_DENY);
+
+    // Other callers are not trusted
+    ctx.start_time--;
+    caller.pid = CALLER + 1;
+    CHECK_EQ(filter_kill(&policy, &caller, TARGET, 9), FILTER_DENY);
+}
+
+static void test_cached_denials(void)
+{
+    struct filter_policy policy;
+    struct filter_caller caller;
+    struct caller_ctx ctx;
+    setup(&policy, &caller, &ctx);
+
+    // Burst is audited, then the same request is served from cache and counted as suppressed
+    for (unsigned i = 0; i < BURST; ++i) {
+        CHECK_EQ(filter_kill(&policy, &caller, TARGET, 9), FILTER_DENY);
+        CHECK(filter_audit(&policy, &caller, AUDIT_KILL_DENIED, TARGET, 9));
+    }
+
+    unsigned calls = ctx.start_time_calls;
+    CHECK_EQ(filter_kill(&policy, &caller, TARGET, 9), FILTER_DENY_CACHED);
+    CHECK_EQ(ctx.start_time_calls, calls);
+
+    // Different signal, target or call is a different request
+    CHECK_EQ(filter_kill(&policy, &caller, TARGET, 15), FILTER_DENY);
+    CHECK_EQ(filter_kill(&policy, &caller, -GROUP, 9), FILTER_DENY);
+    CHECK_EQ(filter_task_for_pid(&policy, &caller, TARGET), FILTER_DENY);
+
+    // Trusting the caller changes the generation, which ends cached denials
+    CHECK_EQ(trustcache_add(&g_trust, CALLER, ctx.start_time, 0), TRUSTCACHE_OK);
+    CHECK_EQ(filter_kill(&policy, &caller, TARGET, 9), FILTER_DENY_CACHED);
+    policy.generation++;
+    CHECK_EQ(filter_kill(&policy, &caller, TARGET, 9), FILTER_ALLOW);
+
+    // Refilled tokens end them as well
+    trustcache_init(&g_trust);
+    policy.generation++;
+    for (unsigned i = 0; i < BURST + 1; ++i) {
+        filter_audit(&policy, &caller, AUDIT_KILL_DENIED, TARGET, 9);
+    }
+    CHECK_EQ(filter_kill(&policy, &caller, TARGET, 9), FILTER_DENY_CACHED);
+    ctx.now += 1000 / RATE;
+    CHECK_EQ(filter_kill(&policy, &caller, TARGET, 9), FILTER_DENY);
+    CHECK(filter_audit(&policy, &caller, AUDIT_KILL_DENIED, TARGET, 9));
+}
+
+static void test_mach_msg(void)
+{
+    struct filter_policy policy;
+    struct filter_caller caller;
+    struct caller_ctx ctx;
+    setup(&policy, &caller, &ctx);
+
+    int32_t target = -1;
+    CHECK_EQ(filter_mach_msg(&policy, &caller, PROTECT_MIG_PROCESSOR_SET_TASKS, NULL, &target), FILTER_DENY);
+    CHECK_EQ(target, 0);
+    CHECK_EQ(filter_mach_msg(&policy, &caller, PROTECT_MIG_PROCESSOR_SET_THREADS, (const void*)0x2000, &target), FILTER_DENY);
+    CHECK_EQ(target, 0);
+
+    // Destination task decides for any other message
+    CHECK_EQ(filter_mach_msg(&policy, &caller, 3402, (const void*)0x1000, &target), FILTER_DENY);
+    CHECK_EQ(target, TARGET);
+
+    // Nothing protected, nothing denied
+    CHECK_EQ(protect_remove(&g_protect, TARGET), PROTECT_OK);
+    CHECK_EQ(filter_mach_msg(&policy, &caller, PROTECT_MIG_PROCESSOR_SET_TASKS, NULL, &target), FILTER_ALLOW);
+    CHECK_EQ(filter_mach_msg(&policy, &caller, 3402, (const void*)0x1000, &target), FILTER_ALLOW);
+    CHECK_EQ(target, 0);
+}
+
+// Verdicts agree with the protected set for random kills from trusted and untrusted callers
+static void test_random_kills(void)
+{
+    struct filter_policy policy;
+    struct filter_caller caller;
+    struct caller_ctx ctx;
+    setup(&policy, &caller, &ctx);
+
+    // Callers keep start time 777, a quarter of them are trusted
+    uint64_t seed = 35;
+    for (int32_t pid = 1; pid < 200; ++pid) {
+        if (check_rand(&seed) % 3 == 0) {
+            CHECK_EQ(protect_add(&g_protect, pid, 1 + pid % 20, check_rand(&seed) & check_rand(&seed), 0, NULL), PROTECT_OK);
+        }
+        if (check_rand(&seed) % 4 == 0) {
+            CHECK_EQ(trustcache_add(&g_trust, pid + 1000, 777, 0), TRUSTCACHE_OK);
+        }
+    }
+
+    for (unsigned round = 0; round < 200000; ++round) {
+        caller.pid = 1000 + (int32_t)(check_rand(&seed) % 200);
+        caller.pgid = 1 + (int32_t)(check_rand(&seed) % 25);
+        ctx.now += check_rand(&seed) % 50;
+        int32_t pid = (int32_t)(check_rand(&seed) % 230) - 25;
+        int signum = (int)(check_rand(&seed) % 66) - 1;
+
+        int protected = protect_check_kill(&g_protect, pid, signum, caller.pgid, NULL, NULL);
+        int trusted = trustcache_check(&g_trust, caller.pid, caller_start_time, &ctx);
+        int res = filter_kill(&policy, &caller, pid, signum);
+        if (!protected || trusted) {
+            CHECK_EQ(res, FILTER_ALLOW);
+        } else {
+            CHECK(res == FILTER_DENY || res == FILTER_DENY_CACHED);
+        }
+        if (res == FILTER_DENY) {
+            filter_audit(&policy, &caller, AUDIT_KILL_DENIED, pid, signum);
+        }
+    }
+}
+
+int main(void)
+{
+    test_allowed_calls_are_free();
+    test_trust();
+    test_cached_denials();
+    test_mach_msg();
+    test_random_kills();
+    printf("filter: ok\n");
+    return 0;
+}
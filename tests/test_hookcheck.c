@@ -0,0 +1,135 @@
+//
+//  test_hookcheck.c
+//  tests
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Hook verification against synthetic sysent and mach trap tables with hooks overwritten at random.
+//
+
+#include <string.h>
+
+#include "check.h"
+#include "hookcheck.h"
+#include "hooks.h"
+#include "killhook.h"
+
+#define SYSENT_ENTRIES  520
+#define TRAP_ENTRIES    128
+#define MAX_SLOTS       200
+
+// Yosemite sysent and Mavericks trap layouts, only the handler pointers matter here
+struct sysent_entry {
+    const void* call;
+    const void* munge;
+    int32_t     return_type;
+    int16_t     narg;
+    uint16_t    arg_bytes;
+};
+
+struct trap_entry {
+    int         arg_count;
+    const void* function;
+    const void* munge;
+    int         u32_words;
+};
+
+static struct sysent_entry g_sysent[SYSENT_ENTRIES];
+static struct trap_entry g_traps[TRAP_ENTRIES];
+static char g_handlers[MAX_SLOTS];      // Addresses stand in for our hook functions
+static char g_foreign[MAX_SLOTS];       // and for handlers someone else installed over them
+
+static struct hookcheck_slot g_slots[MAX_SLOTS];
+
+static void install(unsigned count)
+{
+    memset(g_sysent, 0, sizeof(g_sysent));
+    memset(g_traps, 0, sizeof(g_traps));
+    for (unsigned i = 0; i < count; ++i) {
+        // Spread slots over both tables like the registry does
+        const void** slot = (i % 4 == 3 ? &g_traps[i / 4].function : &g_sysent[i].call);
+        g_slots[i].slot = (const void* const*)slot;
+        g_slots[i].expected = &g_handlers[i];
+        *slot = &g_handlers[i];
+    }
+}
+
+static void check_bitmap(unsigned count, const uint64_t* expected)
+{
+    uint64_t lost[HOOKCHECK_BITMAP_WORDS(MAX_SLOTS)];
+    memset(lost, 0xff, sizeof(lost));
+
+    unsigned nexpected = 0;
+    for (unsigned w = 0; w < HOOKCHECK_BITMAP_WORDS(count); ++w) {
+        nexpected += (unsigned)__builtin_popcountll(expected[w]);
+    }
+
+    CHECK_EQ(hookcheck_verify(g_slots, count, lost), nexpected);
+    for (unsigned w = 0; w < HOOKCHECK_BITMAP_WORDS(count); ++w) {
+        CHECK(lost[w] == expected[w]);
+    }
+    // Words past the bitmap are left alone
+    if (HOOKCHECK_BITMAP_WORDS(count) < HOOKCHECK_BITMAP_WORDS(MAX_SLOTS)) {
+        CHECK(lost[HOOKCHECK_BITMAP_WORDS(count)] == ~0ull);
+    }
+}
+
+static void test_counts(void)
+{
+    // Word boundaries of the bitmap
+    unsigned counts[] = { 0, 1, 63, 64, 65, 127, 128, 129, MAX_SLOTS };
+    uint64_t seed = 29;
+
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        unsigned count = counts[c];
+        for (unsigned round = 0; round < 200; ++round) {
+            install(count);
+
+            uint64_t expected[HOOKCHECK_BITMAP_WORDS(MAX_SLOTS)] = { 0 };
+            check_bitmap(count, expected);
+
+            // Overwrite a random subset, sometimes all of them
+            for (unsigned i = 0; i < count; ++i) {
+                if (round % 50 == 49 || check_rand(&seed) % 5 == 0) {
+                    *(const void**)g_slots[i].slot = &g_foreign[i];
+                    expected[i / 64] |= 1ull << (i % 64);
+                }
+            }
+            check_bitmap(count, expected);
+
+            // Putting our own handler back counts as installed again
+            for (unsigned i = 0; i < count; ++i) {
+                *(const void**)g_slots[i].slot = g_slots[i].expected;
+            }
+            memset(expected, 0, sizeof(expected));
+            check_bitmap(count, expected);
+        }
+    }
+}
+
+// Registry of the kext fits the status bitmap exported through sysctl
+static void test_registry(void)
+{
+    unsigned count = 0;
+#define COUNT_HOOK(table, num, handler, original)   count++;
+    KILLHOOK_HOOKS(COUNT_HOOK)
+#undef COUNT_HOOK
+
+    CHECK(count > 0);
+    CHECK(count <= KILLHOOK_MAX_HOOKS);
+    CHECK(count <= MAX_SLOTS);
+
+    install(count);
+    *(const void**)g_slots[count - 1].slot = NULL;
+    uint64_t expected[HOOKCHECK_BITMAP_WORDS(MAX_SLOTS)] = { 0 };
+    expected[(count - 1) / 64] = 1ull << ((count - 1) % 64);
+    check_bitmap(count, expected);
+}
+
+int main(void)
+{
+    test_counts();
+    test_registry();
+    printf("hookcheck: ok\n");
+    return 0;
+}
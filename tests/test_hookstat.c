@@ -0,0 +1,136 @@
+//
+//  test_hookstat.c
+//  tests
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Bucket placement, percentiles, per-CPU merge and concurrent writers of hookstat.
+//
+
+#include <string.h>
+#include <pthread.h>
+
+#include "check.h"
+#include "hookstat.h"
+
+#define WRITERS         4
+#define WRITER_SAMPLES  200000
+
+static struct hookstat_percpu g_cpus[HOOKSTAT_MAX_CPUS];
+
+static unsigned bucket_of(uint64_t cycles)
+{
+    hookstat_reset(g_cpus, HOOKSTAT_MAX_CPUS);
+    hookstat_record(g_cpus, 0, HOOKSTAT_KILL, cycles);
+    for (unsigned i = 0; i < HOOKSTAT_BUCKETS; ++i) {
+        if (g_cpus[0].hist[HOOKSTAT_KILL].buckets[i]) {
+            return i;
+        }
+    }
+    return HOOKSTAT_BUCKETS;
+}
+
+static void test_buckets(void)
+{
+    CHECK_EQ(bucket_of(0), 0);
+    CHECK_EQ(bucket_of(1), 1);
+    CHECK_EQ(bucket_of(2), 2);
+    CHECK_EQ(bucket_of(3), 2);
+    CHECK_EQ(bucket_of(4), 3);
+    CHECK_EQ(bucket_of(1000), 10);
+    CHECK_EQ(bucket_of(1ull << 62), 63);
+    CHECK_EQ(bucket_of(UINT64_MAX), HOOKSTAT_BUCKETS - 1);
+}
+
+static void test_percentiles(void)
+{
+    struct hookstat_hist hist;
+    memset(&hist, 0, sizeof(hist));
+    CHECK_EQ(hookstat_percentile(&hist, 5000), 0);
+
+    // 990 fast calls in [64, 128), 9 in [1024, 2048) and one outlier in [4096, 8192)
+    hookstat_reset(g_cpus, HOOKSTAT_MAX_CPUS);
+    for (unsigned i = 0; i < 990; ++i) {
+        hookstat_record(g_cpus, 0, HOOKSTAT_MACH_MSG, 100);
+    }
+    for (unsigned i = 0; i < 9; ++i) {
+        hookstat_record(g_cpus, 0, HOOKSTAT_MACH_MSG, 1500);
+    }
+    hookstat_record(g_cpus, 0, HOOKSTAT_MACH_MSG, 5000);
+
+    const struct hookstat_hist* h = &g_cpus[0].hist[HOOKSTAT_MACH_MSG];
+    CHECK_EQ(h->count, 1000);
+    CHECK_EQ(hookstat_percentile(h, 0), 127);
+    CHECK_EQ(hookstat_percentile(h, 5000), 127);
+    CHECK_EQ(hookstat_percentile(h, 9900), 127);
+    CHECK_EQ(hookstat_percentile(h, 9950), 2047);
+    CHECK_EQ(hookstat_percentile(h, 9990), 2047);
+    CHECK_EQ(hookstat_percentile(h, 10000), 8191);
+}
+
+static void test_merge(void)
+{
+    hookstat_reset(g_cpus, HOOKSTAT_MAX_CPUS);
+    for (unsigned cpu = 0; cpu < HOOKSTAT_MAX_CPUS; ++cpu) {
+        hookstat_record(g_cpus, cpu, HOOKSTAT_TASK_FOR_PID, cpu + 1);
+    }
+    // CPU numbers past the array wrap around instead of writing out of bounds
+    hookstat_record(g_cpus, HOOKSTAT_MAX_CPUS + 3, HOOKSTAT_TASK_FOR_PID, 1);
+    CHECK_EQ(g_cpus[3].hist[HOOKSTAT_TASK_FOR_PID].count, 2);
+
+    struct hookstat_snapshot snapshot;
+    hookstat_merge(g_cpus, HOOKSTAT_MAX_CPUS * 2, &snapshot);
+    CHECK_EQ(snapshot.version, HOOKSTAT_VERSION);
+    CHECK_EQ(snapshot.nhooks, HOOKSTAT_COUNT);
+    CHECK_EQ(snapshot.hist[HOOKSTAT_TASK_FOR_PID].count, HOOKSTAT_MAX_CPUS + 1);
+    CHECK_EQ(snapshot.hist[HOOKSTAT_KILL].count, 0);
+
+    uint64_t total = 0;
+    for (unsigned i = 0; i < HOOKSTAT_BUCKETS; ++i) {
+        total += snapshot.hist[HOOKSTAT_TASK_FOR_PID].buckets[i];
+    }
+    CHECK_EQ(total, HOOKSTAT_MAX_CPUS + 1);
+
+    hookstat_reset(g_cpus, HOOKSTAT_MAX_CPUS);
+    hookstat_merge(g_cpus, HOOKSTAT_MAX_CPUS, &snapshot);
+    CHECK_EQ(snapshot.hist[HOOKSTAT_TASK_FOR_PID].count, 0);
+}
+
+static void* writer(void* arg)
+{
+    unsigned cpu = (unsigned)(uintptr_t)arg;
+    uint64_t seed = 0x9e3779b97f4a7c15ull + cpu;
+    for (unsigned i = 0; i < WRITER_SAMPLES; ++i) {
+        hookstat_record(g_cpus, cpu, HOOKSTAT_KILL, check_rand(&seed) % 100000);
+    }
+    return NULL;
+}
+
+// Every writer owns its CPU slot like the kext does with preemption of a hook being rare, so nothing is lost
+static void test_concurrent_writers(void)
+{
+    hookstat_reset(g_cpus, HOOKSTAT_MAX_CPUS);
+
+    pthread_t threads[WRITERS];
+    for (unsigned i = 0; i < WRITERS; ++i) {
+        CHECK(0 == pthread_create(&threads[i], NULL, writer, (void*)(uintptr_t)i));
+    }
+    for (unsigned i = 0; i < WRITERS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    struct hookstat_snapshot snapshot;
+    hookstat_merge(g_cpus, HOOKSTAT_MAX_CPUS, &snapshot);
+    CHECK_EQ(snapshot.hist[HOOKSTAT_KILL].count, WRITERS * WRITER_SAMPLES);
+    CHECK(hookstat_percentile(&snapshot.hist[HOOKSTAT_KILL], 9900) == 131071);
+}
+
+int main(void)
+{
+    test_buckets();
+    test_percentiles();
+    test_merge();
+    test_concurrent_writers();
+    printf("hookstat: ok\n");
+    return 0;
+}
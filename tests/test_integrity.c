@@ -0,0 +1,157 @@
+//
+//  test_integrity.c
+//  tests
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Chunked integrity passes against synthetic sysent and mach trap tables.
+//
+
+#include <string.h>
+
+#include "check.h"
+#include "integrity.h"
+
+#define SYSENT_ENTRIES  520
+#define SYSENT_STRIDE   24
+#define TRAP_ENTRIES    128
+#define TRAP_STRIDE     32
+
+static uint8_t g_sysent[SYSENT_ENTRIES * SYSENT_STRIDE];
+static uint8_t g_traps[TRAP_ENTRIES * TRAP_STRIDE];
+
+static void fill_tables(void)
+{
+    uint64_t seed = 27;
+    for (size_t i = 0; i < sizeof(g_sysent); ++i) {
+        g_sysent[i] = (uint8_t)check_rand(&seed);
+    }
+    for (size_t i = 0; i < sizeof(g_traps); ++i) {
+        g_traps[i] = (uint8_t)check_rand(&seed);
+    }
+}
+
+// Bytes of the current pass already hashed
+static size_t pass_progress(const struct integrity_state* state)
+{
+    size_t done = state->offset;
+    for (unsigned i = 0; i < state->region; ++i) {
+        done += state->regions[i].size;
+    }
+    return done;
+}
+
+// Step until a pass completes, checking that no step hashes more than its budget
+static int run_pass(struct integrity_state* state, size_t budget, unsigned* steps)
+{
+    size_t aligned = budget & ~(size_t)7;
+    aligned = (aligned ? aligned : 8);
+
+    for (*steps = 1; ; ++*steps) {
+        size_t before = pass_progress(state);
+        int res = integrity_step(state, budget);
+        if (res != INTEGRITY_PENDING) {
+            return res;
+        }
+        CHECK(pass_progress(state) - before <= aligned);
+        CHECK(pass_progress(state) > before);
+    }
+}
+
+static void test_chunked_matches_full(void)
+{
+    struct integrity_state state;
+    integrity_init(&state);
+    CHECK(integrity_add_region(&state, g_sysent, sizeof(g_sysent)));
+    CHECK(integrity_add_region(&state, g_traps, sizeof(g_traps)));
+    // Odd sized and empty regions hash the same chunked and in one go
+    CHECK(integrity_add_region(&state, g_sysent + 5, 13));
+    CHECK(integrity_add_region(&state, g_traps, 0));
+    integrity_rebaseline(&state);
+    CHECK(state.baseline == integrity_hash_full(&state));
+
+    size_t budgets[] = { 0, 1, 8, 13, 24, 4096, 1 << 20 };
+    for (size_t i = 0; i < sizeof(budgets) / sizeof(budgets[0]); ++i) {
+        unsigned steps;
+        CHECK_EQ(run_pass(&state, budgets[i], &steps), INTEGRITY_OK);
+        if (budgets[i] >= sizeof(g_sysent) + sizeof(g_traps) + 16) {
+            CHECK_EQ(steps, 1);
+        }
+    }
+
+    unsigned steps;
+    CHECK_EQ(run_pass(&state, 4096, &steps), INTEGRITY_OK);
+    CHECK_EQ(steps, (sizeof(g_sysent) + sizeof(g_traps) + 13 + 4095) / 4096);
+    CHECK_EQ(state.passes, sizeof(budgets) / sizeof(budgets[0]) + 1);
+    CHECK_EQ(state.mismatches, 0);
+}
+
+static void test_detects_modifications(void)
+{
+    struct integrity_state state;
+    integrity_init(&state);
+    CHECK(integrity_add_region(&state, g_sysent, sizeof(g_sysent)));
+    CHECK(integrity_add_region(&state, g_traps, sizeof(g_traps)));
+    integrity_rebaseline(&state);
+
+    unsigned steps;
+    uint64_t seed = 270;
+    for (unsigned round = 0; round < 1000; ++round) {
+        // Patch a handler pointer somewhere while a pass is in progress
+        integrity_step(&state, 4096);
+        uint8_t* table = (round & 1 ? g_traps : g_sysent);
+        size_t size = (round & 1 ? sizeof(g_traps) : sizeof(g_sysent));
+        size_t offset = (check_rand(&seed) % size) & ~(size_t)7;
+        uint64_t saved;
+        memcpy(&saved, table + offset, sizeof(saved));
+        uint64_t patched = saved ^ (1ull << (check_rand(&seed) % 64));
+        memcpy(table + offset, &patched, sizeof(patched));
+
+        // Change behind the cursor shows up one pass later at the latest
+        int res = run_pass(&state, 4096, &steps);
+        if (res == INTEGRITY_OK) {
+            res = run_pass(&state, 4096, &steps);
+        }
+        CHECK_EQ(res, INTEGRITY_MISMATCH);
+
+        // Report once per modification
+        integrity_rebaseline(&state);
+        CHECK_EQ(run_pass(&state, 4096, &steps), INTEGRITY_OK);
+
+        memcpy(table + offset, &saved, sizeof(saved));
+        integrity_rebaseline(&state);
+    }
+
+    // Swapped neighbour entries do not cancel out
+    uint8_t entry[SYSENT_STRIDE];
+    memcpy(entry, g_sysent, SYSENT_STRIDE);
+    memcpy(g_sysent, g_sysent + SYSENT_STRIDE, SYSENT_STRIDE);
+    memcpy(g_sysent + SYSENT_STRIDE, entry, SYSENT_STRIDE);
+    CHECK_EQ(run_pass(&state, 1 << 20, &steps), INTEGRITY_MISMATCH);
+}
+
+static void test_region_limit(void)
+{
+    struct integrity_state state;
+    integrity_init(&state);
+    for (unsigned i = 0; i < INTEGRITY_MAX_REGIONS; ++i) {
+        CHECK(integrity_add_region(&state, g_sysent + i * SYSENT_STRIDE, SYSENT_STRIDE));
+    }
+    CHECK(!integrity_add_region(&state, g_traps, TRAP_STRIDE));
+    CHECK_EQ(state.nregions, INTEGRITY_MAX_REGIONS);
+
+    // No regions means an empty pass that always matches
+    integrity_init(&state);
+    integrity_rebaseline(&state);
+    CHECK_EQ(integrity_step(&state, 4096), INTEGRITY_OK);
+}
+
+int main(void)
+{
+    fill_tables();
+    test_chunked_matches_full();
+    test_detects_modifications();
+    test_region_limit();
+    printf("integrity: ok\n");
+    return 0;
+}
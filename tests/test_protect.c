@@ -0,0 +1,202 @@
+//
+//  test_protect.c
+//  tests
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Simulation of the protected set against a plain reference model: every kill(2) target form,
+//  task_for_pid, task lookups and message ids after random add, update, remove, regroup and exec.
+//
+
+#include <string.h>
+
+#include "check.h"
+#include "protect.h"
+
+#define PIDS        400     /* more than PROTECT_MAX_ENTRIES so the set fills up */
+#define GROUPS      40
+#define ROUNDS      300000
+
+struct model {
+    int         used;
+    int32_t     pgid;
+    uint64_t    sigmask;
+    const void* task;
+};
+
+static struct protect_set g_set;
+static struct model g_model[PIDS + 1];
+static uint32_t g_count;
+
+static const void* task_of(int32_t pid, unsigned generation)
+{
+    return (const void*)(uintptr_t)(((uint64_t)generation << 32) | ((uint32_t)pid << 4) | 0x8);
+}
+
+// Broadcast reach stand-in: caller reaches processes whose pid differs from its own modulo 3
+static int reach_mod3(const struct protect_entry* entry, void* ctx)
+{
+    int32_t caller = *(const int32_t*)ctx;
+    return (entry->pid % 3 != caller % 3);
+}
+
+static int model_kill(int32_t pid, int signum, int32_t caller_pgid, int32_t caller)
+{
+    if (signum <= 0 || signum >= 64) {
+        return 0;
+    }
+
+    uint64_t sigbit = PROTECT_SIGBIT(signum);
+    for (int32_t p = 1; p <= PIDS; ++p) {
+        const struct model* m = &g_model[p];
+        if (!m->used || !(m->sigmask & sigbit)) {
+            continue;
+        }
+        if ((pid > 0 && p == pid) ||
+            (pid == 0 && m->pgid == caller_pgid) ||
+            (pid == -1 && p % 3 != caller % 3) ||
+            (pid < -1 && m->pgid == -pid)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void check_invariants(void)
+{
+    CHECK_EQ(g_set.count, g_count);
+
+    uint64_t sigmask = 0;
+    uint32_t groups = 0;
+    for (int32_t p = 1; p <= PIDS; ++p) {
+        const struct model* m = &g_model[p];
+        const struct protect_entry* entry = protect_find_pid(&g_set, p);
+        CHECK((entry != NULL) == m->used);
+        if (!m->used) {
+            continue;
+        }
+
+        CHECK_EQ(entry->pgid, m->pgid);
+        CHECK(entry->sigmask == m->sigmask);
+        CHECK(entry->task == m->task);
+        CHECK(protect_find_task(&g_set, m->task) == entry);
+        sigmask |= m->sigmask;
+
+        int first = 1;
+        for (int32_t q = 1; q < p; ++q) {
+            first &= !(g_model[q].used && g_model[q].pgid == m->pgid);
+        }
+        groups += (uint32_t)first;
+    }
+
+    CHECK(g_set.sigmask == sigmask);
+    CHECK_EQ(g_set.ngroups, groups);
+}
+
+static void test_random_policy(void)
+{
+    protect_init(&g_set);
+    memset(g_model, 0, sizeof(g_model));
+    g_count = 0;
+
+    unsigned generation = 1;
+    uint64_t seed = 28;
+    for (unsigned round = 0; round < ROUNDS; ++round) {
+        int32_t pid = 1 + (int32_t)(check_rand(&seed) % PIDS);
+        struct model* m = &g_model[pid];
+        unsigned op = (unsigned)(check_rand(&seed) % 10);
+
+        if (op < 3) {
+            int32_t pgid = 1 + (int32_t)(check_rand(&seed) % GROUPS);
+            uint64_t sigmask = check_rand(&seed) & check_rand(&seed);
+            const void* task = task_of(pid, generation++);
+            int res = protect_add(&g_set, pid, pgid, sigmask, 0, task);
+            if (!m->used && g_count == PROTECT_MAX_ENTRIES) {
+                CHECK_EQ(res, PROTECT_FULL);
+            } else {
+                CHECK_EQ(res, PROTECT_OK);
+                g_count += (uint32_t)!m->used;
+                m->used = 1;
+                m->pgid = pgid;
+                m->sigmask = sigmask;
+                m->task = task;
+            }
+        } else if (op == 3) {
+            CHECK_EQ(protect_remove(&g_set, pid), (m->used ? PROTECT_OK : PROTECT_NOT_FOUND));
+            g_count -= (uint32_t)m->used;
+            m->used = 0;
+        } else if (op == 4) {
+            int32_t pgid = 1 + (int32_t)(check_rand(&seed) % GROUPS);
+            CHECK_EQ(protect_setpgid(&g_set, pid, pgid), (m->used ? PROTECT_OK : PROTECT_NOT_FOUND));
+            m->pgid = (m->used ? pgid : m->pgid);
+        } else if (op == 5) {
+            const void* task = task_of(pid, generation++);
+            CHECK_EQ(protect_exec(&g_set, pid, task), (m->used ? PROTECT_OK : PROTECT_NOT_FOUND));
+            m->task = (m->used ? task : m->task);
+        } else {
+            // Every kill(2) target form, with signal numbers just outside the valid range as well
+            int32_t caller = 1 + (int32_t)(check_rand(&seed) % PIDS);
+            int32_t caller_pgid = 1 + (int32_t)(check_rand(&seed) % GROUPS);
+            int signum = (int)(check_rand(&seed) % 66) - 1;
+            int32_t targets[] = { pid, 0, -1, -caller_pgid, -(1 + (int32_t)(check_rand(&seed) % GROUPS)), -GROUPS - 1 };
+            for (size_t i = 0; i < sizeof(targets) / sizeof(targets[0]); ++i) {
+                CHECK_EQ(protect_check_kill(&g_set, targets[i], signum, caller_pgid, reach_mod3, &caller),
+                         model_kill(targets[i], signum, caller_pgid, caller));
+            }
+
+            // Without a reach callback broadcast hits every entry with the signal
+            CHECK_EQ(protect_check_kill(&g_set, -1, signum, caller_pgid, NULL, NULL),
+                     (signum > 0 && signum < 64 && (g_set.sigmask & PROTECT_SIGBIT(signum))));
+
+            CHECK_EQ(protect_check_task_for_pid(&g_set, caller, pid), (m->used && caller != pid));
+            CHECK_EQ(protect_check_task_for_pid(&g_set, pid, pid), 0);
+            CHECK_EQ(protect_check_msg_id(&g_set, PROTECT_MIG_PROCESSOR_SET_TASKS), (g_count != 0));
+            CHECK_EQ(protect_check_msg_id(&g_set, PROTECT_MIG_PROCESSOR_SET_THREADS), (g_count != 0));
+            CHECK_EQ(protect_check_msg_id(&g_set, 3402), 0);
+        }
+
+        if (round % 1000 == 0) {
+            check_invariants();
+        }
+    }
+
+    check_invariants();
+}
+
+static void test_edge_cases(void)
+{
+    protect_init(&g_set);
+    CHECK_EQ(protect_add(&g_set, 0, 1, ~0ull, 0, NULL), PROTECT_INVALID);
+    CHECK_EQ(protect_add(&g_set, -5, 1, ~0ull, 0, NULL), PROTECT_INVALID);
+
+    // Process group 0 or negative never matches
+    CHECK_EQ(protect_add(&g_set, 10, 7, PROTECT_SIGBIT(9), 0, NULL), PROTECT_OK);
+    CHECK_EQ(protect_check_kill(&g_set, 0, 9, 0, NULL, NULL), 0);
+    CHECK_EQ(protect_check_kill(&g_set, 0, 9, 7, NULL, NULL), 1);
+    CHECK_EQ(protect_check_kill(&g_set, -7, 9, 0, NULL, NULL), 1);
+    CHECK_EQ(protect_check_kill(&g_set, -7, 15, 0, NULL, NULL), 0);
+    CHECK_EQ(protect_check_kill(&g_set, 10, 0, 0, NULL, NULL), 0);
+    CHECK_EQ(protect_check_kill(&g_set, INT32_MIN, 9, 7, NULL, NULL), 0);
+    CHECK_EQ(protect_check_kill(&g_set, INT32_MIN + 1, 9, 7, NULL, NULL), 0);
+
+    // Group mask shrinks when the last member carrying a signal leaves
+    CHECK_EQ(protect_add(&g_set, 11, 7, PROTECT_SIGBIT(15), 0, NULL), PROTECT_OK);
+    CHECK_EQ(protect_check_kill(&g_set, -7, 15, 0, NULL, NULL), 1);
+    CHECK_EQ(protect_setpgid(&g_set, 11, 8), PROTECT_OK);
+    CHECK_EQ(protect_check_kill(&g_set, -7, 15, 0, NULL, NULL), 0);
+    CHECK_EQ(protect_check_kill(&g_set, -8, 15, 0, NULL, NULL), 1);
+    CHECK_EQ(protect_remove(&g_set, 11), PROTECT_OK);
+    CHECK_EQ(protect_check_kill(&g_set, -8, 15, 0, NULL, NULL), 0);
+    CHECK(!(g_set.sigmask & PROTECT_SIGBIT(15)));
+
+    // NULL task is not indexed
+    CHECK(protect_find_task(&g_set, NULL) == NULL);
+}
+
+int main(void)
+{
+    test_edge_cases();
+    test_random_policy();
+    printf("protect: ok\n");
+    return 0;
+}
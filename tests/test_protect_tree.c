@@ -0,0 +1,296 @@
+//
+//  test_protect_tree.c
+//  tests
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Process tree churn against a reference model: spawns from protected and unprotected parents,
+//  exits seen and missed, pid reuse over stale entries, sweeps, explicit entries added and removed
+//  by userspace with and without PROTECT_FLAG_INHERIT, and spawn reports naming pids that are not
+//  children of the caller.
+//
+
+#include <string.h>
+
+#include "check.h"
+#include "protect.h"
+
+#define PIDS        700     /* pid space wraps often, live processes stay below half of it */
+#define MAX_LIVE    340
+#define ROUNDS      400000
+
+struct process {
+    int         alive;
+    int32_t     ppid;
+    int32_t     pgid;
+    unsigned    generation;
+};
+
+struct model {
+    int         used;
+    int32_t     pgid;
+    uint64_t    sigmask;
+    uint32_t    flags;
+    const void* task;
+};
+
+static struct protect_set g_set;
+static struct process g_procs[PIDS + 1];
+static struct model g_model[PIDS + 1];
+static uint32_t g_count;
+static unsigned g_live;
+static unsigned g_generation;
+static int32_t g_next_pid;
+
+static const void* task_of(int32_t pid)
+{
+    return (const void*)(uintptr_t)(((uint64_t)g_procs[pid].generation << 32) | ((uint32_t)pid << 4) | 0x8);
+}
+
+static void check_invariants(void)
+{
+    CHECK_EQ(g_set.count, g_count);
+
+    uint32_t ninherit = 0, ninherited = 0;
+    for (int32_t pid = 1; pid <= PIDS; ++pid) {
+        const struct model* m = &g_model[pid];
+        const struct protect_entry* entry = protect_find_pid(&g_set, pid);
+        CHECK((entry != NULL) == m->used);
+        if (!m->used) {
+            continue;
+        }
+
+        CHECK_EQ(entry->pgid, m->pgid);
+        CHECK(entry->sigmask == m->sigmask);
+        CHECK_EQ(entry->flags, m->flags);
+        CHECK(entry->task == m->task);
+        CHECK(protect_find_task(&g_set, m->task) == entry);
+        ninherit += !!(m->flags & PROTECT_FLAG_INHERIT);
+        ninherited += !!(m->flags & PROTECT_FLAG_INHERITED);
+    }
+
+    CHECK_EQ(g_set.ninherit, ninherit);
+    CHECK_EQ(g_set.ninherited, ninherited);
+}
+
+// Next free pid, wrapping like the kernel allocator
+static int32_t alloc_pid(void)
+{
+    do {
+        g_next_pid = (g_next_pid % PIDS) + 1;
+    } while (g_procs[g_next_pid].alive);
+    return g_next_pid;
+}
+
+static int32_t random_live(uint64_t* seed)
+{
+    for (;;) {
+        int32_t pid = 1 + (int32_t)(check_rand(seed) % PIDS);
+        if (g_procs[pid].alive) {
+            return pid;
+        }
+    }
+}
+
+static void model_remove(int32_t pid)
+{
+    g_count -= (uint32_t)g_model[pid].used;
+    g_model[pid].used = 0;
+}
+
+static void spawn(int32_t parent, unsigned* inherited, unsigned* full)
+{
+    int32_t child = alloc_pid();
+    struct process* p = &g_procs[child];
+    p->alive = 1;
+    p->ppid = parent;
+    p->pgid = g_procs[parent].pgid;
+    p->generation = ++g_generation;
+    g_live++;
+
+    const struct model* pm = &g_model[parent];
+    struct model* cm = &g_model[child];
+    int res = protect_fork(&g_set, parent, child, parent, p->pgid, task_of(child));
+
+    if (!pm->used || !(pm->flags & PROTECT_FLAG_INHERIT)) {
+        // Stale inherited entry of a previous owner goes, an explicit one is left to userspace
+        CHECK_EQ(res, PROTECT_NOT_FOUND);
+        if (cm->used && (cm->flags & PROTECT_FLAG_INHERITED)) {
+            model_remove(child);
+        }
+    } else if (!cm->used && g_count == PROTECT_MAX_ENTRIES) {
+        CHECK_EQ(res, PROTECT_FULL);
+        (*full)++;
+    } else {
+        CHECK_EQ(res, PROTECT_OK);
+        g_count += (uint32_t)!cm->used;
+        cm->used = 1;
+        cm->pgid = p->pgid;
+        cm->sigmask = pm->sigmask;
+        cm->flags = pm->flags | PROTECT_FLAG_INHERITED;
+        cm->task = task_of(child);
+        (*inherited)++;
+    }
+}
+
+// Caller names a pid that is not its child, as a second thread rewriting the posix_spawn pid argument would
+static void forged_spawn(int32_t caller, int32_t pid)
+{
+    int32_t ppid = (g_procs[pid].alive ? g_procs[pid].ppid : 0);
+    if (ppid == caller) {
+        return;
+    }
+    CHECK_EQ(protect_fork(&g_set, caller, pid, ppid, g_procs[caller].pgid, task_of(pid)), PROTECT_INVALID);
+}
+
+static int alive(const struct protect_entry* entry, void* ctx)
+{
+    return g_procs[entry->pid].alive;
+}
+
+static void test_tree_churn(void)
+{
+    protect_init(&g_set);
+    memset(g_procs, 0, sizeof(g_procs));
+    memset(g_model, 0, sizeof(g_model));
+    g_count = 0;
+    g_generation = 0;
+    g_next_pid = 1;
+
+    // launchd
+    g_procs[1].alive = 1;
+    g_procs[1].pgid = 1;
+    g_live = 1;
+
+    uint64_t seed = 40;
+    unsigned spawns = 0, inherited = 0, full = 0, missed = 0, swept = 0, forged = 0;
+    for (unsigned round = 0; round < ROUNDS; ++round) {
+        unsigned op = (unsigned)(check_rand(&seed) % 17);
+
+        if (op < 6 && g_live < MAX_LIVE) {
+            // Protected trees breed faster so they get deep
+            int32_t parent = random_live(&seed);
+            unsigned children = (g_model[parent].used ? 3 : 1);
+            for (unsigned i = 0; i < children && g_live < MAX_LIVE; ++i) {
+                spawn(parent, &inherited, &full);
+                spawns++;
+            }
+        } else if (op < 12) {
+            int32_t pid = random_live(&seed);
+            if (pid == 1) {
+                continue;
+            }
+            g_procs[pid].alive = 0;
+            g_live--;
+
+            // Killed processes exit without the kext seeing it
+            if (check_rand(&seed) % 5 == 0) {
+                missed++;
+                continue;
+            }
+
+            struct model* m = &g_model[pid];
+            int expected = (m->used && (m->flags & PROTECT_FLAG_INHERITED) ? PROTECT_OK : PROTECT_NOT_FOUND);
+            CHECK_EQ(protect_exit(&g_set, pid), expected);
+            if (expected == PROTECT_OK) {
+                model_remove(pid);
+            }
+        } else if (op < 14) {
+            // Userspace protects a live process, sometimes with its future children
+            int32_t pid = random_live(&seed);
+            struct model* m = &g_model[pid];
+            uint64_t sigmask = PROTECT_SIGBIT(9) | PROTECT_SIGBIT(15) | (check_rand(&seed) & check_rand(&seed));
+            uint32_t flags = (check_rand(&seed) % 2 ? PROTECT_FLAG_INHERIT : 0);
+            int res = protect_add(&g_set, pid, g_procs[pid].pgid, sigmask, flags, task_of(pid));
+            if (!m->used && g_count == PROTECT_MAX_ENTRIES) {
+                CHECK_EQ(res, PROTECT_FULL);
+            } else {
+                CHECK_EQ(res, PROTECT_OK);
+                g_count += (uint32_t)!m->used;
+                m->used = 1;
+                m->pgid = g_procs[pid].pgid;
+                m->sigmask = sigmask;
+                m->flags = flags;
+                m->task = task_of(pid);
+            }
+        } else if (op == 14) {
+            // Userspace drops any entry, live or stale
+            int32_t pid = 1 + (int32_t)(check_rand(&seed) % PIDS);
+            CHECK_EQ(protect_remove(&g_set, pid), (g_model[pid].used ? PROTECT_OK : PROTECT_NOT_FOUND));
+            model_remove(pid);
+        } else if (op == 15) {
+            // Set is left as it is, invariants below catch any change
+            forged_spawn(random_live(&seed), 1 + (int32_t)(check_rand(&seed) % PIDS));
+            forged++;
+        } else {
+            // Periodic sweep drops inherited entries of processes gone unseen
+            unsigned expected = 0;
+            for (int32_t pid = 1; pid <= PIDS; ++pid) {
+                if (g_model[pid].used && (g_model[pid].flags & PROTECT_FLAG_INHERITED) && !g_procs[pid].alive) {
+                    model_remove(pid);
+                    expected++;
+                }
+            }
+            CHECK_EQ(protect_sweep(&g_set, alive, NULL), expected);
+            swept += expected;
+        }
+
+        if (round % 1000 == 0) {
+            check_invariants();
+        }
+    }
+
+    check_invariants();
+
+    // Every path was taken
+    CHECK(inherited > 1000);
+    CHECK(full > 0);
+    CHECK(swept > 0);
+    printf("protect tree: %u spawns, %u inherited, %u refused while full, %u exits missed, %u swept, %u forged reports\n",
+           spawns, inherited, full, missed, swept, forged);
+}
+
+// Spawn reports for pids that are not children of the caller neither add nor drop entries
+static void test_forged_spawn_report(void)
+{
+    protect_init(&g_set);
+    memset(g_procs, 0, sizeof(g_procs));
+    for (int32_t pid = 1; pid <= 5; ++pid) {
+        g_procs[pid].alive = 1;
+        g_procs[pid].ppid = 1;
+        g_procs[pid].pgid = pid;
+    }
+    g_procs[4].ppid = 2;
+
+    // 2 passes protection on, 4 is its inherited child, 3 and 5 are unrelated
+    CHECK_EQ(protect_add(&g_set, 2, 2, PROTECT_SIGBIT(9), PROTECT_FLAG_INHERIT, task_of(2)), PROTECT_OK);
+    CHECK_EQ(protect_fork(&g_set, 2, 4, 2, 2, task_of(4)), PROTECT_OK);
+    CHECK_EQ(g_set.count, 2);
+
+    // Unprotected caller names the live inherited child, its entry stays
+    CHECK_EQ(protect_fork(&g_set, 3, 4, 2, 3, task_of(4)), PROTECT_INVALID);
+    CHECK(protect_find_pid(&g_set, 4) != NULL);
+
+    // Inheriting parent names an unrelated process, it is not added
+    CHECK_EQ(protect_fork(&g_set, 2, 5, 1, 2, task_of(5)), PROTECT_INVALID);
+    CHECK(protect_find_pid(&g_set, 5) == NULL);
+
+    // Nor is a pid nobody owns
+    CHECK_EQ(protect_fork(&g_set, 2, 0, 2, 2, NULL), PROTECT_INVALID);
+    CHECK_EQ(protect_fork(&g_set, 2, -4, 2, 2, NULL), PROTECT_INVALID);
+    CHECK_EQ(g_set.count, 2);
+    CHECK_EQ(g_set.ninherited, 1);
+
+    // 4 dies unseen and its pid goes to a child of 1, the real report drops the stale entry
+    g_procs[4].ppid = 1;
+    CHECK_EQ(protect_fork(&g_set, 1, 4, 1, 1, task_of(4)), PROTECT_NOT_FOUND);
+    CHECK(protect_find_pid(&g_set, 4) == NULL);
+}
+
+int main(void)
+{
+    test_forged_spawn_report();
+    test_tree_churn();
+    printf("protect tree: ok\n");
+    return 0;
+}
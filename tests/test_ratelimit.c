@@ -0,0 +1,275 @@
+//
+//  test_ratelimit.c
+//  tests
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Token buckets per caller: burst and refill bounds, cached repeat denials, overflow bucket,
+//  idle caller eviction, and conservation of denials with threads denying and flushing concurrently.
+//
+
+#include <pthread.h>
+#include <string.h>
+
+#include "check.h"
+#include "ratelimit.h"
+
+#define RATE        50
+#define BURST       20
+#define THREADS     4
+#define PER_THREAD  200000
+#define BOOT_MS     100000  /* uptime when tests start, fresh slots refill from time 0 */
+
+static struct ratelimit g_rl;
+
+struct flushed {
+    uint64_t total;
+    uint64_t overflow;
+    uint64_t by_pid[1024];
+};
+
+static void collect(int32_t pid, uint32_t suppressed, void* ctx)
+{
+    struct flushed* f = ctx;
+    f->total += suppressed;
+    if (pid == 0) {
+        f->overflow += suppressed;
+    } else if (pid > 0 && pid < 1024) {
+        f->by_pid[pid] += suppressed;
+    }
+}
+
+static void test_bucket(void)
+{
+    ratelimit_init(&g_rl, RATE, BURST);
+    uint64_t verdict = ratelimit_verdict(7, 1, 9, 1);
+
+    // Full burst right away, then nothing until time passes
+    for (unsigned i = 0; i < BURST; ++i) {
+        CHECK(ratelimit_deny(&g_rl, 100, verdict, 1000));
+    }
+    CHECK(!ratelimit_deny(&g_rl, 100, verdict, 1000));
+    CHECK(!ratelimit_deny(&g_rl, 100, verdict, 1000 + 1000 / RATE - 1));
+    CHECK(ratelimit_deny(&g_rl, 100, verdict, 1000 + 1000 / RATE));
+    CHECK(!ratelimit_deny(&g_rl, 100, verdict, 1000 + 1000 / RATE));
+
+    // Time spent below one token is not lost: several short steps add up to one token
+    uint64_t now = 1000 + 1000 / RATE;
+    unsigned audited = 0;
+    for (unsigned step = 0; step < 1000 / RATE; ++step) {
+        audited += (unsigned)ratelimit_deny(&g_rl, 100, verdict, ++now);
+    }
+    CHECK_EQ(audited, 1);
+
+    // Long quiet period refills to burst, never beyond
+    now += 3600 * 1000;
+    for (unsigned i = 0; i < BURST; ++i) {
+        CHECK(ratelimit_deny(&g_rl, 100, verdict, now));
+    }
+    CHECK(!ratelimit_deny(&g_rl, 100, verdict, now));
+
+    // Clock going backwards does not mint tokens
+    CHECK(!ratelimit_deny(&g_rl, 100, verdict, now - 10000));
+
+    struct flushed f;
+    memset(&f, 0, sizeof(f));
+    ratelimit_flush(&g_rl, collect, &f);
+    CHECK_EQ(f.by_pid[100], 3 + (1000 / RATE - audited) + 2);
+    CHECK_EQ(f.total, f.by_pid[100]);
+
+    memset(&f, 0, sizeof(f));
+    ratelimit_flush(&g_rl, collect, &f);
+    CHECK_EQ(f.total, 0);
+}
+
+static void test_cached(void)
+{
+    ratelimit_init(&g_rl, RATE, BURST);
+    uint64_t verdict = ratelimit_verdict(7, 1, 9, 1);
+    uint64_t other = ratelimit_verdict(7, 1, 9, 2);
+
+    // Unknown caller and caller with tokens always get a full check
+    CHECK(!ratelimit_cached_deny(&g_rl, 100, verdict, BOOT_MS));
+    CHECK(ratelimit_deny(&g_rl, 100, verdict, BOOT_MS));
+    CHECK(!ratelimit_cached_deny(&g_rl, 100, verdict, BOOT_MS));
+
+    for (unsigned i = 1; i < BURST; ++i) {
+        CHECK(ratelimit_deny(&g_rl, 100, verdict, BOOT_MS));
+    }
+    CHECK(ratelimit_cached_deny(&g_rl, 100, verdict, BOOT_MS));
+    CHECK(ratelimit_cached_deny(&g_rl, 100, verdict, BOOT_MS));
+    CHECK_EQ(g_rl.cached, 2);
+
+    // Generation bump or a different request goes through the full check
+    CHECK(!ratelimit_cached_deny(&g_rl, 100, other, BOOT_MS));
+    CHECK(!ratelimit_cached_deny(&g_rl, 100, ratelimit_verdict(8, 1, 9, 1), BOOT_MS));
+    CHECK(!ratelimit_cached_deny(&g_rl, 101, verdict, BOOT_MS));
+
+    // A refilled token ends cached denials
+    CHECK(!ratelimit_cached_deny(&g_rl, 100, verdict, BOOT_MS + 1000 / RATE));
+
+    // Cached denials are suppressed like any other
+    struct flushed f;
+    memset(&f, 0, sizeof(f));
+    ratelimit_flush(&g_rl, collect, &f);
+    CHECK_EQ(f.by_pid[100], 2);
+
+    // Verdict packs its fields without bleeding into each other
+    CHECK(ratelimit_verdict(-1, 0, 0, 0) == 0xffffffff00000000ull);
+    CHECK(ratelimit_verdict(0, 0xff, 0, 0) == 0xf0000000ull);
+    CHECK(ratelimit_verdict(0, 0, -1, 0) == 0x0ff00000ull);
+    CHECK(ratelimit_verdict(0, 0, 0, 0xffffffffu) == 0x000fffffull);
+}
+
+static void test_overflow_and_eviction(void)
+{
+    ratelimit_init(&g_rl, RATE, BURST);
+    uint64_t verdict = ratelimit_verdict(7, 1, 9, 1);
+
+    // Busy callers hold their slots, the rest share the overflow bucket
+    unsigned suppressed = 0;
+    for (int32_t pid = 1; pid < 1024; ++pid) {
+        suppressed += !ratelimit_deny(&g_rl, pid, verdict, BOOT_MS);
+        CHECK(!ratelimit_cached_deny(&g_rl, pid, verdict, BOOT_MS));
+    }
+    for (int32_t pid = 1; pid < 1024; ++pid) {
+        for (unsigned i = 0; i < BURST; ++i) {
+            suppressed += !ratelimit_deny(&g_rl, pid, verdict, BOOT_MS);
+        }
+    }
+    CHECK(suppressed > 0);
+    CHECK_EQ(g_rl.evictions, 0);
+
+    unsigned owned = 0;
+    for (unsigned i = 0; i < RATELIMIT_SLOTS; ++i) {
+        owned += (g_rl.slots[i].pid != 0);
+    }
+    CHECK(owned > RATELIMIT_SLOTS / 2);
+
+    // Invalid pids always land in the overflow bucket
+    CHECK(!ratelimit_deny(&g_rl, 0, verdict, BOOT_MS));
+    CHECK(!ratelimit_deny(&g_rl, -5, verdict, BOOT_MS));
+
+    struct flushed f;
+    memset(&f, 0, sizeof(f));
+    ratelimit_flush(&g_rl, collect, &f);
+    CHECK(f.overflow > 0);
+    CHECK_EQ(f.total, suppressed + 2);
+
+    // Once quiet and refilled, callers are forgotten to make room
+    uint64_t later = BOOT_MS + 3600 * 1000;
+    for (int32_t pid = 2000; pid < 2100; ++pid) {
+        ratelimit_deny(&g_rl, pid, verdict, later);
+    }
+    CHECK(g_rl.evictions > 0);
+    unsigned newcomers = 0;
+    for (unsigned i = 0; i < RATELIMIT_SLOTS; ++i) {
+        newcomers += (g_rl.slots[i].pid >= 2000);
+    }
+    CHECK_EQ(newcomers, owned);
+
+    // A caller with unreported suppressions is not evicted
+    ratelimit_init(&g_rl, RATE, 1);
+    ratelimit_deny(&g_rl, 5, verdict, BOOT_MS);
+    ratelimit_deny(&g_rl, 5, verdict, BOOT_MS);
+    for (int32_t pid = 6; pid < 1024; ++pid) {
+        ratelimit_deny(&g_rl, pid, verdict, later);
+    }
+    memset(&f, 0, sizeof(f));
+    ratelimit_flush(&g_rl, collect, &f);
+    CHECK_EQ(f.by_pid[5], 1);
+}
+
+//
+// Concurrent denials and flushes
+//
+
+struct denier {
+    pthread_t thread;
+    unsigned  id;
+    uint64_t  audited;
+    uint64_t  suppressed;
+    uint64_t  cached;
+};
+
+static uint64_t g_clock_ms;
+static unsigned g_deniers_done;
+
+static void* denier_main(void* arg)
+{
+    struct denier* d = arg;
+    uint64_t seed = 380 + d->id;
+    for (unsigned i = 0; i < PER_THREAD; ++i) {
+        // A few hot callers shared by all threads, and a spray of one-off pids
+        int32_t pid = (int32_t)(i % 8 ? 1 + check_rand(&seed) % 16 : 100 + check_rand(&seed) % 900);
+        uint64_t verdict = ratelimit_verdict(1, 1, (int32_t)(check_rand(&seed) % 2), 1);
+        uint64_t now = __atomic_fetch_add(&g_clock_ms, (i % 64 == 0), __ATOMIC_RELAXED);
+
+        if (ratelimit_cached_deny(&g_rl, pid, verdict, now)) {
+            d->cached++;
+        } else if (ratelimit_deny(&g_rl, pid, verdict, now)) {
+            d->audited++;
+        } else {
+            d->suppressed++;
+        }
+    }
+
+    __atomic_fetch_add(&g_deniers_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void test_concurrent(void)
+{
+    ratelimit_init(&g_rl, RATE, BURST);
+    g_clock_ms = BOOT_MS;
+    g_deniers_done = 0;
+
+    struct denier deniers[THREADS];
+    memset(deniers, 0, sizeof(deniers));
+    for (unsigned i = 0; i < THREADS; ++i) {
+        deniers[i].id = i;
+        CHECK(pthread_create(&deniers[i].thread, NULL, denier_main, &deniers[i]) == 0);
+    }
+
+    // Audit tick flushes while denials keep coming
+    struct flushed f;
+    memset(&f, 0, sizeof(f));
+    while (__atomic_load_n(&g_deniers_done, __ATOMIC_ACQUIRE) < THREADS) {
+        ratelimit_flush(&g_rl, collect, &f);
+    }
+    for (unsigned i = 0; i < THREADS; ++i) {
+        CHECK(pthread_join(deniers[i].thread, NULL) == 0);
+    }
+    ratelimit_flush(&g_rl, collect, &f);
+
+    uint64_t audited = 0, suppressed = 0, cached = 0;
+    for (unsigned i = 0; i < THREADS; ++i) {
+        audited += deniers[i].audited;
+        suppressed += deniers[i].suppressed;
+        cached += deniers[i].cached;
+    }
+
+    // Every denial is either audited or reported as suppressed exactly once
+    CHECK_EQ(audited + suppressed + cached, (uint64_t)THREADS * PER_THREAD);
+    CHECK_EQ(f.total, suppressed + cached);
+    CHECK_EQ(g_rl.cached, cached);
+
+    // Audited records stay within what the buckets could hand out
+    uint64_t elapsed_ms = g_clock_ms - BOOT_MS;
+    uint64_t budget = (RATELIMIT_SLOTS + 1 + g_rl.evictions) * BURST +
+                      (RATELIMIT_SLOTS + 1) * (elapsed_ms * RATE / 1000 + 1);
+    CHECK(audited <= budget);
+    printf("ratelimit: %llu audited, %llu suppressed, %llu cached, %llu evictions over %llu ms\n",
+           (unsigned long long)audited, (unsigned long long)suppressed, (unsigned long long)cached,
+           (unsigned long long)g_rl.evictions, (unsigned long long)elapsed_ms);
+}
+
+int main(void)
+{
+    test_bucket();
+    test_cached();
+    test_overflow_and_eviction();
+    test_concurrent();
+    printf("ratelimit: ok\n");
+    return 0;
+}
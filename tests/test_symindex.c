@@ -0,0 +1,226 @@
+//
+//  test_symindex.c
+//  tests
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Symbol index over a synthetic kernel image: which symbols are taken, exact storage sizes,
+//  and lookups of slid addresses checked against a linear scan, including aliases and range edges.
+//
+
+#include <string.h>
+
+#include "check.h"
+#include "image.h"
+#include "symindex.h"
+
+#define TEXT_SYMBOLS    3000
+#define NOISE_SYMBOLS   7
+#define SLIDE           0x0000000012a00000ull
+#define LOOKUPS         200000
+#define UNTERMINATED    12
+
+struct expected_symbol {
+    uint64_t    addr;
+    char        name[32];
+};
+
+static struct image g_image;
+static struct expected_symbol g_expected[TEXT_SYMBOLS];
+static uint32_t g_names_size;
+
+static void build_image(void)
+{
+    // Names are packed, the last one gets 12 bytes and no terminator
+    uint32_t strsize = 1 + UNTERMINATED;
+    for (uint32_t i = 0; i + 1 < TEXT_SYMBOLS; ++i) {
+        strsize += (uint32_t)snprintf(NULL, 0, "_sym_%u", i) + 1;
+    }
+    image_init(&g_image, TEXT_SYMBOLS + NOISE_SYMBOLS, strsize);
+
+    uint64_t seed = 39;
+    uint32_t strx = 1;
+    g_names_size = 0;
+    for (uint32_t i = 0; i < TEXT_SYMBOLS; ++i) {
+        struct expected_symbol* e = &g_expected[i];
+        // Every tenth symbol aliases the previous one, none sits at the very start of __TEXT
+        e->addr = (i % 10 == 9 ? g_expected[i - 1].addr :
+                   IMAGE_TEXT_BASE + 0x1000 + (check_rand(&seed) % (IMAGE_TEXT_SIZE - 0x1000) & ~0xfull));
+        snprintf(e->name, sizeof(e->name), "_sym_%u", i);
+
+        if (i + 1 == TEXT_SYMBOLS) {
+            // Last name runs into the end of the string table
+            CHECK_EQ(g_image.strsize - strx, UNTERMINATED);
+            memcpy(image_strtab(&g_image) + strx, "_unterminated", UNTERMINATED);
+            memcpy(e->name, "_unterminated", UNTERMINATED);
+            e->name[UNTERMINATED] = '\0';
+            image_symbol(&g_image, i, strx, NULL, MACHO_N_SECT | (i & 1), e->addr);
+        } else {
+            image_symbol(&g_image, i, strx, e->name, MACHO_N_SECT | (i & 1), e->addr);
+        }
+        strx += (uint32_t)strlen(e->name) + 1;
+        g_names_size += (uint32_t)strlen(e->name) + 1;
+    }
+
+    // Symbols the index must skip: debug entry, undefined, __DATA, no name, name past the table,
+    // just past __TEXT, just before it
+    uint32_t n = TEXT_SYMBOLS;
+    image_symbol(&g_image, n++, 1, NULL, 0x24 | MACHO_N_SECT, IMAGE_TEXT_BASE + 0x10);
+    image_symbol(&g_image, n++, 1, NULL, 0x01, IMAGE_TEXT_BASE + 0x20);
+    image_symbol(&g_image, n++, 1, NULL, MACHO_N_SECT, IMAGE_DATA_BASE + 0x30);
+    image_symbol(&g_image, n++, 0, NULL, MACHO_N_SECT, IMAGE_TEXT_BASE + 0x40);
+    image_symbol(&g_image, n++, g_image.strsize, NULL, MACHO_N_SECT, IMAGE_TEXT_BASE + 0x50);
+    image_symbol(&g_image, n++, 1, NULL, MACHO_N_SECT, IMAGE_TEXT_BASE + IMAGE_TEXT_SIZE);
+    image_symbol(&g_image, n++, 1, NULL, MACHO_N_SECT, IMAGE_TEXT_BASE - 1);
+    CHECK_EQ(n, TEXT_SYMBOLS + NOISE_SYMBOLS);
+}
+
+// Linear scan reference: greatest symbol address at or below unslid
+static int reference_lookup(uint64_t unslid, uint64_t* best)
+{
+    int found = 0;
+    for (uint32_t i = 0; i < TEXT_SYMBOLS; ++i) {
+        if (g_expected[i].addr <= unslid && (!found || g_expected[i].addr > *best)) {
+            *best = g_expected[i].addr;
+            found = 1;
+        }
+    }
+    return found;
+}
+
+static int is_symbol_at(const char* name, uint64_t addr)
+{
+    for (uint32_t i = 0; i < TEXT_SYMBOLS; ++i) {
+        if (g_expected[i].addr == addr && strcmp(g_expected[i].name, name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void check_lookup(const struct symindex* index, uint64_t addr)
+{
+    const char* name = NULL;
+    uint64_t offset = 0;
+    int res = symindex_lookup(index, addr, &name, &offset);
+
+    if (addr < IMAGE_TEXT_BASE + SLIDE || addr >= IMAGE_TEXT_BASE + SLIDE + IMAGE_TEXT_SIZE) {
+        CHECK_EQ(res, SYMINDEX_OUTSIDE);
+        return;
+    }
+
+    uint64_t best = 0;
+    if (!reference_lookup(addr - SLIDE, &best)) {
+        CHECK_EQ(res, SYMINDEX_UNNAMED);
+        CHECK(name == NULL);
+        CHECK(offset == addr - IMAGE_TEXT_BASE - SLIDE);
+        return;
+    }
+
+    CHECK_EQ(res, SYMINDEX_FOUND);
+    CHECK(offset == addr - SLIDE - best);
+    CHECK(is_symbol_at(name, best));
+}
+
+static void test_index(void)
+{
+    const struct mach_header_64* mh = image_header(&g_image);
+    uint32_t count = 0, names_size = 0;
+    CHECK(symindex_measure(mh, &count, &names_size));
+    CHECK_EQ(count, TEXT_SYMBOLS);
+    CHECK_EQ(names_size, g_names_size);
+
+    struct symindex_entry* entries = malloc(count * sizeof(*entries));
+    char* names = malloc(names_size);
+    CHECK(entries && names);
+
+    // Storage has to match the measured sizes exactly
+    struct symindex index;
+    CHECK(!symindex_build(&index, mh, IMAGE_TEXT_BASE + SLIDE, entries, count - 1, names, names_size));
+    CHECK(!symindex_build(&index, mh, IMAGE_TEXT_BASE + SLIDE, entries, count, names, names_size - 1));
+    CHECK(!symindex_build(&index, mh, IMAGE_TEXT_BASE + SLIDE, entries, count, names, names_size + 1));
+    CHECK(symindex_build(&index, mh, IMAGE_TEXT_BASE + SLIDE, entries, count, names, names_size));
+
+    CHECK_EQ(index.count, TEXT_SYMBOLS);
+    CHECK(index.slide == SLIDE);
+    for (uint32_t i = 1; i < index.count; ++i) {
+        CHECK(index.entries[i - 1].addr <= index.entries[i].addr);
+    }
+
+    // Index does not point into the image
+    uint8_t* saved = g_image.buf;
+    g_image.buf = malloc(g_image.size);
+    memcpy(g_image.buf, saved, g_image.size);
+    memset(saved, 0xcc, g_image.size);
+    free(saved);
+
+    // Every symbol, its neighbours and the range edges
+    for (uint32_t i = 0; i < TEXT_SYMBOLS; ++i) {
+        uint64_t addr = g_expected[i].addr + SLIDE;
+        check_lookup(&index, addr);
+        check_lookup(&index, addr - 1);
+        check_lookup(&index, addr + 1);
+    }
+    uint64_t start = IMAGE_TEXT_BASE + SLIDE;
+    uint64_t edges[] = { start - 1, start, start + 1, start + IMAGE_TEXT_SIZE - 1, start + IMAGE_TEXT_SIZE, 0, ~0ull,
+                         IMAGE_TEXT_BASE, IMAGE_TEXT_BASE + IMAGE_TEXT_SIZE - 1 };
+    for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); ++i) {
+        check_lookup(&index, edges[i]);
+    }
+
+    uint64_t seed = 390;
+    for (unsigned i = 0; i < LOOKUPS / 100; ++i) {
+        check_lookup(&index, start - 0x1000 + check_rand(&seed) % (IMAGE_TEXT_SIZE + 0x2000));
+    }
+
+    // Formatting of each result kind
+    char buf[64];
+    symindex_format(&index, start, buf, sizeof(buf));
+    CHECK(strcmp(buf, "__TEXT+0x0") == 0);
+    symindex_format(&index, start - 1, buf, sizeof(buf));
+    CHECK(strcmp(buf, "outside kernel image") == 0);
+
+    const struct expected_symbol* e = &g_expected[0];
+    uint64_t best = 0;
+    CHECK(reference_lookup(e->addr, &best) && best == e->addr);
+    symindex_format(&index, e->addr + SLIDE, buf, sizeof(buf));
+    CHECK(is_symbol_at(buf, e->addr));
+
+    // Symbols are 16 byte aligned, so the next byte belongs to the same one
+    const char* name;
+    uint64_t offset;
+    char expected[64];
+    CHECK_EQ(symindex_lookup(&index, e->addr + SLIDE, &name, &offset), SYMINDEX_FOUND);
+    snprintf(expected, sizeof(expected), "%s+0x1", name);
+    symindex_format(&index, e->addr + SLIDE + 1, buf, sizeof(buf));
+    CHECK(strcmp(buf, expected) == 0);
+
+    // Truncated buffer stays terminated
+    symindex_format(&index, start - 1, buf, 8);
+    CHECK(strcmp(buf, "outside") == 0);
+
+    free(entries);
+    free(names);
+}
+
+static void test_no_symbols(void)
+{
+    struct image image;
+    image_init(&image, 2, 16);
+    image_symbol(&image, 0, 1, "_data", MACHO_N_SECT, IMAGE_DATA_BASE);
+    image_symbol(&image, 1, 7, "_undef", 0x01, 0);
+
+    uint32_t count = 0, names_size = 0;
+    CHECK(!symindex_measure(image_header(&image), &count, &names_size));
+    image_free(&image);
+}
+
+int main(void)
+{
+    build_image();
+    test_index();
+    test_no_symbols();
+    image_free(&g_image);
+    printf("symindex: ok\n");
+    return 0;
+}
@@ -0,0 +1,201 @@
+//
+//  test_trace.c
+//  tests
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  killctl traces: text import, binary save and load round trips, headers whose counts don't fit the file,
+//  and verdicts of a small replayed trace against what the kext would decide.
+//
+
+#include <string.h>
+
+#include "check.h"
+#include "../killctl/trace.h"
+#include "../killctl/replay.h"
+#include "protect.h"
+
+// 100 passes SIGKILL protection on to its children, 300 is trusted, 200 is anyone else
+static const char g_text[] =
+    "# replay verdicts\n"
+    "target 100 100 200 1\n"
+    "trust 300\n"
+    "\n"
+    "0 kill 200 200 100 9\n"        // denied
+    "1 kill 300 300 100 9\n"
+    "2 kill 200 200 100 15\n"
+    "3 fork 100 100 101 0\n"
+    "4 kill 200 200 101 9\n"        // denied, inherited
+    "5 kill 200 200 -100 9\n"       // denied, group
+    "6 tfp 200 200 101 0\n"         // denied
+    "7 fork 200 200 102 0\n"
+    "8 exit 101 100 0 0\n"
+    "9 kill 200 200 101 9\n"
+    "10 msg 200 200 0 4005\n"       // denied, task enumeration
+    "11 kill 200 200 102 9\n";
+
+#define TEXT_TARGETS    2
+#define TEXT_RECORDS    12
+#define TEXT_DENIED     5
+
+static void import(struct trace* trace)
+{
+    FILE* file = fmemopen((void*)g_text, sizeof(g_text) - 1, "r");
+    CHECK(file != NULL);
+    CHECK_EQ(trace_import_text(trace, file), 0);
+    fclose(file);
+}
+
+static void test_import(void)
+{
+    struct trace trace;
+    import(&trace);
+
+    CHECK_EQ(trace.header.magic, TRACE_MAGIC);
+    CHECK_EQ(trace.header.version, TRACE_VERSION);
+    CHECK_EQ(trace.header.target_count, TEXT_TARGETS);
+    CHECK_EQ(trace.header.record_count, TEXT_RECORDS);
+
+    CHECK_EQ(trace.targets[0].pid, 100);
+    CHECK(trace.targets[0].sigmask == PROTECT_SIGBIT(9));
+    CHECK_EQ(trace.targets[0].flags, PROTECT_FLAG_INHERIT);
+    CHECK_EQ(trace.targets[1].pid, 300);
+    CHECK_EQ(trace.targets[1].flags, TRACE_TARGET_TRUSTED);
+
+    CHECK_EQ(trace.records[3].call, TRACE_FORK);
+    CHECK_EQ(trace.records[5].target, -100);
+    CHECK_EQ(trace.records[10].call, TRACE_MACH_MSG);
+    CHECK_EQ(trace.records[10].arg, PROTECT_MIG_PROCESSOR_SET_TASKS);
+    CHECK(trace.records[11].time_ns == 11);
+    trace_free(&trace);
+
+    // Unknown calls and short lines fail the whole import
+    static const char bad[] = "0 kill 1 1 2 9\n1 ptrace 1 1 2 0\n";
+    FILE* file = fmemopen((void*)bad, sizeof(bad) - 1, "r");
+    CHECK_EQ(trace_import_text(&trace, file), -1);
+    CHECK(trace.records == NULL);
+    fclose(file);
+
+    static const char short_line[] = "0 kill 1 1 2\n";
+    file = fmemopen((void*)short_line, sizeof(short_line) - 1, "r");
+    CHECK_EQ(trace_import_text(&trace, file), -1);
+    fclose(file);
+}
+
+static void test_round_trip(void)
+{
+    struct trace trace;
+    import(&trace);
+
+    FILE* file = tmpfile();
+    CHECK(file != NULL);
+    CHECK_EQ(trace_save(&trace, file), 0);
+    rewind(file);
+
+    struct trace loaded;
+    CHECK_EQ(trace_load(&loaded, file), 0);
+    fclose(file);
+
+    CHECK(memcmp(&loaded.header, &trace.header, sizeof(trace.header)) == 0);
+    CHECK(memcmp(loaded.targets, trace.targets, TEXT_TARGETS * sizeof(*trace.targets)) == 0);
+    CHECK(memcmp(loaded.records, trace.records, TEXT_RECORDS * sizeof(*trace.records)) == 0);
+    trace_free(&loaded);
+    trace_free(&trace);
+}
+
+// Header claiming target_count targets and record_count records, followed by records actual records
+static FILE* trace_file(uint32_t magic, uint32_t target_count, uint32_t record_count, uint32_t records)
+{
+    FILE* file = tmpfile();
+    CHECK(file != NULL);
+
+    struct trace_header header = { magic, TRACE_VERSION, target_count, record_count };
+    struct trace_record record;
+    memset(&record, 0, sizeof(record));
+    CHECK_EQ(fwrite(&header, sizeof(header), 1, file), 1);
+    for (uint32_t i = 0; i < records; ++i) {
+        record.time_ns = i;
+        CHECK_EQ(fwrite(&record, sizeof(record), 1, file), 1);
+    }
+
+    rewind(file);
+    return file;
+}
+
+static int load(uint32_t magic, uint32_t target_count, uint32_t record_count, uint32_t records)
+{
+    FILE* file = trace_file(magic, target_count, record_count, records);
+    struct trace trace;
+    int res = trace_load(&trace, file);
+    fclose(file);
+
+    if (res) {
+        CHECK(trace.targets == NULL && trace.records == NULL);
+        CHECK_EQ(trace.header.record_count, 0);
+    } else {
+        CHECK_EQ(trace.header.record_count, record_count);
+        CHECK(trace.records[record_count - 1].time_ns == record_count - 1);
+    }
+    trace_free(&trace);
+    return res;
+}
+
+static void test_load_counts(void)
+{
+    CHECK_EQ(load(TRACE_MAGIC, 0, 4, 4), 0);
+    CHECK_EQ(load(TRACE_MAGIC + 1, 0, 4, 4), -1);
+
+    // Counts have to fit the file, a wrapping allocation size must not get through
+    CHECK_EQ(load(TRACE_MAGIC, 0, 5, 4), -1);
+    CHECK_EQ(load(TRACE_MAGIC, 1, 4, 4), -1);
+    CHECK_EQ(load(TRACE_MAGIC, 0, 0xffffffffu, 4), -1);
+    CHECK_EQ(load(TRACE_MAGIC, 0xffffffffu, 4, 4), -1);
+    CHECK_EQ(load(TRACE_MAGIC, 0, TRACE_MAX_COUNT + 1, 4), -1);
+
+    // Truncated header
+    FILE* file = tmpfile();
+    CHECK_EQ(fwrite("KHTR", 4, 1, file), 1);
+    rewind(file);
+    struct trace trace;
+    CHECK_EQ(trace_load(&trace, file), -1);
+    fclose(file);
+}
+
+static void test_replay_verdicts(void)
+{
+    struct trace trace;
+    import(&trace);
+
+    struct replay_options options = { 1, 1, 0, PROTECT_MSG_NARROW };
+    struct replay_result result;
+    CHECK_EQ(replay_run(&trace, &options, &result), 0);
+    CHECK(result.calls == TEXT_RECORDS);
+    CHECK(result.denied == TEXT_DENIED);
+    CHECK(result.audited == TEXT_DENIED);
+    CHECK(result.inherit_ok == 1);
+    CHECK(result.inherit_failed == 0);
+
+    // Child exits before the next loop forks it again, so every loop decides the same
+    options.loops = 3;
+    CHECK_EQ(replay_run(&trace, &options, &result), 0);
+    CHECK(result.calls == 3 * TEXT_RECORDS);
+    CHECK(result.denied == 3 * TEXT_DENIED);
+    CHECK(result.inherit_ok == 3);
+
+    // Without mach message filtering only the task enumeration denial goes
+    options.loops = 1;
+    options.msg_filter = PROTECT_MSG_OFF;
+    CHECK_EQ(replay_run(&trace, &options, &result), 0);
+    CHECK(result.denied == TEXT_DENIED - 1);
+    trace_free(&trace);
+}
+
+int main(void)
+{
+    test_import();
+    test_round_trip();
+    test_load_counts();
+    test_replay_verdicts();
+    printf("trace: ok\n");
+    return 0;
+}
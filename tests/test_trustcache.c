@@ -0,0 +1,192 @@
+//
+//  test_trustcache.c
+//  tests
+//
+//  Copyright © 2016 acme. All rights reserved.
+//
+//  Trust cache churn against a reference model: random add, update, remove and pid reuse
+//  with a new start time, set overflow, and checks through the start time callback.
+//
+
+#include <string.h>
+
+#include "check.h"
+#include "trustcache.h"
+
+#define PIDS        2000
+#define ROUNDS      500000
+#define CAPACITY    (TRUSTCACHE_SETS * TRUSTCACHE_WAYS)
+
+struct model {
+    int      used;
+    uint32_t flags;
+    uint64_t start_time;
+};
+
+static struct trustcache g_cache;
+static struct model g_model[PIDS + 1];
+static uint64_t g_start_time[PIDS + 1];    /* start time of the process currently owning pid */
+static uint32_t g_count;
+static unsigned g_start_time_calls;
+
+static uint64_t start_time_of(void* ctx)
+{
+    g_start_time_calls++;
+    return g_start_time[*(const int32_t*)ctx];
+}
+
+static int check_pid(int32_t pid)
+{
+    return trustcache_check(&g_cache, pid, start_time_of, &pid);
+}
+
+static int set_is_full(void)
+{
+    for (unsigned s = 0; s < TRUSTCACHE_SETS; ++s) {
+        unsigned used = 0;
+        for (unsigned w = 0; w < TRUSTCACHE_WAYS; ++w) {
+            used += (g_cache.sets[s][w].pid != 0);
+        }
+        if (used == TRUSTCACHE_WAYS) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void check_invariants(void)
+{
+    CHECK_EQ(g_cache.count, g_count);
+
+    // Every occupied way is in the model, once
+    uint32_t occupied = 0;
+    for (unsigned s = 0; s < TRUSTCACHE_SETS; ++s) {
+        for (unsigned w = 0; w < TRUSTCACHE_WAYS; ++w) {
+            const struct trustcache_entry* entry = &g_cache.sets[s][w];
+            if (!entry->pid) {
+                CHECK(entry->start_time == 0 && entry->flags == 0);
+                continue;
+            }
+            CHECK(entry->pid > 0 && entry->pid <= PIDS);
+            CHECK(g_model[entry->pid].used);
+            CHECK(trustcache_find(&g_cache, entry->pid) == entry);
+            occupied++;
+        }
+    }
+    CHECK_EQ(occupied, g_count);
+
+    for (int32_t pid = 1; pid <= PIDS; ++pid) {
+        const struct model* m = &g_model[pid];
+        const struct trustcache_entry* entry = trustcache_find(&g_cache, pid);
+        CHECK((entry != NULL) == m->used);
+        if (m->used) {
+            CHECK(entry->start_time == m->start_time);
+            CHECK_EQ(entry->flags, m->flags);
+        }
+    }
+}
+
+static void test_churn(void)
+{
+    trustcache_init(&g_cache);
+    memset(g_model, 0, sizeof(g_model));
+    g_count = 0;
+
+    uint64_t seed = 33;
+    uint64_t clock = 1;
+    unsigned full = 0;
+    for (int32_t pid = 1; pid <= PIDS; ++pid) {
+        g_start_time[pid] = clock++;
+    }
+
+    for (unsigned round = 0; round < ROUNDS; ++round) {
+        // Keep the working set near capacity so sets overflow now and then
+        int32_t pid = 1 + (int32_t)(check_rand(&seed) % (CAPACITY * 3 / 2));
+        struct model* m = &g_model[pid];
+        unsigned op = (unsigned)(check_rand(&seed) % 8);
+
+        if (op < 3) {
+            // Trust the current owner of pid
+            uint32_t flags = (uint32_t)check_rand(&seed);
+            int res = trustcache_add(&g_cache, pid, g_start_time[pid], flags);
+            if (res == TRUSTCACHE_FULL) {
+                CHECK(!m->used);
+                CHECK(set_is_full());
+                CHECK(trustcache_find(&g_cache, pid) == NULL);
+                full++;
+            } else {
+                CHECK_EQ(res, TRUSTCACHE_OK);
+                g_count += (uint32_t)!m->used;
+                m->used = 1;
+                m->flags = flags;
+                m->start_time = g_start_time[pid];
+            }
+        } else if (op == 3) {
+            CHECK_EQ(trustcache_remove(&g_cache, pid), (m->used ? TRUSTCACHE_OK : TRUSTCACHE_NOT_FOUND));
+            g_count -= (uint32_t)m->used;
+            m->used = 0;
+        } else if (op == 4) {
+            // Owner exits and the pid goes to a new process, its entry stays until userspace removes it
+            g_start_time[pid] = clock++;
+        } else {
+            // Only the very process that was trusted passes, start time is not fetched for untrusted pids
+            unsigned calls = g_start_time_calls;
+            CHECK_EQ(check_pid(pid), (m->used && m->start_time == g_start_time[pid]));
+            CHECK_EQ(g_start_time_calls - calls, (unsigned)m->used);
+        }
+
+        if (round % 1000 == 0) {
+            check_invariants();
+        }
+    }
+
+    check_invariants();
+    CHECK(full > 0);
+}
+
+static void test_edge_cases(void)
+{
+    trustcache_init(&g_cache);
+    CHECK_EQ(trustcache_add(&g_cache, 0, 1, 0), TRUSTCACHE_INVALID);
+    CHECK_EQ(trustcache_add(&g_cache, -1, 1, 0), TRUSTCACHE_INVALID);
+    CHECK_EQ(trustcache_remove(&g_cache, 0), TRUSTCACHE_INVALID);
+    CHECK(trustcache_find(&g_cache, 0) == NULL);
+    CHECK(trustcache_find(&g_cache, -1) == NULL);
+
+    // Empty cache never fetches start time
+    int32_t pid = 5;
+    g_start_time[pid] = 0;
+    unsigned calls = g_start_time_calls;
+    CHECK(!check_pid(pid));
+    CHECK_EQ(g_start_time_calls, calls);
+
+    // Update in place keeps count
+    CHECK_EQ(trustcache_add(&g_cache, pid, 10, 1), TRUSTCACHE_OK);
+    CHECK_EQ(trustcache_add(&g_cache, pid, 11, 2), TRUSTCACHE_OK);
+    CHECK_EQ(g_cache.count, 1);
+    CHECK(trustcache_find(&g_cache, pid)->start_time == 11);
+    CHECK_EQ(trustcache_remove(&g_cache, pid), TRUSTCACHE_OK);
+    CHECK_EQ(trustcache_remove(&g_cache, pid), TRUSTCACHE_NOT_FOUND);
+    CHECK_EQ(g_cache.count, 0);
+}
+
+// Sequential pids, as a freshly started service tree gets, fill most of the cache before a set overflows
+static void test_load(void)
+{
+    trustcache_init(&g_cache);
+    int32_t pid = 100;
+    while (trustcache_add(&g_cache, pid, 1, 0) == TRUSTCACHE_OK) {
+        pid++;
+    }
+    printf("trustcache: first overflow at %u of %u entries\n", g_cache.count, CAPACITY);
+    CHECK(g_cache.count >= CAPACITY / 2);
+}
+
+int main(void)
+{
+    test_edge_cases();
+    test_load();
+    test_churn();
+    printf("trustcache: ok\n");
+    return 0;
+}